@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui
+QT       += core gui concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -28,17 +28,52 @@ SOURCES += \
     src/mainwindow.cpp \
     src/trackball.cpp \
     src/raycastcanvas.cpp \
+    src/volume.cpp \
     src/vtkvolume.cpp \
+    src/nrrdvolume.cpp \
+    src/rawvolume.cpp \
+    src/metaimagevolume.cpp \
+    src/mappedfile.cpp \
     src/mesh.cpp \
-    src/raycastvolume.cpp
+    src/occupancygrid.cpp \
+    src/volumepicker.cpp \
+    src/brickedvolume.cpp \
+    src/volumecache.cpp \
+    src/raycastvolume.cpp \
+    src/raycastrenderer.cpp \
+    src/frameprofiler.cpp \
+    src/shadercache.cpp \
+    src/transferfunction.cpp \
+    src/framescheduler.cpp \
+    src/transferfunctioneditor.cpp \
+    src/timeseriesplayer.cpp
 
 HEADERS += \
     src/mainwindow.h \
     src/trackball.h \
     src/raycastcanvas.h \
+    src/volume.h \
     src/vtkvolume.h \
+    src/nrrdvolume.h \
+    src/rawvolume.h \
+    src/metaimagevolume.h \
+    src/mappedfile.h \
+    src/voxelkernels.h \
+    src/voxellayout.h \
     src/mesh.h \
-    src/raycastvolume.h
+    src/occupancygrid.h \
+    src/volumepicker.h \
+    src/brickedvolume.h \
+    src/volumecache.h \
+    src/raycastvolume.h \
+    src/raycastrenderer.h \
+    src/compositor.h \
+    src/frameprofiler.h \
+    src/shadercache.h \
+    src/transferfunction.h \
+    src/framescheduler.h \
+    src/transferfunctioneditor.h \
+    src/timeseriesplayer.h
 
 INCLUDEPATH += \
     src
@@ -55,4 +90,8 @@ gcc:QMAKE_CXXFLAGS += -std=c++17
 gcc:QMAKE_CXXFLAGS_RELEASE += -fopenmp -Ofast
 gcc:LIBS += -fopenmp
 
+# Compressed volume payloads are decoded with zlib
+unix:LIBS += -lz
+win32:LIBS += -lzlib
+
 msvc:QMAKE_CXXFLAGS_RELEASE += /openmp /O2
@@ -0,0 +1,80 @@
+#-------------------------------------------------
+#
+# Rendering benchmark on synthetic volumes, without widgets
+#
+#-------------------------------------------------
+
+QT       += core gui concurrent
+
+TARGET = 3d_raycaster_benchmark
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+SOURCES += \
+    src/benchmarkmain.cpp \
+    src/phantom.cpp \
+    src/batchrenderer.cpp \
+    src/volume.cpp \
+    src/vtkvolume.cpp \
+    src/nrrdvolume.cpp \
+    src/rawvolume.cpp \
+    src/metaimagevolume.cpp \
+    src/mappedfile.cpp \
+    src/mesh.cpp \
+    src/occupancygrid.cpp \
+    src/volumepicker.cpp \
+    src/brickedvolume.cpp \
+    src/volumecache.cpp \
+    src/raycastvolume.cpp \
+    src/raycastrenderer.cpp \
+    src/frameprofiler.cpp \
+    src/shadercache.cpp \
+    src/transferfunction.cpp \
+    src/compositor.cpp \
+    src/volumepartition.cpp
+
+HEADERS += \
+    src/phantom.h \
+    src/batchrenderer.h \
+    src/volume.h \
+    src/vtkvolume.h \
+    src/nrrdvolume.h \
+    src/rawvolume.h \
+    src/metaimagevolume.h \
+    src/mappedfile.h \
+    src/voxelkernels.h \
+    src/voxellayout.h \
+    src/mesh.h \
+    src/occupancygrid.h \
+    src/volumepicker.h \
+    src/brickedvolume.h \
+    src/volumecache.h \
+    src/raycastvolume.h \
+    src/raycastrenderer.h \
+    src/frameprofiler.h \
+    src/shadercache.h \
+    src/transferfunction.h \
+    src/compositor.h \
+    src/volumepartition.h
+
+INCLUDEPATH += \
+    src
+
+RESOURCES += \
+    resources.qrc
+
+gcc:QMAKE_CXXFLAGS += -std=c++17
+gcc:QMAKE_CXXFLAGS_RELEASE += -fopenmp -Ofast
+gcc:LIBS += -fopenmp
+
+# Compressed volume payloads are decoded with zlib
+unix:LIBS += -lz
+win32:LIBS += -lzlib
+
+# Peak memory is read from the process counters
+win32:LIBS += -lpsapi
+
+msvc:QMAKE_CXXFLAGS_RELEASE += /openmp /O2
@@ -0,0 +1,69 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Parameters of a frame, shared by all the stages of the raycasting
+// programs. The renderer inserts this block after the #version directive of
+// each shader, and updates its buffer only when a parameter changes.
+//
+// The std140 layout must match RaycastingBlock in raycastrenderer.h.
+
+#if __VERSION__ < 140
+#extension GL_ARB_uniform_buffer_object : require
+#endif
+
+// Partial images are written to two attachments
+#if defined(PARTIAL) && __VERSION__ < 330
+#extension GL_ARB_explicit_attrib_location : require
+#endif
+
+layout(std140) uniform Raycasting {
+    mat4 ViewMatrix;
+    mat4 ModelViewProjectionMatrix;
+    mat3 NormalMatrix;
+
+    vec3 ray_origin;
+    float aspect_ratio;
+    vec3 top;
+    float focal_length;
+    vec3 bottom;
+    float step_length;
+    vec3 proxy_top;
+    float threshold;
+    vec3 proxy_bottom;
+    float jitter_offset;
+    vec3 background_colour;
+    float gamma;
+    vec3 material_colour;
+    float max_lod;
+    vec3 light_position;
+    float brick_size;
+    vec3 brick_extent;
+    vec3 volume_size;
+    vec3 atlas_size;
+    vec2 viewport_size;
+    vec2 window;
+    float opacity_cutoff;
+    vec3 clip_bottom;
+    vec3 clip_top;
+    vec3 box_bottom;
+    vec3 box_top;
+};
@@ -22,10 +22,18 @@
 
 #version 130
 
-in vec4 a_position;
+// Copy of an image rendered by the compute shader, leaving the pixels whose
+// ray missed the volume untouched, as the fragment shader path does
 
-uniform mat4 ModelViewProjectionMatrix;
+uniform sampler2D compute_target;
 
-void main() {
-    gl_Position = ModelViewProjectionMatrix * a_position;
+out vec4 a_colour;
+
+void main()
+{
+    vec4 colour = texelFetch(compute_target, ivec2(gl_FragCoord.xy), 0);
+    if (colour.a == 0.0) {
+        discard;
+    }
+    a_colour = colour;
 }
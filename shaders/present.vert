@@ -22,10 +22,10 @@
 
 #version 130
 
-in vec4 a_position;
+// Full screen triangle, without vertex attributes
 
-uniform mat4 ModelViewProjectionMatrix;
-
-void main() {
-    gl_Position = ModelViewProjectionMatrix * a_position;
+void main()
+{
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(2.0 * position - 1.0, 0.0, 1.0);
 }
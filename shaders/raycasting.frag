@@ -0,0 +1,48 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#version 130
+
+// Raycasting from the fragments of the rasterised proxy box. The ray
+// marching is in raycasting.glsl, and the parameters of the frame are in the
+// Raycasting uniform block, both inserted by the renderer.
+
+#if defined(PARTIAL)
+// Premultiplied linear colour and compositing key of a partial image
+layout(location = 0) out vec4 a_colour;
+layout(location = 1) out float a_key;
+#else
+out vec4 a_colour;
+#endif
+
+void main()
+{
+    a_colour = raycast(gl_FragCoord.xy);
+
+#if defined(PARTIAL)
+    // Keep the cleared pixel, with the empty key, where nothing was rendered
+    if (!ray_rendered) {
+        discard;
+    }
+    a_key = ray_key;
+#endif
+}
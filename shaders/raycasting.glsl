@@ -0,0 +1,517 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Shared source of all the raycasting programs, inserted by the renderer
+// into the fragment shader (raycasting.frag) and into the compute shader
+// (raycasting.comp). The renderer compiles a variant for each combination in
+// use, defining the rendering mode (one of MODE_ISOSURFACE,
+// MODE_ALPHA_BLENDING and MODE_MAXIMUM_INTENSITY_PROJECTION) and the optional
+// features (BRICKED, LAYERED, GRADIENTS, SKIP_EMPTY_SPACE, ADAPTIVE_STEP and
+// PREINTEGRATED), so no program branches on them at run time.
+//
+// With PARTIAL, only the samples inside the clip box are taken, and the ray
+// gives the premultiplied linear colour and the compositing key of a partial
+// image (see PartialImage), without the background. The textures may then
+// hold only the box of the node and its margin, between box_bottom and
+// box_top, while the rays are still cast in the whole volume.
+
+// The parameters of the frame are in the Raycasting uniform block, inserted
+// by the renderer from parameters.glsl
+
+uniform sampler3D volume;
+uniform sampler2D jitter;
+uniform sampler3D occupancy;
+
+// Lookup tables of the transfer function (see TransferFunction)
+uniform sampler2D transfer_function;
+uniform sampler2D opacity_range;
+#if defined(PREINTEGRATED)
+uniform sampler2D preintegrated_transfer;
+#endif
+
+#if defined(GRADIENTS)
+uniform sampler3D gradients;
+#endif
+
+#if defined(BRICKED)
+uniform usampler3D page_table;
+uniform sampler3D coarse_volume;
+#endif
+
+#if defined(LAYERED)
+uniform sampler2DArray volume_layers;
+#endif
+
+// Ray
+struct Ray {
+    vec3 origin;
+    vec3 direction;
+};
+
+// Axis-aligned bounding box
+struct AABB {
+    vec3 top;
+    vec3 bottom;
+};
+
+// Level of detail of the current ray
+float ray_lod = 0.0;
+
+#if defined(PARTIAL)
+// Whether the current ray rendered anything in the clip box, and its
+// compositing key: the depth of the surface, or the maximum intensity
+bool ray_rendered = true;
+float ray_key = 0.0;
+#endif
+
+// Texture coordinates in the box held by the textures, from the ones in the
+// whole volume (only a node holds less than the whole volume)
+vec3 box_coordinates(vec3 position)
+{
+#if defined(PARTIAL)
+    return (position - box_bottom) / (box_top - box_bottom);
+#else
+    return position;
+#endif
+}
+
+// Sample the volume, through the page table when it is streamed in bricks,
+// falling back to the coarse level where the brick is not resident, or
+// across the layers when it is compressed
+float sample_volume(vec3 position)
+{
+#if defined(LAYERED)
+    // Compressed slices are filtered in 2D, interpolate across layers
+    float z = clamp(position.z * volume_size.z - 0.5, 0.0, volume_size.z - 1.0);
+    float below = texture(volume_layers, vec3(position.xy, floor(z))).r;
+    float above = texture(volume_layers, vec3(position.xy, min(floor(z) + 1.0, volume_size.z - 1.0))).r;
+    return mix(below, above, fract(z));
+#elif defined(BRICKED)
+    vec3 voxel = clamp(position * volume_size - 0.5, vec3(0.0), volume_size - 1.0);
+    ivec3 brick = ivec3(floor(voxel / brick_size));
+    uvec4 page = texelFetch(page_table, brick, 0);
+    if (page.a == 0u) {
+        return texture(coarse_volume, position).r;
+    }
+
+    // Skip the apron at the start of the page
+    vec3 local = voxel - vec3(brick) * brick_size + 1.0;
+    return texture(volume, (vec3(page.rgb) * (brick_size + 2.0) + local + 0.5) / atlas_size).r;
+#else
+    return textureLod(volume, box_coordinates(position), ray_lod).r;
+#endif
+}
+
+// Estimate normal from the precomputed gradient, or from a finite
+// difference approximation of the gradient
+vec3 normal(vec3 position, float intensity)
+{
+#if defined(GRADIENTS)
+    vec3 gradient = 2.0 * texture(gradients, box_coordinates(position)).rgb - 1.0;
+    return -normalize(NormalMatrix * gradient);
+#else
+    float d = step_length;
+    float dx = sample_volume(position + vec3(d,0,0)) - intensity;
+    float dy = sample_volume(position + vec3(0,d,0)) - intensity;
+    float dz = sample_volume(position + vec3(0,0,d)) - intensity;
+    return -normalize(NormalMatrix * vec3(dx, dy, dz));
+#endif
+}
+
+// Slab method for ray-box intersection
+void ray_box_intersection(Ray ray, AABB box, out float t_0, out float t_1)
+{
+    vec3 direction_inv = 1.0 / ray.direction;
+    vec3 t_top = direction_inv * (box.top - ray.origin);
+    vec3 t_bottom = direction_inv * (box.bottom - ray.origin);
+    vec3 t_min = min(t_top, t_bottom);
+    vec2 t = max(t_min.xx, t_min.yz);
+    t_0 = max(0.0, max(t.x, t.y));
+    vec3 t_max = max(t_top, t_bottom);
+    t = min(t_max.xx, t_max.yz);
+    t_1 = min(t.x, t.y);
+}
+
+// Start of the occupancy grid, at the first voxel held by the textures
+vec3 grid_bottom()
+{
+#if defined(PARTIAL)
+    return box_bottom;
+#else
+    return vec3(0.0);
+#endif
+}
+
+// Index of the occupancy brick holding a position
+ivec3 brick_index(vec3 position)
+{
+    return clamp(ivec3(floor((position - grid_bottom()) / brick_extent)), ivec3(0), textureSize(occupancy, 0) - 1);
+}
+
+// Intensity range (min, max) of the brick holding a position
+vec2 brick_range(vec3 position)
+{
+    return texelFetch(occupancy, brick_index(position), 0).rg;
+}
+
+// Reciprocal of a vector, finite for any input: rays parallel to an axis
+// get a large value instead of an infinity
+vec3 safe_reciprocal(vec3 x)
+{
+    const float tiny = 1e-20;
+    bvec3 near_zero = lessThanEqual(abs(x), vec3(tiny));
+    vec3 tiny_signed = mix(vec3(tiny), vec3(-tiny), lessThan(x, vec3(0.0)));
+    return 1.0 / mix(x, tiny_signed, near_zero);
+}
+
+// Number of whole steps needed to leave the brick holding a position
+float brick_exit_steps(vec3 position, vec3 step_vector)
+{
+    vec3 brick_bottom = grid_bottom() + vec3(brick_index(position)) * brick_extent;
+    vec3 brick_top = brick_bottom + brick_extent;
+    vec3 inverse_step = safe_reciprocal(step_vector);
+    vec3 t = max((brick_bottom - position) * inverse_step, (brick_top - position) * inverse_step);
+    return max(1.0, ceil(min(t.x, min(t.y, t.z))));
+}
+
+// Advance the ray to the first step past the brick holding its position
+void skip_brick(inout vec3 position, inout float ray_length, vec3 step_vector, float ray_step)
+{
+    float steps = brick_exit_steps(position, step_vector);
+    ray_length -= steps * ray_step;
+    position += steps * step_vector;
+}
+
+// Intensity scaled to the window of the transfer function
+float window_intensity(float intensity)
+{
+    return clamp((intensity - window.x) / max(window.y - window.x, 1e-6), 0.0, 1.0);
+}
+
+// Texture coordinate of the table entry for a windowed intensity
+float table_coordinate(float intensity, float size)
+{
+    return (intensity * (size - 1.0) + 0.5) / size;
+}
+
+// Colour and opacity of the transfer function, applied to the intensity window
+vec4 colour_transfer(float intensity)
+{
+    float size = float(textureSize(transfer_function, 0).x);
+    return texture(transfer_function, vec2(table_coordinate(window_intensity(intensity), size), 0.5));
+}
+
+// Minimum and maximum opacity of the transfer function over an intensity
+// range, rounding the range outwards to the table entries
+vec2 opacity_bounds(vec2 range)
+{
+    float size = float(textureSize(opacity_range, 0).x);
+    int low = int(floor(window_intensity(range.x) * (size - 1.0)));
+    int high = int(ceil(window_intensity(range.y) * (size - 1.0)));
+    return texelFetch(opacity_range, ivec2(low, high), 0).rg;
+}
+
+#if defined(PREINTEGRATED)
+// Colour and opacity of a ray segment between two windowed intensities
+vec4 segment_transfer(float front, float back)
+{
+    float size = float(textureSize(preintegrated_transfer, 0).x);
+    return texture(preintegrated_transfer, vec2(table_coordinate(front, size), table_coordinate(back, size)));
+}
+#endif
+
+// Opacity of a sample over a step, from the opacity over step_length
+float opacity_correction(float alpha, float step)
+{
+    return 1.0 - pow(1.0 - alpha, step / step_length);
+}
+
+#if defined(ADAPTIVE_STEP)
+// Largest multiple of the ray step allowed in the brick holding a position:
+// the step grows where the opacity varies little across the brick, as in
+// homogeneous or nearly transparent regions
+float brick_step_scale(vec3 position)
+{
+    vec2 opacity = opacity_bounds(brick_range(position));
+    float variation = opacity.g - opacity.r;
+    return clamp(0.1 / max(variation, 0.025), 1.0, 4.0);
+}
+#endif
+
+// Direction of the ray through a fragment, in world coordinates
+vec3 ray_direction_at(vec2 fragment)
+{
+    vec3 ray_direction;
+    ray_direction.xy = 2.0 * fragment / viewport_size - 1.0;
+    ray_direction.x *= aspect_ratio;
+    ray_direction.z = -focal_length;
+    return (vec4(ray_direction, 0) * ViewMatrix).xyz;
+}
+
+// Whether the ray through a fragment crosses the proxy box
+bool ray_hits_proxy(vec2 fragment)
+{
+    float t_0, t_1;
+    ray_box_intersection(Ray(ray_origin, ray_direction_at(fragment)), AABB(proxy_top, proxy_bottom), t_0, t_1);
+    return t_0 < t_1;
+}
+
+// Colour of the ray through a fragment, in window coordinates
+vec4 raycast(vec2 fragment)
+{
+    vec3 ray_direction = ray_direction_at(fragment);
+
+    float t_0, t_1;
+    Ray casting_ray = Ray(ray_origin, ray_direction);
+    AABB bounding_box = AABB(proxy_top, proxy_bottom);
+    ray_box_intersection(casting_ray, bounding_box, t_0, t_1);
+
+    vec3 ray_start = (ray_origin + ray_direction * t_0 - bottom) / (top - bottom);
+    vec3 ray_stop = (ray_origin + ray_direction * t_1 - bottom) / (top - bottom);
+
+    vec3 ray = ray_stop - ray_start;
+    float ray_length = length(ray);
+
+    // Level of detail from the footprint of a pixel at the ray entry, relative
+    // to a voxel, with the step growing along with the voxels of the level
+    vec3 voxel_extent = (top - bottom) / volume_size;
+    float footprint = 2.0 * t_0 / viewport_size.y;
+    ray_lod = min(log2(max(footprint / min(voxel_extent.x, min(voxel_extent.y, voxel_extent.z)), 1.0)), max_lod);
+    float ray_step = step_length * exp2(ray_lod);
+    vec3 step_vector = ray_step * ray / ray_length;
+
+    // Random jitter
+    float jitter_fraction = fract(textureLod(jitter, fragment / viewport_size, 0.0).r + jitter_offset);
+
+#if defined(PARTIAL)
+    // Keep the samples of the whole ray falling in the clip box, from the
+    // first one past its entry to the last one before its exit, so the boxes
+    // of all the nodes share the samples of the whole ray
+    vec3 ray_entry = ray_start;
+    vec3 ray_unit = ray / ray_length;
+    vec3 u_top = (clip_top - ray_start) / ray_unit;
+    vec3 u_bottom = (clip_bottom - ray_start) / ray_unit;
+    vec3 u_min = min(u_top, u_bottom);
+    vec3 u_max = max(u_top, u_bottom);
+    float u_0 = max(0.0, max(u_min.x, max(u_min.y, u_min.z)));
+    float u_1 = min(u_max.x, min(u_max.y, u_max.z));
+
+    // The box holding the exit also keeps the overrun of the whole ray
+    float skipped = max(0.0, ceil(u_0 / ray_step - jitter_fraction));
+    ray_length = u_1 < ray_length ? u_1 - ray_step * (jitter_fraction + skipped) : ray_length - ray_step * skipped;
+    jitter_fraction += skipped;
+    if (u_0 >= u_1 || ray_length <= 0.0) {
+        ray_rendered = false;
+        return vec4(0.0);
+    }
+#endif
+
+    ray_start += step_vector * jitter_fraction;
+
+    vec3 position = ray_start;
+
+#if defined(MODE_ISOSURFACE)
+    vec3 colour = pow(background_colour, vec3(gamma));
+
+#if defined(PARTIAL)
+    // Nothing is rendered unless the surface is hit inside the box
+    ray_rendered = false;
+#endif
+
+    // Ray march until reaching the end of the volume
+    while (ray_length > 0) {
+
+#if defined(SKIP_EMPTY_SPACE)
+        // Skip bricks that cannot contain the isosurface
+        if (brick_range(position).g <= threshold) {
+            skip_brick(position, ray_length, step_vector, ray_step);
+            continue;
+        }
+#endif
+
+        float intensity = sample_volume(position);
+
+        if (intensity > threshold) {
+
+            // Get closer to the surface
+            position -= step_vector * 0.5;
+            intensity = sample_volume(position);
+            position -= step_vector * (intensity > threshold ? 0.25 : -0.25);
+            intensity = sample_volume(position);
+
+            // Blinn-Phong shading
+            vec3 L = normalize(light_position - position);
+            vec3 V = -normalize(ray);
+            vec3 N = normal(position, intensity);
+            vec3 H = normalize(L + V);
+
+            float Ia = 0.1;
+            float Id = 1.0 * max(0, dot(N, L));
+            float Is = 8.0 * pow(max(0, dot(N, H)), 600);
+            colour = (Ia + Id) * material_colour + Is * vec3(1.0);
+
+#if defined(PARTIAL)
+            // Depth of the hit along the whole ray
+            ray_rendered = true;
+            ray_key = dot(position - ray_entry, ray_unit);
+#endif
+
+            break;
+        }
+
+        ray_length -= ray_step;
+        position += step_vector;
+    }
+
+#if defined(PARTIAL)
+    return vec4(colour, 1.0);
+#else
+    // Gamma correction
+    return vec4(pow(colour, vec3(1.0 / gamma)), 1.0);
+#endif
+
+#elif defined(MODE_ALPHA_BLENDING)
+    // Premultiplied colour, composited front to back
+    vec4 colour = vec4(0.0);
+
+    // Length of the segment represented by the next sample, as a multiple of
+    // the ray step, and opacity of the previous sample
+    float step_scale = 1.0;
+    float previous_alpha = -1.0;
+
+    // Whether the step was just halved, so it is kept until the ray gets
+    // back to the sample that triggered the refinement
+    bool refined = false;
+
+    // Windowed intensity at the front of the segment, negative if unknown
+    float front = -1.0;
+
+    // Ray march until reaching the end of the volume, or until the colour is
+    // opaque enough to hide anything behind
+    while (ray_length > 0 && colour.a < opacity_cutoff) {
+
+#if defined(SKIP_EMPTY_SPACE)
+        // Skip bricks too transparent to affect the colour
+        if (opacity_bounds(brick_range(position)).g < 1.0 / 255.0) {
+            skip_brick(position, ray_length, step_scale * step_vector, step_scale * ray_step);
+            previous_alpha = -1.0;
+            front = -1.0;
+            continue;
+        }
+#endif
+
+        float intensity = sample_volume(position);
+
+#if defined(PREINTEGRATED)
+        // Segment from the previous sample, or a plain lookup for the first
+        float back = window_intensity(intensity);
+        vec4 c = segment_transfer(front < 0.0 ? back : front, back);
+#else
+        vec4 c = colour_transfer(intensity);
+#endif
+
+#if defined(ADAPTIVE_STEP)
+        // Refine where the opacity changes quickly between samples, step back
+        // and resample with half the step
+        if (previous_alpha >= 0.0 && abs(c.a - previous_alpha) > 0.1 && step_scale > 0.5) {
+            float retreat = 0.5 * step_scale;
+            position -= retreat * step_vector;
+            ray_length += retreat * ray_step;
+            step_scale -= retreat;
+            refined = true;
+            continue;
+        }
+        previous_alpha = c.a;
+#endif
+
+#if defined(PREINTEGRATED)
+        front = back;
+#endif
+
+        // Alpha-blending, with the opacity corrected for the step
+        c.a = opacity_correction(c.a, step_scale * ray_step);
+        colour.rgb += (1.0 - colour.a) * c.a * c.rgb;
+        colour.a += (1.0 - colour.a) * c.a;
+
+#if defined(ADAPTIVE_STEP)
+        // Grow the step again, up to the limit of the brick, and never past
+        // the first step out of it, so the next brick is always sampled
+        if (!refined) {
+            step_scale = min(min(2.0 * step_scale, brick_step_scale(position)), brick_exit_steps(position, step_vector));
+        }
+        refined = false;
+#endif
+
+        ray_length -= step_scale * ray_step;
+        position += step_scale * step_vector;
+    }
+
+#if defined(PARTIAL)
+    return colour;
+#else
+    // Blend background
+    colour.rgb += (1.0 - colour.a) * pow(background_colour, vec3(gamma)).rgb;
+    colour.a = 1.0;
+
+    // Gamma correction
+    return vec4(pow(colour.rgb, vec3(1.0 / gamma)), colour.a);
+#endif
+
+#elif defined(MODE_MAXIMUM_INTENSITY_PROJECTION)
+    float maximum_intensity = 0.0;
+
+    // Ray march until reaching the end of the volume
+    while (ray_length > 0) {
+
+#if defined(SKIP_EMPTY_SPACE)
+        // Skip bricks that cannot raise the maximum
+        if (brick_range(position).g <= maximum_intensity) {
+            skip_brick(position, ray_length, step_vector, ray_step);
+            continue;
+        }
+#endif
+
+        float intensity = sample_volume(position);
+
+        if (intensity > maximum_intensity) {
+            maximum_intensity = intensity;
+        }
+
+        ray_length -= ray_step;
+        position += step_vector;
+    }
+
+    vec4 colour = colour_transfer(maximum_intensity);
+
+#if defined(PARTIAL)
+    ray_key = maximum_intensity;
+    return vec4(colour.a * colour.rgb, colour.a);
+#else
+    // Blend background
+    colour.rgb = colour.a * colour.rgb + (1 - colour.a) * pow(background_colour, vec3(gamma)).rgb;
+    colour.a = 1.0;
+
+    // Gamma correction
+    return vec4(pow(colour.rgb, vec3(1.0 / gamma)), colour.a);
+#endif
+#endif
+}
@@ -24,7 +24,8 @@
 
 in vec4 a_position;
 
-uniform mat4 ModelViewProjectionMatrix;
+// ModelViewProjectionMatrix is in the Raycasting uniform block, inserted by
+// the renderer from parameters.glsl
 
 void main() {
     gl_Position = ModelViewProjectionMatrix * a_position;
@@ -0,0 +1,326 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QtConcurrent>
+
+#include "batchrenderer.h"
+#include "compositor.h"
+#include "cpuraycaster.h"
+#include "sortlastrenderer.h"
+
+/*!
+ * \brief Render images of volumes without a window.
+ *
+ * Each volume is rendered in each mode along the camera path, and written as
+ * `<output>/<volume>_<mode>_<frame>.<format>`. The next volume is prepared on
+ * a worker thread while the current one is rendered.
+ *
+ * With `--cpu`, images are rendered by the software raycaster, without
+ * creating an OpenGL context, as a reference for the shaders or where no
+ * GPU is available.
+ *
+ * With `--partitions`, the volume is split in boxes rendered separately and
+ * composited (sort-last). Each box can be rendered by its own process with
+ * `--node`, writing `<output>/<volume>_<mode>_<frame>.<node>.partial`, and a
+ * last process run with `--composite` and the same arguments composites the
+ * partial images, without reading the volumes. Each node reads and uploads
+ * only its box, with a small margin, so volumes too large for a single GPU
+ * can be split across nodes. Nodes render with OpenGL unless `--cpu` is
+ * given, while whole images split in boxes need `--cpu`.
+ */
+int main(int argc, char *argv[])
+{
+    // Render nodes usually have no display
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QGuiApplication a(argc, argv);
+    QGuiApplication::setApplicationName("3d_raycaster_batch");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Render image sequences of volumes, without a window.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("volumes", "Volume files to be rendered.", "volume...");
+    const QCommandLineOption output_option({"o", "output"}, "Output directory.", "directory", ".");
+    const QCommandLineOption mode_option({"m", "mode"}, "Rendering mode, can be repeated (default: Alpha blending).", "mode");
+    const QCommandLineOption size_option({"s", "size"}, "Image size.", "WxH", "512x512");
+    const QCommandLineOption frames_option({"n", "frames"}, "Frames of a turntable around the volume.", "count", "1");
+    const QCommandLineOption elevation_option("elevation", "Turntable camera elevation, in degrees.", "degrees", "20");
+    const QCommandLineOption distance_option("distance", "Turntable camera distance.", "distance", "3");
+    const QCommandLineOption camera_option({"c", "camera"}, "Camera path file, with a \"yaw pitch distance\" line per frame, replacing the turntable.", "file");
+    const QCommandLineOption samples_option("samples", "Jittered frames averaged for each image.", "count", "1");
+    const QCommandLineOption step_option("step", "Ray marching step, as a fraction of the ray length.", "length", "0.01");
+    const QCommandLineOption threshold_option("threshold", "Isosurface threshold, as a fraction of the intensity range.", "value", "0.5");
+    const QCommandLineOption cutoff_option("opacity-cutoff", "Opacity at which alpha blended rays are terminated.", "opacity", "0.98");
+    const QCommandLineOption fixed_step_option("fixed-step", "March alpha blended rays with a constant step.");
+    const QCommandLineOption transfer_option("transfer-function", "Transfer function file, with an \"intensity red green blue alpha\" line per point.", "file");
+    const QCommandLineOption no_preintegration_option("no-preintegration", "Look up alpha blended samples without pre-integration.");
+    const QCommandLineOption background_option("background", "Background colour.", "colour", "black");
+    const QCommandLineOption format_option("format", "Image format.", "extension", "png");
+    const QCommandLineOption bricked_option("bricked", "Stream the volumes in bricks.");
+    const QCommandLineOption cache_option("cache", "Load the prepared volumes from a binary cache next to them, written when missing or out of date.");
+    const QCommandLineOption cache_dir_option("cache-dir", "Directory of the binary caches, instead of next to the volumes (implies --cache).", "directory");
+    const QCommandLineOption statistics_option("statistics", "Write the timings of each image to a CSV file.", "file");
+    const QCommandLineOption no_lod_option("no-level-of-detail", "Always sample the full resolution volume.");
+    const QCommandLineOption no_proxy_option("no-proxy-geometry", "Rasterise the whole volume box, instead of the bounds of the non-empty bricks.");
+    const QCommandLineOption cpu_option("cpu", "Render on the CPU, without OpenGL (level of detail and proxy geometry are not used).");
+    const QCommandLineOption partitions_option("partitions", "Split the volumes in boxes rendered separately and composited (needs --cpu, unless with --node or --composite).", "count", "1");
+    const QCommandLineOption node_option("node", "Render only one box, writing partial images (needs --partitions).", "index");
+    const QCommandLineOption composite_option("composite", "Composite the partial images written by each node, without reading the volumes.");
+    parser.addOptions({output_option, mode_option, size_option, frames_option, elevation_option, distance_option,
+                       camera_option, samples_option, step_option, threshold_option, cutoff_option,
+                       fixed_step_option, transfer_option, no_preintegration_option, background_option,
+                       format_option, bricked_option, cache_option, cache_dir_option, statistics_option,
+                       no_lod_option, no_proxy_option, cpu_option,
+                       partitions_option, node_option, composite_option});
+    parser.process(a);
+
+    const QStringList volumes = parser.positionalArguments();
+    const QStringList size = parser.value(size_option).split('x');
+    if (volumes.isEmpty() || size.size() != 2 || size[0].toInt() <= 0 || size[1].toInt() <= 0) {
+        parser.showHelp(1);
+    }
+
+    try {
+        const QSize image_size(size[0].toInt(), size[1].toInt());
+        const int samples = parser.value(samples_option).toInt();
+        const bool cpu = parser.isSet(cpu_option);
+        if (cpu && (parser.isSet(bricked_option) || parser.isSet(statistics_option))) {
+            throw std::runtime_error("--bricked and --statistics need the OpenGL renderer.");
+        }
+
+        const int partitions = parser.value(partitions_option).toInt();
+        const int node = parser.isSet(node_option) ? parser.value(node_option).toInt() : -1;
+        const bool compositing = parser.isSet(composite_option);
+        const bool sort_last = partitions > 1 || node >= 0 || compositing;
+        if (sort_last && node < 0 && !compositing && !cpu) {
+            throw std::runtime_error("Whole images split with --partitions need --cpu.");
+        }
+        if (partitions < 1 || node >= partitions || (parser.isSet(node_option) && node < 0)) {
+            throw std::runtime_error("--node must be in [0, --partitions).");
+        }
+        if ((node >= 0 || compositing) && samples > 1) {
+            throw std::runtime_error("--node and --composite render a single sample per image.");
+        }
+        if (node >= 0 && compositing) {
+            throw std::runtime_error("--node and --composite cannot be combined.");
+        }
+        if (compositing && parser.isSet(statistics_option)) {
+            throw std::runtime_error("--composite does not render, --statistics cannot be used.");
+        }
+
+        // The OpenGL renderer is created only when used, so the CPU one and the compositor run without a GPU
+        std::unique_ptr<BatchRenderer> renderer;
+        CpuRayCaster cpu_renderer;
+        SortLastRenderer sort_last_renderer(partitions);
+        std::unique_ptr<VolumePartition> partition;
+        if (!cpu && !compositing) {
+            renderer = std::make_unique<BatchRenderer>(image_size, samples);
+        }
+
+        if (parser.isSet(statistics_option) && !renderer->profiler().set_csv(parser.value(statistics_option))) {
+            throw std::runtime_error("Cannot write " + parser.value(statistics_option).toStdString() + ".");
+        }
+
+        if (parser.isSet(transfer_option)) {
+            const TransferFunction transfer_function = TransferFunction::read(parser.value(transfer_option).toStdString());
+            if (renderer) {
+                renderer->set_transfer_function(transfer_function);
+            }
+            else {
+                sort_last ? sort_last_renderer.set_transfer_function(transfer_function) : cpu_renderer.set_transfer_function(transfer_function);
+            }
+        }
+
+        QStringList modes = parser.values(mode_option);
+        if (modes.isEmpty()) {
+            modes << "Alpha blending";
+        }
+        const std::vector<QString> available_modes = cpu ? CpuRayCaster::modes()
+                                                         : renderer ? renderer->modes() : RayCastRenderer().modes();
+        for (const auto& mode : modes) {
+            if (std::find(available_modes.begin(), available_modes.end(), mode) == available_modes.end()) {
+                throw std::runtime_error("Unknown mode " + mode.toStdString() + ".");
+            }
+        }
+
+        const std::vector<QMatrix4x4> views = parser.isSet(camera_option)
+                ? BatchRenderer::read_camera_path(parser.value(camera_option))
+                : BatchRenderer::turntable(std::max(parser.value(frames_option).toInt(), 1),
+                                           parser.value(elevation_option).toFloat(),
+                                           parser.value(distance_option).toFloat());
+
+        RenderParameters parameters;
+        parameters.step_length = parser.value(step_option).toFloat();
+        parameters.threshold = parser.value(threshold_option).toFloat();
+        parameters.opacity_cutoff = parser.value(cutoff_option).toFloat();
+        parameters.adaptive_step = !parser.isSet(fixed_step_option);
+        parameters.preintegrated = !parser.isSet(no_preintegration_option);
+        parameters.background = QColor(parser.value(background_option));
+        parameters.level_of_detail = !parser.isSet(no_lod_option);
+        parameters.proxy_geometry = !parser.isSet(no_proxy_option);
+
+        VolumeOptions options;
+        options.bricked = parser.isSet(bricked_option);
+        options.cache = parser.isSet(cache_option) || parser.isSet(cache_dir_option);
+        options.cache_directory = parser.value(cache_dir_option).toStdString();
+        if (cpu) {
+            // The CPU raycaster reads 16 bit intensities in Z-ordered bricks, and does not use precomputed gradients
+            options.format = VoxelFormat::Uint16;
+            options.gradients = false;
+            // Boxes are copied from the linear voxels
+            options.bricked_layout = !sort_last;
+        }
+        if (node >= 0) {
+            // Each node reads only its box, so its memory shrinks with the boxes
+            options.partitions = partitions;
+            options.node = node;
+        }
+
+        const QDir output(parser.value(output_option));
+        if (!output.mkpath(".")) {
+            throw std::runtime_error("Cannot create output directory.");
+        }
+
+        const auto prepare = [&](const QString& volume) {
+            return QtConcurrent::run([volume, options]() {
+                return RayCastVolume::prepare_volume(volume, options);
+            });
+        };
+
+        const auto image_name = [&](const QString& volume, const QString& mode, const size_t frame) {
+            return QString("%1_%2_%3").arg(QFileInfo(volume).completeBaseName(), mode.toLower().replace(' ', '_'))
+                    .arg(frame, 4, 10, QChar('0'));
+        };
+
+        int errors = 0;
+        if (compositing) {
+            for (const auto& volume : volumes) {
+                for (const auto& mode : modes) {
+                    for (size_t frame = 0; frame < views.size(); ++frame) {
+                        const QString name = image_name(volume, mode, frame);
+                        try {
+                            std::vector<PartialImage> partials;
+                            for (int i = 0; i < partitions; ++i) {
+                                partials.push_back(read_partial(output.filePath(QString("%1.%2.partial").arg(name).arg(i)).toStdString()));
+                            }
+                            std::vector<float> sum;
+                            CpuRayCaster::accumulate(composite(partials, parameters.opacity_cutoff), parameters.background, sum);
+                            const QString filename = output.filePath(name + "." + parser.value(format_option));
+                            if (!CpuRayCaster::resolve(sum, QSize(partials[0].width, partials[0].height), 1).save(filename)) {
+                                throw std::runtime_error("Cannot write " + filename.toStdString() + ".");
+                            }
+                        }
+                        catch (const std::exception& e) {
+                            std::cerr << name.toStdString() << ": " << e.what() << std::endl;
+                            ++errors;
+                        }
+                    }
+                }
+            }
+            return errors ? 1 : 0;
+        }
+
+        QFuture<std::shared_ptr<const PreparedVolume>> next = prepare(volumes[0]);
+        for (int v = 0; v < volumes.size(); ++v) {
+            std::shared_ptr<const PreparedVolume> volume;
+            try {
+                volume = next.result();
+            }
+            catch (const std::exception& e) {
+                std::cerr << volumes[v].toStdString() << ": " << e.what() << std::endl;
+                ++errors;
+            }
+            if (v + 1 < volumes.size()) {
+                next = prepare(volumes[v + 1]);
+            }
+            if (!volume) {
+                continue;
+            }
+
+            if (renderer) {
+                renderer->load(volume);
+                renderer->profiler().record_load(volumes[v], renderer->volume()->load_timings());
+                if (node >= 0) {
+                    // Only the box of the node is uploaded, and the rays are clipped to it
+                    const QVector3D volume_size = volume->volume_size();
+                    partition = std::make_unique<VolumePartition>(std::array<size_t, 3> {static_cast<size_t>(volume_size.x()),
+                                                                                         static_cast<size_t>(volume_size.y()),
+                                                                                         static_cast<size_t>(volume_size.z())},
+                                                                  partitions);
+                }
+            }
+            else if (sort_last) {
+                sort_last_renderer.load(volume, node);
+            }
+            else {
+                cpu_renderer.load(volume);
+            }
+            for (const auto& mode : modes) {
+                parameters.mode = mode;
+                for (size_t frame = 0; frame < views.size(); ++frame) {
+                    parameters.view = views[frame];
+                    const QString name = image_name(volumes[v], mode, frame);
+                    const QString filename = name + "." + parser.value(format_option);
+                    if (node >= 0) {
+                        const QString partial = output.filePath(QString("%1.%2.partial").arg(name).arg(node));
+                        write_partial(partial.toStdString(), renderer ? renderer->render_partial(parameters, *partition, node)
+                                                                      : sort_last_renderer.render_partials(parameters, image_size).at(0));
+                    }
+                    else if (!cpu) {
+                        renderer->render(parameters, output.filePath(filename));
+                    }
+                    else if (sort_last) {
+                        if (!sort_last_renderer.render(parameters, image_size, samples).save(output.filePath(filename))) {
+                            std::cerr << "Cannot write " << output.filePath(filename).toStdString() << std::endl;
+                            ++errors;
+                        }
+                    }
+                    else if (!cpu_renderer.render(parameters, image_size, samples).save(output.filePath(filename))) {
+                        std::cerr << "Cannot write " << output.filePath(filename).toStdString() << std::endl;
+                        ++errors;
+                    }
+                }
+            }
+        }
+
+        if (renderer) {
+            for (const auto& filename : renderer->finish()) {
+                std::cerr << "Cannot write " << filename.toStdString() << std::endl;
+                ++errors;
+            }
+        }
+        return errors ? 1 : 0;
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
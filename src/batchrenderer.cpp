@@ -0,0 +1,427 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <QFile>
+#include <QImage>
+#include <QTextStream>
+#include <QThread>
+#include <QtConcurrent>
+
+#include "batchrenderer.h"
+
+
+/*!
+ * \brief Create the offscreen context and the render target.
+ * \param size Size of the images, in pixels.
+ * \param samples Jittered frames accumulated for each image.
+ *
+ * A `QGuiApplication` must exist. On machines without a display it can run
+ * with the `offscreen` or `eglfs` platform. Throws `std::runtime_error` if no
+ * OpenGL context can be created.
+ */
+BatchRenderer::BatchRenderer(const QSize& size, const int samples)
+    : m_size {size}
+    , m_samples {std::max(samples, 1)}
+    , m_maxPendingWrites {2 * std::max(QThread::idealThreadCount(), 1)}
+{
+    m_surface.setFormat(QSurfaceFormat::defaultFormat());
+    m_surface.create();
+    m_context.setFormat(QSurfaceFormat::defaultFormat());
+    if (!m_context.create() || !m_context.makeCurrent(&m_surface)) {
+        throw std::runtime_error("Cannot create an OpenGL context.");
+    }
+    initializeOpenGLFunctions();
+
+    for (auto& readback : m_readbacks) {
+        glGenBuffers(1, &readback.buffer);
+    }
+    m_renderer.initialise();
+    create_target();
+}
+
+
+/*!
+ * \brief Destructor, writing any pending image.
+ */
+BatchRenderer::~BatchRenderer()
+{
+    finish();
+    m_context.makeCurrent(&m_surface);
+    for (auto& readback : m_readbacks) {
+        glDeleteBuffers(1, &readback.buffer);
+    }
+    m_fbo.reset();
+    m_partialFbo.reset();
+    m_renderer.release();
+    m_context.doneCurrent();
+}
+
+
+/*!
+ * \brief Change the size of the images.
+ * \param size New size, in pixels.
+ *
+ * Pending images are written first. The loaded volume is kept.
+ */
+void BatchRenderer::resize(const QSize& size)
+{
+    if (size == m_size) {
+        return;
+    }
+    write_pending();
+    m_size = size;
+    create_target();
+}
+
+
+/*!
+ * \brief Create the render target and the pixel buffers for the image size.
+ */
+void BatchRenderer::create_target(void)
+{
+    m_context.makeCurrent(&m_surface);
+
+    QOpenGLFramebufferObjectFormat format;
+    format.setInternalTextureFormat(GL_RGBA16F);
+    m_fbo = std::make_unique<QOpenGLFramebufferObject>(m_size, format);
+    m_partialFbo.reset();
+
+    const size_t image_bytes = 4 * m_size.width() * m_size.height();
+    for (auto& readback : m_readbacks) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, image_bytes, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    // The noise texture takes the size of the viewport
+    glViewport(0, 0, m_size.width(), m_size.height());
+    m_renderer.volume()->create_noise();
+}
+
+
+/*!
+ * \brief Replace the volume being rendered.
+ * \param volume Prepared volume, uploaded at once.
+ *
+ * Volumes can be prepared on a worker thread while the previous one is
+ * being rendered.
+ */
+void BatchRenderer::load(std::shared_ptr<const PreparedVolume> volume)
+{
+    m_context.makeCurrent(&m_surface);
+    m_renderer.volume()->begin_upload(std::move(volume));
+    while (!m_renderer.volume()->upload_step(std::numeric_limits<size_t>::max())) {
+    }
+}
+
+
+/*!
+ * \brief Render an image into the render target, without reading it back.
+ * \param parameters Parameters of the frame. The jitter offset is overridden.
+ *
+ * Bricked volumes are rendered until all the bricks of the view are
+ * resident, and then the jittered samples are accumulated.
+ */
+void BatchRenderer::draw(const RenderParameters& parameters)
+{
+    m_context.makeCurrent(&m_surface);
+    m_fbo->bind();
+
+    const QColor& background = parameters.background;
+    glClearColor(background.redF(), background.greenF(), background.blueF(), background.alphaF());
+
+    // Stream in the bricks of a bricked volume before accumulating
+    RenderParameters p = parameters;
+    p.jitter_offset = 0.0f;
+    for (int pass = 0; pass < m_streamingPasses; ++pass) {
+        glClear(GL_COLOR_BUFFER_BIT);
+        if (!m_renderer.render(p, m_size)) {
+            break;
+        }
+    }
+
+    // Running average of frames with shifted jitter, as in the canvas
+    for (int frame = 1; frame < m_samples; ++frame) {
+        p.jitter_offset = std::fmod(0.618034f * frame, 1.0f);
+        glEnable(GL_BLEND);
+        glBlendColor(0.0f, 0.0f, 0.0f, 1.0f / (frame + 1));
+        glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+        m_renderer.render(p, m_size);
+        glDisable(GL_BLEND);
+    }
+
+    m_fbo->release();
+}
+
+
+/*!
+ * \brief Wait until the GPU has completed all the frames.
+ */
+void BatchRenderer::wait(void)
+{
+    m_context.makeCurrent(&m_surface);
+    glFinish();
+}
+
+
+/*!
+ * \brief Render an image, and queue it to be written.
+ * \param parameters Parameters of the frame. The jitter offset is overridden.
+ * \param filename Destination of the image, in any format supported by `QImage`.
+ *
+ * The image is written only after the next frame is rendered, or when
+ * `finish` is called.
+ */
+void BatchRenderer::render(const RenderParameters& parameters, const QString& filename)
+{
+    m_context.makeCurrent(&m_surface);
+    m_renderer.profiler().begin_frame();
+    draw(parameters);
+    m_fbo->bind();
+
+    // Start an asynchronous transfer of this frame
+    m_renderer.profiler().begin_stage("readback");
+    Readback& readback = m_readbacks[m_nextReadback];
+    if (!readback.filename.isEmpty()) {
+        write(readback);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    glReadPixels(0, 0, m_size.width(), m_size.height(), GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.filename = filename;
+    m_fbo->release();
+
+    // The previous frame has had a whole frame to arrive
+    m_nextReadback = 1 - m_nextReadback;
+    if (!m_readbacks[m_nextReadback].filename.isEmpty()) {
+        write(m_readbacks[m_nextReadback]);
+    }
+    m_renderer.profiler().end_frame();
+}
+
+
+/*!
+ * \brief Render the partial image of a box of the volume, and read it back at once.
+ * \param parameters Parameters of the frame, for a single jitter offset.
+ * \param partition Boxes of the loaded volume.
+ * \param node Box to be rendered.
+ * \return The partial image, ranked by the position of the box in the
+ *         visibility order from the camera, as `SortLastRenderer::render_partials`.
+ *
+ * The whole volume is loaded, and the rays sample only the box, so the
+ * partials of the nodes composite into the image of the whole volume.
+ * Bricked volumes are rendered until all the bricks of the view are
+ * resident. Throws `std::runtime_error` if the mode is unknown.
+ */
+PartialImage BatchRenderer::render_partial(const RenderParameters& parameters, const VolumePartition& partition, const size_t node)
+{
+    m_context.makeCurrent(&m_surface);
+    m_renderer.profiler().begin_frame();
+
+    if (!m_partialFbo) {
+        QOpenGLFramebufferObjectFormat format;
+        format.setInternalTextureFormat(GL_RGBA32F);
+        m_partialFbo = std::make_unique<QOpenGLFramebufferObject>(m_size, format);
+        m_partialFbo->addColorAttachment(m_size, GL_R32F);
+    }
+    m_partialFbo->bind();
+    const GLenum attachments[2] {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, attachments);
+
+    CompositeOperator op = CompositeOperator::Over;
+    for (int pass = 0; pass < m_streamingPasses; ++pass) {
+        if (!m_renderer.render_partial(parameters, m_size, partition.region(node), op)) {
+            break;
+        }
+    }
+
+    // Rank of the box, from the camera in voxels of the volume
+    RayCastVolume *volume = m_renderer.volume();
+    const QVector3D eye = (parameters.view.inverted() * QVector3D(0.0f, 0.0f, 0.0f) - volume->bottom())
+            / (volume->top() - volume->bottom()) * volume->size();
+    const std::vector<size_t> order = partition.visibility_order({eye.x(), eye.y(), eye.z()});
+    const int rank = static_cast<int>(std::find(order.begin(), order.end(), node) - order.begin());
+
+    // Rows come bottom to top, as in the partials of the CPU raycaster
+    m_renderer.profiler().begin_stage("readback");
+    PartialImage partial(m_size.width(), m_size.height(), op, rank);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, 0, m_size.width(), m_size.height(), GL_RGBA, GL_FLOAT, partial.rgba.data());
+    if (!partial.key.empty()) {
+        glReadBuffer(GL_COLOR_ATTACHMENT1);
+        glReadPixels(0, 0, m_size.width(), m_size.height(), GL_RED, GL_FLOAT, partial.key.data());
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+    }
+    m_renderer.profiler().end_stage();
+
+    m_partialFbo->release();
+    m_renderer.profiler().end_frame();
+    return partial;
+}
+
+
+/*!
+ * \brief Write all the pending images.
+ * \return The images that could not be written.
+ */
+QStringList BatchRenderer::finish(void)
+{
+    write_pending();
+    m_renderer.profiler().flush();
+
+    QStringList failed = m_failed;
+    m_failed.clear();
+    return failed;
+}
+
+
+/*!
+ * \brief Write the frames still in the pixel buffers, and wait for all the writes.
+ */
+void BatchRenderer::write_pending(void)
+{
+    m_context.makeCurrent(&m_surface);
+    for (int i = 0; i < 2; ++i) {
+        Readback& readback = m_readbacks[(m_nextReadback + i) % 2];
+        if (!readback.filename.isEmpty()) {
+            write(readback);
+        }
+    }
+    wait_writes(0);
+}
+
+
+/*!
+ * \brief Copy a frame out of its pixel buffer, and encode it on a worker thread.
+ * \param readback Pixel buffer holding the frame, freed afterwards.
+ */
+void BatchRenderer::write(Readback& readback)
+{
+    wait_writes(m_maxPendingWrites - 1);
+
+    // Rows come bottom to top, they are flipped by the worker
+    QImage image(m_size, QImage::Format_RGBA8888);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    const void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, image.sizeInBytes(), GL_MAP_READ_BIT);
+    if (pixels) {
+        std::memcpy(image.bits(), pixels, image.sizeInBytes());
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    if (!pixels) {
+        m_failed << readback.filename;
+    }
+    else {
+        m_writes.push_back(QtConcurrent::run([image, filename = readback.filename]() {
+            return image.mirrored().save(filename);
+        }));
+        m_writeNames.push_back(readback.filename);
+    }
+    readback.filename.clear();
+}
+
+
+/*!
+ * \brief Wait until at most a number of images are still being written.
+ * \param pending Number of writes that can still be running.
+ */
+void BatchRenderer::wait_writes(const size_t pending)
+{
+    while (m_writes.size() > pending) {
+        if (!m_writes.front().result()) {
+            m_failed << m_writeNames.front();
+        }
+        m_writes.erase(m_writes.begin());
+        m_writeNames.erase(m_writeNames.begin());
+    }
+}
+
+
+/*!
+ * \brief Camera path orbiting the volume around its vertical axis.
+ * \param frames Number of frames of a whole turn.
+ * \param elevation Angle of the camera above the horizontal plane, in degrees.
+ * \param distance Distance of the camera from the centre of the volume.
+ * \return The view matrix of each frame.
+ */
+std::vector<QMatrix4x4> BatchRenderer::turntable(const int frames, const float elevation, const float distance)
+{
+    std::vector<QMatrix4x4> views;
+    for (int i = 0; i < frames; ++i) {
+        QMatrix4x4 view;
+        view.translate(0.0f, 0.0f, -distance);
+        view.rotate(elevation, 1.0f, 0.0f, 0.0f);
+        view.rotate(360.0f * i / frames, 0.0f, 1.0f, 0.0f);
+        views.push_back(view);
+    }
+    return views;
+}
+
+
+/*!
+ * \brief Read a camera path from file.
+ * \param filename Text file, with a line "yaw pitch distance" (angles in degrees) per frame.
+ * \return The view matrix of each frame.
+ *
+ * Empty lines and lines starting with `#` are skipped. Throws
+ * `std::runtime_error` if the file cannot be read.
+ */
+std::vector<QMatrix4x4> BatchRenderer::read_camera_path(const QString& filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        throw std::runtime_error("Cannot open camera path " + filename.toStdString() + ".");
+    }
+
+    std::vector<QMatrix4x4> views;
+    QTextStream stream(&file);
+    for (int line_number = 1; !stream.atEnd(); ++line_number) {
+        const QString line = stream.readLine().trimmed();
+        if (line.isEmpty() || line.startsWith('#')) {
+            continue;
+        }
+
+        const QStringList values = line.split(' ', QString::SkipEmptyParts);
+        bool ok[3] = {false, false, false};
+        const float yaw = values.value(0).toFloat(&ok[0]);
+        const float pitch = values.value(1).toFloat(&ok[1]);
+        const float distance = values.value(2).toFloat(&ok[2]);
+        if (values.size() != 3 || !ok[0] || !ok[1] || !ok[2]) {
+            throw std::runtime_error("Invalid camera at line " + std::to_string(line_number) + " of " + filename.toStdString() + ".");
+        }
+
+        QMatrix4x4 view;
+        view.translate(0.0f, 0.0f, -distance);
+        view.rotate(pitch, 1.0f, 0.0f, 0.0f);
+        view.rotate(yaw, 0.0f, 1.0f, 0.0f);
+        views.push_back(view);
+    }
+    return views;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <QFuture>
+#include <QMatrix4x4>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLFramebufferObject>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+
+#include "compositor.h"
+#include "raycastrenderer.h"
+#include "volumepartition.h"
+
+/*!
+ * \brief Renderer of image sequences without a window.
+ *
+ * The renderer owns an OpenGL context on an offscreen surface, and renders
+ * into a framebuffer object with the same shaders as the canvas. The context,
+ * the shaders and the loaded volume are reused across frames.
+ *
+ * Images are read back through a pair of pixel buffer objects, so the
+ * transfer of a frame overlaps the rendering of the next one, and they are
+ * encoded and written on worker threads.
+ */
+class BatchRenderer : protected QOpenGLExtraFunctions
+{
+public:
+    BatchRenderer(const QSize& size, const int samples = 1);
+    virtual ~BatchRenderer();
+
+    BatchRenderer(const BatchRenderer&) = delete;
+    BatchRenderer& operator=(const BatchRenderer&) = delete;
+
+    void resize(const QSize& size);
+    void load(std::shared_ptr<const PreparedVolume> volume);
+    void draw(const RenderParameters& parameters);
+    void wait(void);
+    void render(const RenderParameters& parameters, const QString& filename);
+    PartialImage render_partial(const RenderParameters& parameters, const VolumePartition& partition, const size_t node);
+    QStringList finish(void);
+
+    /*!
+     * \brief Volume being rendered.
+     */
+    RayCastVolume * volume(void) {
+        return m_renderer.volume();
+    }
+
+    /*!
+     * \brief Timer of the stages of each image, disabled by default.
+     */
+    FrameProfiler& profiler(void) {
+        return m_renderer.profiler();
+    }
+
+    /*!
+     * \brief Names of the rendering modes.
+     */
+    std::vector<QString> modes(void) const {
+        return m_renderer.modes();
+    }
+
+    /*!
+     * \brief Set the transfer function of the alpha blending and MIP modes.
+     */
+    void set_transfer_function(const TransferFunction& transfer_function) {
+        m_renderer.set_transfer_function(transfer_function);
+    }
+
+    static std::vector<QMatrix4x4> turntable(const int frames, const float elevation, const float distance);
+    static std::vector<QMatrix4x4> read_camera_path(const QString& filename);
+
+private:
+    /*!
+     * \brief Frame being read back into a pixel buffer.
+     */
+    struct Readback {
+        GLuint buffer {0};  /*!< Pixel buffer object. */
+        QString filename;   /*!< Destination of the image, empty if the buffer is free. */
+    };
+
+    QSize m_size;                       /*!< Size of the images, in pixels. */
+    const int m_samples;                /*!< Jittered frames accumulated for each image. */
+    const int m_streamingPasses = 64;   /*!< Maximum frames rendered to stream in the bricks of a view. */
+    const int m_maxPendingWrites;       /*!< Images being encoded before rendering waits for them. */
+
+    QOffscreenSurface m_surface;
+    QOpenGLContext m_context;
+    RayCastRenderer m_renderer;
+    std::unique_ptr<QOpenGLFramebufferObject> m_fbo; /*!< Floating point render target. */
+    std::unique_ptr<QOpenGLFramebufferObject> m_partialFbo; /*!< Colour and key targets of partial images, created when first used. */
+
+    Readback m_readbacks[2];              /*!< Pixel buffers, used alternately. */
+    int m_nextReadback = 0;               /*!< Pixel buffer for the next frame. */
+    std::vector<QFuture<bool>> m_writes;  /*!< Images being encoded and written. */
+    std::vector<QString> m_writeNames;    /*!< Destination of each pending write. */
+    QStringList m_failed;                 /*!< Images that could not be written. */
+
+    void create_target(void);
+    void write_pending(void);
+    void write(Readback& readback);
+    void wait_writes(const size_t pending);
+};
@@ -0,0 +1,298 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <iostream>
+
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QTextStream>
+
+#if defined(Q_OS_WIN)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "batchrenderer.h"
+#include "phantom.h"
+
+/*!
+ * \brief Names of the voxel formats, in the order of `VoxelFormat`.
+ */
+static const QStringList format_names {"automatic", "uint8", "uint16", "float16", "float32", "rgtc1"};
+
+
+/*!
+ * \brief Peak resident memory of the process so far, in MiB.
+ */
+static double peak_memory(void)
+{
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize / 1048576.0 : 0.0;
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(Q_OS_MACOS)
+    return usage.ru_maxrss / 1048576.0;
+#else
+    return usage.ru_maxrss / 1024.0;
+#endif
+#endif
+}
+
+
+/*!
+ * \brief Split a comma separated option.
+ */
+static QStringList list(const QCommandLineParser& parser, const QCommandLineOption& option)
+{
+    return parser.value(option).split(',', QString::SkipEmptyParts);
+}
+
+
+/*!
+ * \brief Benchmark the rendering of synthetic volumes.
+ *
+ * Each phantom is generated once at each size (and kept in the data
+ * directory), loaded in each voxel format, and rendered in each mode along a
+ * fixed orbit for each resolution and step length. A CSV row is written for
+ * each configuration.
+ */
+int main(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QGuiApplication a(argc, argv);
+    QGuiApplication::setApplicationName("3d_raycaster_benchmark");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmark the raycaster on synthetic volumes.");
+    parser.addHelpOption();
+    QStringList phantom_list;
+    for (const auto& name : phantom_names()) {
+        phantom_list << QString::fromStdString(name);
+    }
+    const QCommandLineOption phantoms_option("phantoms", "Phantoms, among " + phantom_list.join(',') + ".", "list", phantom_list.join(','));
+    const QCommandLineOption sizes_option("sizes", "Side of the volumes, in voxels.", "list", "128,256,512");
+    const QCommandLineOption formats_option("formats", "Voxel formats, among " + format_names.join(',') + ".", "list", "automatic");
+    const QCommandLineOption resolutions_option("resolutions", "Image sizes.", "list", "512x512,1920x1080");
+    const QCommandLineOption steps_option("steps", "Ray marching steps, as a fraction of the ray length.", "list", "0.01,0.0025");
+    const QCommandLineOption mode_option({"m", "mode"}, "Rendering mode, can be repeated (default: all).", "mode");
+    const QCommandLineOption frames_option({"n", "frames"}, "Frames of the orbit, for each configuration.", "count", "36");
+    const QCommandLineOption warmup_option("warmup", "Frames rendered before timing each configuration.", "count", "4");
+    const QCommandLineOption threshold_option("threshold", "Isosurface threshold, as a fraction of the intensity range.", "value", "0.3");
+    const QCommandLineOption ablation_option("ablation", "Also run each configuration without empty space skipping, without level of detail, with a fixed step, and without pre-integration.");
+    const QCommandLineOption bricked_option("bricked", "Stream the volumes in bricks.");
+    const QCommandLineOption cache_option("cache", "Load the volumes from the binary cache, when up to date.");
+    const QCommandLineOption data_option("data", "Directory of the generated volumes.", "directory",
+                                         QDir::temp().filePath("3d_raycaster_benchmark"));
+    const QCommandLineOption output_option({"o", "output"}, "CSV file of the results (default: standard output).", "file");
+    parser.addOptions({phantoms_option, sizes_option, formats_option, resolutions_option, steps_option, mode_option,
+                       frames_option, warmup_option, threshold_option, ablation_option, bricked_option, cache_option,
+                       data_option, output_option});
+    parser.process(a);
+
+    try {
+        // Parse the configurations before starting any long work
+        std::vector<Phantom> phantoms;
+        for (const auto& name : list(parser, phantoms_option)) {
+            phantoms.push_back(parse_phantom(name.toStdString()));
+        }
+        std::vector<size_t> sizes;
+        for (const auto& side : list(parser, sizes_option)) {
+            if (side.toInt() <= 0) {
+                throw std::runtime_error("Invalid volume size " + side.toStdString() + ".");
+            }
+            sizes.push_back(side.toInt());
+        }
+        std::vector<VoxelFormat> formats;
+        for (const auto& name : list(parser, formats_option)) {
+            if (!format_names.contains(name)) {
+                throw std::runtime_error("Unknown format " + name.toStdString() + ".");
+            }
+            formats.push_back(static_cast<VoxelFormat>(format_names.indexOf(name)));
+        }
+        std::vector<QSize> resolutions;
+        for (const auto& resolution : list(parser, resolutions_option)) {
+            const QStringList size = resolution.split('x');
+            if (size.size() != 2 || size[0].toInt() <= 0 || size[1].toInt() <= 0) {
+                throw std::runtime_error("Invalid resolution " + resolution.toStdString() + ".");
+            }
+            resolutions.emplace_back(size[0].toInt(), size[1].toInt());
+        }
+        std::vector<float> steps;
+        for (const auto& step : list(parser, steps_option)) {
+            if (step.toFloat() <= 0.0f) {
+                throw std::runtime_error("Invalid step length " + step.toStdString() + ".");
+            }
+            steps.push_back(step.toFloat());
+        }
+        if (phantoms.empty() || sizes.empty() || formats.empty() || resolutions.empty() || steps.empty()) {
+            parser.showHelp(1);
+        }
+
+        BatchRenderer renderer(resolutions.front());
+        FrameProfiler& profiler = renderer.profiler();
+        profiler.set_enabled(true);
+
+        QStringList modes = parser.values(mode_option);
+        if (modes.isEmpty()) {
+            for (const auto& mode : renderer.modes()) {
+                modes << mode;
+            }
+        }
+        for (const auto& mode : modes) {
+            if (std::find(renderer.modes().begin(), renderer.modes().end(), mode) == renderer.modes().end()) {
+                throw std::runtime_error("Unknown mode " + mode.toStdString() + ".");
+            }
+        }
+
+        // Feature toggles of each run: all enabled, then each one disabled
+        struct Variant {
+            bool skip_empty_space;
+            bool level_of_detail;
+            bool adaptive_step;
+            bool preintegrated;
+        };
+        std::vector<Variant> variants {{true, true, true, true}};
+        if (parser.isSet(ablation_option)) {
+            variants.push_back({false, true, true, true});
+            variants.push_back({true, false, true, true});
+            variants.push_back({true, true, false, true});
+            variants.push_back({true, true, true, false});
+        }
+
+        const std::vector<QMatrix4x4> orbit = BatchRenderer::turntable(std::max(parser.value(frames_option).toInt(), 1), 20.0f, 3.0f);
+        const int warmup = std::max(parser.value(warmup_option).toInt(), 0);
+
+        QFile output_file;
+        if (parser.isSet(output_option)) {
+            output_file.setFileName(parser.value(output_option));
+            if (!output_file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+                throw std::runtime_error("Cannot write " + parser.value(output_option).toStdString() + ".");
+            }
+        }
+        else {
+            output_file.open(stdout, QIODevice::WriteOnly | QIODevice::Text);
+        }
+        QTextStream output(&output_file);
+        output << "# " << profiler.renderer_info() << "\n"
+               << "phantom,side,format,bricked,mode,width,height,step_length,skip_empty_space,level_of_detail,adaptive_step,preintegrated,"
+               << "frames,fps,ms_per_frame,gpu_ms,load_ms,psnr,peak_memory_mib\n";
+
+        const QDir data(parser.value(data_option));
+        if (!data.mkpath(".")) {
+            throw std::runtime_error("Cannot create data directory.");
+        }
+
+        for (const auto phantom : phantoms) {
+            const QString phantom_name = QString::fromStdString(phantom_names()[static_cast<size_t>(phantom)]);
+            for (const auto side : sizes) {
+                // The phantoms are deterministic, so they are generated only once
+                const QString filename = data.filePath(QString("%1_%2.nrrd").arg(phantom_name).arg(side));
+                if (!QFileInfo::exists(filename)) {
+                    std::cerr << "Generating " << filename.toStdString() << std::endl;
+                    write_phantom(filename.toStdString(), phantom, side);
+                }
+
+                for (const auto format : formats) {
+                    VolumeOptions options;
+                    options.format = format;
+                    options.bricked = parser.isSet(bricked_option);
+                    options.cache = parser.isSet(cache_option);
+
+                    QElapsedTimer timer;
+                    timer.start();
+                    std::shared_ptr<const PreparedVolume> volume = RayCastVolume::prepare_volume(filename, options);
+                    const bool bricked = static_cast<bool>(volume->bricks);
+                    const QString format_name = bricked ? "uint8" : format_names[static_cast<int>(volume->format)];
+                    const double psnr = volume->psnr;
+                    renderer.load(std::move(volume));
+                    renderer.wait();
+                    const double load_time = timer.nsecsElapsed() / 1e6;
+
+                    for (const auto& resolution : resolutions) {
+                        renderer.resize(resolution);
+                        for (const auto& mode : modes) {
+                            for (const auto step : steps) {
+                                for (const auto& variant : variants) {
+                                    RenderParameters parameters;
+                                    parameters.mode = mode;
+                                    parameters.step_length = step;
+                                    parameters.threshold = parser.value(threshold_option).toFloat();
+                                    parameters.skip_empty_space = variant.skip_empty_space;
+                                    parameters.proxy_geometry = variant.skip_empty_space;
+                                    parameters.level_of_detail = variant.level_of_detail;
+                                    parameters.adaptive_step = variant.adaptive_step;
+                                    parameters.preintegrated = variant.preintegrated;
+
+                                    for (int frame = 0; frame < warmup; ++frame) {
+                                        parameters.view = orbit[frame % orbit.size()];
+                                        renderer.draw(parameters);
+                                    }
+                                    renderer.wait();
+                                    profiler.reset();
+
+                                    timer.restart();
+                                    for (const auto& view : orbit) {
+                                        parameters.view = view;
+                                        profiler.begin_frame();
+                                        renderer.draw(parameters);
+                                        profiler.end_frame();
+                                    }
+                                    renderer.wait();
+                                    const double elapsed = timer.nsecsElapsed() / 1e6;
+                                    profiler.flush();
+                                    const FrameStats stats = profiler.average();
+
+                                    output << phantom_name << "," << side << "," << format_name << ","
+                                           << bricked << "," << mode << ","
+                                           << resolution.width() << "," << resolution.height() << ","
+                                           << step << "," << variant.skip_empty_space << "," << variant.level_of_detail << "," << variant.adaptive_step << "," << variant.preintegrated << ","
+                                           << orbit.size() << "," << 1000.0 * orbit.size() / elapsed << ","
+                                           << elapsed / orbit.size() << ","
+                                           << (stats.gpu_ms >= 0.0 ? QString::number(stats.gpu_ms) : QString()) << ","
+                                           << load_time << "," << psnr << "," << peak_memory() << "\n";
+                                    output.flush();
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+
+#include "brickedvolume.h"
+
+
+/*!
+ * \brief Split a volume in bricks.
+ * \param volume Volume, not normalised, preferably still mapped from its file.
+ * \param brick_size Side of each brick, in voxels. Must be a power of two.
+ * \param coarse_limit Maximum side of the coarse level, in voxels.
+ *
+ * Each coarse voxel averages a cube of voxels, whose side is the smallest
+ * power of two (up to the brick size) that keeps the coarse level within
+ * `coarse_limit` voxels per side. Since the side divides the brick size, the
+ * coarse level is filled brick by brick, with a single pass over the volume.
+ */
+BrickedVolume::BrickedVolume(std::unique_ptr<Volume> volume, const size_t brick_size, const size_t coarse_limit)
+    : m_volume {std::move(volume)}
+    , m_brick_size {brick_size}
+{
+    // Bricks are read in any order
+    m_volume->inflate_payload();
+
+    const size_t width = std::get<0>(m_volume->size());
+    const size_t height = std::get<1>(m_volume->size());
+    const size_t depth = std::get<2>(m_volume->size());
+    const size_t grid_width = (width + brick_size - 1) / brick_size;
+    const size_t grid_height = (height + brick_size - 1) / brick_size;
+    const size_t grid_depth = (depth + brick_size - 1) / brick_size;
+
+    size_t factor = 1;
+    while (factor < brick_size && (std::max({width, height, depth}) + factor - 1) / factor > coarse_limit) {
+        factor *= 2;
+    }
+    const size_t coarse_width = (width + factor - 1) / factor;
+    const size_t coarse_height = (height + factor - 1) / factor;
+    const size_t coarse_depth = (depth + factor - 1) / factor;
+    const size_t coarse_bricks = brick_size / factor;
+    m_coarse_size = {coarse_width, coarse_height, coarse_depth};
+    m_coarse.resize(coarse_width * coarse_height * coarse_depth);
+
+    const size_t bricks = grid_width * grid_height * grid_depth;
+    std::vector<unsigned char> ranges(2 * bricks);
+    const size_t side = page_size();
+
+    #pragma omp parallel
+    {
+        std::vector<unsigned char> page(page_bytes());
+
+        #pragma omp for schedule(dynamic)
+        for (std::ptrdiff_t b = 0; b < static_cast<std::ptrdiff_t>(bricks); ++b) {
+            read_page(b, page.data());
+
+            // Range over the page, so it includes the apron
+            const auto [minimum, maximum] = std::minmax_element(page.begin(), page.end());
+            ranges[2 * b] = *minimum;
+            ranges[2 * b + 1] = *maximum;
+
+            // Average the coarse voxels falling inside the brick
+            const size_t i = b % grid_width;
+            const size_t j = (b / grid_width) % grid_height;
+            const size_t k = b / (grid_width * grid_height);
+            for (size_t cz = k * coarse_bricks; cz < std::min((k + 1) * coarse_bricks, coarse_depth); ++cz) {
+                for (size_t cy = j * coarse_bricks; cy < std::min((j + 1) * coarse_bricks, coarse_height); ++cy) {
+                    for (size_t cx = i * coarse_bricks; cx < std::min((i + 1) * coarse_bricks, coarse_width); ++cx) {
+                        size_t sum = 0;
+                        size_t count = 0;
+                        for (size_t z = cz * factor; z < std::min((cz + 1) * factor, depth); ++z) {
+                            for (size_t y = cy * factor; y < std::min((cy + 1) * factor, height); ++y) {
+                                const unsigned char *row = page.data() + ((z - k * brick_size + 1) * side + (y - j * brick_size + 1)) * side;
+                                for (size_t x = cx * factor; x < std::min((cx + 1) * factor, width); ++x) {
+                                    sum += row[x - i * brick_size + 1];
+                                    ++count;
+                                }
+                            }
+                        }
+                        m_coarse[(cz * coarse_height + cy) * coarse_width + cx] = static_cast<unsigned char>((sum + count / 2) / count);
+                    }
+                }
+            }
+        }
+    }
+
+    m_occupancy = OccupancyGrid(std::move(ranges), grid_width, grid_height, grid_depth, brick_size);
+}
+
+
+/*!
+ * \brief Read the page of a brick.
+ * \param brick Index of the brick, with x varying fastest.
+ * \param dst Output buffer, holding `page_bytes()` elements.
+ *
+ * This function can be called concurrently from multiple threads.
+ */
+void BrickedVolume::read_page(const size_t brick, unsigned char *dst) const
+{
+    const size_t grid_width = (std::get<0>(m_volume->size()) + m_brick_size - 1) / m_brick_size;
+    const size_t grid_height = (std::get<1>(m_volume->size()) + m_brick_size - 1) / m_brick_size;
+    const std::ptrdiff_t i = brick % grid_width;
+    const std::ptrdiff_t j = (brick / grid_width) % grid_height;
+    const std::ptrdiff_t k = brick / (grid_width * grid_height);
+    const std::ptrdiff_t b = m_brick_size;
+
+    m_volume->read_brick(i * b - 1, j * b - 1, k * b - 1, page_size(), dst);
+}
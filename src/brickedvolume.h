@@ -0,0 +1,122 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "occupancygrid.h"
+#include "volume.h"
+
+
+/*!
+ * \brief Volume split in bricks, read on demand from its file.
+ *
+ * The voxels stay in the file, and each brick is normalised to [0, 255] only
+ * when requested. A page holds a brick together with a one voxel apron taken
+ * from its neighbours, so trilinear interpolation within a page matches
+ * interpolation in the whole volume.
+ *
+ * On construction the volume is scanned once, to find the intensity range of
+ * each brick and to build a coarse level of detail, which is rendered where
+ * the bricks are not resident on the GPU.
+ */
+class BrickedVolume {
+
+public:
+
+    /*!
+     * \brief Split a volume in bricks.
+     * \param volume Volume, not normalised, preferably still mapped from its file.
+     * \param brick_size Side of each brick, in voxels. Must be a power of two.
+     * \param coarse_limit Maximum side of the coarse level, in voxels.
+     */
+    BrickedVolume(std::unique_ptr<Volume> volume, const size_t brick_size, const size_t coarse_limit);
+
+    /*!
+     * \brief Side of each brick, in voxels.
+     */
+    size_t brick_size(void) const {
+        return m_brick_size;
+    }
+
+    /*!
+     * \brief Side of each page, in voxels, including the apron.
+     */
+    size_t page_size(void) const {
+        return m_brick_size + 2;
+    }
+
+    /*!
+     * \brief Size of each page, in bytes.
+     */
+    size_t page_bytes(void) const {
+        return page_size() * page_size() * page_size();
+    }
+
+    /*!
+     * \brief Number of bricks.
+     */
+    size_t brick_count(void) const {
+        return m_occupancy.width() * m_occupancy.height() * m_occupancy.depth();
+    }
+
+    /*!
+     * \brief Intensity range of each brick, which also defines the brick grid.
+     */
+    const OccupancyGrid& occupancy(void) const {
+        return m_occupancy;
+    }
+
+    /*!
+     * \brief Voxels of the coarse level, normalised to [0, 255].
+     */
+    const std::vector<unsigned char>& coarse(void) const {
+        return m_coarse;
+    }
+
+    /*!
+     * \brief Number of voxels of the coarse level for each axis.
+     */
+    std::tuple<size_t, size_t, size_t> coarse_size(void) const {
+        return m_coarse_size;
+    }
+
+    /*!
+     * \brief The underlying volume.
+     */
+    const Volume& volume(void) const {
+        return *m_volume;
+    }
+
+    void read_page(const size_t brick, unsigned char *dst) const;
+
+private:
+    std::unique_ptr<Volume> m_volume;              /*!< Source of the voxels. */
+    size_t m_brick_size;                              /*!< Side of each brick, in voxels. */
+    OccupancyGrid m_occupancy;                        /*!< Intensity range of each brick. */
+    std::vector<unsigned char> m_coarse;              /*!< Coarse level of detail. */
+    std::tuple<size_t, size_t, size_t> m_coarse_size; /*!< Number of voxels of the coarse level. */
+};
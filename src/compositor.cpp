@@ -0,0 +1,221 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+
+#include "compositor.h"
+
+
+/*!
+ * \brief Layout version of the partial image files.
+ */
+static constexpr uint32_t partial_version = 1;
+
+/*!
+ * \brief Value written to detect files of a different byte order.
+ */
+static constexpr uint32_t byte_order_tag = 0x01020304;
+
+/*!
+ * \brief Header at the start of a partial image file.
+ */
+struct PartialHeader {
+    char magic[8];       /*!< Always "RCVPARTL". */
+    uint32_t version;    /*!< Layout version. */
+    uint32_t byte_order; /*!< `byte_order_tag`, in the byte order of the writer. */
+    int32_t width;       /*!< In pixels. */
+    int32_t height;      /*!< In pixels. */
+    uint32_t op;         /*!< `CompositeOperator` of the partial. */
+    int32_t rank;        /*!< Position in the visibility order. */
+    uint64_t key_size;   /*!< Number of keys, zero or one per pixel. */
+};
+
+static_assert(std::is_trivially_copyable<PartialHeader>::value, "The partial header is written as raw bytes");
+
+static const char partial_magic[8] = {'R', 'C', 'V', 'P', 'A', 'R', 'T', 'L'};
+
+
+/*!
+ * \brief Allocate a transparent partial image.
+ * \param width Width, in pixels.
+ * \param height Height, in pixels.
+ * \param op Operator combining the partial with the others.
+ * \param rank Position in the visibility order, front first.
+ */
+PartialImage::PartialImage(const int width, const int height, const CompositeOperator op, const int rank)
+    : width {width}
+    , height {height}
+    , op {op}
+    , rank {rank}
+    , rgba(4 * static_cast<size_t>(width) * height, 0.0f)
+    , key(CompositeOperator::Over == op ? 0 : static_cast<size_t>(width) * height, empty_key(op))
+{
+}
+
+
+/*!
+ * \brief Composite the partial images of a frame.
+ * \param partials Partials of the same size and operator, in any order.
+ * \param opacity_cutoff Opacity after which the partials behind a pixel are
+ *                       ignored by `CompositeOperator::Over`, as the rays
+ *                       of a single node are terminated.
+ * \return The composited image, with rank zero and an empty key.
+ *
+ * The partials are ordered by rank, and each thread composites a strip of
+ * rows from all of them, so the exchange is a direct send of the strips.
+ * Throws `std::runtime_error` if the partials do not match.
+ */
+PartialImage composite(const std::vector<PartialImage>& partials, const float opacity_cutoff)
+{
+    if (partials.empty()) {
+        throw std::runtime_error("No partial images to composite.");
+    }
+
+    std::vector<const PartialImage *> ordered;
+    for (const PartialImage& partial : partials) {
+        if (partial.width != partials[0].width || partial.height != partials[0].height || partial.op != partials[0].op) {
+            throw std::runtime_error("The partial images differ in size or operator.");
+        }
+        if (partial.rgba.size() != 4 * static_cast<size_t>(partial.width) * partial.height
+                || (CompositeOperator::Over != partial.op && partial.key.size() != partial.rgba.size() / 4)) {
+            throw std::runtime_error("Incomplete partial image.");
+        }
+        ordered.push_back(&partial);
+    }
+    std::stable_sort(ordered.begin(), ordered.end(), [](const PartialImage *a, const PartialImage *b) {
+        return a->rank < b->rank;
+    });
+
+    const CompositeOperator op = partials[0].op;
+    PartialImage result(partials[0].width, partials[0].height, CompositeOperator::Over);
+    const int64_t pixels = static_cast<int64_t>(result.width) * result.height;
+
+    #pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < pixels; ++i) {
+        float *dst = result.rgba.data() + 4 * i;
+        if (CompositeOperator::Over == op) {
+            for (const PartialImage *partial : ordered) {
+                if (dst[3] >= opacity_cutoff) {
+                    break;
+                }
+                const float *src = partial->rgba.data() + 4 * i;
+                const float transmittance = 1.0f - dst[3];
+                for (int c = 0; c < 4; ++c) {
+                    dst[c] += transmittance * src[c];
+                }
+            }
+        }
+        else {
+            // Ties go to the partial in front
+            const PartialImage *best = nullptr;
+            for (const PartialImage *partial : ordered) {
+                const float key = partial->key[i];
+                if (key == PartialImage::empty_key(op)) {
+                    continue;
+                }
+                if (!best || (CompositeOperator::Nearest == op ? key < best->key[i] : key > best->key[i])) {
+                    best = partial;
+                }
+            }
+            if (best) {
+                std::copy_n(best->rgba.data() + 4 * i, 4, dst);
+            }
+        }
+    }
+    return result;
+}
+
+
+/*!
+ * \brief Write a partial image to file, in native byte order.
+ * \param filename Destination file.
+ * \param partial Partial image.
+ *
+ * Throws `std::runtime_error` if the file cannot be written.
+ */
+void write_partial(const std::string& filename, const PartialImage& partial)
+{
+    PartialHeader header {};
+    std::memcpy(header.magic, partial_magic, sizeof(partial_magic));
+    header.version = partial_version;
+    header.byte_order = byte_order_tag;
+    header.width = partial.width;
+    header.height = partial.height;
+    header.op = static_cast<uint32_t>(partial.op);
+    header.rank = partial.rank;
+    header.key_size = partial.key.size();
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        throw std::runtime_error("Cannot create partial image file " + filename + ".");
+    }
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(partial.rgba.data()), partial.rgba.size() * sizeof(float));
+    file.write(reinterpret_cast<const char *>(partial.key.data()), partial.key.size() * sizeof(float));
+    if (!file.flush()) {
+        throw std::runtime_error("Cannot write partial image file " + filename + ".");
+    }
+}
+
+
+/*!
+ * \brief Read a partial image written by `write_partial`.
+ * \param filename Source file.
+ * \return The partial image.
+ *
+ * Throws `std::runtime_error` if the file cannot be read or it is not a
+ * partial image written on a machine with the same byte order.
+ */
+PartialImage read_partial(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Cannot open partial image file " + filename + ".");
+    }
+
+    PartialHeader header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))
+            || std::memcmp(header.magic, partial_magic, sizeof(partial_magic)) != 0
+            || partial_version != header.version
+            || byte_order_tag != header.byte_order
+            || header.width <= 0 || header.height <= 0
+            || header.op > static_cast<uint32_t>(CompositeOperator::Maximum)) {
+        throw std::runtime_error("Invalid partial image file " + filename + ".");
+    }
+
+    PartialImage partial;
+    partial.width = header.width;
+    partial.height = header.height;
+    partial.op = static_cast<CompositeOperator>(header.op);
+    partial.rank = header.rank;
+    partial.rgba.resize(4 * static_cast<size_t>(partial.width) * partial.height);
+    partial.key.resize(header.key_size);
+    if (!file.read(reinterpret_cast<char *>(partial.rgba.data()), partial.rgba.size() * sizeof(float))
+            || !file.read(reinterpret_cast<char *>(partial.key.data()), partial.key.size() * sizeof(float))) {
+        throw std::runtime_error("Truncated partial image file " + filename + ".");
+    }
+    return partial;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+
+/*!
+ * \brief How the partial images of a frame are combined.
+ */
+enum class CompositeOperator : uint32_t {
+    Over,    /*!< Front to back alpha compositing, in visibility order. */
+    Nearest, /*!< The partial closest to the camera, by the depth in the key. */
+    Maximum, /*!< The partial with the largest key (the maximum intensity). */
+};
+
+
+/*!
+ * \brief Image rendered from a part of a volume, to be composited with the others.
+ *
+ * The colour is linear and premultiplied by the opacity, so the background
+ * is blended only once, on the composited image. The key holds what the
+ * operator needs besides the colour: the depth of the surface for
+ * `CompositeOperator::Nearest`, the maximum intensity for
+ * `CompositeOperator::Maximum`; it is empty for `CompositeOperator::Over`.
+ */
+struct PartialImage {
+    int width {0};                                  /*!< In pixels. */
+    int height {0};                                 /*!< In pixels. */
+    CompositeOperator op {CompositeOperator::Over}; /*!< Operator combining this partial with the others. */
+    int rank {0};                                   /*!< Position in the visibility order, front first. */
+    std::vector<float> rgba;                        /*!< Premultiplied linear colour, rows from the bottom. */
+    std::vector<float> key;                         /*!< One value per pixel, as required by the operator. */
+
+    PartialImage(void) = default;
+    PartialImage(const int width, const int height, const CompositeOperator op, const int rank = 0);
+
+    /*!
+     * \brief Key of a pixel where nothing was rendered.
+     */
+    static float empty_key(const CompositeOperator op) {
+        return CompositeOperator::Maximum == op ? std::numeric_limits<float>::lowest()
+                                                : std::numeric_limits<float>::max();
+    }
+};
+
+
+PartialImage composite(const std::vector<PartialImage>& partials, const float opacity_cutoff = 1.0f);
+void write_partial(const std::string& filename, const PartialImage& partial);
+PartialImage read_partial(const std::string& filename);
@@ -0,0 +1,942 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include <QtMath>
+
+#include "cpuraycaster.h"
+
+
+/*!
+ * \brief Reciprocal of a step component, finite even for a zero component.
+ *
+ * Release builds assume finite math, so the infinities the shaders rely on
+ * are replaced by a large value.
+ */
+static inline float safe_reciprocal(const float x)
+{
+    constexpr float tiny = 1e-20f;
+    return 1.0f / (std::abs(x) > tiny ? x : std::copysign(tiny, x));
+}
+
+
+/*!
+ * \brief Jitter of the ray through a pixel, in [0, 1].
+ *
+ * A hash of the pixel, quantised to bytes as the jitter texture of the
+ * shaders, so images are reproducible.
+ */
+static inline float pixel_jitter(const int x, const int y)
+{
+    uint32_t h = static_cast<uint32_t>(x) * 0x8da6b343u ^ static_cast<uint32_t>(y) * 0xd8163841u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    return (h & 0xff) / 255.0f;
+}
+
+
+/*!
+ * \brief Colour written to the image, after gamma correction.
+ */
+static inline float gamma_correction(const float linear, const float gamma)
+{
+    return std::pow(std::max(linear, 0.0f), 1.0f / gamma);
+}
+
+
+/*!
+ * \brief Constructor, without a volume.
+ */
+CpuRayCaster::CpuRayCaster(void)
+{
+    m_transferTable = m_transferFunction.table(transfer_table_size);
+    m_opacityRange = TransferFunction::opacity_range(m_transferTable);
+}
+
+
+/*!
+ * \brief Load a prepared volume.
+ * \param volume Volume prepared whole, in any format but `VoxelFormat::Rgtc1`
+ *               (unless it holds a bricked layout).
+ *
+ * The voxels are copied into Z-ordered bricks of 16 bit intensities, or
+ * shared if the volume was prepared with `VolumeOptions::bricked_layout`,
+ * and the occupancy grid of the volume is reused for empty space skipping.
+ * Throws `std::runtime_error` for bricked or compressed volumes.
+ */
+void CpuRayCaster::load(std::shared_ptr<const PreparedVolume> volume)
+{
+    if (volume->bricks || volume->partial() || (!volume->layout && VoxelFormat::Rgtc1 == volume->format)) {
+        throw std::runtime_error("The CPU raycaster needs an uncompressed volume, prepared whole.");
+    }
+
+    if (volume->layout) {
+        // Shared with the prepared volume, already in the right layout
+        m_voxels = volume->layout;
+    }
+    else {
+        m_voxels = RayCastVolume::bricked_layout(*volume);
+    }
+    m_occupancy = volume->occupancy;
+    m_offset = QVector3D(0.0f, 0.0f, 0.0f);
+    m_clipped = false;
+    set_geometry(*volume);
+}
+
+
+/*!
+ * \brief Load a box of a prepared volume, to render partial images of it.
+ * \param volume Volume prepared whole, or only a box of it holding the
+ *               region and its margin, in any format but `VoxelFormat::Rgtc1`.
+ * \param region Box to be rendered, inside the whole volume.
+ *
+ * Only the box and a margin of `region_margin` voxels around it are copied,
+ * and the occupancy grid is built for them, while the camera geometry is
+ * still the one of the whole volume.
+ * Throws `std::runtime_error` for bricked or compressed volumes, and for
+ * boxes of a volume not holding the region.
+ */
+void CpuRayCaster::load(std::shared_ptr<const PreparedVolume> volume, const VoxelRegion& region)
+{
+    if (volume->bricks || VoxelFormat::Rgtc1 == volume->format) {
+        throw std::runtime_error("The CPU raycaster needs an uncompressed volume.");
+    }
+
+    const QVector3D volume_size = volume->volume_size();
+    const std::array<size_t, 3> size {static_cast<size_t>(volume_size.x()),
+                                      static_cast<size_t>(volume_size.y()),
+                                      static_cast<size_t>(volume_size.z())};
+    const VoxelRegion copied = region.grown(region_margin, size);
+
+    // The voxels held start at the offset of the box read, if not the whole volume
+    VoxelRegion held = copied;
+    for (int axis = 0; axis < 3; ++axis) {
+        const size_t first = static_cast<size_t>(volume->box_offset[axis]);
+        if (copied.offset[axis] < first || copied.offset[axis] + copied.size[axis] > first + static_cast<size_t>(volume->size[axis])) {
+            throw std::runtime_error("The box to be rendered is not held by the volume.");
+        }
+        held.offset[axis] -= first;
+    }
+    m_voxels = RayCastVolume::bricked_layout(*volume, held);
+    m_occupancy = OccupancyGrid(*m_voxels, volume->occupancy.brick_size());
+    m_offset = QVector3D(copied.offset[0], copied.offset[1], copied.offset[2]);
+    set_geometry(*volume);
+
+    // Faces on the boundary of the volume are moved away, so they never clip
+    m_clipped = true;
+    for (int axis = 0; axis < 3; ++axis) {
+        const size_t end = region.offset[axis] + region.size[axis];
+        m_clipBottom[axis] = region.offset[axis] > 0 ? static_cast<float>(region.offset[axis]) / size[axis] : -1.0f;
+        m_clipTop[axis] = end < size[axis] ? static_cast<float>(end) / size[axis] : 2.0f;
+    }
+}
+
+
+/*!
+ * \brief Set the size and the box of the volume, as in RayCastVolume.
+ */
+void CpuRayCaster::set_geometry(const PreparedVolume& volume)
+{
+    m_size = volume.volume_size();
+    m_range = volume.range;
+    QVector3D extent = m_size * volume.spacing;
+    extent /= std::max({extent.x(), extent.y(), extent.z()});
+    m_top = extent / 2.0f;
+    m_bottom = -extent / 2.0f;
+    m_modelMatrix.setToIdentity();
+    m_modelMatrix.scale(0.5f * extent);
+}
+
+
+/*!
+ * \brief Set the transfer function of the alpha blending and MIP modes.
+ * \param transfer_function New transfer function.
+ */
+void CpuRayCaster::set_transfer_function(const TransferFunction& transfer_function)
+{
+    if (transfer_function != m_transferFunction) {
+        m_transferFunction = transfer_function;
+        m_transferTable = m_transferFunction.table(transfer_table_size);
+        m_opacityRange = TransferFunction::opacity_range(m_transferTable);
+        m_preintegrated.clear();
+    }
+}
+
+
+/*!
+ * \brief Render an image.
+ * \param parameters Parameters of the frame, as for `RayCastRenderer::render`.
+ * \param size Size of the image, in pixels.
+ * \param samples Jittered frames averaged, with the jitter offsets of the batch renderer.
+ * \return The image, with the origin at the top left.
+ *
+ * Throws `std::runtime_error` if no volume is loaded or the mode is unknown.
+ */
+QImage CpuRayCaster::render(const RenderParameters& parameters, const QSize& size, const int samples)
+{
+    std::vector<float> sum;
+    RenderParameters sample_parameters = parameters;
+    for (int sample = 0; sample < std::max(samples, 1); ++sample) {
+        sample_parameters.jitter_offset = jitter_offset(parameters, sample);
+        accumulate(render_partial(sample_parameters, size), parameters.background, sum);
+    }
+    return resolve(sum, size, std::max(samples, 1));
+}
+
+
+/*!
+ * \brief Render a partial image of the loaded volume or box, for a single jitter offset.
+ * \param parameters Parameters of the frame, as for `RayCastRenderer::render`.
+ * \param size Size of the image, in pixels.
+ * \return The partial image, with rank zero: `CompositeOperator::Nearest`
+ *         for isosurfaces, `CompositeOperator::Over` for alpha blending,
+ *         `CompositeOperator::Maximum` for MIP.
+ *
+ * The background colour of the parameters is ignored, and blended by
+ * `accumulate`. Throws `std::runtime_error` if no volume is loaded or the
+ * mode is unknown.
+ */
+PartialImage CpuRayCaster::render_partial(const RenderParameters& parameters, const QSize& size)
+{
+    if (!m_voxels) {
+        throw std::runtime_error("No volume loaded.");
+    }
+
+    Frame frame;
+    CompositeOperator op;
+    if ("Isosurface" == parameters.mode) {
+        frame.mode = Mode::Isosurface;
+        op = CompositeOperator::Nearest;
+    }
+    else if ("Alpha blending" == parameters.mode) {
+        frame.mode = Mode::AlphaBlending;
+        op = CompositeOperator::Over;
+    }
+    else if ("MIP" == parameters.mode) {
+        frame.mode = Mode::MaximumIntensityProjection;
+        op = CompositeOperator::Maximum;
+    }
+    else {
+        throw std::runtime_error("Unknown mode " + parameters.mode.toStdString() + ".");
+    }
+
+    frame.width = size.width();
+    frame.height = size.height();
+    frame.view = parameters.view;
+    frame.normal_matrix = (parameters.view * m_modelMatrix).normalMatrix();
+    frame.ray_origin = parameters.view.inverted() * QVector3D(0.0f, 0.0f, 0.0f);
+    frame.aspect_ratio = static_cast<float>(size.width()) / size.height();
+    frame.focal_length = 1.0 / qTan(M_PI / 180.0 * parameters.fov / 2.0);
+    frame.step_length = parameters.step_length;
+    frame.threshold = parameters.threshold;
+    frame.jitter_offset = parameters.jitter_offset;
+    frame.material_colour = parameters.material_colour;
+    frame.light_position = parameters.light_position;
+    frame.window_low = parameters.window.x();
+    frame.window_high = parameters.window.y();
+    frame.opacity_cutoff = parameters.opacity_cutoff;
+    frame.skip_empty_space = parameters.skip_empty_space;
+    frame.adaptive_step = parameters.adaptive_step;
+    frame.preintegrated = parameters.preintegrated;
+
+    if (frame.preintegrated && m_preintegrated.empty()) {
+        m_preintegrated = m_transferFunction.preintegrated(transfer_table_size);
+    }
+
+    // Tiles take very different times, so they are handed out dynamically
+    PartialImage image(frame.width, frame.height, op);
+    const int tiles_x = (frame.width + tile_size - 1) / tile_size;
+    const int tiles_y = (frame.height + tile_size - 1) / tile_size;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int tile = 0; tile < tiles_x * tiles_y; ++tile) {
+        trace_tile(frame, (tile % tiles_x) * tile_size, (tile / tiles_x) * tile_size, image);
+    }
+    return image;
+}
+
+
+/*!
+ * \brief Position of the camera, in voxels of the volume.
+ * \param view View matrix of the frame.
+ *
+ * The texture coordinates scaled by the size of the volume, as
+ * `VolumePartition::visibility_order` expects.
+ */
+QVector3D CpuRayCaster::camera_voxel(const QMatrix4x4& view) const
+{
+    const QVector3D eye = view.inverted() * QVector3D(0.0f, 0.0f, 0.0f);
+    return (eye - m_bottom) / (m_top - m_bottom) * m_size;
+}
+
+
+/*!
+ * \brief Jitter offset of a frame averaged by `render`.
+ * \param parameters Parameters of the frame, holding the offset of the first sample.
+ * \param sample Index of the frame.
+ */
+float CpuRayCaster::jitter_offset(const RenderParameters& parameters, const int sample)
+{
+    return sample > 0 ? std::fmod(0.618034f * sample, 1.0f) : parameters.jitter_offset;
+}
+
+
+/*!
+ * \brief Add a composited image to a sum of frames, over a background.
+ * \param image Image, with premultiplied linear colours (see `render_partial` and `composite`).
+ * \param background Background colour.
+ * \param sum Sums of the colours after gamma correction, rows from the bottom,
+ *            allocated on the first frame.
+ */
+void CpuRayCaster::accumulate(const PartialImage& image, const QColor& background, std::vector<float>& sum)
+{
+    const int64_t pixels = static_cast<int64_t>(image.width) * image.height;
+    sum.resize(3 * pixels, 0.0f);
+    const float linear[3] {std::pow(static_cast<float>(background.redF()), gamma),
+                           std::pow(static_cast<float>(background.greenF()), gamma),
+                           std::pow(static_cast<float>(background.blueF()), gamma)};
+
+    #pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < pixels; ++i) {
+        const float *src = image.rgba.data() + 4 * i;
+        const float transmittance = 1.0f - src[3];
+        for (int c = 0; c < 3; ++c) {
+            sum[3 * i + c] += gamma_correction(src[c] + transmittance * linear[c], gamma);
+        }
+    }
+}
+
+
+/*!
+ * \brief Image of the average of the frames summed by `accumulate`.
+ * \param sum Sums of the colours.
+ * \param size Size of the image, in pixels.
+ * \param samples Number of frames summed.
+ * \return The image, with the origin at the top left.
+ */
+QImage CpuRayCaster::resolve(const std::vector<float>& sum, const QSize& size, const int samples)
+{
+    // Rows are traced from the bottom, as window coordinates
+    QImage result(size, QImage::Format_RGB32);
+    const int width = size.width();
+    const int height = size.height();
+    const float scale = 1.0f / samples;
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < height; ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(result.scanLine(height - 1 - y));
+        const float *row = sum.data() + 3 * static_cast<size_t>(y) * width;
+        for (int x = 0; x < width; ++x) {
+            const auto channel = [&](const int c) {
+                return static_cast<int>(std::clamp(row[3 * x + c] * scale, 0.0f, 1.0f) * 255.0f + 0.5f);
+            };
+            line[x] = qRgb(channel(0), channel(1), channel(2));
+        }
+    }
+    return result;
+}
+
+
+/*!
+ * \brief Trace the rays of a tile.
+ * \param frame Values of the frame.
+ * \param x0 First pixel of the tile along x.
+ * \param y0 First pixel of the tile along y, from the bottom.
+ * \param image Partial image, written for the pixels of the tile.
+ */
+void CpuRayCaster::trace_tile(const Frame& frame, const int x0, const int y0, PartialImage& image) const
+{
+    const int x1 = std::min(x0 + tile_size, frame.width);
+    const int y1 = std::min(y0 + tile_size, frame.height);
+
+    for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; x += packet_size) {
+            const int lanes = std::min(packet_size, x1 - x);
+            float rgba[4 * packet_size];
+            float key[packet_size];
+            trace_packet(frame, x, y, lanes, rgba, key);
+
+            const size_t pixel = static_cast<size_t>(y) * frame.width + x;
+            std::copy_n(rgba, 4 * lanes, image.rgba.data() + 4 * pixel);
+            if (!image.key.empty()) {
+                std::copy_n(key, lanes, image.key.data() + pixel);
+            }
+        }
+    }
+}
+
+
+/*!
+ * \brief Trace a packet of rays, along a row of pixels.
+ * \param frame Values of the frame.
+ * \param x First pixel of the packet.
+ * \param y Row of the packet, from the bottom.
+ * \param lanes Number of pixels in the packet, up to `packet_size`.
+ * \param rgba Output premultiplied linear colour of each pixel.
+ * \param key Output compositing key of each pixel (see `PartialImage`).
+ */
+void CpuRayCaster::trace_packet(const Frame& frame, const int x, const int y, const int lanes, float *rgba, float *key) const
+{
+    Packet packet;
+    packet.ray_step = frame.step_length;
+    QVector3D ray[packet_size];
+    QVector3D entry[packet_size];
+
+    const float empty_key = PartialImage::empty_key(Mode::Isosurface == frame.mode ? CompositeOperator::Nearest
+                                                                                   : CompositeOperator::Maximum);
+    for (int i = 0; i < packet_size; ++i) {
+        packet.active[i] = false;
+        packet.sampled[i] = false;
+        packet.x[i] = packet.y[i] = packet.z[i] = 0.0f;
+        packet.dx[i] = packet.dy[i] = packet.dz[i] = 0.0f;
+        packet.length[i] = 0.0f;
+        std::fill_n(rgba + 4 * i, 4, 0.0f);
+        key[i] = empty_key;
+        if (i >= lanes) {
+            continue;
+        }
+
+        // Direction of the ray through the pixel centre, as ray_direction_at
+        QVector3D direction(2.0f * (x + i + 0.5f) / frame.width - 1.0f, 2.0f * (y + 0.5f) / frame.height - 1.0f, -frame.focal_length);
+        direction.setX(direction.x() * frame.aspect_ratio);
+        direction = (QVector4D(direction, 0.0f) * frame.view).toVector3D();
+
+        // Slab method for ray-box intersection
+        const QVector3D inverse(safe_reciprocal(direction.x()), safe_reciprocal(direction.y()), safe_reciprocal(direction.z()));
+        const QVector3D t_top = inverse * (m_top - frame.ray_origin);
+        const QVector3D t_bottom = inverse * (m_bottom - frame.ray_origin);
+        const float t_0 = std::max({0.0f, std::min(t_top.x(), t_bottom.x()), std::min(t_top.y(), t_bottom.y()), std::min(t_top.z(), t_bottom.z())});
+        const float t_1 = std::min({std::max(t_top.x(), t_bottom.x()), std::max(t_top.y(), t_bottom.y()), std::max(t_top.z(), t_bottom.z())});
+        if (t_0 >= t_1) {
+            continue;
+        }
+
+        QVector3D start = (frame.ray_origin + direction * t_0 - m_bottom) / (m_top - m_bottom);
+        const QVector3D stop = (frame.ray_origin + direction * t_1 - m_bottom) / (m_top - m_bottom);
+        float length = (stop - start).length();
+        if (length <= 0.0f) {
+            continue;
+        }
+        ray[i] = (stop - start) / length;
+        entry[i] = start;
+        const QVector3D step = packet.ray_step * ray[i];
+
+        // Jitter along the first step
+        float jitter = pixel_jitter(x + i, y) + frame.jitter_offset;
+        jitter -= std::floor(jitter);
+
+        if (m_clipped) {
+            // Keep the samples of the whole ray falling in the box, from the
+            // first one past its entry to the last one before its exit
+            const QVector3D inverse_ray(safe_reciprocal(ray[i].x()), safe_reciprocal(ray[i].y()), safe_reciprocal(ray[i].z()));
+            const QVector3D u_top = inverse_ray * (m_clipTop - start);
+            const QVector3D u_bottom = inverse_ray * (m_clipBottom - start);
+            const float u_0 = std::max({0.0f, std::min(u_top.x(), u_bottom.x()), std::min(u_top.y(), u_bottom.y()), std::min(u_top.z(), u_bottom.z())});
+            const float u_1 = std::min({std::max(u_top.x(), u_bottom.x()), std::max(u_top.y(), u_bottom.y()), std::max(u_top.z(), u_bottom.z())});
+            if (u_0 >= u_1) {
+                continue;
+            }
+
+            // The box holding the exit also keeps the overrun of the whole ray
+            const float skipped = std::max(0.0f, std::ceil(u_0 / packet.ray_step - jitter));
+            length = u_1 < length ? u_1 - packet.ray_step * (jitter + skipped) : length - packet.ray_step * skipped;
+            jitter += skipped;
+            if (length <= 0.0f) {
+                continue;
+            }
+        }
+        start += step * jitter;
+
+        packet.x[i] = start.x();
+        packet.y[i] = start.y();
+        packet.z[i] = start.z();
+        packet.dx[i] = step.x();
+        packet.dy[i] = step.y();
+        packet.dz[i] = step.z();
+        packet.length[i] = length;
+        packet.active[i] = true;
+    }
+
+    switch (frame.mode) {
+    case Mode::Isosurface:
+        march_isosurface(frame, packet, ray, entry, rgba, key);
+        break;
+    case Mode::AlphaBlending:
+        march_alpha_blending(frame, packet, rgba);
+        break;
+    case Mode::MaximumIntensityProjection:
+        march_maximum_intensity(frame, packet, rgba, key);
+        break;
+    }
+}
+
+
+/*!
+ * \brief March a packet to the first intersection with the isosurface.
+ * \param frame Values of the frame.
+ * \param packet Rays, marched in place.
+ * \param ray Unit direction of each ray, in texture coordinates.
+ * \param entry Entry point of each ray in the volume box, in texture coordinates.
+ * \param rgba Colour of each pixel, written where the surface is hit.
+ * \param key Distance of the hit from the entry point, written where the surface is hit.
+ */
+void CpuRayCaster::march_isosurface(const Frame& frame, Packet& packet, const QVector3D *ray, const QVector3D *entry, float *rgba, float *key) const
+{
+    while (true) {
+        bool any = false;
+        for (int i = 0; i < packet_size; ++i) {
+            packet.sampled[i] = false;
+            if (!packet.active[i]) {
+                continue;
+            }
+            if (packet.length[i] <= 0.0f) {
+                packet.active[i] = false;
+                continue;
+            }
+            any = true;
+
+            // Skip bricks that cannot contain the isosurface
+            if (frame.skip_empty_space && brick_range(packet.x[i], packet.y[i], packet.z[i])[1] <= frame.threshold) {
+                const float steps = brick_exit_steps(packet.x[i], packet.y[i], packet.z[i], packet.dx[i], packet.dy[i], packet.dz[i]);
+                packet.length[i] -= steps * packet.ray_step;
+                packet.x[i] += steps * packet.dx[i];
+                packet.y[i] += steps * packet.dy[i];
+                packet.z[i] += steps * packet.dz[i];
+                continue;
+            }
+            packet.sampled[i] = true;
+        }
+        if (!any) {
+            break;
+        }
+
+        sample_packet(packet);
+
+        for (int i = 0; i < packet_size; ++i) {
+            if (!packet.sampled[i]) {
+                continue;
+            }
+            const QVector3D step(packet.dx[i], packet.dy[i], packet.dz[i]);
+            QVector3D position(packet.x[i], packet.y[i], packet.z[i]);
+
+            if (packet.sample[i] > frame.threshold) {
+                // Get closer to the surface
+                position -= step * 0.5f;
+                float intensity = sample_volume(position.x(), position.y(), position.z());
+                position -= step * (intensity > frame.threshold ? 0.25f : -0.25f);
+                intensity = sample_volume(position.x(), position.y(), position.z());
+
+                // Blinn-Phong shading
+                const QVector3D L = (frame.light_position - position).normalized();
+                const QVector3D V = -ray[i];
+                const QVector3D N = normal(frame, position, intensity);
+                const QVector3D H = (L + V).normalized();
+
+                const float Ia = 0.1f;
+                const float Id = 1.0f * std::max(0.0f, QVector3D::dotProduct(N, L));
+                const float Is = 8.0f * std::pow(std::max(0.0f, QVector3D::dotProduct(N, H)), 600.0f);
+                const QVector3D colour = (Ia + Id) * frame.material_colour + Is * QVector3D(1.0f, 1.0f, 1.0f);
+                rgba[4 * i + 0] = colour.x();
+                rgba[4 * i + 1] = colour.y();
+                rgba[4 * i + 2] = colour.z();
+                rgba[4 * i + 3] = 1.0f;
+                key[i] = QVector3D::dotProduct(position - entry[i], ray[i]);
+
+                packet.active[i] = false;
+                continue;
+            }
+
+            packet.length[i] -= packet.ray_step;
+            packet.x[i] += packet.dx[i];
+            packet.y[i] += packet.dy[i];
+            packet.z[i] += packet.dz[i];
+        }
+    }
+}
+
+
+/*!
+ * \brief March a packet, compositing front to back.
+ * \param frame Values of the frame.
+ * \param packet Rays, marched in place.
+ * \param rgba Premultiplied colour of each pixel, written for the rays marched.
+ */
+void CpuRayCaster::march_alpha_blending(const Frame& frame, Packet& packet, float *rgba) const
+{
+    for (int i = 0; i < packet_size; ++i) {
+        packet.r[i] = packet.g[i] = packet.b[i] = packet.a[i] = 0.0f;
+        packet.step_scale[i] = 1.0f;
+        packet.previous_alpha[i] = -1.0f;
+        packet.front[i] = -1.0f;
+        packet.refined[i] = false;
+    }
+    bool marched[packet_size];
+    std::copy(packet.active, packet.active + packet_size, marched);
+
+    while (true) {
+        bool any = false;
+        for (int i = 0; i < packet_size; ++i) {
+            packet.sampled[i] = false;
+            if (!packet.active[i]) {
+                continue;
+            }
+            if (packet.length[i] <= 0.0f || packet.a[i] >= frame.opacity_cutoff) {
+                packet.active[i] = false;
+                continue;
+            }
+            any = true;
+
+            // Skip bricks too transparent to affect the colour
+            if (frame.skip_empty_space
+                    && opacity_bounds(frame, brick_range(packet.x[i], packet.y[i], packet.z[i]))[1] < 1.0f / 255.0f) {
+                const float scale = packet.step_scale[i];
+                const float steps = brick_exit_steps(packet.x[i], packet.y[i], packet.z[i],
+                                                     scale * packet.dx[i], scale * packet.dy[i], scale * packet.dz[i]);
+                packet.length[i] -= steps * scale * packet.ray_step;
+                packet.x[i] += steps * scale * packet.dx[i];
+                packet.y[i] += steps * scale * packet.dy[i];
+                packet.z[i] += steps * scale * packet.dz[i];
+                packet.previous_alpha[i] = -1.0f;
+                packet.front[i] = -1.0f;
+                continue;
+            }
+            packet.sampled[i] = true;
+        }
+        if (!any) {
+            break;
+        }
+
+        sample_packet(packet);
+
+        for (int i = 0; i < packet_size; ++i) {
+            if (!packet.sampled[i]) {
+                continue;
+            }
+
+            std::array<float, 4> c;
+            const float back = window_intensity(frame, packet.sample[i]);
+            if (frame.preintegrated) {
+                // Segment from the previous sample, or a plain lookup for the first
+                c = segment_transfer(packet.front[i] < 0.0f ? back : packet.front[i], back);
+            }
+            else {
+                c = colour_transfer(frame, packet.sample[i]);
+            }
+
+            if (frame.adaptive_step) {
+                // Refine where the opacity changes quickly between samples
+                if (packet.previous_alpha[i] >= 0.0f && std::abs(c[3] - packet.previous_alpha[i]) > 0.1f && packet.step_scale[i] > 0.5f) {
+                    const float retreat = 0.5f * packet.step_scale[i];
+                    packet.x[i] -= retreat * packet.dx[i];
+                    packet.y[i] -= retreat * packet.dy[i];
+                    packet.z[i] -= retreat * packet.dz[i];
+                    packet.length[i] += retreat * packet.ray_step;
+                    packet.step_scale[i] -= retreat;
+                    packet.refined[i] = true;
+                    continue;
+                }
+                packet.previous_alpha[i] = c[3];
+            }
+            packet.front[i] = back;
+
+            // Alpha blending, with the opacity corrected for the step
+            const float alpha = 1.0f - std::pow(1.0f - c[3], packet.step_scale[i] * packet.ray_step / frame.step_length);
+            const float weight = (1.0f - packet.a[i]) * alpha;
+            packet.r[i] += weight * c[0];
+            packet.g[i] += weight * c[1];
+            packet.b[i] += weight * c[2];
+            packet.a[i] += weight;
+
+            if (frame.adaptive_step) {
+                // Never past the first step out of the brick, so the next brick is always sampled
+                if (!packet.refined[i]) {
+                    packet.step_scale[i] = std::min({2.0f * packet.step_scale[i],
+                                                     brick_step_scale(frame, packet.x[i], packet.y[i], packet.z[i]),
+                                                     brick_exit_steps(packet.x[i], packet.y[i], packet.z[i], packet.dx[i], packet.dy[i], packet.dz[i])});
+                }
+                packet.refined[i] = false;
+            }
+
+            const float scale = packet.step_scale[i];
+            packet.length[i] -= scale * packet.ray_step;
+            packet.x[i] += scale * packet.dx[i];
+            packet.y[i] += scale * packet.dy[i];
+            packet.z[i] += scale * packet.dz[i];
+        }
+    }
+
+    for (int i = 0; i < packet_size; ++i) {
+        if (marched[i]) {
+            rgba[4 * i + 0] = packet.r[i];
+            rgba[4 * i + 1] = packet.g[i];
+            rgba[4 * i + 2] = packet.b[i];
+            rgba[4 * i + 3] = packet.a[i];
+        }
+    }
+}
+
+
+/*!
+ * \brief March a packet, keeping the maximum intensity.
+ * \param frame Values of the frame.
+ * \param packet Rays, marched in place.
+ * \param rgba Premultiplied colour of each pixel, written for the rays marched.
+ * \param key Maximum intensity of each pixel, written for the rays marched.
+ */
+void CpuRayCaster::march_maximum_intensity(const Frame& frame, Packet& packet, float *rgba, float *key) const
+{
+    float maximum[packet_size] {};
+    bool marched[packet_size];
+    std::copy(packet.active, packet.active + packet_size, marched);
+
+    while (true) {
+        bool any = false;
+        for (int i = 0; i < packet_size; ++i) {
+            packet.sampled[i] = false;
+            if (!packet.active[i]) {
+                continue;
+            }
+            if (packet.length[i] <= 0.0f) {
+                packet.active[i] = false;
+                continue;
+            }
+            any = true;
+
+            // Skip bricks that cannot raise the maximum
+            if (frame.skip_empty_space && brick_range(packet.x[i], packet.y[i], packet.z[i])[1] <= maximum[i]) {
+                const float steps = brick_exit_steps(packet.x[i], packet.y[i], packet.z[i], packet.dx[i], packet.dy[i], packet.dz[i]);
+                packet.length[i] -= steps * packet.ray_step;
+                packet.x[i] += steps * packet.dx[i];
+                packet.y[i] += steps * packet.dy[i];
+                packet.z[i] += steps * packet.dz[i];
+                continue;
+            }
+            packet.sampled[i] = true;
+        }
+        if (!any) {
+            break;
+        }
+
+        sample_packet(packet);
+
+        for (int i = 0; i < packet_size; ++i) {
+            if (packet.sampled[i]) {
+                maximum[i] = std::max(maximum[i], packet.sample[i]);
+                packet.length[i] -= packet.ray_step;
+                packet.x[i] += packet.dx[i];
+                packet.y[i] += packet.dy[i];
+                packet.z[i] += packet.dz[i];
+            }
+        }
+    }
+
+    for (int i = 0; i < packet_size; ++i) {
+        if (marched[i]) {
+            const std::array<float, 4> c = colour_transfer(frame, maximum[i]);
+            rgba[4 * i + 0] = c[3] * c[0];
+            rgba[4 * i + 1] = c[3] * c[1];
+            rgba[4 * i + 2] = c[3] * c[2];
+            rgba[4 * i + 3] = c[3];
+            key[i] = maximum[i];
+        }
+    }
+}
+
+
+/*!
+ * \brief Sample the volume at the position of each ray that needs it.
+ *
+ * The lanes are independent and the sampling is branch free, so the loop
+ * is vectorised, with gathers of the voxels.
+ */
+void CpuRayCaster::sample_packet(Packet& packet) const
+{
+    #pragma omp simd
+    for (int i = 0; i < packet_size; ++i) {
+        packet.sample[i] = packet.sampled[i] ? sample_volume(packet.x[i], packet.y[i], packet.z[i]) : 0.0f;
+    }
+}
+
+
+/*!
+ * \brief Trilinear sample of the volume, with the clamping of a texture.
+ * \param x Position along x, in texture coordinates.
+ * \param y Position along y, in texture coordinates.
+ * \param z Position along z, in texture coordinates.
+ * \return Normalised intensity, in [0, 1].
+ */
+float CpuRayCaster::sample_volume(const float x, const float y, const float z) const
+{
+    return m_voxels->interpolate(x * m_size.x() - 0.5f - m_offset.x(),
+                                 y * m_size.y() - 0.5f - m_offset.y(),
+                                 z * m_size.z() - 0.5f - m_offset.z()) * (1.0f / 65535.0f);
+}
+
+
+/*!
+ * \brief Normal from a forward difference approximation of the gradient.
+ * \param frame Values of the frame.
+ * \param position Position, in texture coordinates.
+ * \param intensity Intensity at the position.
+ * \return Unit normal, in camera coordinates, or zero where the gradient vanishes.
+ */
+QVector3D CpuRayCaster::normal(const Frame& frame, const QVector3D& position, const float intensity) const
+{
+    const float d = frame.step_length;
+    const QVector3D gradient(sample_volume(position.x() + d, position.y(), position.z()) - intensity,
+                             sample_volume(position.x(), position.y() + d, position.z()) - intensity,
+                             sample_volume(position.x(), position.y(), position.z() + d) - intensity);
+
+    QVector3D n;
+    for (int row = 0; row < 3; ++row) {
+        n[row] = frame.normal_matrix(row, 0) * gradient.x()
+                + frame.normal_matrix(row, 1) * gradient.y()
+                + frame.normal_matrix(row, 2) * gradient.z();
+    }
+    return -n.normalized();
+}
+
+
+/*!
+ * \brief Intensity range (min, max) of the occupancy brick holding a position.
+ */
+std::array<float, 2> CpuRayCaster::brick_range(const float x, const float y, const float z) const
+{
+    const float brick = m_occupancy.brick_size();
+    const auto index = [brick](const float position, const float size, const float offset, const size_t count) {
+        return static_cast<size_t>(std::clamp(std::floor((position * size - offset) / brick), 0.0f, count - 1.0f));
+    };
+    const size_t i = index(x, m_size.x(), m_offset.x(), m_occupancy.width());
+    const size_t j = index(y, m_size.y(), m_offset.y(), m_occupancy.height());
+    const size_t k = index(z, m_size.z(), m_offset.z(), m_occupancy.depth());
+    return {m_occupancy.minimum(i, j, k) / 255.0f, m_occupancy.maximum(i, j, k) / 255.0f};
+}
+
+
+/*!
+ * \brief Number of whole steps needed to leave the occupancy brick holding a position.
+ */
+float CpuRayCaster::brick_exit_steps(const float x, const float y, const float z, const float dx, const float dy, const float dz) const
+{
+    const float brick = m_occupancy.brick_size();
+    const auto exit = [brick](const float position, const float step, const float size, const float offset, const size_t count) {
+        const float extent = brick / size;
+        const float origin = offset / size;
+        const float bottom = std::clamp(std::floor((position - origin) / extent), 0.0f, count - 1.0f) * extent + origin;
+        const float inverse = safe_reciprocal(step);
+        return std::max((bottom - position) * inverse, (bottom + extent - position) * inverse);
+    };
+    const float t = std::min({exit(x, dx, m_size.x(), m_offset.x(), m_occupancy.width()),
+                              exit(y, dy, m_size.y(), m_offset.y(), m_occupancy.height()),
+                              exit(z, dz, m_size.z(), m_offset.z(), m_occupancy.depth())});
+    return std::max(1.0f, std::ceil(t));
+}
+
+
+/*!
+ * \brief Intensity scaled to the window of the transfer function.
+ */
+float CpuRayCaster::window_intensity(const Frame& frame, const float intensity) const
+{
+    return std::clamp((intensity - frame.window_low) / std::max(frame.window_high - frame.window_low, 1e-6f), 0.0f, 1.0f);
+}
+
+
+/*!
+ * \brief Colour and opacity of the transfer function, applied to the intensity window.
+ *
+ * The table is interpolated linearly, as the texture of the shaders.
+ */
+std::array<float, 4> CpuRayCaster::colour_transfer(const Frame& frame, const float intensity) const
+{
+    const float position = window_intensity(frame, intensity) * (transfer_table_size - 1);
+    const size_t i0 = std::min(static_cast<size_t>(position), transfer_table_size - 2);
+    const float t = position - i0;
+
+    std::array<float, 4> c;
+    for (int channel = 0; channel < 4; ++channel) {
+        const float a = m_transferTable[4 * i0 + channel];
+        const float b = m_transferTable[4 * (i0 + 1) + channel];
+        c[channel] = a + t * (b - a);
+    }
+    return c;
+}
+
+
+/*!
+ * \brief Minimum and maximum opacity of the transfer function over an intensity range.
+ *
+ * The range is rounded outwards to the table entries.
+ */
+std::array<float, 2> CpuRayCaster::opacity_bounds(const Frame& frame, const std::array<float, 2>& range) const
+{
+    const size_t last = transfer_table_size - 1;
+    const size_t low = static_cast<size_t>(std::floor(window_intensity(frame, range[0]) * last));
+    const size_t high = static_cast<size_t>(std::ceil(window_intensity(frame, range[1]) * last));
+    const float *entry = &m_opacityRange[2 * (high * transfer_table_size + low)];
+    return {entry[0], entry[1]};
+}
+
+
+/*!
+ * \brief Colour and opacity of a ray segment between two windowed intensities.
+ *
+ * The pre-integrated table is interpolated bilinearly, as the texture of
+ * the shaders.
+ */
+std::array<float, 4> CpuRayCaster::segment_transfer(const float front, const float back) const
+{
+    const size_t n = transfer_table_size;
+    const float u = front * (n - 1);
+    const float v = back * (n - 1);
+    const size_t i0 = std::min(static_cast<size_t>(u), n - 2);
+    const size_t j0 = std::min(static_cast<size_t>(v), n - 2);
+    const float s = u - i0;
+    const float t = v - j0;
+
+    std::array<float, 4> c;
+    for (int channel = 0; channel < 4; ++channel) {
+        const auto at = [&](const size_t i, const size_t j) { return m_preintegrated[4 * (j * n + i) + channel]; };
+        const float bottom = at(i0, j0) + s * (at(i0 + 1, j0) - at(i0, j0));
+        const float top = at(i0, j0 + 1) + s * (at(i0 + 1, j0 + 1) - at(i0, j0 + 1));
+        c[channel] = bottom + t * (top - bottom);
+    }
+    return c;
+}
+
+
+/*!
+ * \brief Largest multiple of the ray step allowed in the brick holding a position.
+ *
+ * \sa brick_step_scale in raycasting.glsl
+ */
+float CpuRayCaster::brick_step_scale(const Frame& frame, const float x, const float y, const float z) const
+{
+    const std::array<float, 2> opacity = opacity_bounds(frame, brick_range(x, y, z));
+    const float variation = opacity[1] - opacity[0];
+    return std::clamp(0.1f / std::max(variation, 0.025f), 1.0f, 4.0f);
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <QColor>
+#include <QImage>
+#include <QMatrix3x3>
+#include <QMatrix4x4>
+#include <QSize>
+#include <QString>
+#include <QVector3D>
+
+#include "compositor.h"
+#include "raycastrenderer.h"
+#include "transferfunction.h"
+#include "volumepartition.h"
+#include "voxellayout.h"
+
+/*!
+ * \brief Software raycaster, reproducing the shaders on the CPU.
+ *
+ * It renders the same three modes as the fragment shaders, with the same
+ * camera, sampling and compositing, so it can render where no GPU is
+ * available, and its images can be compared pixel by pixel with the GPU
+ * ones to validate shader changes. It needs no OpenGL context.
+ *
+ * The image is split in tiles, balanced dynamically across threads, and
+ * each tile is traced in packets of adjacent rays, marched in lockstep over
+ * arrays of their state, so the sampling of a packet is vectorised. The
+ * voxels are stored in Z-ordered bricks (see `BrickedLayout`).
+ *
+ * The volume is always sampled at full resolution, without proxy geometry:
+ * images match the shaders with level of detail and proxy geometry
+ * disabled, up to the jitter, which is a hash of the pixel instead of a
+ * random texture.
+ *
+ * A raycaster can also load a single box of the volume, and render a
+ * partial image of it for sort-last compositing (see `SortLastRenderer`).
+ * The rays of every box are sampled at the same positions as the rays
+ * of the whole volume, so the composited image matches the whole one.
+ */
+class CpuRayCaster
+{
+public:
+    static constexpr int packet_size = 8; /*!< Rays marched together, along a row of pixels. */
+    static constexpr int tile_size = 16;  /*!< Side of the tiles scheduled on each thread, in pixels. */
+    static constexpr size_t region_margin = VolumePartition::margin; /*!< Voxels copied around a box, for the samples on its faces. */
+
+    CpuRayCaster(void);
+
+    void load(std::shared_ptr<const PreparedVolume> volume);
+    void load(std::shared_ptr<const PreparedVolume> volume, const VoxelRegion& region);
+    QImage render(const RenderParameters& parameters, const QSize& size, const int samples = 1);
+    PartialImage render_partial(const RenderParameters& parameters, const QSize& size);
+    QVector3D camera_voxel(const QMatrix4x4& view) const;
+
+    static float jitter_offset(const RenderParameters& parameters, const int sample);
+    static void accumulate(const PartialImage& image, const QColor& background, std::vector<float>& sum);
+    static QImage resolve(const std::vector<float>& sum, const QSize& size, const int samples);
+
+    /*!
+     * \brief Names of the rendering modes.
+     */
+    static std::vector<QString> modes(void) {
+        return {"Alpha blending", "Isosurface", "MIP"};
+    }
+
+    /*!
+     * \brief Transfer function of the alpha blending and MIP modes.
+     */
+    const TransferFunction& transfer_function(void) const {
+        return m_transferFunction;
+    }
+
+    void set_transfer_function(const TransferFunction& transfer_function);
+
+    /*!
+     * \brief Range of the volume, in intensity value.
+     */
+    std::pair<double, double> range(void) const {
+        return m_range;
+    }
+
+private:
+    enum class Mode {Isosurface, AlphaBlending, MaximumIntensityProjection};
+
+    /*!
+     * \brief Values shared by all the rays of a frame, as in the uniform block.
+     */
+    struct Frame {
+        Mode mode;
+        int width;                 /*!< Of the image, in pixels. */
+        int height;                /*!< Of the image, in pixels. */
+        QMatrix4x4 view;
+        QMatrix3x3 normal_matrix;
+        QVector3D ray_origin;
+        float aspect_ratio;
+        float focal_length;
+        float step_length;
+        float threshold;
+        float jitter_offset;
+        QVector3D material_colour;
+        QVector3D light_position;
+        float window_low;
+        float window_high;
+        float opacity_cutoff;
+        bool skip_empty_space;
+        bool adaptive_step;
+        bool preintegrated;
+    };
+
+    /*!
+     * \brief State of a packet of rays, one element per lane.
+     */
+    struct Packet {
+        float x[packet_size], y[packet_size], z[packet_size];    /*!< Position, in texture coordinates. */
+        float dx[packet_size], dy[packet_size], dz[packet_size]; /*!< Step vector, for a step of `ray_step`. */
+        float length[packet_size];                               /*!< Length of the ray left. */
+        float sample[packet_size];                               /*!< Intensity at the position. */
+        bool active[packet_size];                                /*!< Whether the ray is still marching. */
+        bool sampled[packet_size];                               /*!< Whether the ray needs the sample at its position. */
+        float r[packet_size], g[packet_size], b[packet_size], a[packet_size]; /*!< Colour of the ray. */
+        float step_scale[packet_size];                           /*!< Adaptive step, as a multiple of `ray_step`. */
+        float previous_alpha[packet_size];                       /*!< Opacity of the previous sample, negative if none. */
+        float front[packet_size];                                /*!< Windowed intensity of the previous sample, negative if none. */
+        bool refined[packet_size];                               /*!< Whether the step was just halved. */
+        float ray_step;                                          /*!< Step along the rays. */
+    };
+
+    std::shared_ptr<const BrickedLayout<uint16_t>> m_voxels; /*!< Normalised intensities, of the loaded box and its margin. */
+    OccupancyGrid m_occupancy;             /*!< Intensity range of each brick of `m_voxels`. */
+    QVector3D m_offset;                    /*!< First voxel of `m_voxels` in the volume. */
+    QVector3D m_size;                      /*!< Number of voxels of the volume for each axis. */
+    QVector3D m_top;                       /*!< Top corner of the volume box. */
+    QVector3D m_bottom;                    /*!< Bottom corner of the volume box. */
+    QMatrix4x4 m_modelMatrix;              /*!< From the unit cube to the volume box. */
+    std::pair<double, double> m_range;     /*!< Original intensity range. */
+    bool m_clipped {false};                /*!< Whether only a box of the volume is loaded. */
+    QVector3D m_clipBottom;                /*!< Bottom corner of the loaded box, in texture coordinates. */
+    QVector3D m_clipTop;                   /*!< Top corner of the loaded box, in texture coordinates. */
+
+    TransferFunction m_transferFunction;   /*!< Sampled into the lookup tables. */
+    std::vector<float> m_transferTable;    /*!< Colour and opacity table. */
+    std::vector<float> m_opacityRange;     /*!< Opacity range of each intensity interval. */
+    std::vector<float> m_preintegrated;    /*!< Pre-integrated table, computed when first needed. */
+
+    static constexpr size_t transfer_table_size = 256; /*!< Entries of the transfer function tables, as in the renderer. */
+    static constexpr float gamma = 2.2f;               /*!< Gamma correction parameter, as in the renderer. */
+
+    void set_geometry(const PreparedVolume& volume);
+    void trace_tile(const Frame& frame, const int x0, const int y0, PartialImage& image) const;
+    void trace_packet(const Frame& frame, const int x, const int y, const int lanes, float *rgba, float *key) const;
+    void march_isosurface(const Frame& frame, Packet& packet, const QVector3D *ray, const QVector3D *entry, float *rgba, float *key) const;
+    void march_alpha_blending(const Frame& frame, Packet& packet, float *rgba) const;
+    void march_maximum_intensity(const Frame& frame, Packet& packet, float *rgba, float *key) const;
+
+    void sample_packet(Packet& packet) const;
+    float sample_volume(const float x, const float y, const float z) const;
+    QVector3D normal(const Frame& frame, const QVector3D& position, const float intensity) const;
+    std::array<float, 2> brick_range(const float x, const float y, const float z) const;
+    float brick_exit_steps(const float x, const float y, const float z, const float dx, const float dy, const float dz) const;
+    float window_intensity(const Frame& frame, const float intensity) const;
+    std::array<float, 4> colour_transfer(const Frame& frame, const float intensity) const;
+    std::array<float, 2> opacity_bounds(const Frame& frame, const std::array<float, 2>& range) const;
+    std::array<float, 4> segment_transfer(const float front, const float back) const;
+    float brick_step_scale(const Frame& frame, const float x, const float y, const float z) const;
+};
@@ -0,0 +1,350 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <map>
+
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+
+#include "frameprofiler.h"
+
+
+/*!
+ * \brief Constructor, without OpenGL resources.
+ */
+FrameProfiler::FrameProfiler(void)
+{
+}
+
+
+/*!
+ * \brief Destructor, the queries must have been released.
+ */
+FrameProfiler::~FrameProfiler()
+{
+}
+
+
+/*!
+ * \brief Check the support for timer queries, in the current context.
+ */
+void FrameProfiler::initialise(void)
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    m_gpuTiming = !context->isOpenGLES()
+            && (context->format().version() >= qMakePair(3, 3) || context->hasExtension("GL_ARB_timer_query"));
+
+    QOpenGLFunctions *f = context->functions();
+    m_rendererInfo = QString("%1, OpenGL %2")
+            .arg(reinterpret_cast<const char *>(f->glGetString(GL_RENDERER)),
+                 reinterpret_cast<const char *>(f->glGetString(GL_VERSION)));
+}
+
+
+/*!
+ * \brief Release the queries, in the current context.
+ *
+ * Frames still waiting for their GPU timings are discarded.
+ */
+void FrameProfiler::release(void)
+{
+    m_current = PendingFrame {};
+    m_pending.clear();
+    m_pool.clear();
+    m_inFrame = false;
+    m_inStage = false;
+}
+
+
+/*!
+ * \brief Start or stop writing the timings to a CSV file.
+ * \param filename Destination file, overwritten, or empty to stop writing.
+ * \return `false` if the file cannot be opened.
+ *
+ * Each row holds the frame index, the stage name, and its CPU and GPU time in
+ * milliseconds. The GPU time is empty when not measured. The timings of the
+ * whole frame are in the `frame` stage, and the CPU time of each loading
+ * stage is recorded in a `load/<stage>` row.
+ */
+bool FrameProfiler::set_csv(const QString& filename)
+{
+    m_csvStream.setDevice(nullptr);
+    m_csv.close();
+    if (filename.isEmpty()) {
+        return true;
+    }
+
+    m_csv.setFileName(filename);
+    if (!m_csv.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        return false;
+    }
+    m_csvStream.setDevice(&m_csv);
+    if (!m_rendererInfo.isEmpty()) {
+        m_csvStream << "# " << m_rendererInfo << "\n";
+    }
+    m_csvStream << "frame,stage,cpu_ms,gpu_ms\n";
+    return true;
+}
+
+
+/*!
+ * \brief Start timing a frame.
+ *
+ * The frames whose GPU timings have become available are completed.
+ */
+void FrameProfiler::begin_frame(void)
+{
+    if (!enabled()) {
+        return;
+    }
+    collect(false);
+
+    m_current = PendingFrame {};
+    m_current.stats.frame = m_frame++;
+    m_timeGpu = m_gpuTiming && m_pending.size() < m_maxPending;
+    m_inFrame = true;
+    m_inStage = false;
+    m_frameTimer.start();
+}
+
+
+/*!
+ * \brief Start timing a stage of the current frame.
+ * \param name Name of the stage.
+ *
+ * Any stage still open is ended first.
+ */
+void FrameProfiler::begin_stage(const QString& name)
+{
+    if (!m_inFrame) {
+        return;
+    }
+    end_stage();
+
+    m_current.stats.stages.push_back(StageTime {name});
+    if (m_timeGpu) {
+        std::unique_ptr<QOpenGLTimerQuery> query;
+        if (m_pool.empty()) {
+            query = std::make_unique<QOpenGLTimerQuery>();
+            query->create();
+        }
+        else {
+            query = std::move(m_pool.back());
+            m_pool.pop_back();
+        }
+        query->begin();
+        m_current.queries.push_back(std::move(query));
+    }
+    m_inStage = true;
+    m_stageTimer.start();
+}
+
+
+/*!
+ * \brief Stop timing the current stage.
+ */
+void FrameProfiler::end_stage(void)
+{
+    if (!m_inStage) {
+        return;
+    }
+    m_current.stats.stages.back().cpu_ms = m_stageTimer.nsecsElapsed() / 1e6;
+    if (m_timeGpu) {
+        m_current.queries.back()->end();
+    }
+    m_inStage = false;
+}
+
+
+/*!
+ * \brief Stop timing the current frame.
+ *
+ * The frame is completed once its GPU timings are available.
+ */
+void FrameProfiler::end_frame(void)
+{
+    if (!m_inFrame) {
+        return;
+    }
+    end_stage();
+
+    m_current.stats.cpu_ms = m_frameTimer.nsecsElapsed() / 1e6;
+    m_pending.push_back(std::move(m_current));
+    m_current = PendingFrame {};
+    m_inFrame = false;
+    collect(false);
+}
+
+
+/*!
+ * \brief Wait for the GPU timings of all the frames, and complete them.
+ */
+void FrameProfiler::flush(void)
+{
+    collect(true);
+    m_csvStream.flush();
+}
+
+
+/*!
+ * \brief Complete all the frames, and start averaging anew.
+ */
+void FrameProfiler::reset(void)
+{
+    flush();
+    m_history.clear();
+}
+
+
+/*!
+ * \brief Record the timings of a volume being loaded.
+ * \param name Name of the volume.
+ * \param timings CPU time of each loading stage, in milliseconds.
+ */
+void FrameProfiler::record_load(const QString& name, const std::vector<std::pair<std::string, double>>& timings)
+{
+    if (!m_csv.isOpen()) {
+        return;
+    }
+    m_csvStream << "# " << name << "\n";
+    for (const auto& [stage, ms] : timings) {
+        m_csvStream << m_frame << ",load/" << QString::fromStdString(stage) << "," << ms << ",\n";
+    }
+}
+
+
+/*!
+ * \brief Average timings of the most recent frames.
+ * \return Average of the whole frame, and of each stage by name.
+ *
+ * The timings of stages with the same name in a frame are summed. GPU times
+ * are averaged only over the frames where they were measured.
+ */
+FrameStats FrameProfiler::average(void) const
+{
+    FrameStats average;
+    if (m_history.empty()) {
+        return average;
+    }
+
+    // Sums and GPU sample counts, by name, in order of appearance
+    std::map<QString, size_t> index;
+    std::vector<int> gpu_samples;
+    int frame_gpu_samples = 0;
+    double frame_gpu = 0.0;
+
+    for (const auto& stats : m_history) {
+        average.cpu_ms += stats.cpu_ms;
+        if (stats.gpu_ms >= 0.0) {
+            frame_gpu += stats.gpu_ms;
+            ++frame_gpu_samples;
+        }
+
+        std::vector<bool> timed_gpu(average.stages.size(), false);
+        for (const auto& stage : stats.stages) {
+            auto it = index.find(stage.name);
+            if (it == index.end()) {
+                it = index.emplace(stage.name, average.stages.size()).first;
+                average.stages.push_back(StageTime {stage.name, 0.0, 0.0});
+                gpu_samples.push_back(0);
+                timed_gpu.push_back(false);
+            }
+            StageTime& sum = average.stages[it->second];
+            sum.cpu_ms += stage.cpu_ms;
+            if (stage.gpu_ms >= 0.0) {
+                sum.gpu_ms += stage.gpu_ms;
+                timed_gpu[it->second] = true;
+            }
+        }
+        for (size_t i = 0; i < timed_gpu.size(); ++i) {
+            gpu_samples[i] += timed_gpu[i];
+        }
+    }
+
+    const double frames = m_history.size();
+    average.frame = m_history.back().frame;
+    average.cpu_ms /= frames;
+    average.gpu_ms = frame_gpu_samples > 0 ? frame_gpu / frame_gpu_samples : -1.0;
+    for (size_t i = 0; i < average.stages.size(); ++i) {
+        average.stages[i].cpu_ms /= frames;
+        average.stages[i].gpu_ms = gpu_samples[i] > 0 ? average.stages[i].gpu_ms / gpu_samples[i] : -1.0;
+    }
+    return average;
+}
+
+
+/*!
+ * \brief Complete the pending frames whose GPU timings are available.
+ * \param wait Wait for the timings of all the pending frames.
+ *
+ * Frames are completed in order, so a frame still running on the GPU holds
+ * back the following ones.
+ */
+void FrameProfiler::collect(const bool wait)
+{
+    while (!m_pending.empty()) {
+        PendingFrame& frame = m_pending.front();
+        if (!wait) {
+            for (const auto& query : frame.queries) {
+                if (!query->isResultAvailable()) {
+                    return;
+                }
+            }
+        }
+
+        if (!frame.queries.empty()) {
+            frame.stats.gpu_ms = 0.0;
+            for (size_t i = 0; i < frame.queries.size(); ++i) {
+                frame.stats.stages[i].gpu_ms = frame.queries[i]->waitForResult() / 1e6;
+                frame.stats.gpu_ms += frame.stats.stages[i].gpu_ms;
+                m_pool.push_back(std::move(frame.queries[i]));
+            }
+        }
+
+        complete(frame.stats);
+        m_pending.pop_front();
+    }
+}
+
+
+/*!
+ * \brief Add a frame to the history, and write it to the CSV file.
+ * \param stats Timings of the frame.
+ */
+void FrameProfiler::complete(const FrameStats& stats)
+{
+    m_history.push_back(stats);
+    while (m_history.size() > m_historySize) {
+        m_history.pop_front();
+    }
+
+    if (!m_csv.isOpen()) {
+        return;
+    }
+    const auto gpu = [](const double ms) {
+        return ms >= 0.0 ? QString::number(ms) : QString();
+    };
+    for (const auto& stage : stats.stages) {
+        m_csvStream << stats.frame << "," << stage.name << "," << stage.cpu_ms << "," << gpu(stage.gpu_ms) << "\n";
+    }
+    m_csvStream << stats.frame << ",frame," << stats.cpu_ms << "," << gpu(stats.gpu_ms) << "\n";
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QOpenGLTimerQuery>
+#include <QString>
+#include <QTextStream>
+
+/*!
+ * \brief Time spent in a stage of a frame.
+ */
+struct StageTime
+{
+    QString name;          /*!< Name of the stage. */
+    double cpu_ms {0.0};   /*!< Time spent by the CPU issuing the stage, in milliseconds. */
+    double gpu_ms {-1.0};  /*!< Time spent by the GPU executing the stage, in milliseconds (negative if not measured). */
+};
+
+/*!
+ * \brief Timings of a frame.
+ */
+struct FrameStats
+{
+    qint64 frame {0};               /*!< Index of the frame. */
+    double cpu_ms {0.0};            /*!< CPU time of the whole frame, in milliseconds. */
+    double gpu_ms {-1.0};           /*!< GPU time of all the stages, in milliseconds (negative if not measured). */
+    std::vector<StageTime> stages;  /*!< Timings of each stage, in order. */
+};
+
+/*!
+ * \brief CPU and GPU timer of the stages of each frame.
+ *
+ * Each stage is timed on the GPU with a `GL_TIME_ELAPSED` query. Queries are
+ * read only once their result is available, a few frames later, so timing
+ * never stalls the pipeline. Elapsed time queries cannot be nested, so the
+ * stages of a frame must not overlap.
+ *
+ * The profiler does nothing until enabled. The completed frames are kept for
+ * a short while, to average them for display, and optionally written to a
+ * CSV file, with a row per stage.
+ */
+class FrameProfiler
+{
+public:
+    FrameProfiler(void);
+    ~FrameProfiler();
+
+    FrameProfiler(const FrameProfiler&) = delete;
+    FrameProfiler& operator=(const FrameProfiler&) = delete;
+
+    void initialise(void);
+    void release(void);
+    bool set_csv(const QString& filename);
+
+    void begin_frame(void);
+    void begin_stage(const QString& name);
+    void end_stage(void);
+    void end_frame(void);
+    void flush(void);
+    void reset(void);
+
+    void record_load(const QString& name, const std::vector<std::pair<std::string, double>>& timings);
+    FrameStats average(void) const;
+
+    /*!
+     * \brief Enable or disable the timing of the frames.
+     */
+    void set_enabled(const bool enabled) {
+        m_enabled = enabled;
+    }
+
+    /*!
+     * \brief Whether the frames are being timed.
+     */
+    bool enabled(void) const {
+        return m_enabled || m_csv.isOpen();
+    }
+
+    /*!
+     * \brief Name of the renderer and version of the driver, once initialised.
+     */
+    QString renderer_info(void) const {
+        return m_rendererInfo;
+    }
+
+    /*!
+     * \brief Whether the GPU time of the stages can be measured.
+     */
+    bool gpu_timing(void) const {
+        return m_gpuTiming;
+    }
+
+private:
+    /*!
+     * \brief Frame whose GPU timings may still be running.
+     */
+    struct PendingFrame {
+        FrameStats stats;
+        std::vector<std::unique_ptr<QOpenGLTimerQuery>> queries; /*!< A query per stage, or none if not measured. */
+    };
+
+    const size_t m_maxPending = 8;   /*!< Frames in flight before the GPU timing is skipped. */
+    const size_t m_historySize = 60; /*!< Completed frames averaged for display. */
+
+    bool m_enabled = false;
+    bool m_gpuTiming = false;       /*!< Whether timer queries are supported. */
+    QString m_rendererInfo;         /*!< Renderer and driver version, written in the CSV header. */
+
+    qint64 m_frame = 0;             /*!< Index of the next frame. */
+    bool m_inFrame = false;         /*!< Whether a frame is being timed. */
+    bool m_inStage = false;         /*!< Whether a stage is being timed. */
+    bool m_timeGpu = false;         /*!< Whether the GPU time of the current frame is measured. */
+    PendingFrame m_current;         /*!< Frame being timed. */
+    QElapsedTimer m_frameTimer;
+    QElapsedTimer m_stageTimer;
+
+    std::deque<PendingFrame> m_pending;                      /*!< Frames waiting for their GPU timings, oldest first. */
+    std::vector<std::unique_ptr<QOpenGLTimerQuery>> m_pool;  /*!< Queries free to be reused. */
+    std::deque<FrameStats> m_history;                        /*!< Most recent completed frames. */
+
+    QFile m_csv;
+    QTextStream m_csvStream;
+
+    void collect(const bool wait);
+    void complete(const FrameStats& stats);
+};
@@ -0,0 +1,148 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <utility>
+
+#include "framescheduler.h"
+
+
+/*!
+ * \brief Constructor.
+ * \param draw Called when a frame is due, typically `QWidget::update`.
+ * \param parent Parent object.
+ */
+FrameScheduler::FrameScheduler(std::function<void(void)> draw, QObject *parent)
+    : QObject {parent}
+    , m_draw {std::move(draw)}
+{
+    m_timer.setSingleShot(true);
+    connect(&m_timer, &QTimer::timeout, this, &FrameScheduler::dispatch);
+    m_lastFrame.start();
+    m_lastInput.start();
+}
+
+
+/*!
+ * \brief Request a frame.
+ * \param priority Urgency of the frame.
+ *
+ * A request made while a frame is pending is merged with it, taking the
+ * higher priority of the two.
+ */
+void FrameScheduler::request(const Priority priority)
+{
+    if (priority == Priority::Interactive) {
+        m_lastInput.restart();
+    }
+
+    if (m_pending && (m_dispatched || priority <= m_priority)) {
+        return;
+    }
+    m_pending = true;
+    m_priority = std::max(m_priority, priority);
+    schedule();
+}
+
+
+/*!
+ * \brief Notify that a frame is being drawn.
+ *
+ * This must be called at the start of each frame, including those painted
+ * for other reasons (exposure, resizing), so they satisfy the pending
+ * request. Requests made while drawing schedule the next frame.
+ */
+void FrameScheduler::frame_started(void)
+{
+    m_lastFrame.restart();
+    m_timer.stop();
+    m_pending = false;
+    m_dispatched = false;
+    m_priority = Priority::Refinement;
+}
+
+
+/*!
+ * \brief Drop a pending refinement frame.
+ *
+ * Pending interactive frames are kept.
+ */
+void FrameScheduler::cancel_refinement(void)
+{
+    if (m_pending && !m_dispatched && m_priority == Priority::Refinement) {
+        m_timer.stop();
+        m_pending = false;
+    }
+}
+
+
+/*!
+ * \brief Set the maximum frame rate.
+ * \param fps Frames per second, or zero to remove the limit.
+ */
+void FrameScheduler::set_max_frame_rate(const int fps)
+{
+    m_minInterval = fps > 0 ? 1000 / fps : 0;
+    if (m_pending && !m_dispatched) {
+        schedule();
+    }
+}
+
+
+/*!
+ * \brief Time before the pending frame is due, in milliseconds.
+ */
+int FrameScheduler::delay(void) const
+{
+    int delay = m_minInterval - static_cast<int>(m_lastFrame.elapsed());
+    if (m_priority == Priority::Refinement) {
+        delay = std::max(delay, m_refinementDelay - static_cast<int>(m_lastInput.elapsed()));
+    }
+    return std::max(delay, 0);
+}
+
+
+/*!
+ * \brief Start the timer of the pending frame, or draw it if already due.
+ */
+void FrameScheduler::schedule(void)
+{
+    const int due = delay();
+    if (due == 0) {
+        dispatch();
+    }
+    else {
+        m_timer.start(due);
+    }
+}
+
+
+/*!
+ * \brief Hand the pending frame to the widget.
+ */
+void FrameScheduler::dispatch(void)
+{
+    if (m_pending && !m_dispatched) {
+        m_dispatched = true;
+        m_draw();
+    }
+}
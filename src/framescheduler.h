@@ -0,0 +1,94 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <functional>
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTimer>
+
+/*!
+ * \brief Paces the repaints of a widget.
+ *
+ * Requests are coalesced into at most one pending frame, which is drawn no
+ * sooner than the minimum frame interval after the previous one, so bursts
+ * of input (mouse moves, slider ticks) cost one frame per interval instead
+ * of one frame per event.
+ *
+ * Interactive requests come from input that changes the image. Refinement
+ * requests come from work that improves an image already shown, such as
+ * progressive accumulation or brick streaming: they are deferred until the
+ * input has been idle for the refinement delay, and input arriving while one
+ * is pending takes its place, so refinement never delays a response.
+ */
+class FrameScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    /*!
+     * \brief Urgency of a frame request.
+     */
+    enum class Priority
+    {
+        Refinement,  /*!< Improves the current image, deferred while there is input. */
+        Interactive, /*!< Responds to input, drawn as soon as the frame rate allows. */
+    };
+
+    explicit FrameScheduler(std::function<void(void)> draw, QObject *parent = nullptr);
+
+    void request(const Priority priority = Priority::Interactive);
+    void frame_started(void);
+    void cancel_refinement(void);
+
+    void set_max_frame_rate(const int fps);
+
+    /*!
+     * \brief Time without input before refinement frames are drawn, in milliseconds.
+     */
+    void set_refinement_delay(const int msec) {
+        m_refinementDelay = msec;
+    }
+
+    /*!
+     * \brief Whether a frame has been requested and not drawn yet.
+     */
+    bool pending(void) const {
+        return m_pending;
+    }
+
+private:
+    std::function<void(void)> m_draw; /*!< Schedules the actual repaint. */
+    QTimer m_timer;                   /*!< Fires when the pending frame is due. */
+    QElapsedTimer m_lastFrame;        /*!< Since the last frame started. */
+    QElapsedTimer m_lastInput;        /*!< Since the last interactive request. */
+    int m_minInterval = 16;           /*!< Minimum time between frames, in milliseconds. */
+    int m_refinementDelay = 100;      /*!< Time without input before refining, in milliseconds. */
+    bool m_pending = false;           /*!< Whether a frame is requested. */
+    Priority m_priority = Priority::Refinement; /*!< Of the pending frame. */
+    bool m_dispatched = false;        /*!< Whether the pending frame was handed to the widget. */
+
+    int delay(void) const;
+    void schedule(void);
+    void dispatch(void);
+};
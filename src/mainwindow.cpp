@@ -22,7 +22,11 @@
 
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include "volume.h"
 
+#include <algorithm>
+
+#include <QCollator>
 #include <QColorDialog>
 #include <QFileDialog>
 #include <QSignalBlocker>
@@ -31,9 +35,25 @@
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow {parent}
     , ui {new Ui::MainWindow}
+    , m_loadProgress {new QProgressBar(this)}
 {
     ui->setupUi(this);
 
+    // Report the progress of volumes loaded in the background
+    m_loadProgress->setMaximumWidth(200);
+    m_loadProgress->hide();
+    ui->statusBar->addPermanentWidget(m_loadProgress);
+    connect(ui->canvas, &RayCastCanvas::volumeLoadStarted, this, &MainWindow::volume_load_started);
+    connect(ui->canvas, &RayCastCanvas::volumeLoadProgress, this, &MainWindow::volume_load_progress);
+    connect(ui->canvas, &RayCastCanvas::volumeLoaded, this, &MainWindow::volume_loaded, Qt::QueuedConnection);
+    connect(ui->canvas, &RayCastCanvas::volumeLoadFailed, this, &MainWindow::volume_load_failed);
+    connect(ui->canvas, &RayCastCanvas::seriesFrameShown, this, &MainWindow::series_frame_shown);
+    connect(ui->canvas, &RayCastCanvas::surfacePicked, this, &MainWindow::surface_picked);
+    connect(ui->canvas, &RayCastCanvas::surfaceMissed, this, &MainWindow::surface_missed);
+
+    // Edits of the transfer function are drawn as they happen
+    connect(ui->transferFunction, &TransferFunctionEditor::transferFunctionChanged, ui->canvas, &RayCastCanvas::setTransferFunction);
+
     // Set inital values
     ui->stepLength->valueChanged(ui->stepLength->value());
     ui->threshold_slider->valueChanged(ui->threshold_slider->value());
@@ -76,9 +96,12 @@ void MainWindow::dropEvent(QDropEvent *event)
     const QMimeData* mimeData = event->mimeData();
 
     if (mimeData->hasUrls()) {
+        // Several files dropped together are played back as a sequence
+        QStringList paths;
         for (auto& url : mimeData->urls()) {
-            load_volume(url.toLocalFile());
+            paths << url.toLocalFile();
         }
+        paths.size() > 1 ? load_sequence(paths) : load_volume(paths.first());
     }
 }
 
@@ -87,25 +110,165 @@ void MainWindow::dropEvent(QDropEvent *event)
  * \brief Load a volume
  * \param path Volume file to be loaded.
  *
- * Try to load the volume. Update the UI if succesfull, or prompt an error
- * message in case of failure.
+ * The volume is loaded in the background. The UI is updated when loading
+ * is complete.
  */
 void MainWindow::load_volume(const QString& path)
 {
-    try {
-        ui->canvas->setVolume(path);
+    reset_playback(false);
+    ui->canvas->setVolume(path);
+}
+
+
+/*!
+ * \brief Load a sequence of volumes, to be played back as a time series.
+ * \param paths Volume files, sorted by name to get the playback order.
+ */
+void MainWindow::load_sequence(const QStringList& paths)
+{
+    if (paths.size() < 2) {
+        load_volume(paths.first());
+        return;
+    }
+
+    QStringList sorted = paths;
+    QCollator collator;
+    collator.setNumericMode(true);
+    std::sort(sorted.begin(), sorted.end(), collator);
+
+    reset_playback(true);
+    ui->canvas->setSeriesFrameRate(ui->sequenceFrameRate->value());
+    ui->canvas->setVolumeSeries(sorted);
+}
+
+
+/*!
+ * \brief Stop the playback controls, without changing the canvas.
+ * \param enabled Whether a sequence is loaded.
+ */
+void MainWindow::reset_playback(const bool enabled)
+{
+    const QSignalBlocker blocker(ui->playSequence);
+    ui->playSequence->setChecked(false);
+    ui->playSequence->setText(tr("Play"));
+    ui->playSequence->setEnabled(enabled);
+}
+
+
+/*!
+ * \brief Show the frame of the sequence on screen and the playback statistics.
+ * \param index Index of the frame in the sequence.
+ * \param count Number of frames in the sequence.
+ */
+void MainWindow::series_frame_shown(int index, int count)
+{
+    const auto statistics = ui->canvas->getSeriesStatistics();
+    ui->statusBar->showMessage(tr("Frame %1/%2, %3 fps, %4 buffered, %5 dropped, %6 stalls")
+                               .arg(index + 1).arg(count)
+                               .arg(statistics.frame_rate, 0, 'f', 1)
+                               .arg(statistics.buffered)
+                               .arg(statistics.dropped)
+                               .arg(statistics.stalls));
+}
+
+
+/*!
+ * \brief Show a point picked on the isosurface, and its distance from the previous one.
+ * \param voxel Position of the point, in voxel coordinates.
+ * \param position Position of the point, in physical units.
+ * \param value Intensity at the point.
+ */
+void MainWindow::surface_picked(const QVector3D& voxel, const QVector3D& position, double value)
+{
+    QString message = tr("Voxel (%1, %2, %3), intensity %4")
+            .arg(voxel.x(), 0, 'f', 1).arg(voxel.y(), 0, 'f', 1).arg(voxel.z(), 0, 'f', 1)
+            .arg(value, 0, 'g', 4);
+    if (m_lastPick) {
+        message += tr(", %1 from the previous point").arg((position - *m_lastPick).length(), 0, 'g', 4);
+    }
+    m_lastPick = position;
+    ui->statusBar->showMessage(message);
+}
+
+
+/*!
+ * \brief Report a pick that did not hit the isosurface.
+ */
+void MainWindow::surface_missed(void)
+{
+    ui->statusBar->showMessage(tr("No isosurface under the cursor"), 2000);
+}
+
+
+/*!
+ * \brief Show a busy indicator while a volume is read.
+ * \param path Volume file being loaded.
+ */
+void MainWindow::volume_load_started(const QString& path)
+{
+    ui->statusBar->showMessage(tr("Loading ") + path);
+    m_loadProgress->setRange(0, 0);
+    m_loadProgress->show();
+}
+
+
+/*!
+ * \brief Show the progress of the volume upload.
+ * \param percent Percentage of the volume already uploaded.
+ */
+void MainWindow::volume_load_progress(int percent)
+{
+    m_loadProgress->setRange(0, 100);
+    m_loadProgress->setValue(percent);
+}
+
+
+/*!
+ * \brief Update the UI once a volume has been loaded.
+ * \param path Volume file that has been loaded.
+ */
+void MainWindow::volume_loaded(const QString& path)
+{
+    (void) path;
+    ui->statusBar->clearMessage();
+    m_loadProgress->hide();
+    m_lastPick.reset();
+
+    auto range = ui->canvas->getRange();
+    ui->threshold_spinbox->setMinimum(range.first);
+    ui->threshold_spinbox->setMaximum(range.second);
+    ui->threshold_slider->valueChanged(ui->threshold_slider->value());
 
-        // Update the UI
-        auto range = ui->canvas->getRange();
-        ui->threshold_spinbox->setMinimum(range.first);
-        ui->threshold_spinbox->setMaximum(range.second);
-        ui->threshold_slider->valueChanged(ui->threshold_slider->value());
+    // Reset the window to the whole range
+    {
+        const QSignalBlocker low_blocker(ui->windowLow);
+        const QSignalBlocker high_blocker(ui->windowHigh);
+        ui->windowLow->setRange(range.first, range.second);
+        ui->windowHigh->setRange(range.first, range.second);
+        ui->windowLow->setValue(range.first);
+        ui->windowHigh->setValue(range.second);
     }
-    catch (std::runtime_error& e) {
-        QMessageBox::warning(this, tr("Error"), tr("Cannot load volume ") + path + ": " + e.what());
+    ui->canvas->setWindow(range.first, range.second);
+
+    if (const double psnr = ui->canvas->getCompressionPsnr(); psnr > 0.0) {
+        ui->statusBar->showMessage(tr("Compressed volume, PSNR %1 dB").arg(psnr, 0, 'f', 1));
     }
 }
 
+
+/*!
+ * \brief Prompt an error message when a volume cannot be loaded.
+ * \param path Volume file that failed to load.
+ * \param message Description of the error.
+ */
+void MainWindow::volume_load_failed(const QString& path, const QString& message)
+{
+    ui->statusBar->clearMessage();
+    m_loadProgress->hide();
+    QMessageBox::warning(this, tr("Error"), tr("Cannot load volume ") + path + ": " + message);
+    reset_playback(false);
+}
+
 /*!
  * \brief Set the ray marching step lenght.
  * \param arg1 Step length, as a fraction of the ray length.
@@ -120,12 +283,50 @@ void MainWindow::on_stepLength_valueChanged(double arg1)
  */
 void MainWindow::on_loadVolume_clicked()
 {
-    QString path = QFileDialog::getOpenFileName(this, tr("Open volume"), ".", tr("VTK images (*.vtk)"));
+    QStringList patterns;
+    for (const auto& extension : volume_extensions()) {
+        patterns << "*." + QString::fromStdString(extension);
+    }
+    QString path = QFileDialog::getOpenFileName(this, tr("Open volume"), ".", tr("Volumes (%1)").arg(patterns.join(' ')));
     if (!path.isNull()) {
         load_volume(path);
     }
 }
 
+/*!
+ * \brief Load a sequence of volumes from files.
+ */
+void MainWindow::on_loadSequence_clicked()
+{
+    QStringList patterns;
+    for (const auto& extension : volume_extensions()) {
+        patterns << "*." + QString::fromStdString(extension);
+    }
+    const QStringList paths = QFileDialog::getOpenFileNames(this, tr("Open sequence"), ".", tr("Volumes (%1)").arg(patterns.join(' ')));
+    if (!paths.isEmpty()) {
+        load_sequence(paths);
+    }
+}
+
+/*!
+ * \brief Start or pause the playback of the sequence.
+ * \param checked Whether the sequence is playing.
+ */
+void MainWindow::on_playSequence_toggled(bool checked)
+{
+    ui->playSequence->setText(checked ? tr("Pause") : tr("Play"));
+    ui->canvas->setPlaying(checked);
+}
+
+/*!
+ * \brief Set the target frame rate of the sequence playback.
+ * \param arg1 Frames per second.
+ */
+void MainWindow::on_sequenceFrameRate_valueChanged(double arg1)
+{
+    ui->canvas->setSeriesFrameRate(arg1);
+}
+
 /*!
  * \brief MainWindow::on_threshold_spinbox_valueChanged
  * \param arg1 Threshold in image intensity value.
@@ -139,7 +340,7 @@ void MainWindow::on_threshold_spinbox_valueChanged(double arg1)
 {
     ui->canvas->setThreshold(arg1);
 
-    QSignalBlocker(ui->threshold_slider);
+    const QSignalBlocker blocker(ui->threshold_slider);
     auto range = ui->threshold_spinbox->maximum() - ui->threshold_spinbox->minimum();
     ui->threshold_slider->setValue(100 * (arg1 - ui->threshold_spinbox->minimum()) / range);
 }
@@ -157,7 +358,7 @@ void MainWindow::on_threshold_slider_valueChanged(int value)
 
     ui->canvas->setThreshold(threshold);
 
-    QSignalBlocker(ui->threshold_spinbox);
+    const QSignalBlocker blocker(ui->threshold_spinbox);
     ui->threshold_spinbox->setValue(threshold);
 }
 
@@ -182,6 +383,176 @@ void MainWindow::on_mode_currentTextChanged(const QString &mode)
 }
 
 
+/*!
+ * \brief Enable or disable empty space skipping.
+ * \param checked Whether empty space skipping is enabled.
+ */
+void MainWindow::on_skipEmptySpace_toggled(bool checked)
+{
+    ui->canvas->setEmptySpaceSkipping(checked);
+}
+
+
+/*!
+ * \brief Enable or disable the tight proxy geometry.
+ * \param checked Whether the proxy geometry is enabled.
+ */
+void MainWindow::on_proxyGeometry_toggled(bool checked)
+{
+    ui->canvas->setProxyGeometry(checked);
+}
+
+
+/*!
+ * \brief Enable or disable the precomputed gradient texture.
+ * \param checked Whether gradients are precomputed.
+ */
+void MainWindow::on_gradientTexture_toggled(bool checked)
+{
+    ui->canvas->setGradientTexture(checked);
+}
+
+
+/*!
+ * \brief Enable or disable the binary cache of the prepared volumes.
+ * \param checked Whether the prepared volumes are cached.
+ */
+void MainWindow::on_volumeCache_toggled(bool checked)
+{
+    ui->canvas->setVolumeCache(checked);
+}
+
+
+/*!
+ * \brief Set the resolution scale used while moving the camera.
+ * \param arg1 Scale factor for the canvas resolution.
+ */
+void MainWindow::on_interactiveScale_valueChanged(double arg1)
+{
+    ui->canvas->setInteractiveScale(static_cast<float>(arg1));
+}
+
+
+/*!
+ * \brief Set the time without input before rendering at full quality.
+ * \param arg1 Timeout, in milliseconds.
+ */
+void MainWindow::on_idleTimeout_valueChanged(int arg1)
+{
+    ui->canvas->setIdleTimeout(arg1);
+}
+
+
+/*!
+ * \brief Set the maximum frame rate of the canvas.
+ * \param arg1 Frames per second, or zero for no limit.
+ */
+void MainWindow::on_frameRateLimit_valueChanged(int arg1)
+{
+    ui->canvas->setFrameRateLimit(arg1);
+}
+
+
+/*!
+ * \brief Enable or disable progressive refinement of still frames.
+ * \param checked Whether frames are accumulated.
+ */
+void MainWindow::on_progressive_toggled(bool checked)
+{
+    ui->canvas->setProgressive(checked);
+}
+
+
+/*!
+ * \brief Enable or disable the level of detail selection.
+ * \param checked Whether coarser levels are sampled for distant views.
+ */
+void MainWindow::on_levelOfDetail_toggled(bool checked)
+{
+    ui->canvas->setLevelOfDetail(checked);
+}
+
+
+/*!
+ * \brief Set the opacity at which alpha blended rays are terminated.
+ * \param arg1 Opacity, between 0 and 1.
+ */
+void MainWindow::on_opacityCutoff_valueChanged(double arg1)
+{
+    ui->canvas->setOpacityCutoff(static_cast<float>(arg1));
+}
+
+
+/*!
+ * \brief Enable or disable the adaptive alpha blending step.
+ * \param checked Whether the step varies with the local opacity change.
+ */
+void MainWindow::on_adaptiveStep_toggled(bool checked)
+{
+    ui->canvas->setAdaptiveStep(checked);
+}
+
+
+/*!
+ * \brief Enable or disable the pre-integrated transfer function.
+ * \param checked Whether alpha blended segments are pre-integrated.
+ */
+void MainWindow::on_preintegration_toggled(bool checked)
+{
+    ui->canvas->setPreintegration(checked);
+}
+
+
+/*!
+ * \brief Set the lower bound of the intensity window.
+ * \param arg1 Lower bound, in image intensity value.
+ */
+void MainWindow::on_windowLow_valueChanged(double arg1)
+{
+    ui->canvas->setWindow(arg1, ui->windowHigh->value());
+}
+
+
+/*!
+ * \brief Set the upper bound of the intensity window.
+ * \param arg1 Upper bound, in image intensity value.
+ */
+void MainWindow::on_windowHigh_valueChanged(double arg1)
+{
+    ui->canvas->setWindow(ui->windowLow->value(), arg1);
+}
+
+
+/*!
+ * \brief Set the precision of the volume texture.
+ * \param index Index of the format, in the order of `VoxelFormat`.
+ */
+void MainWindow::on_precision_currentIndexChanged(int index)
+{
+    ui->canvas->setVoxelFormat(static_cast<VoxelFormat>(index));
+}
+
+
+/*!
+ * \brief Enable or disable out-of-core streaming of the bricks.
+ * \param checked Whether the next volumes loaded are streamed in bricks.
+ */
+void MainWindow::on_brickStreaming_toggled(bool checked)
+{
+    ui->canvas->setBrickStreaming(checked);
+}
+
+
+/*!
+ * \brief Set the GPU memory reserved to the bricks of streamed volumes.
+ * \param arg1 Size of the brick cache, in MiB.
+ */
+void MainWindow::on_brickCacheSize_valueChanged(int arg1)
+{
+    ui->canvas->setBrickCacheSize(arg1);
+}
+
+
 /*!
  * \brief Open a dialog to choose the background colour.
  */
@@ -193,3 +564,35 @@ void MainWindow::on_background_clicked()
         ui->canvas->setBackground(colour);
     }
 }
+
+
+/*!
+ * \brief Show or hide the frame statistics overlay.
+ * \param checked Whether the overlay is shown.
+ */
+void MainWindow::on_frameStatistics_toggled(bool checked)
+{
+    ui->canvas->setFrameStatistics(checked);
+}
+
+
+/*!
+ * \brief Start or stop recording the frame statistics to a CSV file.
+ * \param checked Whether the statistics are recorded.
+ */
+void MainWindow::on_recordStatistics_toggled(bool checked)
+{
+    if (!checked) {
+        ui->canvas->setStatisticsFile(QString());
+        return;
+    }
+
+    const QString path = QFileDialog::getSaveFileName(this, tr("Record statistics"), "statistics.csv", tr("CSV files (*.csv)"));
+    if (path.isEmpty() || !ui->canvas->setStatisticsFile(path)) {
+        if (!path.isEmpty()) {
+            QMessageBox::warning(this, tr("Error"), tr("Cannot write ") + path);
+        }
+        const QSignalBlocker blocker(ui->recordStatistics);
+        ui->recordStatistics->setChecked(false);
+    }
+}
@@ -22,7 +22,11 @@
 
 #pragma once
 
+#include <optional>
+
 #include <QMainWindow>
+#include <QProgressBar>
+#include <QVector3D>
 
 namespace Ui {
 class MainWindow;
@@ -44,18 +48,82 @@ private slots:
 
     void load_volume(const QString& path);
 
+    void load_sequence(const QStringList& paths);
+
+    void series_frame_shown(int index, int count);
+
+    void surface_picked(const QVector3D& voxel, const QVector3D& position, double value);
+
+    void surface_missed(void);
+
+    void volume_load_started(const QString& path);
+
+    void volume_load_progress(int percent);
+
+    void volume_loaded(const QString& path);
+
+    void volume_load_failed(const QString& path, const QString& message);
+
     void on_stepLength_valueChanged(double arg1);
 
     void on_loadVolume_clicked();
 
+    void on_loadSequence_clicked();
+
+    void on_playSequence_toggled(bool checked);
+
+    void on_sequenceFrameRate_valueChanged(double arg1);
+
     void on_threshold_spinbox_valueChanged(double arg1);
 
     void on_threshold_slider_valueChanged(int value);
 
     void on_mode_currentTextChanged(const QString &arg1);
 
+    void on_skipEmptySpace_toggled(bool checked);
+
+    void on_proxyGeometry_toggled(bool checked);
+
+    void on_gradientTexture_toggled(bool checked);
+
+    void on_volumeCache_toggled(bool checked);
+
+    void on_interactiveScale_valueChanged(double arg1);
+
+    void on_idleTimeout_valueChanged(int arg1);
+
+    void on_frameRateLimit_valueChanged(int arg1);
+
+    void on_progressive_toggled(bool checked);
+
+    void on_levelOfDetail_toggled(bool checked);
+
+    void on_opacityCutoff_valueChanged(double arg1);
+
+    void on_adaptiveStep_toggled(bool checked);
+
+    void on_preintegration_toggled(bool checked);
+
+    void on_windowLow_valueChanged(double arg1);
+
+    void on_windowHigh_valueChanged(double arg1);
+
+    void on_precision_currentIndexChanged(int index);
+
+    void on_brickStreaming_toggled(bool checked);
+
+    void on_brickCacheSize_valueChanged(int arg1);
+
     void on_background_clicked();
 
+    void on_frameStatistics_toggled(bool checked);
+
+    void on_recordStatistics_toggled(bool checked);
+
 private:
     Ui::MainWindow *ui;
+    QProgressBar *m_loadProgress; /*!< Progress of the volume being loaded. */
+    std::optional<QVector3D> m_lastPick; /*!< Position of the previous point picked, measured from. */
+
+    void reset_playback(const bool enabled);
 };
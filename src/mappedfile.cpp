@@ -0,0 +1,106 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mappedfile.h"
+
+
+/*!
+ * \brief Map a file in memory.
+ * \param filename File to be mapped.
+ */
+MappedFile::MappedFile(const std::string& filename)
+{
+#ifdef _WIN32
+    m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                         OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (INVALID_HANDLE_VALUE == m_file) {
+        throw std::runtime_error("Cannot open file.");
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size) || 0 == size.QuadPart) {
+        CloseHandle(m_file);
+        throw std::runtime_error("Cannot map an empty file.");
+    }
+    m_size = static_cast<size_t>(size.QuadPart);
+
+    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (nullptr == m_mapping) {
+        CloseHandle(m_file);
+        throw std::runtime_error("Cannot map file.");
+    }
+
+    m_data = static_cast<const unsigned char *>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (nullptr == m_data) {
+        CloseHandle(m_mapping);
+        CloseHandle(m_file);
+        throw std::runtime_error("Cannot map file.");
+    }
+#else
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open file.");
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || 0 == st.st_size) {
+        close(fd);
+        throw std::runtime_error("Cannot map an empty file.");
+    }
+    m_size = static_cast<size_t>(st.st_size);
+
+    void *p = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps a reference to the file
+    if (MAP_FAILED == p) {
+        throw std::runtime_error("Cannot map file.");
+    }
+
+    // The payload is consumed front to back
+    madvise(p, m_size, MADV_SEQUENTIAL);
+
+    m_data = static_cast<const unsigned char *>(p);
+#endif
+}
+
+
+/*!
+ * \brief Destructor, unmapping the file.
+ */
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+    UnmapViewOfFile(m_data);
+    CloseHandle(m_mapping);
+    CloseHandle(m_file);
+#else
+    munmap(const_cast<unsigned char *>(m_data), m_size);
+#endif
+}
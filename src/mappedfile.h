@@ -0,0 +1,74 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+
+/*!
+ * \brief Read-only memory mapping of a whole file.
+ *
+ * The mapping is released when the object is destroyed.
+ */
+class MappedFile {
+
+public:
+
+    /*!
+     * \brief Map a file in memory.
+     * \param filename File to be mapped.
+     */
+    MappedFile(const std::string& filename);
+
+    /*!
+     * \brief Destructor, unmapping the file.
+     */
+    virtual ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /*!
+     * \brief Pointer to the first byte of the file.
+     */
+    const unsigned char * data(void) const {
+        return m_data;
+    }
+
+    /*!
+     * \brief Size of the file, in bytes.
+     */
+    size_t size(void) const {
+        return m_size;
+    }
+
+private:
+    const unsigned char *m_data {nullptr}; /*!< Start of the mapping. */
+    size_t m_size {0};                      /*!< Size of the mapping, in bytes. */
+#ifdef _WIN32
+    void *m_file {nullptr};                 /*!< File handle. */
+    void *m_mapping {nullptr};              /*!< File mapping handle. */
+#endif
+};
@@ -64,6 +64,9 @@ Mesh::Mesh(const std::vector<GLfloat>& vertices, const std::vector<GLuint> &indi
  */
 Mesh::~Mesh()
 {
+    glDeleteVertexArrays(1, &m_vao);
+    glDeleteBuffers(1, &m_vertex_VBO);
+    glDeleteBuffers(1, &m_index_VBO);
 }
 
 
@@ -0,0 +1,166 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <cctype>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+
+#include "metaimagevolume.h"
+
+
+/*!
+ * \brief Remove leading and trailing whitespace.
+ */
+static std::string trim(const std::string& s)
+{
+    const size_t first = s.find_first_not_of(" \t\r");
+    const size_t last = s.find_last_not_of(" \t\r");
+    return std::string::npos == first ? std::string() : s.substr(first, last - first + 1);
+}
+
+
+/*!
+ * \brief Create a volume from file.
+ * \param filename Header file to be loaded.
+ *
+ * The header is a list of "Key = Value" lines, terminated by the
+ * `ElementDataFile` key. A `LOCAL` data file starts right after it.
+ */
+MetaImageVolume::MetaImageVolume(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw VolumeReadError("Cannot open file.");
+    }
+
+    std::map<std::string, std::string> fields;
+    std::string line;
+    while (std::getline(file, line)) {
+        const size_t separator = line.find('=');
+        if (std::string::npos == separator) {
+            continue;
+        }
+
+        std::string key = trim(line.substr(0, separator));
+        for (auto& c : key) {
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+        fields[key] = trim(line.substr(separator + 1));
+        if ("elementdatafile" == key) {
+            break;
+        }
+    }
+    if (!fields.count("elementdatafile")) {
+        throw VolumeReadError("Not a valid MetaImage file.");
+    }
+    const size_t header_size = file.good() ? static_cast<size_t>(file.tellg()) : payload_at_end;
+    file.close();
+
+    const auto field = [&](const std::string& key, const std::string& fallback) {
+        const auto it = fields.find(key);
+        return fields.end() == it ? fallback : it->second;
+    };
+    const auto flag = [&](const std::string& key) {
+        const std::string value = field(key, "False");
+        return "True" == value || "true" == value || "1" == value;
+    };
+
+    if (field("ndims", "") != "3") {
+        throw VolumeReadError("Only three dimensional volumes are supported.");
+    }
+    if (field("elementnumberofchannels", "1") != "1") {
+        throw VolumeReadError("Only scalar volumes are supported.");
+    }
+
+    long long width, height, depth;
+    if (3 != std::sscanf(field("dimsize", "").c_str(), "%lld %lld %lld", &width, &height, &depth)
+            || width <= 0 || height <= 0 || depth <= 0) {
+        throw VolumeReadError("Cannot read volume dimension.");
+    }
+    m_size = {width, height, depth};
+
+    static const std::map<std::string, DataType> types {
+        {"MET_CHAR", DataType::Int8}, {"MET_UCHAR", DataType::Uint8},
+        {"MET_SHORT", DataType::Int16}, {"MET_USHORT", DataType::Uint16},
+        {"MET_INT", DataType::Int32}, {"MET_UINT", DataType::Uint32},
+        {"MET_LONG", DataType::Int32}, {"MET_ULONG", DataType::Uint32},
+        {"MET_LONG_LONG", DataType::Int64}, {"MET_ULONG_LONG", DataType::Uint64},
+        {"MET_FLOAT", DataType::Float}, {"MET_DOUBLE", DataType::Double},
+    };
+    const auto type = types.find(field("elementtype", ""));
+    if (types.end() == type) {
+        throw VolumeReadError("Unsupported data type '" + field("elementtype", "") + "'.");
+    }
+    m_datatype = type->second;
+
+    float x, y, z;
+    m_spacing = {1.0f, 1.0f, 1.0f};
+    if (3 == std::sscanf(field("elementspacing", field("elementsize", "")).c_str(), "%f %f %f", &x, &y, &z)) {
+        m_spacing = {x, y, z};
+    }
+    m_origin = {0.0f, 0.0f, 0.0f};
+    if (3 == std::sscanf(field("offset", field("origin", field("position", ""))).c_str(), "%f %f %f", &x, &y, &z)) {
+        m_origin = {x, y, z};
+    }
+
+    const Encoding encoding = flag("compresseddata") ? Encoding::Zlib : Encoding::Raw;
+    const bool big_endian = flag("elementbyteordermsb") || flag("binarydatabyteordermsb");
+
+    // Locate the payload
+    std::string data_file = field("elementdatafile", "");
+    size_t offset = 0;
+    if ("LOCAL" == data_file) {
+        if (payload_at_end == header_size) {
+            throw VolumeReadError("Missing volume data.");
+        }
+        data_file = filename;
+        offset = header_size;
+    }
+    else {
+        if ("LIST" == data_file.substr(0, 4) || std::string::npos != data_file.find('%')) {
+            throw VolumeReadError("Volumes split in multiple data files are not supported.");
+        }
+        const std::filesystem::path path(data_file);
+        data_file = path.is_absolute() ? path.string() : (std::filesystem::path(filename).parent_path() / path).string();
+
+        long long skip = 0;
+        if (fields.count("headersize") && 1 != std::sscanf(field("headersize", "").c_str(), "%lld", &skip)) {
+            throw VolumeReadError("Cannot read field 'HeaderSize'.");
+        }
+        if (skip < 0 && Encoding::Raw != encoding) {
+            throw VolumeReadError("Cannot locate compressed volume data.");
+        }
+        offset = skip < 0 ? payload_at_end : static_cast<size_t>(skip);
+    }
+
+    load_payload(data_file, offset, encoding, big_endian);
+}
+
+
+/*!
+ * \brief Destructor.
+ */
+MetaImageVolume::~MetaImageVolume()
+{
+}
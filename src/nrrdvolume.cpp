@@ -0,0 +1,282 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include "nrrdvolume.h"
+
+
+/*!
+ * \brief Create an empty volume.
+ */
+NrrdVolume::NrrdVolume(void)
+{
+}
+
+
+/*!
+ * \brief Create a volume from file.
+ * \param filename Header file to be loaded.
+ */
+NrrdVolume::NrrdVolume(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw VolumeReadError("Cannot open file.");
+    }
+
+    std::string magic;
+    std::getline(file, magic);
+    if (magic.substr(0, 4) != "NRRD") {
+        throw VolumeReadError("Not a valid NRRD file.");
+    }
+
+    // An attached payload starts after the blank line closing the header
+    const Fields fields = read_fields(file);
+    const size_t offset = file.good() ? static_cast<size_t>(file.tellg()) : payload_at_end;
+    file.close();
+
+    load_fields(fields, filename, filename, offset);
+}
+
+
+/*!
+ * \brief Destructor.
+ */
+NrrdVolume::~NrrdVolume()
+{
+}
+
+
+/*!
+ * \brief Read the fields of a NRRD header.
+ * \param file Stream, positioned after the magic line.
+ * \return The value of each field, by field name in lower case.
+ *
+ * The header ends at the first blank line, or at the end of the stream.
+ * Comments and key/value pairs are skipped.
+ */
+NrrdVolume::Fields NrrdVolume::read_fields(std::istream& file)
+{
+    Fields fields;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && '\r' == line.back()) {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            break;
+        }
+
+        const size_t separator = line.find(": ");
+        if ('#' == line[0] || std::string::npos == separator || line.find(":=") < separator) {
+            continue;
+        }
+
+        std::string key = line.substr(0, separator);
+        for (auto& c : key) {
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+        fields[key] = line.substr(separator + 2);
+    }
+    return fields;
+}
+
+
+/*!
+ * \brief Parse a NRRD type name.
+ * \param name Type name, in any of the spellings allowed by the format.
+ */
+template<typename DataType>
+static DataType parse_type(const std::string& name)
+{
+    static const std::map<std::string, DataType> types {
+        {"signed char", DataType::Int8}, {"int8", DataType::Int8}, {"int8_t", DataType::Int8},
+        {"uchar", DataType::Uint8}, {"unsigned char", DataType::Uint8}, {"uint8", DataType::Uint8}, {"uint8_t", DataType::Uint8},
+        {"short", DataType::Int16}, {"short int", DataType::Int16}, {"signed short", DataType::Int16},
+        {"signed short int", DataType::Int16}, {"int16", DataType::Int16}, {"int16_t", DataType::Int16},
+        {"ushort", DataType::Uint16}, {"unsigned short", DataType::Uint16}, {"unsigned short int", DataType::Uint16},
+        {"uint16", DataType::Uint16}, {"uint16_t", DataType::Uint16},
+        {"int", DataType::Int32}, {"signed int", DataType::Int32}, {"int32", DataType::Int32}, {"int32_t", DataType::Int32},
+        {"uint", DataType::Uint32}, {"unsigned int", DataType::Uint32}, {"uint32", DataType::Uint32}, {"uint32_t", DataType::Uint32},
+        {"longlong", DataType::Int64}, {"long long", DataType::Int64}, {"long long int", DataType::Int64},
+        {"signed long long", DataType::Int64}, {"signed long long int", DataType::Int64},
+        {"int64", DataType::Int64}, {"int64_t", DataType::Int64},
+        {"ulonglong", DataType::Uint64}, {"unsigned long long", DataType::Uint64}, {"unsigned long long int", DataType::Uint64},
+        {"uint64", DataType::Uint64}, {"uint64_t", DataType::Uint64},
+        {"float", DataType::Float}, {"double", DataType::Double},
+    };
+
+    const auto type = types.find(name);
+    if (types.end() == type) {
+        throw VolumeReadError("Unsupported data type '" + name + "'.");
+    }
+    return type->second;
+}
+
+
+/*!
+ * \brief Parse the vectors of a NRRD field, such as "(1,0,0) (0,1,0)".
+ * \param value Value of the field.
+ * \return The components of the vectors, in order.
+ */
+static std::vector<double> parse_vectors(const std::string& value)
+{
+    std::vector<double> components;
+    std::string text = value;
+    for (auto& c : text) {
+        if ('(' == c || ')' == c || ',' == c) {
+            c = ' ';
+        }
+    }
+    std::istringstream stream(text);
+    double component;
+    while (stream >> component) {
+        components.push_back(component);
+    }
+    return components;
+}
+
+
+/*!
+ * \brief Read the metadata and the payload described by the fields of a header.
+ * \param fields Fields of the header.
+ * \param header Header file, which detached data files are relative to.
+ * \param attached File holding the payload, when there is no data file field.
+ * \param attached_offset Offset of the payload in the attached file, or
+ *        `payload_at_end` if there is no attached payload.
+ */
+void NrrdVolume::load_fields(const Fields& fields, const std::string& header, const std::string& attached, const size_t attached_offset)
+{
+    const auto field = [&](const std::string& key, const std::string& fallback) {
+        const auto it = fields.find(key);
+        return fields.end() == it ? fallback : it->second;
+    };
+    const auto integer = [&](const std::string& key, const std::string& alias) {
+        long long value;
+        if (1 != std::sscanf(field(key, field(alias, "0")).c_str(), "%lld", &value)) {
+            throw VolumeReadError("Cannot read field '" + key + "'.");
+        }
+        return value;
+    };
+
+    if (field("dimension", "") != "3") {
+        throw VolumeReadError("Only three dimensional volumes are supported.");
+    }
+    m_datatype = parse_type<DataType>(field("type", ""));
+
+    long long width, height, depth;
+    if (3 != std::sscanf(field("sizes", "").c_str(), "%lld %lld %lld", &width, &height, &depth)
+            || width <= 0 || height <= 0 || depth <= 0) {
+        throw VolumeReadError("Cannot read volume dimension.");
+    }
+    m_size = {width, height, depth};
+
+    // Spacings may be given per axis, or as the length of each axis direction
+    m_spacing = {1.0f, 1.0f, 1.0f};
+    float sx, sy, sz;
+    const std::vector<double> directions = parse_vectors(field("space directions", ""));
+    if (3 == std::sscanf(field("spacings", "").c_str(), "%f %f %f", &sx, &sy, &sz)) {
+        m_spacing = {sx, sy, sz};
+    }
+    else if (9 == directions.size()) {
+        const auto norm = [&](const size_t i) {
+            return static_cast<float>(std::sqrt(directions[i] * directions[i]
+                                                + directions[i + 1] * directions[i + 1]
+                                                + directions[i + 2] * directions[i + 2]));
+        };
+        m_spacing = {norm(0), norm(3), norm(6)};
+    }
+
+    m_origin = {0.0f, 0.0f, 0.0f};
+    const std::vector<double> origin = parse_vectors(field("space origin", ""));
+    if (3 == origin.size()) {
+        m_origin = {origin[0], origin[1], origin[2]};
+    }
+
+    const std::string encoding_name = field("encoding", "raw");
+    Encoding encoding;
+    if ("raw" == encoding_name) {
+        encoding = Encoding::Raw;
+    }
+    else if ("txt" == encoding_name || "text" == encoding_name || "ascii" == encoding_name) {
+        encoding = Encoding::Ascii;
+    }
+    else if ("gz" == encoding_name || "gzip" == encoding_name) {
+        encoding = Encoding::Zlib;
+    }
+    else {
+        throw VolumeReadError("Unsupported encoding '" + encoding_name + "'.");
+    }
+    const bool big_endian = "big" == field("endian", "little");
+
+    // Locate the payload
+    std::string data_file = field("data file", field("datafile", ""));
+    size_t offset = 0;
+    if (data_file.empty()) {
+        if (payload_at_end == attached_offset) {
+            throw VolumeReadError("Missing volume data.");
+        }
+        data_file = attached;
+        offset = attached_offset;
+    }
+    else {
+        if ("LIST" == data_file.substr(0, 4) || std::string::npos != data_file.find('%')) {
+            throw VolumeReadError("Volumes split in multiple data files are not supported.");
+        }
+        const std::filesystem::path path(data_file);
+        data_file = path.is_absolute() ? path.string() : (std::filesystem::path(header).parent_path() / path).string();
+    }
+
+    const long long line_skip = integer("line skip", "lineskip");
+    if (line_skip > 0) {
+        std::ifstream file(data_file, std::ios::binary);
+        file.seekg(offset);
+        std::string line;
+        for (long long i = 0; i < line_skip && std::getline(file, line); ++i) {
+        }
+        if (!file.good()) {
+            throw VolumeReadError("Truncated volume data.");
+        }
+        offset = static_cast<size_t>(file.tellg());
+    }
+
+    // Skipping bytes of a compressed payload would happen after decompression
+    const long long byte_skip = integer("byte skip", "byteskip");
+    if (byte_skip != 0 && Encoding::Raw != encoding) {
+        throw VolumeReadError("Byte skip is only supported for raw encoding.");
+    }
+    if (byte_skip < 0) {
+        offset = payload_at_end;
+    }
+    else {
+        offset += static_cast<size_t>(byte_skip);
+    }
+
+    load_payload(data_file, offset, encoding, big_endian);
+}
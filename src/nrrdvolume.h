@@ -0,0 +1,61 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <istream>
+#include <map>
+#include <string>
+
+#include "volume.h"
+
+
+/*!
+ * \brief Represent a NRRD volume.
+ *
+ * This class allows to load a three dimensional scalar NRRD volume, either
+ * with an attached payload (`.nrrd`) or with a detached header (`.nhdr`).
+ * Raw, ASCII and gzip encodings are supported.
+ */
+class NrrdVolume : public Volume {
+
+public:
+
+    /*!
+     * \brief Create a volume from file.
+     * \param filename Header file to be loaded.
+     */
+    NrrdVolume(const std::string& filename);
+
+    /*!
+     * \brief Destructor.
+     */
+    virtual ~NrrdVolume();
+
+protected:
+    typedef std::map<std::string, std::string> Fields;
+
+    NrrdVolume(void);
+
+    static Fields read_fields(std::istream& file);
+    void load_fields(const Fields& fields, const std::string& header, const std::string& attached, const size_t attached_offset);
+};
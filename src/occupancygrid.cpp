@@ -0,0 +1,197 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <utility>
+
+#include "occupancygrid.h"
+#include "voxelkernels.h"
+
+
+/*!
+ * \brief Create an empty grid.
+ */
+OccupancyGrid::OccupancyGrid(void)
+{
+}
+
+
+/*!
+ * \brief Lowest 8 bit level not above a normalised voxel.
+ */
+static inline unsigned char lower_level(const uint8_t v) { return v; }
+
+template<typename U>
+static inline unsigned char lower_level(const U v)
+{
+    return static_cast<unsigned char>(std::clamp(std::floor(255.0f * to_unit(v)), 0.0f, 255.0f));
+}
+
+
+/*!
+ * \brief Highest 8 bit level not below a normalised voxel.
+ */
+static inline unsigned char upper_level(const uint8_t v) { return v; }
+
+template<typename U>
+static inline unsigned char upper_level(const U v)
+{
+    return static_cast<unsigned char>(std::clamp(std::ceil(255.0f * to_unit(v)), 0.0f, 255.0f));
+}
+
+
+/*!
+ * \brief Interleaved (minimum, maximum) ranges of each brick of a volume.
+ * \param width Number of voxels along x.
+ * \param height Number of voxels along y.
+ * \param depth Number of voxels along z.
+ * \param brick_size Side of each brick, in voxels.
+ * \param row Function returning an accessor for the voxels of row `(y, z)`,
+ *            indexed by x.
+ */
+template<typename F>
+static std::vector<unsigned char> brick_ranges(const size_t width, const size_t height, const size_t depth, const size_t brick_size, F&& row)
+{
+    const size_t bricks_x = (width + brick_size - 1) / brick_size;
+    const size_t bricks_y = (height + brick_size - 1) / brick_size;
+    const size_t bricks_z = (depth + brick_size - 1) / brick_size;
+    std::vector<unsigned char> ranges(2 * bricks_x * bricks_y * bricks_z);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (std::ptrdiff_t k = 0; k < static_cast<std::ptrdiff_t>(bricks_z); ++k) {
+        // Include a one voxel border, reached by interpolation within the brick
+        const size_t z0 = k * brick_size > 0 ? k * brick_size - 1 : 0;
+        const size_t z1 = std::min((k + 1) * brick_size + 1, depth);
+
+        for (size_t j = 0; j < bricks_y; ++j) {
+            const size_t y0 = j * brick_size > 0 ? j * brick_size - 1 : 0;
+            const size_t y1 = std::min((j + 1) * brick_size + 1, height);
+
+            for (size_t i = 0; i < bricks_x; ++i) {
+                const size_t x0 = i * brick_size > 0 ? i * brick_size - 1 : 0;
+                const size_t x1 = std::min((i + 1) * brick_size + 1, width);
+
+                unsigned char minimum = 255;
+                unsigned char maximum = 0;
+                for (size_t z = z0; z < z1; ++z) {
+                    for (size_t y = y0; y < y1; ++y) {
+                        const auto voxels = row(y, z);
+                        for (size_t x = x0; x < x1; ++x) {
+                            minimum = std::min(minimum, lower_level(voxels[x]));
+                            maximum = std::max(maximum, upper_level(voxels[x]));
+                        }
+                    }
+                }
+
+                const size_t brick = (k * bricks_y + j) * bricks_x + i;
+                ranges[2 * brick] = minimum;
+                ranges[2 * brick + 1] = maximum;
+            }
+        }
+    }
+
+    return ranges;
+}
+
+
+/*!
+ * \brief Build the grid for a volume.
+ * \param data Voxels, normalised (see `normalise_kernel`).
+ * \param width Number of voxels along x.
+ * \param height Number of voxels along y.
+ * \param depth Number of voxels along z.
+ * \param brick_size Side of each brick, in voxels.
+ */
+template<typename U>
+OccupancyGrid::OccupancyGrid(const U *data, const size_t width, const size_t height, const size_t depth, const size_t brick_size)
+    : OccupancyGrid(brick_ranges(width, height, depth, brick_size, [&](const size_t y, const size_t z) {
+                        return data + (z * height + y) * width;
+                    }),
+                    (width + brick_size - 1) / brick_size,
+                    (height + brick_size - 1) / brick_size,
+                    (depth + brick_size - 1) / brick_size,
+                    brick_size)
+{
+}
+
+template OccupancyGrid::OccupancyGrid(const uint8_t *, size_t, size_t, size_t, size_t);
+template OccupancyGrid::OccupancyGrid(const uint16_t *, size_t, size_t, size_t, size_t);
+template OccupancyGrid::OccupancyGrid(const half_t *, size_t, size_t, size_t, size_t);
+template OccupancyGrid::OccupancyGrid(const float *, size_t, size_t, size_t, size_t);
+
+
+/*!
+ * \brief Accessor for a row of a bricked layout, indexed by x.
+ */
+template<typename U>
+struct BrickedRow {
+    const BrickedLayout<U>& layout; /*!< Layout holding the row. */
+    const U *row;                   /*!< First voxel of the row. */
+
+    U operator[](const size_t x) const {
+        return row[layout.offset_x(x)];
+    }
+};
+
+
+/*!
+ * \brief Build the grid for a volume stored in Z-ordered bricks.
+ * \param voxels Voxels, normalised (see `bricked_normalise_kernel`).
+ * \param brick_size Side of each brick, in voxels.
+ */
+template<typename U>
+OccupancyGrid::OccupancyGrid(const BrickedLayout<U>& voxels, const size_t brick_size)
+    : OccupancyGrid(brick_ranges(voxels.width(), voxels.height(), voxels.depth(), brick_size, [&](const size_t y, const size_t z) {
+                        return BrickedRow<U> {voxels, voxels.data() + voxels.index(0, y, z)};
+                    }),
+                    (voxels.width() + brick_size - 1) / brick_size,
+                    (voxels.height() + brick_size - 1) / brick_size,
+                    (voxels.depth() + brick_size - 1) / brick_size,
+                    brick_size)
+{
+}
+
+template OccupancyGrid::OccupancyGrid(const BrickedLayout<uint8_t>&, size_t);
+template OccupancyGrid::OccupancyGrid(const BrickedLayout<uint16_t>&, size_t);
+template OccupancyGrid::OccupancyGrid(const BrickedLayout<float>&, size_t);
+
+
+/*!
+ * \brief Wrap ranges computed elsewhere.
+ * \param ranges Interleaved (minimum, maximum) pairs, with x varying fastest.
+ * \param width Number of bricks along x.
+ * \param height Number of bricks along y.
+ * \param depth Number of bricks along z.
+ * \param brick_size Side of each brick, in voxels.
+ *
+ * Each range must include the voxels immediately around its brick.
+ */
+OccupancyGrid::OccupancyGrid(std::vector<unsigned char> ranges, const size_t width, const size_t height, const size_t depth, const size_t brick_size)
+    : m_brick_size {brick_size}
+    , m_width {width}
+    , m_height {height}
+    , m_depth {depth}
+    , m_data {std::move(ranges)}
+{
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "voxellayout.h"
+
+
+/*!
+ * \brief Coarse grid holding the intensity range of each brick of a volume.
+ *
+ * The volume is split in cubic bricks, and for each brick the minimum and
+ * maximum intensity are stored. The range of each brick also includes the
+ * voxels immediately around it, so it accounts for any value that can be
+ * produced by trilinear interpolation inside the brick.
+ */
+class OccupancyGrid {
+
+public:
+
+    /*!
+     * \brief Create an empty grid.
+     */
+    OccupancyGrid(void);
+
+    /*!
+     * \brief Build the grid for a volume.
+     * \param data Voxels, normalised (see `normalise_kernel`).
+     * \param width Number of voxels along x.
+     * \param height Number of voxels along y.
+     * \param depth Number of voxels along z.
+     * \param brick_size Side of each brick, in voxels.
+     *
+     * The ranges are always quantised to 8 bits, rounding outwards, so they
+     * stay conservative for voxels with a higher precision.
+     */
+    template<typename U>
+    OccupancyGrid(const U *data, const size_t width, const size_t height, const size_t depth, const size_t brick_size);
+
+    /*!
+     * \brief Build the grid for a volume stored in Z-ordered bricks.
+     * \param voxels Voxels, normalised (see `Volume::read_bricked`).
+     * \param brick_size Side of each brick, in voxels.
+     *
+     * Bricks no larger than `BrickedLayout::brick_side` are read from a few
+     * adjacent storage bricks, instead of a few slices.
+     */
+    template<typename U>
+    OccupancyGrid(const BrickedLayout<U>& voxels, const size_t brick_size);
+
+    /*!
+     * \brief Wrap ranges computed elsewhere.
+     * \param ranges Interleaved (minimum, maximum) pairs, with x varying fastest.
+     * \param width Number of bricks along x.
+     * \param height Number of bricks along y.
+     * \param depth Number of bricks along z.
+     * \param brick_size Side of each brick, in voxels.
+     */
+    OccupancyGrid(std::vector<unsigned char> ranges, const size_t width, const size_t height, const size_t depth, const size_t brick_size);
+
+    /*!
+     * \brief Side of each brick, in voxels.
+     */
+    size_t brick_size(void) const {
+        return m_brick_size;
+    }
+
+    /*!
+     * \brief Number of bricks along x.
+     */
+    size_t width(void) const {
+        return m_width;
+    }
+
+    /*!
+     * \brief Number of bricks along y.
+     */
+    size_t height(void) const {
+        return m_height;
+    }
+
+    /*!
+     * \brief Number of bricks along z.
+     */
+    size_t depth(void) const {
+        return m_depth;
+    }
+
+    /*!
+     * \brief Minimum intensity within a brick.
+     */
+    unsigned char minimum(const size_t i, const size_t j, const size_t k) const {
+        return m_data[2 * index(i, j, k)];
+    }
+
+    /*!
+     * \brief Maximum intensity within a brick.
+     */
+    unsigned char maximum(const size_t i, const size_t j, const size_t k) const {
+        return m_data[2 * index(i, j, k) + 1];
+    }
+
+    /*!
+     * \brief Interleaved (minimum, maximum) pairs, with x varying fastest.
+     */
+    const std::vector<unsigned char>& data(void) const {
+        return m_data;
+    }
+
+private:
+    size_t m_brick_size {0};           /*!< Side of each brick, in voxels. */
+    size_t m_width {0};                /*!< Number of bricks along x. */
+    size_t m_height {0};               /*!< Number of bricks along y. */
+    size_t m_depth {0};                /*!< Number of bricks along z. */
+    std::vector<unsigned char> m_data; /*!< Interleaved (minimum, maximum) pairs. */
+
+    size_t index(const size_t i, const size_t j, const size_t k) const {
+        return (k * m_height + j) * m_width + i;
+    }
+};
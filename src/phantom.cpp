@@ -0,0 +1,356 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+#include "phantom.h"
+
+
+/*!
+ * \brief Hash of an integer, with good avalanche (splitmix64).
+ */
+static uint64_t splitmix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+
+/*!
+ * \brief Uniform value in [0, 1), depending only on a seed.
+ *
+ * The values do not depend on the standard library or on the number of
+ * threads, so the phantoms are the same on every machine.
+ */
+static double uniform(const uint64_t seed)
+{
+    return (splitmix64(seed) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+/*!
+ * \brief Approximately normal value with unit variance, depending only on a seed.
+ */
+static double gaussian(const uint64_t seed)
+{
+    const double sum = uniform(4 * seed) + uniform(4 * seed + 1) + uniform(4 * seed + 2) + uniform(4 * seed + 3);
+    return (sum - 2.0) * std::sqrt(3.0);
+}
+
+
+/*!
+ * \brief Segment of a tube, in normalised coordinates.
+ */
+struct Segment
+{
+    std::array<double, 3> a; /*!< First end. */
+    std::array<double, 3> b; /*!< Second end. */
+    double radius;
+};
+
+
+/*!
+ * \brief Grow a tree of tubes from a few roots, by deterministic random walks.
+ */
+static std::vector<Segment> vessel_tree(void)
+{
+    struct Branch {
+        std::array<double, 3> position;
+        std::array<double, 3> direction;
+        double radius;
+    };
+
+    uint64_t state = 0;
+    const auto random = [&]() { return uniform(++state); };
+
+    // Roots on a sphere, heading towards the centre
+    std::vector<Branch> branches;
+    for (int i = 0; i < 6; ++i) {
+        const double theta = 2.0 * M_PI * random();
+        const double z = 2.0 * random() - 1.0;
+        const double s = std::sqrt(1.0 - z * z);
+        const std::array<double, 3> p {s * std::cos(theta), s * std::sin(theta), z};
+        branches.push_back({{0.85 * p[0], 0.85 * p[1], 0.85 * p[2]}, {-p[0], -p[1], -p[2]}, 0.025});
+    }
+
+    const size_t max_segments = 4000;
+    const double step = 0.04;
+
+    std::vector<Segment> segments;
+    while (!branches.empty() && segments.size() < max_segments) {
+        Branch branch = branches.back();
+        branches.pop_back();
+
+        while (branch.radius > 0.002 && segments.size() < max_segments) {
+            // Perturb the direction, and take a step
+            std::array<double, 3>& d = branch.direction;
+            for (auto& c : d) {
+                c += 0.5 * (random() - 0.5);
+            }
+            const double norm = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+            for (auto& c : d) {
+                c /= norm;
+            }
+
+            Segment segment {branch.position, {}, branch.radius};
+            for (int i = 0; i < 3; ++i) {
+                segment.b[i] = branch.position[i] + step * d[i];
+            }
+            if (std::max({std::abs(segment.b[0]), std::abs(segment.b[1]), std::abs(segment.b[2])}) > 0.95) {
+                break;
+            }
+            segments.push_back(segment);
+            branch.position = segment.b;
+            branch.radius *= 0.98;
+
+            // Fork a thinner branch, at an angle
+            if (random() < 0.12) {
+                Branch child = branch;
+                child.radius *= 0.7;
+                for (auto& c : child.direction) {
+                    c += 1.5 * (random() - 0.5);
+                }
+                branches.push_back(child);
+            }
+        }
+    }
+    return segments;
+}
+
+
+/*!
+ * \brief Distance between a point and a segment.
+ */
+static double distance(const std::array<double, 3>& p, const Segment& s)
+{
+    std::array<double, 3> ab, ap;
+    for (int i = 0; i < 3; ++i) {
+        ab[i] = s.b[i] - s.a[i];
+        ap[i] = p[i] - s.a[i];
+    }
+    const double length2 = ab[0] * ab[0] + ab[1] * ab[1] + ab[2] * ab[2];
+    const double t = std::clamp((ap[0] * ab[0] + ap[1] * ab[1] + ap[2] * ab[2]) / length2, 0.0, 1.0);
+    double d2 = 0.0;
+    for (int i = 0; i < 3; ++i) {
+        const double c = ap[i] - t * ab[i];
+        d2 += c * c;
+    }
+    return std::sqrt(d2);
+}
+
+
+/*!
+ * \brief Ellipsoid of the Shepp-Logan phantom.
+ */
+struct Ellipsoid
+{
+    double density;                 /*!< Added to the voxels within the ellipsoid. */
+    std::array<double, 3> axes;     /*!< Semi-axes. */
+    std::array<double, 3> centre;
+    double phi;                     /*!< Rotation about the z axis, in degrees. */
+};
+
+
+/*!
+ * \brief Ellipsoids of the modified 3D Shepp-Logan phantom (Toft, 1996).
+ */
+static const std::vector<Ellipsoid> shepp_logan {
+    { 1.0, {0.6900, 0.920, 0.810}, { 0.00,  0.0000,  0.00},   0.0},
+    {-0.8, {0.6624, 0.874, 0.780}, { 0.00, -0.0184,  0.00},   0.0},
+    {-0.2, {0.1100, 0.310, 0.220}, { 0.22,  0.0000,  0.00}, -18.0},
+    {-0.2, {0.1600, 0.410, 0.280}, {-0.22,  0.0000,  0.00},  18.0},
+    { 0.1, {0.2100, 0.250, 0.410}, { 0.00,  0.3500, -0.15},   0.0},
+    { 0.1, {0.0460, 0.046, 0.050}, { 0.00,  0.1000,  0.25},   0.0},
+    { 0.1, {0.0460, 0.046, 0.050}, { 0.00, -0.1000,  0.25},   0.0},
+    { 0.1, {0.0460, 0.023, 0.050}, {-0.08, -0.6050,  0.00},   0.0},
+    { 0.1, {0.0230, 0.023, 0.020}, { 0.00, -0.6060,  0.00},   0.0},
+    { 0.1, {0.0230, 0.046, 0.020}, { 0.06, -0.6050,  0.00},   0.0},
+};
+
+
+/*!
+ * \brief Names of the phantoms, in the order of `Phantom`.
+ */
+std::vector<std::string> phantom_names(void)
+{
+    return {"shells", "ct", "vessels"};
+}
+
+
+/*!
+ * \brief Phantom with a given name.
+ * \param name Name of the phantom, as in `phantom_names`.
+ *
+ * Throws `std::invalid_argument` if there is no phantom with that name.
+ */
+Phantom parse_phantom(const std::string& name)
+{
+    const std::vector<std::string> names = phantom_names();
+    const auto it = std::find(names.begin(), names.end(), name);
+    if (it == names.end()) {
+        throw std::invalid_argument("Unknown phantom '" + name + "'.");
+    }
+    return static_cast<Phantom>(it - names.begin());
+}
+
+
+/*!
+ * \brief Generate a phantom and write it as a NRRD file.
+ * \param filename Destination file, overwritten.
+ * \param phantom Phantom to be generated.
+ * \param side Number of voxels for each axis.
+ *
+ * The phantoms are defined in normalised coordinates, so they depict the
+ * same scene at every size, and they are bit for bit reproducible. They are
+ * generated a slab at a time, so volumes larger than the memory can be
+ * written. The file appears only once complete. Throws `std::runtime_error`
+ * if the file cannot be written.
+ */
+void write_phantom(const std::string& filename, const Phantom phantom, const size_t side)
+{
+    const bool wide = Phantom::Ct == phantom;
+    const size_t voxel_size = wide ? 2 : 1;
+    const size_t slice_voxels = side * side;
+    const size_t slab_slices = 16;
+    const double voxel = 2.0 / side; // Side of a voxel, in normalised coordinates
+
+    const uint16_t one = 1;
+    const bool little_endian = *reinterpret_cast<const unsigned char *>(&one) == 1;
+
+    const std::string partial = filename + ".part";
+    std::ofstream file(partial, std::ios::binary | std::ios::trunc);
+    file << "NRRD0004\n"
+         << "type: " << (wide ? "uint16" : "uint8") << "\n"
+         << "dimension: 3\n"
+         << "sizes: " << side << " " << side << " " << side << "\n"
+         << "spacings: 1 1 1\n"
+         << "encoding: raw\n"
+         << "endian: " << (little_endian ? "little" : "big") << "\n"
+         << "\n";
+
+    const std::vector<Segment> segments = Phantom::Vessels == phantom ? vessel_tree() : std::vector<Segment> {};
+    const auto coordinate = [&](const size_t i) { return (2.0 * i + 1.0) / side - 1.0; };
+
+    std::vector<unsigned char> slab(slab_slices * slice_voxels * voxel_size);
+    for (size_t z0 = 0; z0 < side && file; z0 += slab_slices) {
+        const size_t slices = std::min(slab_slices, side - z0);
+        std::fill(slab.begin(), slab.end(), 0);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (size_t k = 0; k < slices; ++k) {
+            const size_t z = z0 + k;
+            const double pz = coordinate(z);
+            unsigned char *slice = slab.data() + k * slice_voxels * voxel_size;
+
+            if (Phantom::Shells == phantom) {
+                // Seven shells, one voxel thick at least, brighter outwards
+                const double half_thickness = std::max(0.005, 0.75 * voxel);
+                for (size_t y = 0; y < side; ++y) {
+                    for (size_t x = 0; x < side; ++x) {
+                        const double px = coordinate(x), py = coordinate(y);
+                        const double r = std::sqrt(px * px + py * py + pz * pz);
+                        const int shell = static_cast<int>(std::lround(8.0 * r));
+                        if (shell < 1 || shell > 7) {
+                            continue;
+                        }
+                        const double weight = std::clamp(1.0 - std::abs(r - shell / 8.0) / half_thickness, 0.0, 1.0);
+                        slice[y * side + x] = static_cast<unsigned char>(std::lround(weight * (32 * shell - 1)));
+                    }
+                }
+            }
+            else if (Phantom::Ct == phantom) {
+                // Only the ellipsoids crossing the slice are tested
+                struct Section {
+                    const Ellipsoid *e;
+                    double cos_phi, sin_phi, w2;
+                };
+                std::vector<Section> sections;
+                for (const auto& e : shepp_logan) {
+                    const double w = (pz - e.centre[2]) / e.axes[2];
+                    if (w * w <= 1.0) {
+                        const double phi = e.phi * M_PI / 180.0;
+                        sections.push_back({&e, std::cos(phi), std::sin(phi), w * w});
+                    }
+                }
+
+                uint16_t *values = reinterpret_cast<uint16_t *>(slice);
+                for (size_t y = 0; y < side; ++y) {
+                    for (size_t x = 0; x < side; ++x) {
+                        const double px = coordinate(x), py = coordinate(y);
+                        double density = 0.0;
+                        for (const auto& s : sections) {
+                            const double dx = px - s.e->centre[0], dy = py - s.e->centre[1];
+                            const double u = (s.cos_phi * dx + s.sin_phi * dy) / s.e->axes[0];
+                            const double v = (-s.sin_phi * dx + s.cos_phi * dy) / s.e->axes[1];
+                            if (u * u + v * v + s.w2 <= 1.0) {
+                                density += s.e->density;
+                            }
+                        }
+                        const uint64_t index = (z * side + y) * side + x;
+                        const double value = 50.0 + 2000.0 * density + 25.0 * gaussian(index);
+                        values[y * side + x] = static_cast<uint16_t>(std::clamp(std::lround(value), 0l, 65535l));
+                    }
+                }
+            }
+            else {
+                // Rasterise the segments crossing the slice, with antialiased borders
+                for (const auto& s : segments) {
+                    const double reach = s.radius + voxel;
+                    if (pz < std::min(s.a[2], s.b[2]) - reach || pz > std::max(s.a[2], s.b[2]) + reach) {
+                        continue;
+                    }
+                    const auto first = [&](const double c) {
+                        return static_cast<size_t>(std::clamp((c + 1.0) / voxel - 0.5, 0.0, side - 1.0));
+                    };
+                    const size_t x_begin = first(std::min(s.a[0], s.b[0]) - reach);
+                    const size_t x_end = first(std::max(s.a[0], s.b[0]) + reach) + 1;
+                    const size_t y_begin = first(std::min(s.a[1], s.b[1]) - reach);
+                    const size_t y_end = first(std::max(s.a[1], s.b[1]) + reach) + 1;
+                    for (size_t y = y_begin; y < y_end; ++y) {
+                        for (size_t x = x_begin; x < x_end; ++x) {
+                            const double d = distance({coordinate(x), coordinate(y), pz}, s);
+                            const double weight = std::clamp((s.radius - d) / voxel + 0.5, 0.0, 1.0);
+                            unsigned char& value = slice[y * side + x];
+                            value = std::max(value, static_cast<unsigned char>(std::lround(255.0 * weight)));
+                        }
+                    }
+                }
+            }
+        }
+
+        file.write(reinterpret_cast<const char *>(slab.data()), slices * slice_voxels * voxel_size);
+    }
+
+    file.close();
+    if (!file || std::rename(partial.c_str(), filename.c_str()) != 0) {
+        std::remove(partial.c_str());
+        throw std::runtime_error("Cannot write " + filename + ".");
+    }
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <fstream>
+
+#include "rawvolume.h"
+
+
+/*!
+ * \brief Create a volume from file.
+ * \param filename Raw file to be loaded.
+ */
+RawVolume::RawVolume(const std::string& filename)
+{
+    std::ifstream file(sidecar(filename), std::ios::binary);
+    if (!file.is_open()) {
+        throw VolumeReadError("Cannot open sidecar file '" + sidecar(filename) + "'.");
+    }
+
+    // The dimension is implied, and the payload is the raw file itself
+    Fields fields = read_fields(file);
+    fields.emplace("dimension", "3");
+    file.close();
+    m_sources.push_back(sidecar(filename));
+
+    load_fields(fields, filename, filename, 0);
+}
+
+
+/*!
+ * \brief Destructor.
+ */
+RawVolume::~RawVolume()
+{
+}
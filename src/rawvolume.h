@@ -0,0 +1,64 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "nrrdvolume.h"
+
+
+/*!
+ * \brief Represent a headerless raw volume, described by a sidecar file.
+ *
+ * The metadata of `volume.raw` is read from `volume.raw.txt`, holding NRRD
+ * fields (one "field: value" per line). At least the `sizes` and `type`
+ * fields are required, and the other fields default to a little endian,
+ * uncompressed payload starting at the beginning of the file:
+ *
+ *     sizes: 256 256 128
+ *     type: uint16
+ *     endian: little
+ *     spacings: 0.5 0.5 1.0
+ */
+class RawVolume : public NrrdVolume {
+
+public:
+
+    /*!
+     * \brief Create a volume from file.
+     * \param filename Raw file to be loaded.
+     */
+    RawVolume(const std::string& filename);
+
+    /*!
+     * \brief Destructor.
+     */
+    virtual ~RawVolume();
+
+    /*!
+     * \brief Path of the sidecar of a raw file.
+     */
+    static std::string sidecar(const std::string& filename) {
+        return filename + ".txt";
+    }
+};
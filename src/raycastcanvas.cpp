@@ -20,37 +20,37 @@
  * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <cmath>
 #include <cstdlib>
 #include <ctime>
 #include <iostream>
 #include <vector>
 
+#include <QtConcurrent>
 #include <QtWidgets>
 
 #include "raycastcanvas.h"
 
 
-/*!
- * \brief Convert a QColor to a QVector3D.
- * \return A QVector3D holding a RGB representation of the colour.
- */
-QVector3D to_vector3d(const QColor& colour) {
-    return QVector3D(colour.redF(), colour.greenF(), colour.blueF());
-}
-
-
 /*!
  * \brief Constructor for the canvas.
  * \param parent Parent widget.
  */
 RayCastCanvas::RayCastCanvas(QWidget *parent)
     : QOpenGLWidget {parent}
-    , m_raycasting_volume {nullptr}
 {
-    // Register the rendering modes here, so they are available to the UI when it is initialised
-    m_modes["Isosurface"] = [&]() { RayCastCanvas::raycasting("Isosurface"); };
-    m_modes["Alpha blending"] = [&]() { RayCastCanvas::raycasting("Alpha blending"); };
-    m_modes["MIP"] = [&]() { RayCastCanvas::raycasting("MIP"); };
+    // Render at full quality once the input has been idle for a while
+    m_idleTimer.setSingleShot(true);
+    m_idleTimer.setInterval(300);
+    connect(&m_idleTimer, &QTimer::timeout, this, &RayCastCanvas::interaction_finished);
+
+    // Frames of a sequence are drawn when due, or as soon as they are decoded
+    connect(&m_series, &TimeSeriesPlayer::tick, this, [this]() { m_scheduler.request(); });
+    connect(&m_series, &TimeSeriesPlayer::frameDecoded, this, [this]() { m_scheduler.request(); });
+    connect(&m_series, &TimeSeriesPlayer::frameFailed, this, [this](const QString& path, const QString& message) {
+        close_series();
+        emit volumeLoadFailed(path, message);
+    });
 }
 
 
@@ -59,10 +59,10 @@ RayCastCanvas::RayCastCanvas(QWidget *parent)
  */
 RayCastCanvas::~RayCastCanvas()
 {
-    for (auto& [key, val] : m_shaders) {
-        delete val;
-    }
-    delete m_raycasting_volume;
+    makeCurrent();
+    m_lowResFbo.reset();
+    m_accumulationFbo.reset();
+    m_renderer.release();
 }
 
 
@@ -73,12 +73,10 @@ void RayCastCanvas::initializeGL()
 {
     initializeOpenGLFunctions();
 
-    m_raycasting_volume = new RayCastVolume();
-    m_raycasting_volume->create_noise();
-
-    add_shader("Isosurface", ":/shaders/isosurface.vert", ":/shaders/isosurface.frag");
-    add_shader("Alpha blending", ":/shaders/alpha_blending.vert", ":/shaders/alpha_blending.frag");
-    add_shader("MIP", ":/shaders/maximum_intensity_projection.vert", ":/shaders/maximum_intensity_projection.frag");
+    m_renderer.initialise();
+    m_renderer.volume()->set_brick_cache_size(m_brickCacheSize);
+    m_renderer.volume()->set_texture_pool_budget(m_volumeOptions.texture_budget);
+    m_renderer.volume()->create_noise();
 }
 
 
@@ -90,10 +88,231 @@ void RayCastCanvas::initializeGL()
 void RayCastCanvas::resizeGL(int w, int h)
 {
     (void) w; (void) h;
-    m_viewportSize = {(float) scaled_width(), (float) scaled_height()};
-    m_aspectRatio = (float) scaled_width() / scaled_height();
     glViewport(0, 0, scaled_width(), scaled_height());
-    m_raycasting_volume->create_noise();
+    m_renderer.volume()->create_noise();
+}
+
+
+/*!
+ * \brief Load a volume in the background.
+ * \param volume File to be loaded.
+ *
+ * The volume is read and normalised on a worker thread, and then uploaded to
+ * the GPU a slab per frame. The current volume is rendered until the new one
+ * is ready. Loading a volume while another one is loading supersedes it.
+ */
+void RayCastCanvas::setVolume(const QString& volume)
+{
+    struct Result {
+        std::shared_ptr<const PreparedVolume> volume;
+        QString error;
+    };
+
+    close_series();
+    const int generation = ++m_loadGeneration;
+    m_loadingPath = volume;
+    emit volumeLoadStarted(volume);
+
+    auto watcher = new QFutureWatcher<Result>(this);
+    connect(watcher, &QFutureWatcher<Result>::finished, this, [this, watcher, generation, volume]() {
+        const Result result = watcher->result();
+        watcher->deleteLater();
+
+        if (generation != m_loadGeneration) {
+            return;
+        }
+        if (!result.volume) {
+            emit volumeLoadFailed(volume, result.error);
+            return;
+        }
+
+        makeCurrent();
+        m_renderer.volume()->begin_upload(result.volume);
+        doneCurrent();
+        m_scheduler.request(FrameScheduler::Priority::Refinement);
+    });
+
+    watcher->setFuture(QtConcurrent::run([volume, options = m_volumeOptions]() {
+        try {
+            return Result {RayCastVolume::prepare_volume(volume, options), {}};
+        }
+        catch (std::exception& e) {
+            return Result {nullptr, e.what()};
+        }
+    }));
+}
+
+
+/*!
+ * \brief Load a sequence of volumes, to be played back as a time series.
+ * \param files Volume files, in playback order.
+ *
+ * The sequence opens paused on its first frame. Frames are decoded ahead on
+ * worker threads, and each one is uploaded while the previous one is shown,
+ * replacing it when due.
+ *
+ * \sa TimeSeriesPlayer
+ */
+void RayCastCanvas::setVolumeSeries(const QStringList& files)
+{
+    if (files.size() < 2) {
+        if (!files.isEmpty()) {
+            setVolume(files.first());
+        }
+        return;
+    }
+
+    close_series();
+    ++m_loadGeneration;
+    m_loadingPath = files.first();
+    emit volumeLoadStarted(m_loadingPath);
+
+    m_series.open(files, m_volumeOptions);
+}
+
+
+/*!
+ * \brief Stop the sequence being played, if any, discarding its pending frame.
+ */
+void RayCastCanvas::close_series(void)
+{
+    if (!m_series.active()) {
+        return;
+    }
+    m_series.close();
+    m_seriesHeld = -1;
+    makeCurrent();
+    m_renderer.volume()->cancel_upload();
+    doneCurrent();
+}
+
+
+/*!
+ * \brief Advance the sequence being played.
+ *
+ * The next frame is uploaded a slab per repaint without replacing the one
+ * shown, and it is swapped in once the clock reaches it. If the upload falls
+ * behind, the frame is shown late and the player skips ahead to the frame
+ * due, dropping the ones in between.
+ */
+void RayCastCanvas::series_step(void)
+{
+    RayCastVolume *volume = m_renderer.volume();
+    const long due = m_series.due_frame();
+
+    if (m_seriesHeld >= 0 && m_seriesHeld <= due && volume->uploaded()) {
+        const bool first = m_series.shown() < 0;
+        volume->replace_volume();
+        m_series.presented(m_seriesHeld);
+        m_seriesHeld = -1;
+        m_accumulatedFrames = 0;
+
+        if (first) {
+            emit volumeLoaded(m_loadingPath);
+        }
+        emit seriesFrameShown(static_cast<int>(m_series.shown() % m_series.frame_count()), m_series.frame_count());
+    }
+
+    if (m_seriesHeld < 0) {
+        const long next = std::max(due, m_series.shown() + 1);
+        if (auto prepared = m_series.decoded(next)) {
+            volume->begin_upload(prepared);
+            m_seriesHeld = next;
+        }
+    }
+
+    if (m_seriesHeld >= 0 && !volume->uploaded()) {
+        volume->upload_step(m_uploadBudget, false);
+        m_scheduler.request();
+    }
+    else if (m_seriesHeld >= 0 && m_seriesHeld <= due) {
+        m_scheduler.request();
+    }
+}
+
+
+/*!
+ * \brief Set the intensity window of the colour transfer function.
+ * \param low Intensity mapped to the bottom of the transfer function.
+ * \param high Intensity mapped to the top of the transfer function.
+ */
+void RayCastCanvas::setWindow(const double low, const double high)
+{
+    auto range = m_renderer.volume() ? getRange() : std::pair<double, double>{0.0, 1.0};
+    const double width = range.second - range.first;
+    if (width > 0.0) {
+        set_parameter(m_window, QVector2D((low - range.first) / width, (high - range.first) / width));
+    }
+}
+
+
+/*!
+ * \brief Set the GPU memory reserved to the bricks of streamed volumes.
+ * \param mebibytes Size of the brick cache, in MiB.
+ *
+ * The new size takes effect from the next volume loaded.
+ */
+void RayCastCanvas::setBrickCacheSize(const int mebibytes)
+{
+    m_brickCacheSize = static_cast<size_t>(mebibytes) << 20;
+    if (m_renderer.volume()) {
+        m_renderer.volume()->set_brick_cache_size(m_brickCacheSize);
+    }
+}
+
+
+/*!
+ * \brief Enable or disable the binary cache of the prepared volumes.
+ * \param enabled Whether the prepared volumes are cached.
+ *
+ * The cache files are written in the cache location of the user, rather than
+ * next to the volumes, whose directory may be read-only or shared. The
+ * setting takes effect from the next volume loaded.
+ */
+void RayCastCanvas::setVolumeCache(const bool enabled)
+{
+    m_volumeOptions.cache = enabled;
+    m_volumeOptions.cache_directory = enabled
+            ? QStandardPaths::writableLocation(QStandardPaths::CacheLocation).toStdString()
+            : std::string();
+}
+
+
+/*!
+ * \brief Enable or disable the precomputed gradient texture.
+ * \param enabled Whether gradients are precomputed.
+ *
+ * The gradient texture takes four times the memory of the volume, but it
+ * replaces three texture fetches per shaded sample with one. Enabling it
+ * takes effect from the next volume loaded, while disabling it releases the
+ * current gradient texture immediately.
+ */
+void RayCastCanvas::setGradientTexture(const bool enabled)
+{
+    m_volumeOptions.gradients = enabled;
+    if (!enabled && m_renderer.volume()) {
+        makeCurrent();
+        m_renderer.volume()->release_gradients();
+        doneCurrent();
+    }
+    invalidate();
+}
+
+
+/*!
+ * \brief Start or stop writing the timings of each frame to a CSV file.
+ * \param filename Destination file, overwritten, or empty to stop writing.
+ * \return `false` if the file cannot be opened.
+ *
+ * \sa FrameProfiler::set_csv
+ */
+bool RayCastCanvas::setStatisticsFile(const QString& filename)
+{
+    makeCurrent();
+    m_renderer.profiler().flush();
+    doneCurrent();
+    m_scheduler.request();
+    return m_renderer.profiler().set_csv(filename);
 }
 
 
@@ -102,73 +321,219 @@ void RayCastCanvas::resizeGL(int w, int h)
  */
 void RayCastCanvas::paintGL()
 {
+    m_scheduler.frame_started();
+
+    FrameProfiler& profiler = m_renderer.profiler();
+    profiler.begin_frame();
+
+    // Upload the next slab of a volume being loaded
+    if (m_series.active()) {
+        profiler.begin_stage("upload");
+        series_step();
+        profiler.end_stage();
+    }
+    else if (m_renderer.volume()->uploading()) {
+        profiler.begin_stage("upload");
+        const bool uploaded = m_renderer.volume()->upload_step(m_uploadBudget);
+        profiler.end_stage();
+
+        if (uploaded) {
+            m_accumulatedFrames = 0;
+            profiler.record_load(m_loadingPath, m_renderer.volume()->load_timings());
+            emit volumeLoaded(m_loadingPath);
+        }
+        else {
+            emit volumeLoadProgress(static_cast<int>(100 * m_renderer.volume()->upload_progress()));
+            m_scheduler.request(FrameScheduler::Priority::Refinement);
+        }
+    }
+
     // Compute geometry
     m_viewMatrix.setToIdentity();
     m_viewMatrix.translate(0, 0, -4.0f * std::exp(m_distExp / 600.0f));
     m_viewMatrix.rotate(m_trackBall.rotation());
 
-    m_modelViewProjectionMatrix.setToIdentity();
-    m_modelViewProjectionMatrix.perspective(m_fov, (float)scaled_width()/scaled_height(), 0.1f, 100.0f);
-    m_modelViewProjectionMatrix *= m_viewMatrix * m_raycasting_volume->modelMatrix();
+    RenderParameters parameters;
+    parameters.mode = m_active_mode;
+    parameters.view = m_viewMatrix;
+    parameters.step_length = m_stepLength;
+    parameters.threshold = m_threshold;
+    parameters.window = m_window;
+    parameters.background = m_background;
+    parameters.skip_empty_space = m_skipEmptySpace;
+    parameters.proxy_geometry = m_proxyGeometry;
+    parameters.level_of_detail = m_levelOfDetail;
+    parameters.opacity_cutoff = m_opacityCutoff;
+    parameters.adaptive_step = m_adaptiveStep;
+    parameters.preintegrated = m_preintegrated;
+    parameters.brick_budget = m_brickBudget;
+
+    // Choose the render target for this frame
+    const bool interactive = m_interacting && m_interactiveScale < 1.0f;
+    const bool progressive = m_progressive && !interactive;
+    const QSize full_size(scaled_width(), scaled_height());
+    QSize render_size = full_size;
+    QOpenGLFramebufferObject *target = nullptr;
+
+    if (interactive) {
+        // While interacting, render to a smaller target with a proportionally coarser step
+        render_size = QSize(std::max(1, static_cast<int>(m_interactiveScale * full_size.width())),
+                            std::max(1, static_cast<int>(m_interactiveScale * full_size.height())));
+        parameters.step_length = m_stepLength / m_interactiveScale;
+
+        if (!m_lowResFbo || m_lowResFbo->size() != render_size) {
+            m_lowResFbo = std::make_unique<QOpenGLFramebufferObject>(render_size);
+        }
+        target = m_lowResFbo.get();
+        m_accumulatedFrames = 0;
+    }
+    else if (progressive) {
+        // While the view is still, accumulate frames with different jitter
+        if (!m_accumulationFbo || m_accumulationFbo->size() != full_size) {
+            QOpenGLFramebufferObjectFormat format;
+            format.setInternalTextureFormat(GL_RGBA16F);
+            m_accumulationFbo = std::make_unique<QOpenGLFramebufferObject>(full_size, format);
+            m_accumulatedFrames = 0;
+        }
+        if (m_viewMatrix != m_accumulatedMatrix) {
+            m_accumulatedMatrix = m_viewMatrix;
+            m_accumulatedFrames = 0;
+        }
+        target = m_accumulationFbo.get();
+    }
+
+    if (target) {
+        glBindFramebuffer(GL_FRAMEBUFFER, target->handle());
+    }
+
+    // Once converged, the accumulated frame is just presented again
+    if (!progressive || m_accumulatedFrames < m_progressiveFrames) {
+        const bool accumulate = progressive && m_accumulatedFrames > 0;
+
+        // Shift the jitter along an additive recurrence, so successive frames
+        // sample the gaps left by the previous ones
+        parameters.jitter_offset = progressive ? std::fmod(0.618034f * m_accumulatedFrames, 1.0f) : 0.0f;
+
+        if (accumulate) {
+            // Running average of the frames
+            glEnable(GL_BLEND);
+            glBlendColor(0.0f, 0.0f, 0.0f, 1.0f / (m_accumulatedFrames + 1));
+            glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+        }
+        else {
+            glClearColor(m_background.redF(), m_background.greenF(), m_background.blueF(), m_background.alphaF());
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+
+        // Perform raycasting
+        const bool streaming = m_renderer.render(parameters, render_size);
+
+        glDisable(GL_BLEND);
+
+        if (progressive && ++m_accumulatedFrames < m_progressiveFrames) {
+            m_scheduler.request(FrameScheduler::Priority::Refinement);
+        }
+
+        // Frames rendered while bricks are streamed in are not accumulated
+        if (streaming) {
+            m_accumulatedFrames = 0;
+            m_scheduler.request(FrameScheduler::Priority::Refinement);
+        }
+    }
 
-    m_normalMatrix = (m_viewMatrix * m_raycasting_volume->modelMatrix()).normalMatrix();
+    // Present the offscreen frame on the canvas, upscaling it if needed
+    if (target) {
+        profiler.begin_stage("present");
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, target->handle());
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, defaultFramebufferObject());
+        glBlitFramebuffer(0, 0, render_size.width(), render_size.height(),
+                          0, 0, full_size.width(), full_size.height(),
+                          GL_COLOR_BUFFER_BIT, render_size == full_size ? GL_NEAREST : GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+        glViewport(0, 0, full_size.width(), full_size.height());
+        profiler.end_stage();
+    }
 
-    m_rayOrigin = m_viewMatrix.inverted() * QVector3D({0.0, 0.0, 0.0});
+    profiler.end_frame();
 
-    // Perform raycasting
-    m_modes[m_active_mode]();
+    if (m_frameStatistics) {
+        draw_statistics();
+    }
 }
 
 
 /*!
- * \brief Width scaled by the pixel ratio (for HiDPI devices).
+ * \brief Format a duration for the statistics overlay.
+ * \param ms Duration in milliseconds, negative if not measured.
  */
-GLuint RayCastCanvas::scaled_width()
+static QString format_time(const double ms)
 {
-    return devicePixelRatio() * width();
+    return ms >= 0.0 ? QString("%1 ms").arg(ms, 7, 'f', 2) : QString("%1").arg("n/a", 10);
 }
 
 
 /*!
- * \brief Height scaled by the pixel ratio (for HiDPI devices).
+ * \brief Draw the average timings of the recent frames over the canvas.
+ *
+ * The overlay is drawn after the frame has been timed, so it does not
+ * count towards the statistics.
  */
-GLuint RayCastCanvas::scaled_height()
+void RayCastCanvas::draw_statistics(void)
 {
-    return devicePixelRatio() * height();
+    const FrameStats stats = m_renderer.profiler().average();
+
+    QStringList lines;
+    lines << QString("%1 %2 %3").arg("", -12).arg("CPU", 10).arg("GPU", 10);
+    for (const auto& stage : stats.stages) {
+        lines << QString("%1 %2 %3").arg(stage.name, -12).arg(format_time(stage.cpu_ms)).arg(format_time(stage.gpu_ms));
+    }
+    lines << QString("%1 %2 %3").arg("frame", -12).arg(format_time(stats.cpu_ms)).arg(format_time(stats.gpu_ms));
+    if (!m_renderer.profiler().gpu_timing()) {
+        lines << "Timer queries not supported";
+    }
+
+    const auto& timings = m_renderer.volume()->load_timings();
+    if (!timings.empty()) {
+        lines << "" << "Volume load";
+        for (const auto& [stage, ms] : timings) {
+            lines << QString("%1 %2").arg(QString::fromStdString(stage), -12).arg(format_time(ms));
+        }
+    }
+
+    if (m_series.active()) {
+        const TimeSeriesPlayer::Statistics series = m_series.statistics();
+        lines << "" << QString("Playback %1/%2").arg(std::max(m_series.shown(), 0L) % m_series.frame_count() + 1).arg(m_series.frame_count());
+        lines << QString("%1 %2").arg("rate", -12).arg(QString("%1 fps").arg(series.frame_rate, 0, 'f', 1), 10);
+        lines << QString("%1 %2").arg("buffered", -12).arg(series.buffered, 10);
+        lines << QString("%1 %2").arg("dropped", -12).arg(series.dropped, 10);
+        lines << QString("%1 %2").arg("stalls", -12).arg(series.stalls, 10);
+    }
+
+    QPainter painter(this);
+    painter.setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    const QString text = lines.join('\n');
+    const QRect bounds = painter.boundingRect(QRect(10, 10, width(), height()), Qt::AlignLeft | Qt::AlignTop, text);
+    painter.fillRect(bounds.adjusted(-5, -5, 5, 5), QColor(0, 0, 0, 160));
+    painter.setPen(Qt::white);
+    painter.drawText(bounds, Qt::AlignLeft | Qt::AlignTop, text);
 }
 
 
 /*!
- * \brief Perform isosurface raycasting.
+ * \brief Width scaled by the pixel ratio (for HiDPI devices).
  */
-void RayCastCanvas::raycasting(const QString& shader)
+GLuint RayCastCanvas::scaled_width()
 {
-    m_shaders[shader]->bind();
-    {
-        m_shaders[shader]->setUniformValue("ViewMatrix", m_viewMatrix);
-        m_shaders[shader]->setUniformValue("ModelViewProjectionMatrix", m_modelViewProjectionMatrix);
-        m_shaders[shader]->setUniformValue("NormalMatrix", m_normalMatrix);
-        m_shaders[shader]->setUniformValue("aspect_ratio", m_aspectRatio);
-        m_shaders[shader]->setUniformValue("focal_length", m_focalLength);
-        m_shaders[shader]->setUniformValue("viewport_size", m_viewportSize);
-        m_shaders[shader]->setUniformValue("ray_origin", m_rayOrigin);
-        m_shaders[shader]->setUniformValue("top", m_raycasting_volume->top());
-        m_shaders[shader]->setUniformValue("bottom", m_raycasting_volume->bottom());
-        m_shaders[shader]->setUniformValue("background_colour", to_vector3d(m_background));
-        m_shaders[shader]->setUniformValue("light_position", m_lightPosition);
-        m_shaders[shader]->setUniformValue("material_colour", m_diffuseMaterial);
-        m_shaders[shader]->setUniformValue("step_length", m_stepLength);
-        m_shaders[shader]->setUniformValue("threshold", m_threshold);
-        m_shaders[shader]->setUniformValue("gamma", m_gamma);
-        m_shaders[shader]->setUniformValue("volume", 0);
-        m_shaders[shader]->setUniformValue("jitter", 1);
+    return devicePixelRatio() * width();
+}
 
-        glClearColor(m_background.redF(), m_background.greenF(), m_background.blueF(), m_background.alphaF());
-        glClear(GL_COLOR_BUFFER_BIT);
 
-        m_raycasting_volume->paint();
-    }
-    m_shaders[shader]->release();
+/*!
+ * \brief Height scaled by the pixel ratio (for HiDPI devices).
+ */
+GLuint RayCastCanvas::scaled_height()
+{
+    return devicePixelRatio() * height();
 }
 
 
@@ -186,27 +551,80 @@ QPointF RayCastCanvas::pixel_pos_to_view_pos(const QPointF& p)
 
 /*!
  * \brief Callback for mouse movement.
+ *
+ * Hover moves, without a button pressed, do not change the view and do not
+ * cause a repaint.
  */
 void RayCastCanvas::mouseMoveEvent(QMouseEvent *event)
 {
     if (event->buttons() & Qt::LeftButton) {
         m_trackBall.move(pixel_pos_to_view_pos(event->pos()), m_scene_trackBall.rotation().conjugated());
+        interaction_started();
+        m_scheduler.request();
     } else {
         m_trackBall.release(pixel_pos_to_view_pos(event->pos()), m_scene_trackBall.rotation().conjugated());
     }
-    update();
 }
 
 
 /*!
  * \brief Callback for mouse press.
+ *
+ * Pressing does not change the view, but it cancels pending refinement, as
+ * a drag is likely to follow. The right button picks the isosurface under
+ * the cursor.
  */
 void RayCastCanvas::mousePressEvent(QMouseEvent *event)
 {
     if (event->buttons() & Qt::LeftButton) {
         m_trackBall.push(pixel_pos_to_view_pos(event->pos()), m_scene_trackBall.rotation().conjugated());
+        m_scheduler.cancel_refinement();
+    }
+    else if (event->button() == Qt::RightButton) {
+        if (const auto hit = pickSurface(event->pos())) {
+            emit surfacePicked(hit->voxel, hit->voxel * m_renderer.volume()->spacing(), hit->value);
+        }
+        else {
+            emit surfaceMissed();
+        }
+    }
+}
+
+
+/*!
+ * \brief Intersect the isosurface under a point of the canvas, on the CPU.
+ * \param pos Position on the canvas, in widget coordinates.
+ * \return The first intersection with the isosurface, if any.
+ *
+ * The ray is the one of the fragment under the point, in the last view
+ * drawn, so the hit matches the isosurface on screen. The framebuffer is
+ * not read back, and the query takes a few microseconds, but the first pick
+ * of a volume reads its file again into a host copy of the voxels. Frames of a
+ * sequence are replaced too often to be worth a copy, and are not picked.
+ */
+std::optional<VolumePicker::Hit> RayCastCanvas::pickSurface(const QPointF& pos)
+{
+    if (!m_renderer.volume() || m_series.active()) {
+        return std::nullopt;
     }
-    update();
+    try {
+        if (!m_renderer.volume()->build_picker()) {
+            return std::nullopt;
+        }
+    }
+    catch (const std::exception&) {
+        // The file may have been removed since it was loaded
+        return std::nullopt;
+    }
+
+    // Same ray as ray_direction_at, with the default field of view
+    const QPointF p = pixel_pos_to_view_pos(pos);
+    const float focal_length = 1.0 / qTan(M_PI / 180.0 * RenderParameters {}.fov / 2.0);
+    QVector3D direction(p.x() * width() / height(), p.y(), -focal_length);
+    direction = (QVector4D(direction, 0.0f) * m_viewMatrix).toVector3D();
+    const QVector3D origin = m_viewMatrix.inverted() * QVector3D(0.0f, 0.0f, 0.0f);
+
+    return m_renderer.volume()->pick(origin, direction, m_threshold);
 }
 
 
@@ -217,8 +635,8 @@ void RayCastCanvas::mouseReleaseEvent(QMouseEvent *event)
 {
     if (event->button() == Qt::LeftButton) {
         m_trackBall.release(pixel_pos_to_view_pos(event->pos()), m_scene_trackBall.rotation().conjugated());
+        interaction_finished();
     }
-    update();
 }
 
 
@@ -232,20 +650,35 @@ void RayCastCanvas::wheelEvent(QWheelEvent * event)
         m_distExp = -1800;
     if (m_distExp > 600)
         m_distExp = 600;
-    update();
+    interaction_started();
+    m_scheduler.request();
 }
 
 
 /*!
- * \brief Add a shader.
- * \param name Name for the shader.
- * \param vertex Vertex shader source file.
- * \param fragment Fragment shader source file.
+ * \brief Switch to interactive rendering, until the input stops.
+ *
+ * \sa RayCastCanvas::interaction_finished
  */
-void RayCastCanvas::add_shader(const QString& name, const QString& vertex, const QString& fragment)
+void RayCastCanvas::interaction_started(void)
 {
-    m_shaders[name] = new QOpenGLShaderProgram(this);
-    m_shaders[name]->addShaderFromSourceFile(QOpenGLShader::Vertex, vertex);
-    m_shaders[name]->addShaderFromSourceFile(QOpenGLShader::Fragment, fragment);
-    m_shaders[name]->link();
+    m_interacting = true;
+    m_idleTimer.start();
+}
+
+
+/*!
+ * \brief Switch back to full quality rendering.
+ *
+ * This happens when the mouse is released, or when the input has been idle
+ * for longer than the idle timeout, e.g. when the pointer rests during a
+ * drag. Moving again restarts the interaction.
+ */
+void RayCastCanvas::interaction_finished(void)
+{
+    m_idleTimer.stop();
+    if (m_interacting) {
+        m_interacting = false;
+        m_scheduler.request();
+    }
 }
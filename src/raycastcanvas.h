@@ -23,18 +23,19 @@
 #pragma once
 
 #include <functional>
+#include <memory>
+#include <optional>
 #include <vector>
 
-#include <QtMath>
-
 #include <QOpenGLWidget>
 #include <QOpenGLExtraFunctions>
-#include <QOpenGLShaderProgram>
+#include <QOpenGLFramebufferObject>
+#include <QTimer>
 
-#include "mesh.h"
-#include "raycastvolume.h"
+#include "framescheduler.h"
+#include "raycastrenderer.h"
+#include "timeseriesplayer.h"
 #include "trackball.h"
-#include "vtkvolume.h"
 
 /*!
  * \brief Class for a raycasting canvas widget.
@@ -47,37 +48,109 @@ public:
     ~RayCastCanvas();
 
     void setStepLength(const GLfloat step_length) {
-        m_stepLength = step_length;
-        update();
+        set_parameter(m_stepLength, step_length);
+    }
+
+    void setVolume(const QString& volume);
+    void setVolumeSeries(const QStringList& files);
+
+    void setPlaying(const bool playing) {
+        playing ? m_series.play() : m_series.pause();
     }
 
-    void setVolume(const QString& volume) {
-        m_raycasting_volume->load_volume(volume);
-        update();
+    void setSeriesFrameRate(const double fps) {
+        m_series.set_frame_rate(fps);
     }
 
     void setThreshold(const double threshold) {
-        auto range = m_raycasting_volume ? getRange() : std::pair<double, double>{0.0, 1.0};
-        m_threshold = threshold / (range.second - range.first);
-        update();
+        auto range = m_renderer.volume() ? getRange() : std::pair<double, double>{0.0, 1.0};
+        set_parameter(m_threshold, static_cast<GLfloat>(threshold / (range.second - range.first)));
     }
 
     void setMode(const QString& mode) {
-        m_active_mode = mode;
-        update();
+        set_parameter(m_active_mode, mode);
+    }
+
+    void setEmptySpaceSkipping(const bool enabled) {
+        set_parameter(m_skipEmptySpace, enabled);
+    }
+
+    void setGradientTexture(const bool enabled);
+
+    void setWindow(const double low, const double high);
+
+    void setVoxelFormat(const VoxelFormat format) {
+        m_volumeOptions.format = format;
+    }
+
+    void setBrickStreaming(const bool enabled) {
+        m_volumeOptions.bricked = enabled;
+    }
+
+    void setBrickCacheSize(const int mebibytes);
+
+    void setVolumeCache(const bool enabled);
+
+    void setProxyGeometry(const bool enabled) {
+        set_parameter(m_proxyGeometry, enabled);
+    }
+
+    void setInteractiveScale(const float scale) {
+        if (scale != m_interactiveScale) {
+            m_interactiveScale = scale;
+            m_scheduler.request();
+        }
+    }
+
+    void setIdleTimeout(const int msec) {
+        m_idleTimer.setInterval(msec);
+    }
+
+    void setFrameRateLimit(const int fps) {
+        m_scheduler.set_max_frame_rate(fps);
+    }
+
+    void setLevelOfDetail(const bool enabled) {
+        set_parameter(m_levelOfDetail, enabled);
+    }
+
+    void setOpacityCutoff(const float opacity) {
+        set_parameter(m_opacityCutoff, opacity);
+    }
+
+    void setAdaptiveStep(const bool enabled) {
+        set_parameter(m_adaptiveStep, enabled);
+    }
+
+    void setPreintegration(const bool enabled) {
+        set_parameter(m_preintegrated, enabled);
+    }
+
+    void setTransferFunction(const TransferFunction& transfer_function) {
+        if (transfer_function != m_renderer.transfer_function()) {
+            m_renderer.set_transfer_function(transfer_function);
+            invalidate();
+        }
+    }
+
+    void setProgressive(const bool enabled) {
+        set_parameter(m_progressive, enabled);
     }
 
     void setBackground(const QColor& colour) {
-        m_background = colour;
-        update();
+        set_parameter(m_background, colour);
+    }
+
+    void setFrameStatistics(const bool enabled) {
+        m_frameStatistics = enabled;
+        m_renderer.profiler().set_enabled(enabled);
+        m_scheduler.request();
     }
 
+    bool setStatisticsFile(const QString& filename);
+
     std::vector<QString> getModes(void) {
-        std::vector<QString> modes;
-        for (const auto& [key, val] : m_modes) {
-            modes.push_back(key);
-        }
-        return modes;
+        return m_renderer.modes();
     }
 
     QColor getBackground(void) {
@@ -85,11 +158,27 @@ public:
     }
 
     std::pair<double, double> getRange(void) {
-        return m_raycasting_volume->range();
+        return m_renderer.volume()->range();
+    }
+
+    double getCompressionPsnr(void) {
+        return m_renderer.volume()->psnr();
     }
 
+    TimeSeriesPlayer::Statistics getSeriesStatistics(void) {
+        return m_series.statistics();
+    }
+
+    std::optional<VolumePicker::Hit> pickSurface(const QPointF& pos);
+
 signals:
-    // NOPE
+    void volumeLoadStarted(const QString& path);
+    void volumeLoadProgress(int percent);
+    void volumeLoaded(const QString& path);
+    void volumeLoadFailed(const QString& path, const QString& message);
+    void seriesFrameShown(int index, int count);
+    void surfacePicked(const QVector3D& voxel, const QVector3D& position, double value);
+    void surfaceMissed(void);
 
 public slots:
     virtual void mouseMoveEvent(QMouseEvent *event);
@@ -105,28 +194,22 @@ protected:
 private:
 
     QMatrix4x4 m_viewMatrix;
-    QMatrix4x4 m_modelViewProjectionMatrix;
-    QMatrix3x3 m_normalMatrix;
 
-    const GLfloat m_fov = 60.0f;                                          /*!< Vertical field of view. */
-    const GLfloat m_focalLength = 1.0 / qTan(M_PI / 180.0 * m_fov / 2.0); /*!< Focal length. */
-    GLfloat m_aspectRatio;                                                /*!< width / height */
-
-    QVector2D m_viewportSize;
-    QVector3D m_rayOrigin; /*!< Camera position in model space coordinates. */
-
-    QVector3D m_lightPosition {3.0, 0.0, 3.0};    /*!< In camera coordinates. */
-    QVector3D m_diffuseMaterial {1.0, 1.0, 1.0};  /*!< Material colour. */
-    GLfloat m_stepLength;                         /*!< Step length for ray march. */
-    GLfloat m_threshold;                          /*!< Isosurface intensity threshold. */
+    GLfloat m_stepLength = 0.0f;                  /*!< Step length for ray march. */
+    GLfloat m_threshold = 0.0f;                   /*!< Isosurface intensity threshold. */
+    bool m_skipEmptySpace = true;                 /*!< Skip bricks that cannot affect the ray. */
+    bool m_proxyGeometry = true;                  /*!< Rasterise only the bounding box of the non-empty bricks. */
+    bool m_levelOfDetail = true;                  /*!< Sample coarser levels, with longer steps, where voxels are smaller than pixels. */
+    float m_opacityCutoff = 0.98f;                /*!< Opacity at which alpha blended rays are terminated. */
+    bool m_adaptiveStep = true;                   /*!< Vary the alpha blending step with the local opacity change. */
+    bool m_preintegrated = true;                  /*!< Look up alpha blended segments in the pre-integrated table. */
+    VolumeOptions m_volumeOptions;                /*!< Derived data prepared with each volume. */
+    QVector2D m_window {0.0, 1.0};                /*!< Normalised intensity window of the colour transfer function. */
     QColor m_background;                          /*!< Viewport background colour. */
+    bool m_frameStatistics = false;               /*!< Overlay the timings of the rendering stages. */
 
-    const GLfloat m_gamma = 2.2f; /*!< Gamma correction parameter. */
-
-    RayCastVolume *m_raycasting_volume;
-
-    std::map<QString, QOpenGLShaderProgram*> m_shaders;
-    std::map<QString, std::function<void(void)>> m_modes;
+    RayCastRenderer m_renderer; /*!< Volume, shaders and raycasting. */
+    FrameScheduler m_scheduler {[this]() { update(); }}; /*!< Paces the repaints of the canvas. */
     QString m_active_mode;
 
     TrackBall m_trackBall {};       /*!< Trackball holding the model rotation. */
@@ -134,12 +217,54 @@ private:
 
     GLint m_distExp = -200;
 
+    bool m_interacting = false;                          /*!< Whether the user is moving the camera. */
+    float m_interactiveScale = 0.5f;                     /*!< Resolution scale while interacting (1 disables it). */
+    QTimer m_idleTimer;                                  /*!< Ends the interaction when the input stops. */
+    std::unique_ptr<QOpenGLFramebufferObject> m_lowResFbo; /*!< Render target while interacting. */
+
+    bool m_progressive = true;                                  /*!< Accumulate jittered frames while the view is still. */
+    const int m_progressiveFrames = 16;                         /*!< Number of frames accumulated before stopping. */
+    int m_accumulatedFrames = 0;                                /*!< Number of frames in the accumulation buffer. */
+    QMatrix4x4 m_accumulatedMatrix;                             /*!< View of the accumulated frames. */
+    std::unique_ptr<QOpenGLFramebufferObject> m_accumulationFbo; /*!< Floating point accumulation buffer. */
+
+    QString m_loadingPath;                         /*!< Volume being loaded in the background. */
+    int m_loadGeneration = 0;                      /*!< Incremented at each load, to discard superseded ones. */
+    const size_t m_uploadBudget = 32 * 1024 * 1024; /*!< Bytes of volume data uploaded per frame. */
+    const size_t m_brickBudget = 8 * 1024 * 1024;  /*!< Bytes of bricks streamed per frame. */
+    size_t m_brickCacheSize = size_t {512} << 20;  /*!< GPU memory reserved to bricks. */
+
+    TimeSeriesPlayer m_series;                     /*!< Clock and decoded frames of the sequence being played. */
+    long m_seriesHeld = -1;                        /*!< Frame of the sequence being uploaded ahead, or -1. */
+
     GLuint scaled_width();
     GLuint scaled_height();
 
-    void raycasting(const QString& shader);
+    void interaction_started(void);
+
+    /*!
+     * \brief Schedule a repaint, discarding the accumulated frames.
+     */
+    void invalidate(void) {
+        m_accumulatedFrames = 0;
+        m_scheduler.request();
+    }
+
+    /*!
+     * \brief Assign a rendering parameter, invalidating the frame only if it changed.
+     */
+    template<typename T>
+    void set_parameter(T& parameter, const T& value) {
+        if (parameter != value) {
+            parameter = value;
+            invalidate();
+        }
+    }
+
+    void interaction_finished(void);
+    void draw_statistics(void);
+    void series_step(void);
+    void close_series(void);
 
     QPointF pixel_pos_to_view_pos(const QPointF& p);
-    void create_noise(void);
-    void add_shader(const QString& name, const QString& vector, const QString& fragment);
 };
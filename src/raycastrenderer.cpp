@@ -0,0 +1,563 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <QDebug>
+#include <QOpenGLContext>
+#include <QVector4D>
+#include <QtMath>
+
+#include "raycastrenderer.h"
+
+
+/*!
+ * \brief Convert a QColor to a QVector3D.
+ * \return A QVector3D holding a RGB representation of the colour.
+ */
+static QVector3D to_vector3d(const QColor& colour) {
+    return QVector3D(colour.redF(), colour.greenF(), colour.blueF());
+}
+
+
+/*!
+ * \brief Copy a vector into a `vec3` of a uniform block.
+ */
+static void set_vec3(GLfloat *dst, const QVector3D& v)
+{
+    dst[0] = v.x();
+    dst[1] = v.y();
+    dst[2] = v.z();
+}
+
+
+/*!
+ * \brief Constructor, without OpenGL resources.
+ */
+RayCastRenderer::RayCastRenderer(void)
+{
+    // Register the rendering modes here, so they are available before initialisation
+    m_modes["Isosurface"] = [&](const RenderParameters& p) { raycasting(p, QStringLiteral("MODE_ISOSURFACE")); };
+    m_modes["Alpha blending"] = [&](const RenderParameters& p) { raycasting(p, QStringLiteral("MODE_ALPHA_BLENDING")); };
+    m_modes["MIP"] = [&](const RenderParameters& p) { raycasting(p, QStringLiteral("MODE_MAXIMUM_INTENSITY_PROJECTION")); };
+    m_modes["Isosurface (compute)"] = [&](const RenderParameters& p) { raycasting(p, QStringLiteral("MODE_ISOSURFACE"), true); };
+    m_modes["Alpha blending (compute)"] = [&](const RenderParameters& p) { raycasting(p, QStringLiteral("MODE_ALPHA_BLENDING"), true); };
+    m_modes["MIP (compute)"] = [&](const RenderParameters& p) { raycasting(p, QStringLiteral("MODE_MAXIMUM_INTENSITY_PROJECTION"), true); };
+
+    m_transferTable = m_transferFunction.table(transfer_table_size);
+}
+
+
+/*!
+ * \brief Destructor, the context of the renderer must be current.
+ */
+RayCastRenderer::~RayCastRenderer()
+{
+}
+
+
+/*!
+ * \brief Create the volume, in the current context.
+ *
+ * Shader programs are compiled when first used.
+ */
+void RayCastRenderer::initialise(void)
+{
+    initializeOpenGLFunctions();
+
+    m_volume = std::make_unique<RayCastVolume>();
+    m_profiler.initialise();
+
+    glGenBuffers(1, &m_uniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_uniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(RaycastingBlock), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    m_blockValid = false;
+    m_transferValid = false;
+    m_preintegratedValid = false;
+
+    const QOpenGLContext *context = QOpenGLContext::currentContext();
+    m_computeSupported = !context->isOpenGLES() && context->format().version() >= qMakePair(4, 3);
+    glGenVertexArrays(1, &m_emptyVao);
+}
+
+
+/*!
+ * \brief Release the volume and the shaders, in the current context.
+ */
+void RayCastRenderer::release(void)
+{
+    m_shaders.clear();
+    m_computeShaders.clear();
+    m_presentShaders.clear();
+    m_program = nullptr;
+    glDeleteTextures(1, &m_computeTarget);
+    m_computeTarget = 0;
+    m_computeTargetSize = QSize();
+    glDeleteVertexArrays(1, &m_emptyVao);
+    m_emptyVao = 0;
+    glDeleteBuffers(1, &m_uniformBuffer);
+    m_uniformBuffer = 0;
+    for (GLuint *texture : {&m_transferTexture, &m_opacityRangeTexture, &m_preintegratedTexture}) {
+        glDeleteTextures(1, texture);
+        *texture = 0;
+    }
+    m_volume.reset();
+    m_profiler.release();
+}
+
+
+/*!
+ * \brief Render a frame into the bound framebuffer.
+ * \param parameters Parameters of the frame.
+ * \param size Size of the viewport, in pixels.
+ * \return `true` if bricks were streamed in, so the frame is still incomplete.
+ *
+ * The viewport is set to the whole frame, and blending and clearing are left
+ * to the caller.
+ */
+bool RayCastRenderer::render(const RenderParameters& parameters, const QSize& size)
+{
+    glViewport(0, 0, size.width(), size.height());
+    m_viewportSize = QVector2D(size.width(), size.height());
+
+    m_viewProjectionMatrix.setToIdentity();
+    m_viewProjectionMatrix.perspective(parameters.fov, static_cast<float>(size.width()) / size.height(), 0.1f, 100.0f);
+    m_viewProjectionMatrix *= parameters.view;
+    m_modelViewProjectionMatrix = m_viewProjectionMatrix * m_volume->modelMatrix();
+
+    // The mode is resolved again only when it changes
+    if (!m_mode || parameters.mode != m_modeName) {
+        const auto it = m_modes.find(parameters.mode);
+        m_mode = it != m_modes.end() ? &it->second : nullptr;
+        m_modeName = parameters.mode;
+    }
+
+    m_streaming = false;
+    if (m_mode) {
+        (*m_mode)(parameters);
+    }
+    return m_streaming;
+}
+
+
+/*!
+ * \brief Render the partial image of a box of the volume into the bound framebuffer.
+ * \param parameters Parameters of the frame.
+ * \param size Size of the viewport, in pixels.
+ * \param region Box of the volume to be rendered, in voxels.
+ * \param op Output operator compositing the partial with the others:
+ *           `CompositeOperator::Nearest` for isosurfaces,
+ *           `CompositeOperator::Over` for alpha blending,
+ *           `CompositeOperator::Maximum` for MIP.
+ * \return `true` if bricks were streamed in, so the frame is still incomplete.
+ *
+ * The framebuffer must have two float colour attachments, as draw buffers,
+ * receiving the premultiplied linear colour and the key of `PartialImage`.
+ * Both are cleared here, and the background is left to the compositor.
+ * Only the samples of the whole rays inside the box are taken, as in
+ * `CpuRayCaster::render_partial`, and the compute modes are rendered from
+ * fragments, as they write a single image. Throws `std::runtime_error` if
+ * the mode is unknown.
+ */
+bool RayCastRenderer::render_partial(const RenderParameters& parameters, const QSize& size, const VoxelRegion& region, CompositeOperator& op)
+{
+    if (!has_mode(parameters.mode)) {
+        throw std::runtime_error("Unknown mode " + parameters.mode.toStdString() + ".");
+    }
+
+    // Faces on the boundary of the volume are moved away, so they never clip
+    const QVector3D volume_size = m_volume->size();
+    for (int axis = 0; axis < 3; ++axis) {
+        const size_t end = region.offset[axis] + region.size[axis];
+        m_clipBottom[axis] = region.offset[axis] > 0 ? region.offset[axis] / volume_size[axis] : -1.0f;
+        m_clipTop[axis] = end < volume_size[axis] ? end / volume_size[axis] : 2.0f;
+    }
+
+    m_partial = true;
+    const bool streaming = render(parameters, size);
+    m_partial = false;
+    m_clipBottom = QVector3D(-1.0f, -1.0f, -1.0f);
+    m_clipTop = QVector3D(2.0f, 2.0f, 2.0f);
+
+    op = m_partialOperator;
+    return streaming;
+}
+
+
+/*!
+ * \brief Perform raycasting.
+ * \param p Parameters of the frame.
+ * \param mode Definition selecting the rendering mode in the shader.
+ * \param compute Whether the rays are marched by the compute shader.
+ *
+ * The program is specialised for the features of the volume and of the
+ * frame, so the shader does not branch on them. The proxy and the streamed
+ * bricks keep the bricks above the threshold for isosurfaces, any non-empty
+ * brick for MIP (the shader skips bricks by intensity, and the maximum may be
+ * transparent), and the bricks reaching an opacity of 1/255 in the transfer
+ * function for alpha blending.
+ */
+void RayCastRenderer::raycasting(const RenderParameters& p, const QString& mode, const bool compute)
+{
+    if (compute && !m_computeSupported && !m_computeWarned) {
+        qWarning() << "Compute shaders need OpenGL 4.3, raycasting from fragments instead.";
+        m_computeWarned = true;
+    }
+    const bool use_compute = compute && m_computeSupported && !m_partial;
+
+    m_profiler.begin_stage("bricks");
+    const BrickVisibility visibility = QStringLiteral("MODE_ISOSURFACE") == mode
+            ? BrickVisibility::above(p.threshold)
+            : QStringLiteral("MODE_MAXIMUM_INTENSITY_PROJECTION") == mode
+            ? BrickVisibility::above(0.0f)
+            : BrickVisibility::opaque(m_transferTable, p.window);
+    if (p.proxy_geometry) {
+        m_volume->update_proxy(visibility);
+    }
+
+    // Stream the bricks needed for this view, if the volume is bricked
+    if (m_volume->update_bricks(m_modelViewProjectionMatrix, m_viewportSize, visibility, p.brick_budget)) {
+        m_streaming = true;
+    }
+    m_profiler.end_stage();
+
+    m_profiler.begin_stage("raycasting");
+    // Resolve the program variant only when the features change
+    const unsigned features = (m_volume->bricked() ? 1u : 0u) | (m_volume->layered() ? 2u : 0u)
+            | (m_volume->has_gradients() ? 4u : 0u) | (p.skip_empty_space ? 8u : 0u)
+            | (p.adaptive_step ? 16u : 0u) | (p.preintegrated ? 32u : 0u) | (use_compute ? 64u : 0u)
+            | (m_partial ? 128u : 0u);
+    if (!m_program || features != m_programFeatures || mode != m_programMode) {
+        QStringList defines {mode};
+        if (m_volume->bricked()) {
+            defines << "BRICKED";
+        }
+        if (m_volume->layered()) {
+            defines << "LAYERED";
+        }
+        if (m_volume->has_gradients()) {
+            defines << "GRADIENTS";
+        }
+        if (p.skip_empty_space) {
+            defines << "SKIP_EMPTY_SPACE";
+        }
+        if (p.adaptive_step) {
+            defines << "ADAPTIVE_STEP";
+        }
+        if (p.preintegrated) {
+            defines << "PREINTEGRATED";
+        }
+        if (m_partial) {
+            defines << "PARTIAL";
+        }
+        m_program = (use_compute ? m_computeShaders : m_shaders).program(defines);
+        m_programFeatures = features;
+        m_programMode = mode;
+    }
+
+    update_block(p);
+    update_transfer_function(p.preintegrated);
+
+    if (m_partial) {
+        // Pixels outside the proxy box keep a transparent colour and an empty key
+        m_partialOperator = QStringLiteral("MODE_ISOSURFACE") == mode ? CompositeOperator::Nearest
+                          : QStringLiteral("MODE_ALPHA_BLENDING") == mode ? CompositeOperator::Over
+                          : CompositeOperator::Maximum;
+        const GLfloat transparent[4] {0.0f, 0.0f, 0.0f, 0.0f};
+        const GLfloat empty_key[4] {PartialImage::empty_key(m_partialOperator), 0.0f, 0.0f, 0.0f};
+        glClearBufferfv(GL_COLOR, 0, transparent);
+        glClearBufferfv(GL_COLOR, 1, empty_key);
+    }
+
+    if (use_compute) {
+        dispatch(p);
+    }
+    else {
+        m_program->bind();
+        m_volume->paint(p.proxy_geometry);
+        m_program->release();
+    }
+    m_profiler.end_stage();
+}
+
+
+/*!
+ * \brief March the rays with the compute shader, and copy them into the framebuffer.
+ * \param p Parameters of the frame.
+ *
+ * Only the tiles covering the screen-space bounds of the volume are
+ * dispatched, and tiles whose pyramid of rays misses the proxy box are
+ * cleared without marching. The copy is restricted to the bounds, and it skips the pixels
+ * whose ray missed the volume, so the framebuffer and the blending state set
+ * by the caller are used as with the rasterised proxy box.
+ */
+void RayCastRenderer::dispatch(const RenderParameters& p)
+{
+    if (p.proxy_geometry && m_volume->proxy_empty()) {
+        return;
+    }
+    const QRect bounds = screen_bounds(p);
+    if (bounds.isEmpty()) {
+        return;
+    }
+
+    const QSize size(m_viewportSize.x(), m_viewportSize.y());
+    if (!m_computeTarget || m_computeTargetSize != size) {
+        glDeleteTextures(1, &m_computeTarget);
+        glGenTextures(1, &m_computeTarget);
+        glBindTexture(GL_TEXTURE_2D, m_computeTarget);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, size.width(), size.height());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        m_computeTargetSize = size;
+    }
+
+    m_volume->bind_textures();
+    m_program->bind();
+    glUniform2i(m_program->uniformLocation("tile_origin"), bounds.x(), bounds.y());
+    glUniform2i(m_program->uniformLocation("bounds_end"), bounds.x() + bounds.width(), bounds.y() + bounds.height());
+    glBindImageTexture(0, m_computeTarget, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    glDispatchCompute((bounds.width() + 7) / 8, (bounds.height() + 7) / 8, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    m_program->release();
+
+    QOpenGLShaderProgram *present = m_presentShaders.program({});
+    present->bind();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_computeTarget);
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(bounds.x(), bounds.y(), bounds.width(), bounds.height());
+    glBindVertexArray(m_emptyVao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glDisable(GL_SCISSOR_TEST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    present->release();
+}
+
+
+/*!
+ * \brief Pixels covered by the projection of the proxy box.
+ * \param p Parameters of the frame.
+ * \return Bounds in window coordinates, with the origin at the bottom left,
+ *         clipped to the viewport. The whole viewport if the camera is
+ *         inside or too close to the box.
+ */
+QRect RayCastRenderer::screen_bounds(const RenderParameters& p)
+{
+    const QRect viewport(0, 0, m_viewportSize.x(), m_viewportSize.y());
+    const QVector3D low = p.proxy_geometry ? m_volume->proxy_bottom() : m_volume->bottom();
+    const QVector3D high = p.proxy_geometry ? m_volume->proxy_top() : m_volume->top();
+
+    float x0 = std::numeric_limits<float>::max(), y0 = x0;
+    float x1 = std::numeric_limits<float>::lowest(), y1 = x1;
+    for (int corner = 0; corner < 8; ++corner) {
+        const QVector4D position(corner & 1 ? high.x() : low.x(),
+                                 corner & 2 ? high.y() : low.y(),
+                                 corner & 4 ? high.z() : low.z(), 1.0f);
+        const QVector4D clip = m_viewProjectionMatrix * position;
+        if (clip.w() <= 1e-4f) {
+            return viewport;
+        }
+        const float x = (0.5f + 0.5f * clip.x() / clip.w()) * viewport.width();
+        const float y = (0.5f + 0.5f * clip.y() / clip.w()) * viewport.height();
+        x0 = std::min(x0, x);
+        y0 = std::min(y0, y);
+        x1 = std::max(x1, x);
+        y1 = std::max(y1, y);
+    }
+
+    // Clamp before converting, as the projection can be far off screen
+    x0 = std::clamp(std::floor(x0), 0.0f, static_cast<float>(viewport.width()));
+    y0 = std::clamp(std::floor(y0), 0.0f, static_cast<float>(viewport.height()));
+    x1 = std::clamp(std::ceil(x1), 0.0f, static_cast<float>(viewport.width()));
+    y1 = std::clamp(std::ceil(y1), 0.0f, static_cast<float>(viewport.height()));
+    return QRect(static_cast<int>(x0), static_cast<int>(y0), static_cast<int>(x1 - x0), static_cast<int>(y1 - y0));
+}
+
+
+/*!
+ * \brief Update the uniform block of the raycasting programs.
+ * \param p Parameters of the frame.
+ *
+ * The buffer is written only when some value differs from the last frame,
+ * and it is bound to the binding point of the block.
+ */
+void RayCastRenderer::update_block(const RenderParameters& p)
+{
+    RaycastingBlock block {};
+
+    std::memcpy(block.view_matrix, p.view.constData(), sizeof(block.view_matrix));
+    std::memcpy(block.model_view_projection_matrix, m_modelViewProjectionMatrix.constData(), sizeof(block.model_view_projection_matrix));
+
+    // Columns of a mat3 are padded to four components
+    const QMatrix3x3 normal_matrix = (p.view * m_volume->modelMatrix()).normalMatrix();
+    for (int column = 0; column < 3; ++column) {
+        for (int row = 0; row < 3; ++row) {
+            block.normal_matrix[4 * column + row] = normal_matrix(row, column);
+        }
+    }
+
+    set_vec3(block.ray_origin, p.view.inverted() * QVector3D(0.0f, 0.0f, 0.0f));
+    block.aspect_ratio = m_viewportSize.x() / m_viewportSize.y();
+    set_vec3(block.top, m_volume->top());
+    block.focal_length = 1.0 / qTan(M_PI / 180.0 * p.fov / 2.0);
+    set_vec3(block.bottom, m_volume->bottom());
+    block.step_length = p.step_length;
+    set_vec3(block.proxy_top, p.proxy_geometry ? m_volume->proxy_top() : m_volume->top());
+    block.threshold = p.threshold;
+    set_vec3(block.proxy_bottom, p.proxy_geometry ? m_volume->proxy_bottom() : m_volume->bottom());
+    block.jitter_offset = p.jitter_offset;
+    set_vec3(block.background_colour, to_vector3d(p.background));
+    block.gamma = m_gamma;
+    set_vec3(block.material_colour, p.material_colour);
+    block.max_lod = p.level_of_detail ? m_volume->max_lod() : 0.0f;
+    set_vec3(block.light_position, p.light_position);
+    block.brick_size = m_volume->brick_size();
+    set_vec3(block.brick_extent, m_volume->brick_extent());
+    set_vec3(block.volume_size, m_volume->size());
+    set_vec3(block.atlas_size, m_volume->atlas_size());
+    block.viewport_size[0] = m_viewportSize.x();
+    block.viewport_size[1] = m_viewportSize.y();
+    block.window[0] = p.window.x();
+    block.window[1] = p.window.y();
+    block.opacity_cutoff = p.opacity_cutoff;
+    set_vec3(block.clip_bottom, m_clipBottom);
+    set_vec3(block.clip_top, m_clipTop);
+    set_vec3(block.box_bottom, m_volume->box_bottom());
+    set_vec3(block.box_top, m_volume->box_top());
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, uniform_binding, m_uniformBuffer);
+    if (!m_blockValid || std::memcmp(&block, &m_block, sizeof(block)) != 0) {
+        glBindBuffer(GL_UNIFORM_BUFFER, m_uniformBuffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        m_block = block;
+        m_blockValid = true;
+    }
+}
+
+
+/*!
+ * \brief Set the constant uniforms of a new program variant.
+ * \param program Program just linked, and bound.
+ *
+ * Texture units and the binding of the uniform block do not change, so
+ * they are set only once per program.
+ */
+void RayCastRenderer::setup_program(QOpenGLShaderProgram *program)
+{
+    program->setUniformValue("volume", 0);
+    program->setUniformValue("jitter", 1);
+    program->setUniformValue("occupancy", 2);
+    program->setUniformValue("gradients", 3);
+    program->setUniformValue("page_table", 4);
+    program->setUniformValue("coarse_volume", 5);
+    program->setUniformValue("volume_layers", 6);
+    program->setUniformValue("transfer_function", 7);
+    program->setUniformValue("opacity_range", 8);
+    program->setUniformValue("preintegrated_transfer", 9);
+
+    const GLuint block = glGetUniformBlockIndex(program->programId(), "Raycasting");
+    if (block != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program->programId(), block, uniform_binding);
+    }
+}
+
+
+/*!
+ * \brief Set the transfer function of the alpha blending and MIP modes.
+ * \param transfer_function New transfer function.
+ *
+ * The lookup tables are updated by the next frame that uses them, so this
+ * does not need a current context.
+ */
+void RayCastRenderer::set_transfer_function(const TransferFunction& transfer_function)
+{
+    if (transfer_function != m_transferFunction) {
+        m_transferFunction = transfer_function;
+        m_transferTable = m_transferFunction.table(transfer_table_size);
+        m_transferValid = false;
+        m_preintegratedValid = false;
+    }
+}
+
+
+/*!
+ * \brief Update the lookup tables of the transfer function, and bind them.
+ * \param preintegrated Whether the pre-integrated table is needed.
+ *
+ * Tables are sampled only when the function has changed, and the
+ * pre-integrated one only when it is used.
+ */
+void RayCastRenderer::update_transfer_function(const bool preintegrated)
+{
+    if (!m_transferValid) {
+        upload_table(m_transferTexture, GL_RGBA16F, GL_RGBA, GL_LINEAR, transfer_table_size, 1, m_transferTable.data());
+        const std::vector<float> range = TransferFunction::opacity_range(m_transferTable);
+        upload_table(m_opacityRangeTexture, GL_RG32F, GL_RG, GL_NEAREST, transfer_table_size, transfer_table_size, range.data());
+        m_transferValid = true;
+    }
+    if (preintegrated && !m_preintegratedValid) {
+        const std::vector<float> table = m_transferFunction.preintegrated(transfer_table_size);
+        upload_table(m_preintegratedTexture, GL_RGBA16F, GL_RGBA, GL_LINEAR, transfer_table_size, transfer_table_size, table.data());
+        m_preintegratedValid = true;
+    }
+
+    glActiveTexture(GL_TEXTURE7); glBindTexture(GL_TEXTURE_2D, m_transferTexture);
+    glActiveTexture(GL_TEXTURE8); glBindTexture(GL_TEXTURE_2D, m_opacityRangeTexture);
+    glActiveTexture(GL_TEXTURE9); glBindTexture(GL_TEXTURE_2D, preintegrated ? m_preintegratedTexture : 0);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+
+/*!
+ * \brief Write a lookup table into a 2D texture, creating it if needed.
+ * \param texture Name of the texture, zero to create it.
+ * \param internal_format Internal format of the texture.
+ * \param format Format of the table.
+ * \param filter Minification and magnification filter.
+ * \param width Entries along x.
+ * \param height Entries along y.
+ * \param data Interleaved entries, with x varying fastest.
+ */
+void RayCastRenderer::upload_table(GLuint& texture, const GLint internal_format, const GLenum format, const GLint filter,
+                                   const size_t width, const size_t height, const float *data)
+{
+    if (!texture) {
+        glGenTextures(1, &texture);
+    }
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, GL_FLOAT, data);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
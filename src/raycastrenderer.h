@@ -0,0 +1,260 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <QColor>
+#include <QMatrix4x4>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QRect>
+#include <QSize>
+#include <QVector2D>
+#include <QVector3D>
+
+#include "compositor.h"
+#include "frameprofiler.h"
+#include "raycastvolume.h"
+#include "shadercache.h"
+#include "transferfunction.h"
+
+/*!
+ * \brief Parameters of a rendered frame.
+ */
+struct RenderParameters
+{
+    QString mode;                           /*!< Name of the rendering mode. */
+    QMatrix4x4 view;                        /*!< View matrix, from world to camera coordinates. */
+    float fov = 60.0f;                      /*!< Vertical field of view, in degrees. */
+    float step_length = 0.01f;              /*!< Ray marching step, as a fraction of the ray length. */
+    float threshold = 0.5f;                 /*!< Normalised isosurface intensity threshold. */
+    QVector2D window {0.0f, 1.0f};          /*!< Normalised intensity window of the colour transfer function. */
+    QColor background {Qt::black};          /*!< Background colour. */
+    QVector3D light_position {3.0, 0.0, 3.0};   /*!< In camera coordinates. */
+    QVector3D material_colour {1.0, 1.0, 1.0};  /*!< Material colour. */
+    bool skip_empty_space = true;           /*!< Skip bricks that cannot affect the ray. */
+    bool proxy_geometry = true;             /*!< Rasterise only the bounding box of the non-empty bricks. */
+    bool level_of_detail = true;            /*!< Sample coarser levels where voxels are smaller than pixels. */
+    float jitter_offset = 0.0f;             /*!< Offset added to the ray jitter, for progressive accumulation. */
+    float opacity_cutoff = 0.98f;           /*!< Opacity at which alpha blended rays are terminated. */
+    bool adaptive_step = true;              /*!< Vary the alpha blending step with the local opacity change. */
+    bool preintegrated = true;              /*!< Look up alpha blended segments in the pre-integrated table. */
+    size_t brick_budget = 8 * 1024 * 1024;  /*!< Bytes of bricks streamed per frame. */
+};
+
+/*!
+ * \brief Values of the `Raycasting` uniform block, in the std140 layout.
+ *
+ * Each `vec3` is followed by a scalar or by padding, and the columns of the
+ * normal matrix are padded to four components, as in `parameters.glsl`.
+ */
+struct RaycastingBlock
+{
+    GLfloat view_matrix[16];
+    GLfloat model_view_projection_matrix[16];
+    GLfloat normal_matrix[12];
+    GLfloat ray_origin[3];
+    GLfloat aspect_ratio;
+    GLfloat top[3];
+    GLfloat focal_length;
+    GLfloat bottom[3];
+    GLfloat step_length;
+    GLfloat proxy_top[3];
+    GLfloat threshold;
+    GLfloat proxy_bottom[3];
+    GLfloat jitter_offset;
+    GLfloat background_colour[3];
+    GLfloat gamma;
+    GLfloat material_colour[3];
+    GLfloat max_lod;
+    GLfloat light_position[3];
+    GLfloat brick_size;
+    GLfloat brick_extent[3];
+    GLfloat pad0;
+    GLfloat volume_size[3];
+    GLfloat pad1;
+    GLfloat atlas_size[3];
+    GLfloat pad2;
+    GLfloat viewport_size[2];
+    GLfloat window[2];
+    GLfloat opacity_cutoff;
+    GLfloat pad3[3];
+    GLfloat clip_bottom[3];
+    GLfloat pad4;
+    GLfloat clip_top[3];
+    GLfloat pad5;
+    GLfloat box_bottom[3];
+    GLfloat pad6;
+    GLfloat box_top[3];
+    GLfloat pad7;
+};
+
+static_assert(sizeof(RaycastingBlock) == 448, "RaycastingBlock must match the std140 layout of the shader");
+
+/*!
+ * \brief Raycasting of a volume with the shaders of each rendering mode.
+ *
+ * The renderer owns the volume and the shader programs, and draws into
+ * whatever framebuffer is bound, so it can be shared between the canvas
+ * widget and offscreen rendering. It can be created without an OpenGL
+ * context, and `initialise` must be called once a context is current.
+ *
+ * Rendering adds the `bricks` and `raycasting` stages to the frame being
+ * timed by the profiler, if any.
+ *
+ * The parameters of the frame are shared by all the program variants
+ * through a uniform buffer, which is written only when they change.
+ *
+ * Each mode has a compute variant, marching the rays in 8x8 tiles over the
+ * screen-space bounds of the volume, and falling back to the fragment
+ * shaders where compute shaders (OpenGL 4.3) are not available.
+ *
+ * For sort-last rendering, `render_partial` draws the partial image of a box
+ * of the volume, to be composited with the boxes of the other nodes.
+ */
+class RayCastRenderer : protected QOpenGLExtraFunctions
+{
+public:
+    RayCastRenderer(void);
+    virtual ~RayCastRenderer();
+
+    RayCastRenderer(const RayCastRenderer&) = delete;
+    RayCastRenderer& operator=(const RayCastRenderer&) = delete;
+
+    void initialise(void);
+    void release(void);
+    bool render(const RenderParameters& parameters, const QSize& size);
+    bool render_partial(const RenderParameters& parameters, const QSize& size, const VoxelRegion& region, CompositeOperator& op);
+
+    /*!
+     * \brief Volume being rendered, or null until initialised.
+     */
+    RayCastVolume * volume(void) {
+        return m_volume.get();
+    }
+
+    /*!
+     * \brief Timer of the stages of each frame, disabled by default.
+     */
+    FrameProfiler& profiler(void) {
+        return m_profiler;
+    }
+
+    /*!
+     * \brief Names of the rendering modes.
+     */
+    std::vector<QString> modes(void) const {
+        std::vector<QString> modes;
+        for (const auto& [key, val] : m_modes) {
+            modes.push_back(key);
+        }
+        return modes;
+    }
+
+    /*!
+     * \brief Transfer function of the alpha blending and MIP modes.
+     */
+    const TransferFunction& transfer_function(void) const {
+        return m_transferFunction;
+    }
+
+    void set_transfer_function(const TransferFunction& transfer_function);
+
+    /*!
+     * \brief Whether a rendering mode exists.
+     */
+    bool has_mode(const QString& mode) const {
+        return m_modes.count(mode) > 0;
+    }
+
+private:
+    const GLfloat m_gamma = 2.2f; /*!< Gamma correction parameter. */
+
+    static constexpr GLuint uniform_binding = 0; /*!< Binding point of the uniform block. */
+    static constexpr size_t transfer_table_size = 256; /*!< Entries of the transfer function tables. */
+
+    std::unique_ptr<RayCastVolume> m_volume;
+    FrameProfiler m_profiler;
+    ShaderCache m_shaders {                 /*!< Variants of the raycasting program. */
+        {{QOpenGLShader::Vertex, ":/shaders/raycasting.vert"}, {QOpenGLShader::Fragment, ":/shaders/raycasting.frag"}},
+        {":/shaders/parameters.glsl", ":/shaders/raycasting.glsl"},
+        [this](QOpenGLShaderProgram *program) { setup_program(program); },
+    };
+    ShaderCache m_computeShaders {          /*!< Variants of the compute raycasting program. */
+        {{QOpenGLShader::Compute, ":/shaders/raycasting.comp"}},
+        {":/shaders/parameters.glsl", ":/shaders/raycasting.glsl"},
+        [this](QOpenGLShaderProgram *program) { setup_program(program); },
+    };
+    ShaderCache m_presentShaders {          /*!< Copy of the compute target into the framebuffer. */
+        {{QOpenGLShader::Vertex, ":/shaders/present.vert"}, {QOpenGLShader::Fragment, ":/shaders/present.frag"}},
+        {},
+        [](QOpenGLShaderProgram *program) { program->setUniformValue("compute_target", 0); },
+    };
+    std::map<QString, std::function<void(const RenderParameters&)>> m_modes;
+
+    const std::function<void(const RenderParameters&)> *m_mode = nullptr; /*!< Resolved rendering mode. */
+    QString m_modeName;                     /*!< Name of the resolved rendering mode. */
+    QOpenGLShaderProgram *m_program = nullptr; /*!< Program variant of the last frame. */
+    QString m_programMode;                  /*!< Mode definition of the last program. */
+    unsigned m_programFeatures = 0;         /*!< Feature mask of the last program. */
+
+    GLuint m_uniformBuffer = 0;             /*!< Buffer backing the uniform block. */
+    RaycastingBlock m_block {};             /*!< Contents of the uniform buffer. */
+    bool m_blockValid = false;              /*!< Whether the buffer holds `m_block`. */
+
+    TransferFunction m_transferFunction;    /*!< Sampled into the lookup tables. */
+    std::vector<float> m_transferTable;     /*!< Colour and opacity table, also used to cull bricks. */
+    GLuint m_transferTexture = 0;           /*!< Colour and opacity table. */
+    GLuint m_opacityRangeTexture = 0;       /*!< Opacity range of each intensity interval. */
+    GLuint m_preintegratedTexture = 0;      /*!< Pre-integrated table, computed when first needed. */
+    bool m_transferValid = false;           /*!< Whether the tables match the function. */
+    bool m_preintegratedValid = false;      /*!< Whether the pre-integrated table matches the function. */
+
+    bool m_computeSupported = false;        /*!< Whether the context runs compute shaders. */
+    bool m_computeWarned = false;           /*!< Whether the fallback to fragments was reported. */
+    GLuint m_computeTarget = 0;             /*!< Image written by the compute shader. */
+    QSize m_computeTargetSize;              /*!< Size of the compute target. */
+    GLuint m_emptyVao = 0;                  /*!< Vertex array of the attribute-less present pass. */
+
+    QMatrix4x4 m_viewProjectionMatrix;      /*!< Of the frame being rendered. */
+    QMatrix4x4 m_modelViewProjectionMatrix; /*!< Of the frame being rendered. */
+    QVector2D m_viewportSize;               /*!< Of the frame being rendered. */
+    bool m_streaming = false;               /*!< Whether bricks were streamed for the frame being rendered. */
+    bool m_partial = false;                 /*!< Whether the frame being rendered is a partial image. */
+    CompositeOperator m_partialOperator = CompositeOperator::Over; /*!< Operator of the partial being rendered. */
+    QVector3D m_clipBottom {-1.0f, -1.0f, -1.0f}; /*!< Clip box of the partial, in texture coordinates. */
+    QVector3D m_clipTop {2.0f, 2.0f, 2.0f};       /*!< Clip box of the partial, in texture coordinates. */
+
+    void raycasting(const RenderParameters& p, const QString& mode, const bool compute = false);
+    void dispatch(const RenderParameters& p);
+    QRect screen_bounds(const RenderParameters& p);
+    void update_block(const RenderParameters& p);
+    void setup_program(QOpenGLShaderProgram *program);
+    void update_transfer_function(const bool preintegrated);
+    void upload_table(GLuint& texture, const GLint internal_format, const GLenum format, const GLint filter,
+                      const size_t width, const size_t height, const float *data);
+};
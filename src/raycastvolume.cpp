@@ -21,13 +21,227 @@
  */
 
 
+#include "brickedvolume.h"
 #include "raycastvolume.h"
-#include "vtkvolume.h"
+#include "volumecache.h"
+#include "volumepartition.h"
+#include "voxelkernels.h"
+#include "volume.h"
 
-#include <QRegularExpression>
+#include <QElapsedTimer>
+#include <QVector4D>
 
 #include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+
+/*!
+ * \brief Triangles for the faces of a box, counter-clockwise when seen from outside.
+ */
+static const std::vector<GLuint> box_indices {
+    // front
+    0, 1, 2,
+    0, 2, 3,
+    // right
+    1, 5, 6,
+    1, 6, 2,
+    // back
+    5, 4, 7,
+    5, 7, 6,
+    // left
+    4, 0, 3,
+    4, 3, 7,
+    // top
+    2, 6, 7,
+    2, 7, 3,
+    // bottom
+    4, 5, 1,
+    4, 1, 0,
+};
+
+
+/*!
+ * \brief Vertices of an axis-aligned box.
+ * \param bottom Corner with the lowest coordinates.
+ * \param top Corner with the highest coordinates.
+ * \return Strided x-y-z coordinates of the vertices, matching `box_indices`.
+ */
+static std::vector<GLfloat> box_vertices(const QVector3D& bottom, const QVector3D& top)
+{
+    return {
+        bottom.x(), bottom.y(), top.z(),
+        top.x(),    bottom.y(), top.z(),
+        top.x(),    top.y(),    top.z(),
+        bottom.x(), top.y(),    top.z(),
+        bottom.x(), bottom.y(), bottom.z(),
+        top.x(),    bottom.y(), bottom.z(),
+        top.x(),    top.y(),    bottom.z(),
+        bottom.x(), top.y(),    bottom.z(),
+    };
+}
+
+
+/*!
+ * \brief OpenGL description of a voxel format.
+ */
+struct TextureFormat
+{
+    GLint internal_format; /*!< Internal format of the texture. */
+    GLenum type;           /*!< Type of the pixel data. */
+    size_t voxel_size;     /*!< Size of each voxel, in bytes (0 for compressed formats). */
+};
+
+
+/*!
+ * \brief OpenGL description of a voxel format.
+ * \param format Voxel format, other than `VoxelFormat::Automatic`.
+ */
+static TextureFormat texture_format(const VoxelFormat format)
+{
+    switch (format) {
+    case VoxelFormat::Uint16:
+        return {GL_R16, GL_UNSIGNED_SHORT, 2};
+    case VoxelFormat::Float16:
+        return {GL_R16F, GL_HALF_FLOAT, 2};
+    case VoxelFormat::Float32:
+        return {GL_R32F, GL_FLOAT, 4};
+    case VoxelFormat::Rgtc1:
+        return {GL_COMPRESSED_RED_RGTC1, GL_UNSIGNED_BYTE, 0};
+    default:
+        return {GL_R8, GL_UNSIGNED_BYTE, 1};
+    }
+}
+
+
+/*!
+ * \brief Size of a slice of voxels.
+ * \param format Voxel format, other than `VoxelFormat::Automatic`.
+ * \param width Number of voxels along x.
+ * \param height Number of voxels along y.
+ * \return Size of the slice, in bytes.
+ *
+ * Compressed slices are made of 8 byte blocks of 4x4 voxels.
+ */
+size_t slice_bytes(const VoxelFormat format, const size_t width, const size_t height)
+{
+    if (VoxelFormat::Rgtc1 == format) {
+        return 8 * ((width + 3) / 4) * ((height + 3) / 4);
+    }
+    return texture_format(format).voxel_size * width * height;
+}
+
+
+/*!
+ * \brief Size of the base level of a texture.
+ * \param internal_format Internal format of the texture, one of those created by the volume.
+ * \param size Number of texels for each axis.
+ * \return Size of the storage, in bytes, ignoring the mipmaps.
+ */
+static size_t storage_bytes(const GLint internal_format, const QVector3D& size)
+{
+    const size_t width = size.x();
+    const size_t height = size.y();
+    const size_t depth = size.z();
+    switch (internal_format) {
+    case GL_COMPRESSED_RED_RGTC1:
+        return depth * slice_bytes(VoxelFormat::Rgtc1, width, height);
+    case GL_R16:
+    case GL_R16F:
+    case GL_RG8:
+        return 2 * width * height * depth;
+    case GL_R32F:
+    case GL_RGBA8:
+    case GL_RGBA8UI:
+        return 4 * width * height * depth;
+    default:
+        return width * height * depth;
+    }
+}
+
+
+/*!
+ * \brief Call a generic function with a value of the C++ type matching a voxel format.
+ * \param format Voxel format, other than `VoxelFormat::Automatic`.
+ * \param f Callable, invoked with a default-constructed value of the matching type.
+ */
+template<typename F>
+static void dispatch(const VoxelFormat format, F&& f)
+{
+    switch (format) {
+    case VoxelFormat::Uint16:
+        f(uint16_t {});
+        break;
+    case VoxelFormat::Float16:
+        f(half_t {});
+        break;
+    case VoxelFormat::Float32:
+        f(float {});
+        break;
+    default:
+        f(uint8_t {});
+        break;
+    }
+}
+
+
+/*!
+ * \brief Pick the narrowest format that preserves the dynamic range of a volume.
+ * \param volume Volume to be uploaded.
+ * \param voxels Number of voxels uploaded, of the whole volume or of a box.
+ * \param budget Memory available for the textures, including the mipmaps, in bytes.
+ * \param gradients Whether a gradient texture is wanted, reset if it does not fit.
+ * \return The format for the volume texture.
+ *
+ * Integer data is stored losslessly in 8 or 16 bit normalised integers when
+ * its range has few enough levels, and any other data in single precision
+ * floats. The volume and gradient textures must fit the budget together:
+ * the gradients are dropped first, as they can be computed on the fly, then
+ * the format is narrowed, down to lossy RGTC1 compression as a last resort.
+ */
+static VoxelFormat automatic_format(const Volume& volume, const size_t voxels, const size_t budget, bool& gradients)
+{
+    const double levels = volume.range().second - volume.range().first + 1.0;
+
+    VoxelFormat format = VoxelFormat::Float32;
+    if (volume.integral() && levels <= 256.0) {
+        format = VoxelFormat::Uint8;
+    }
+    else if (volume.integral() && levels <= 65536.0) {
+        format = VoxelFormat::Uint16;
+    }
+
+    // The mipmaps take one seventh more memory, and the RGBA8 gradients have none
+    const auto fits = [&](const VoxelFormat f) {
+        if (gradients && 8 * voxels * texture_format(f).voxel_size + 7 * 4 * voxels <= 7 * budget) {
+            return true;
+        }
+        if (8 * voxels * texture_format(f).voxel_size <= 7 * budget) {
+            gradients = false;
+            return true;
+        }
+        return false;
+    };
+    if (VoxelFormat::Float32 == format && !fits(format)) {
+        format = VoxelFormat::Uint16;
+    }
+    if (VoxelFormat::Uint16 == format && !fits(format)) {
+        format = VoxelFormat::Uint8;
+    }
+
+    // Compressed volumes have no mipmaps, and take half a byte per voxel,
+    // less than their gradients would
+    if (VoxelFormat::Uint8 == format && !fits(format)) {
+        format = VoxelFormat::Rgtc1;
+        gradients = false;
+    }
+    return format;
+}
 
 
 /*!
@@ -36,95 +250,730 @@
 RayCastVolume::RayCastVolume(void)
     : m_volume_texture {0}
     , m_noise_texture {0}
-    , m_cube_vao {
-          {
-              -1.0f, -1.0f,  1.0f,
-               1.0f, -1.0f,  1.0f,
-               1.0f,  1.0f,  1.0f,
-              -1.0f,  1.0f,  1.0f,
-              -1.0f, -1.0f, -1.0f,
-               1.0f, -1.0f, -1.0f,
-               1.0f,  1.0f, -1.0f,
-              -1.0f,  1.0f, -1.0f,
-          },
-          {
-              // front
-              0, 1, 2,
-              0, 2, 3,
-              // right
-              1, 5, 6,
-              1, 6, 2,
-              // back
-              5, 4, 7,
-              5, 7, 6,
-              // left
-              4, 0, 3,
-              4, 3, 7,
-              // top
-              2, 6, 7,
-              2, 7, 3,
-              // bottom
-              4, 5, 1,
-              4, 1, 0,
-          }
-      }
+    , m_cube_vao {box_vertices({-1.0f, -1.0f, -1.0f}, {1.0f, 1.0f, 1.0f}), box_indices}
 {
     initializeOpenGLFunctions();
 }
 
 
 /*!
- * \brief Destructor.
+ * \brief Destructor, the context of the volume must be current.
+ *
+ * The textures in use, the pool, the pixel buffer and the noise texture
+ * are freed.
  */
 RayCastVolume::~RayCastVolume()
 {
+    release_brick_cache();
+    release_texture(m_volume_texture);
+    release_texture(m_gradient_texture);
+    release_texture(m_coarse_texture);
+    release_texture(m_occupancy_texture);
+    release_texture(m_pending_texture);
+    release_texture(m_pending_gradient_texture);
+
+    for (TextureStorage& t : m_textures) {
+        glDeleteTextures(1, &t.name);
+    }
+    m_textures.clear();
+    for (TextureStorage& t : m_texture_pool) {
+        glDeleteTextures(1, &t.name);
+    }
+    m_texture_pool.clear();
+
+    if (m_pixel_buffer) {
+        glDeleteBuffers(1, &m_pixel_buffer);
+        m_pixel_buffer = 0;
+    }
+    if (m_noise_texture) {
+        glDeleteTextures(1, &m_noise_texture);
+        m_noise_texture = 0;
+    }
 }
 
 
 /*!
- * \brief Load a volume from file.
- * \param File to be loaded.
+ * \brief Read the voxels of a volume file into Z-ordered bricks of 16 bit intensities.
+ * \param filename Volume file.
+ * \return The layout, read from the source whatever the format the volume is prepared in.
  */
-void RayCastVolume::load_volume(const QString& filename) {
-    std::vector<unsigned char> data;
+static std::shared_ptr<const BrickedLayout<uint16_t>> read_layout(const std::string& filename)
+{
+    return std::make_shared<const BrickedLayout<uint16_t>>(open_volume(filename)->read_bricked<uint16_t>());
+}
 
-    QRegularExpression re {"^.*\\.([^\\.]+)$"};
-    QRegularExpressionMatch match = re.match(filename);
 
-    if (!match.hasMatch()) {
-        throw std::runtime_error("Cannot determine file extension.");
+/*!
+ * \brief Copy the voxels of a prepared volume into Z-ordered bricks of 16 bit intensities.
+ * \param volume Volume prepared whole, in any format but `VoxelFormat::Rgtc1`.
+ * \return The layout, to be shared by the CPU passes.
+ */
+std::shared_ptr<const BrickedLayout<uint16_t>> RayCastVolume::bricked_layout(const PreparedVolume& volume)
+{
+    const std::array<size_t, 3> size {static_cast<size_t>(volume.size.x()),
+                                      static_cast<size_t>(volume.size.y()),
+                                      static_cast<size_t>(volume.size.z())};
+    return bricked_layout(volume, VoxelRegion {{0, 0, 0}, size});
+}
+
+
+/*!
+ * \brief Copy a region of a prepared volume into Z-ordered bricks of 16 bit intensities.
+ * \param volume Volume prepared whole, in any format but `VoxelFormat::Rgtc1`.
+ * \param region Region to be copied, inside the volume.
+ * \return The layout of the region, with its first voxel at the origin.
+ */
+std::shared_ptr<const BrickedLayout<uint16_t>> RayCastVolume::bricked_layout(const PreparedVolume& volume, const VoxelRegion& region)
+{
+    std::shared_ptr<const BrickedLayout<uint16_t>> layout;
+    dispatch(volume.format, [&](auto t) {
+        using U = decltype(t);
+        layout = std::make_shared<const BrickedLayout<uint16_t>>(
+                    reinterpret_cast<const U *>(volume.voxels()), volume.size.x(), volume.size.y(), region,
+                    [](const U v) { return static_cast<uint16_t>(std::clamp(to_unit(v), 0.0f, 1.0f) * 65535.0f + 0.5f); });
+    });
+    return layout;
+}
+
+
+/*!
+ * \brief Read and normalise a volume from file.
+ * \param filename File to be loaded.
+ * \param options Derived data to be computed.
+ * \return The volume data, ready to be uploaded.
+ *
+ * This function does not use OpenGL, and it can be called from any thread.
+ * Unless disabled in the options, an up to date cache of the volume is
+ * loaded instead of the source, and a new cache is written otherwise.
+ *
+ * With `VolumeOptions::node`, only the box of the node and its margin are
+ * read from the file, so the memory of a node shrinks with the number of
+ * boxes. Such boxes are never cached, streamed in bricks or compressed, and
+ * `std::runtime_error` is thrown if they would need to be.
+ */
+std::shared_ptr<const PreparedVolume> RayCastVolume::prepare_volume(const QString& filename, const VolumeOptions& options)
+{
+    // Time each stage, for profiling
+    QElapsedTimer timer;
+    timer.start();
+    std::vector<std::pair<std::string, double>> timings;
+    const auto lap = [&](const char *stage) {
+        timings.emplace_back(stage, timer.nsecsElapsed() / 1e6);
+        timer.restart();
+    };
+
+    std::unique_ptr<VolumeCache> cache;
+    if (options.cache && !options.bricked && options.node < 0) {
+        cache = std::make_unique<VolumeCache>(filename.toStdString(), options);
+        if (auto cached = cache->load()) {
+            lap("cache read");
+            if (options.bricked_layout) {
+                // Only 16 bit voxels hold the intensities of the layout, which
+                // is read from the source otherwise, as for a fresh volume
+                cached->layout = VoxelFormat::Uint16 == cached->format ? bricked_layout(*cached)
+                                                                       : read_layout(filename.toStdString());
+                lap("bricked layout");
+            }
+            cached->source = filename.toStdString();
+            cached->timings = std::move(timings);
+            return cached;
+        }
     }
 
-    const std::string extension {match.captured(1).toLower().toStdString()};
-    if ("vtk" == extension) {
-        VTKVolume volume {filename.toStdString()};
-        volume.uint8_normalised();
-        m_size = QVector3D(std::get<0>(volume.size()), std::get<1>(volume.size()), std::get<2>(volume.size()));
-        m_origin = QVector3D(std::get<0>(volume.origin()), std::get<1>(volume.origin()), std::get<2>(volume.origin()));
-        m_spacing = QVector3D(std::get<0>(volume.spacing()), std::get<1>(volume.spacing()), std::get<2>(volume.spacing()));
-        m_range = volume.range();
-        data = volume.data();
+    auto prepared = std::make_shared<PreparedVolume>();
+    prepared->source = filename.toStdString();
+
+    std::unique_ptr<Volume> volume = open_volume(filename.toStdString());
+    lap("read");
+    prepared->size = QVector3D(std::get<0>(volume->size()), std::get<1>(volume->size()), std::get<2>(volume->size()));
+
+    // A node reads only its box, with a margin for the samples on its faces
+    const std::array<size_t, 3> whole_size {std::get<0>(volume->size()), std::get<1>(volume->size()), std::get<2>(volume->size())};
+    VoxelRegion box {{0, 0, 0}, whole_size};
+    if (options.node >= 0) {
+        if (options.bricked) {
+            throw std::runtime_error("A box of a volume cannot be streamed in bricks.");
+        }
+        const VolumePartition partition(whole_size, options.partitions);
+        if (static_cast<size_t>(options.node) >= partition.count()) {
+            throw std::runtime_error("No render node " + std::to_string(options.node) + ".");
+        }
+        box = partition.region(options.node).grown(VolumePartition::margin, whole_size);
+        prepared->whole_size = prepared->size;
+        prepared->box_offset = QVector3D(box.offset[0], box.offset[1], box.offset[2]);
+        prepared->size = QVector3D(box.size[0], box.size[1], box.size[2]);
+    }
+    prepared->origin = QVector3D(std::get<0>(volume->origin()), std::get<1>(volume->origin()), std::get<2>(volume->origin()));
+    prepared->spacing = QVector3D(std::get<0>(volume->spacing()), std::get<1>(volume->spacing()), std::get<2>(volume->spacing()));
+    prepared->range = volume->range();
+
+    if (options.bricked) {
+        // Keep the voxels in the file, and prepare only the coarse level
+        auto bricks = std::make_shared<BrickedVolume>(std::move(volume), streaming_brick_size, coarse_size_limit);
+        prepared->data = bricks->coarse();
+        prepared->occupancy = bricks->occupancy();
+        prepared->bricks = std::move(bricks);
+        lap("bricks");
+        prepared->timings = std::move(timings);
+        return prepared;
+    }
+
+    bool gradients = options.gradients;
+    const size_t voxels = box.size[0] * box.size[1] * box.size[2];
+    prepared->format = VoxelFormat::Automatic == options.format ? automatic_format(*volume, voxels, options.texture_budget, gradients) : options.format;
+    if (prepared->partial() && VoxelFormat::Rgtc1 == prepared->format) {
+        throw std::runtime_error("A box of a volume cannot be compressed, split the volume in more boxes.");
+    }
+
+    // Normalise straight into the buffer to be uploaded (compressed
+    // volumes are normalised to 8 bits, and compressed at the end)
+    prepared->data.resize(voxels * std::max<size_t>(texture_format(prepared->format).voxel_size, 1));
+    const bool layout_texture = options.bricked_layout && VoxelFormat::Uint16 == prepared->format;
+    if (prepared->partial()) {
+        // Only the rows of the box are read, and its layout is copied from them
+        dispatch(prepared->format, [&](auto t) {
+            volume->read_normalised(reinterpret_cast<decltype(t) *>(prepared->data.data()), box);
+        });
+        if (options.bricked_layout) {
+            prepared->layout = bricked_layout(*prepared);
+        }
     }
     else {
-        throw std::runtime_error("Unrecognised extension '" + extension + "'.");
+        if (options.bricked_layout) {
+            prepared->layout = std::make_shared<const BrickedLayout<uint16_t>>(volume->read_bricked<uint16_t>());
+            lap("bricked layout");
+        }
+        if (layout_texture) {
+            // Same voxels as the layout, only reordered
+            prepared->layout->to_linear(reinterpret_cast<uint16_t *>(prepared->data.data()));
+        }
+        else {
+            dispatch(prepared->format, [&](auto t) {
+                volume->read_normalised(reinterpret_cast<decltype(t) *>(prepared->data.data()));
+            });
+        }
     }
+    lap("normalise");
 
-    glDeleteTextures(1, &m_volume_texture);
-    glGenTextures(1, &m_volume_texture);
-    glBindTexture(GL_TEXTURE_3D, m_volume_texture);
+    const size_t width = prepared->size.x();
+    const size_t height = prepared->size.y();
+    const size_t depth = prepared->size.z();
+
+    dispatch(prepared->format, [&](auto t) {
+        const auto *voxels = reinterpret_cast<const decltype(t) *>(prepared->data.data());
+        prepared->occupancy = layout_texture ? OccupancyGrid(*prepared->layout, occupancy_brick_size)
+                                             : OccupancyGrid(voxels, width, height, depth, occupancy_brick_size);
+        lap("occupancy");
+
+        if (gradients) {
+            prepared->gradients.resize(4 * width * height * depth);
+            gradient_kernel(voxels, prepared->gradients.data(), width, height, depth);
+            lap("gradients");
+        }
+    });
+
+    if (VoxelFormat::Rgtc1 == prepared->format) {
+        std::vector<unsigned char> blocks(depth * slice_bytes(prepared->format, width, height));
+        const double error = rgtc1_kernel(prepared->data.data(), blocks.data(), width, height, depth);
+        // Errors are sums of squared integers, so a lossless volume gets the
+        // PSNR of a single unit of error instead of an infinite one
+        prepared->psnr = 10.0 * std::log10(255.0 * 255.0 * width * height * depth / std::max(error, 1.0));
+        prepared->data = std::move(blocks);
+        lap("compression");
+    }
+
+    if (cache && cache->valid()) {
+        try {
+            cache->store(*prepared, volume->sources());
+        }
+        catch (const std::exception&) {
+            // The cache is an optimisation, the source may be in a read-only directory
+        }
+        lap("cache write");
+    }
+
+    prepared->timings = std::move(timings);
+    return prepared;
+}
+
+
+/*!
+ * \brief Load a volume from file.
+ * \param File to be loaded.
+ * \param options Derived data to be computed.
+ *
+ * The whole volume is uploaded before returning.
+ */
+void RayCastVolume::load_volume(const QString& filename, const VolumeOptions& options) {
+    begin_upload(prepare_volume(filename, options));
+    while (!upload_step(std::numeric_limits<size_t>::max())) {
+    }
+}
+
+
+/*!
+ * \brief Create a 3D texture with clamped borders.
+ * \param internal_format Internal format of the texture.
+ * \param format Format of the pixel data.
+ * \param filter Minification and magnification filter.
+ * \param size Number of voxels for each axis.
+ * \param data Pixel data, or `nullptr` to leave the texture uninitialised.
+ * \param type Type of the pixel data.
+ * \return Name of the new texture, to be freed with `release_texture`.
+ *
+ * A released texture with the same storage is reused if available, and
+ * the data is uploaded into it without reallocating.
+ */
+GLuint RayCastVolume::create_texture(const GLint internal_format, const GLenum format, const GLint filter, const QVector3D& size, const void *data, const GLenum type)
+{
+    bool reused;
+    const GLuint texture = acquire_texture(GL_TEXTURE_3D, internal_format, size, reused);
+    glBindTexture(GL_TEXTURE_3D, texture);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, filter);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // The array on the host has 1 byte alignment
+    if (!reused) {
+        glTexImage3D(GL_TEXTURE_3D, 0, internal_format, size.x(), size.y(), size.z(), 0, format, type, data);
+    }
+    else if (data) {
+        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, size.x(), size.y(), size.z(), format, type, data);
+    }
+    glBindTexture(GL_TEXTURE_3D, 0);
+    return texture;
+}
+
+
+/*!
+ * \brief Create a compressed 2D array texture, with a layer per slice.
+ * \param format Block compressed format of the voxels, giving the internal format and the storage size.
+ * \param size Number of voxels for each axis.
+ * \return Name of the new texture, left uninitialised, to be freed with `release_texture`.
+ *
+ * Block compressed formats are not available for 3D textures, so the slices
+ * are filtered in 2D, and interpolated across layers in the shaders.
+ */
+GLuint RayCastVolume::create_layered_texture(const VoxelFormat format, const QVector3D& size)
+{
+    const GLint internal_format = texture_format(format).internal_format;
+    bool reused;
+    const GLuint texture = acquire_texture(GL_TEXTURE_2D_ARRAY, internal_format, size, reused);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+    if (!reused) {
+        glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internal_format, size.x(), size.y(), size.z(), 0,
+                               size.z() * slice_bytes(format, size.x(), size.y()), nullptr);
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    return texture;
+}
+
+
+/*!
+ * \brief Get a texture with the given storage, reusing a released one if possible.
+ * \param target Target of the texture.
+ * \param internal_format Internal format of the storage.
+ * \param size Size of the base level, for each axis.
+ * \param reused Set to whether the storage already exists, so only its contents need to be uploaded.
+ * \return Name of the texture.
+ *
+ * On a miss, released textures of the same target and format are freed
+ * first, as they are unlikely to be reused once the size changed.
+ */
+GLuint RayCastVolume::acquire_texture(const GLenum target, const GLint internal_format, const QVector3D& size, bool& reused)
+{
+    const auto same_kind = [&](const TextureStorage& t) {
+        return t.target == target && t.internal_format == internal_format;
+    };
+    auto pooled = std::find_if(m_texture_pool.begin(), m_texture_pool.end(), [&](const TextureStorage& t) {
+        return same_kind(t) && t.size == size;
+    });
+
+    reused = m_texture_pool.end() != pooled;
+    TextureStorage storage {0, target, internal_format, size};
+    if (reused) {
+        storage = *pooled;
+        m_texture_pool.erase(pooled);
+    }
+    else {
+        for (auto it = m_texture_pool.begin(); it != m_texture_pool.end();) {
+            if (same_kind(*it)) {
+                glDeleteTextures(1, &it->name);
+                it = m_texture_pool.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        glGenTextures(1, &storage.name);
+    }
+    m_textures.push_back(storage);
+    return storage.name;
+}
+
+
+/*!
+ * \brief Free a texture created by `create_texture` or `create_layered_texture`.
+ * \param texture Name of the texture, zero if none, reset to zero.
+ */
+void RayCastVolume::release_texture(GLuint& texture)
+{
+    if (!texture) {
+        return;
+    }
+
+    const auto storage = std::find_if(m_textures.begin(), m_textures.end(), [&](const TextureStorage& t) {
+        return t.name == texture;
+    });
+    if (m_textures.end() != storage) {
+        m_textures.erase(storage);
+    }
+    glDeleteTextures(1, &texture);
+    texture = 0;
+}
+
+
+/*!
+ * \brief Keep a texture for reuse by the next texture of the same storage.
+ * \param texture Name of the texture, zero if none, reset to zero.
+ * \param successor Texture replacing it, whose storage must match for the texture to be kept.
+ *
+ * A texture replaced by one of another storage is freed, as is a texture not
+ * created by `create_texture` or `create_layered_texture`. The least recently
+ * released textures are freed while the pool holds more than
+ * `m_texture_pool_budget` bytes.
+ */
+void RayCastVolume::recycle_texture(GLuint& texture, const GLuint successor)
+{
+    const auto find = [&](const GLuint name) {
+        return std::find_if(m_textures.begin(), m_textures.end(), [&](const TextureStorage& t) {
+            return t.name == name;
+        });
+    };
+    const auto storage = find(texture);
+    const auto next = find(successor);
+    if (!texture || m_textures.end() == storage || m_textures.end() == next
+            || storage->target != next->target || storage->internal_format != next->internal_format
+            || storage->size != next->size) {
+        release_texture(texture);
+        return;
+    }
+
+    m_texture_pool.push_back(*storage);
+    m_textures.erase(storage);
+    texture = 0;
+
+    size_t pooled = 0;
+    for (const TextureStorage& t : m_texture_pool) {
+        pooled += storage_bytes(t.internal_format, t.size);
+    }
+    while (!m_texture_pool.empty() && pooled > m_texture_pool_budget) {
+        pooled -= storage_bytes(m_texture_pool.front().internal_format, m_texture_pool.front().size);
+        glDeleteTextures(1, &m_texture_pool.front().name);
+        m_texture_pool.erase(m_texture_pool.begin());
+    }
+}
+
+
+/*!
+ * \brief Copy pixel data into the pixel buffer object.
+ * \param data Pixel data.
+ * \param size Size of the data, in bytes.
+ * \return The pointer to pass to the upload call.
+ *
+ * The pixel buffer is left bound, and the returned pointer is an offset into
+ * it. If the buffer cannot be mapped, it is unbound and the data is uploaded
+ * straight from the host.
+ */
+const void * RayCastVolume::stage_pixels(const unsigned char *data, const size_t size)
+{
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pixel_buffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    void *p = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (p) {
+        std::memcpy(p, data, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        return nullptr; // Offset into the pixel buffer
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return data;
+}
+
+
+/*!
+ * \brief Upload a slab of compressed slices to a layered texture, through the pixel buffer object.
+ * \param texture Destination texture.
+ * \param format Compressed voxel format.
+ * \param data First byte of the whole compressed volume.
+ * \param first_slice First slice to be uploaded.
+ * \param slices Number of slices to be uploaded.
+ */
+void RayCastVolume::upload_compressed_slab(const GLuint texture, const VoxelFormat format, const unsigned char *data, const size_t first_slice, const size_t slices)
+{
+    const size_t width = m_pending->size.x();
+    const size_t height = m_pending->size.y();
+    const size_t slice_size = slice_bytes(format, width, height);
+    const void *slab = stage_pixels(data + first_slice * slice_size, slices * slice_size);
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, first_slice, width, height, slices,
+                              texture_format(format).internal_format, slices * slice_size, slab);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+
+/*!
+ * \brief Upload a slab of slices to a 3D texture, through the pixel buffer object.
+ * \param texture Destination texture.
+ * \param format Format of the pixel data.
+ * \param data First byte of the whole volume data.
+ * \param voxel_size Size of each voxel, in bytes.
+ * \param first_slice First slice to be uploaded.
+ * \param slices Number of slices to be uploaded.
+ * \param type Type of the pixel data.
+ */
+void RayCastVolume::upload_slab(const GLuint texture, const GLenum format, const unsigned char *data, const size_t voxel_size, const size_t first_slice, const size_t slices, const GLenum type)
+{
+    const size_t width = m_pending->size.x();
+    const size_t height = m_pending->size.y();
+    const size_t slice_size = voxel_size * width * height;
+    const void *slab = stage_pixels(data + first_slice * slice_size, slices * slice_size);
+
+    glBindTexture(GL_TEXTURE_3D, texture);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // The array on the host has 1 byte alignment
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, m_size.x(), m_size.y(), m_size.z(), 0, GL_RED, GL_UNSIGNED_BYTE, data.data());
+    glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, first_slice, width, height, slices, format, type, slab);
     glBindTexture(GL_TEXTURE_3D, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+
+/*!
+ * \brief Start uploading a volume.
+ * \param volume Volume to be uploaded.
+ *
+ * The current volume is kept, and it is replaced only when the upload is
+ * complete. Any upload already in progress is cancelled.
+ *
+ * \sa RayCastVolume::upload_step
+ */
+void RayCastVolume::begin_upload(std::shared_ptr<const PreparedVolume> volume)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    m_pending = std::move(volume);
+    m_pending_slice = 0;
+    m_upload_time = 0.0;
+
+    release_texture(m_pending_texture);
+    release_texture(m_pending_gradient_texture);
+
+    if (!m_pixel_buffer) {
+        glGenBuffers(1, &m_pixel_buffer);
+    }
+
+    if (m_pending->bricks) {
+        // Only the coarse level is uploaded, and it is small enough to be uploaded at once
+        const auto size = m_pending->bricks->coarse_size();
+        m_pending_texture = create_texture(GL_R8, GL_RED, GL_LINEAR,
+                                           QVector3D(std::get<0>(size), std::get<1>(size), std::get<2>(size)),
+                                           m_pending->voxels());
+        m_pending_slice = m_pending->size.z();
+        m_upload_time = timer.nsecsElapsed() / 1e6;
+        return;
+    }
+
+    const TextureFormat format = texture_format(m_pending->format);
+    if (VoxelFormat::Rgtc1 == m_pending->format) {
+        m_pending_texture = create_layered_texture(m_pending->format, m_pending->size);
+    }
+    else {
+        m_pending_texture = create_texture(format.internal_format, GL_RED, GL_LINEAR, m_pending->size, nullptr, format.type);
+    }
+    if (m_pending->gradient_data()) {
+        m_pending_gradient_texture = create_texture(GL_RGBA8, GL_RGBA, GL_LINEAR, m_pending->size, nullptr);
+    }
+    m_upload_time = timer.nsecsElapsed() / 1e6;
+}
+
+
+/*!
+ * \brief Upload the next slab of the pending volume.
+ * \param budget Maximum number of bytes to upload (at least one slice is uploaded).
+ * \param replace Whether the volume replaces the current one once uploaded.
+ * \return `true` if the upload is complete.
+ *
+ * Each slab is streamed through a pixel buffer object, so the transfer to the
+ * GPU does not block the caller. Once the last slab is uploaded, the pending
+ * volume replaces the current one, or, if `replace` is false, it is held
+ * until `replace_volume` is called, so it can be uploaded ahead of time.
+ */
+bool RayCastVolume::upload_step(const size_t budget, const bool replace)
+{
+    if (!m_pending) {
+        return true;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const bool gradients = m_pending_gradient_texture != 0;
+    const size_t depth = m_pending->size.z();
+
+    if (m_pending_slice < depth) {
+        const TextureFormat format = texture_format(m_pending->format);
+        const size_t width = m_pending->size.x();
+        const size_t height = m_pending->size.y();
+        const size_t slice_size = slice_bytes(m_pending->format, width, height) + (gradients ? 4 * width * height : 0);
+        const size_t slices = std::min(std::max<size_t>(budget / slice_size, 1), depth - m_pending_slice);
+
+        if (VoxelFormat::Rgtc1 == m_pending->format) {
+            upload_compressed_slab(m_pending_texture, m_pending->format, m_pending->voxels(), m_pending_slice, slices);
+        }
+        else {
+            upload_slab(m_pending_texture, GL_RED, m_pending->voxels(), format.voxel_size, m_pending_slice, slices, format.type);
+        }
+        if (gradients) {
+            upload_slab(m_pending_gradient_texture, GL_RGBA, m_pending->gradient_data(), 4, m_pending_slice, slices);
+        }
+
+        m_pending_slice += slices;
+        m_upload_time += timer.nsecsElapsed() / 1e6;
+        if (m_pending_slice < depth) {
+            return false;
+        }
+    }
+
+    if (replace) {
+        replace_volume();
+    }
+    return true;
+}
+
+
+/*!
+ * \brief Replace the current volume with the pending one, once uploaded.
+ *
+ * \sa RayCastVolume::upload_step
+ */
+void RayCastVolume::replace_volume(void)
+{
+    if (!uploaded()) {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Keep the textures for the next volume only if it has the same storage,
+    // as the frames of a time series do
+    recycle_texture(m_volume_texture, m_pending->bricks ? 0 : m_pending_texture);
+    recycle_texture(m_gradient_texture, m_pending_gradient_texture);
+    recycle_texture(m_coarse_texture, m_pending->bricks ? m_pending_texture : 0);
+    m_volume_levels = 1;
+    m_volume_layered = false;
+    release_brick_cache();
+    if (m_pending->bricks) {
+        m_coarse_texture = m_pending_texture;
+        create_brick_cache(m_pending->bricks);
+    }
+    else if (VoxelFormat::Rgtc1 == m_pending->format) {
+        m_volume_texture = m_pending_texture;
+        m_volume_layered = true;
+    }
+    else {
+        m_volume_texture = m_pending_texture;
+
+        // Build the pyramid of downsampled levels on the GPU
+        const float side = std::max({m_pending->size.x(), m_pending->size.y(), m_pending->size.z()});
+        m_volume_levels = 1 + static_cast<int>(std::floor(std::log2(side)));
+        glBindTexture(GL_TEXTURE_3D, m_volume_texture);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glGenerateMipmap(GL_TEXTURE_3D);
+        glBindTexture(GL_TEXTURE_3D, 0);
+    }
+    m_gradient_texture = m_pending_gradient_texture;
+    m_pending_texture = 0;
+    m_pending_gradient_texture = 0;
+
+    // The occupancy grid is small enough to be uploaded at once
+    const OccupancyGrid& occupancy = m_pending->occupancy;
+    release_texture(m_occupancy_texture);
+    m_occupancy_texture = create_texture(GL_RG8, GL_RG, GL_NEAREST,
+                                         QVector3D(occupancy.width(), occupancy.height(), occupancy.depth()),
+                                         occupancy.data().data());
+
+    m_size = m_pending->volume_size();
+    m_box_offset = m_pending->box_offset;
+    m_box_size = m_pending->size;
+    m_origin = m_pending->origin;
+    m_spacing = m_pending->spacing;
+    m_range = m_pending->range;
+    m_psnr = m_pending->psnr;
+    m_occupancy = occupancy;
+    // Boxes of a volume cannot be picked, as the picker needs all the voxels
+    const bool pickable = !m_pending->partial() && !m_pending->bricks;
+    m_picker = pickable && m_pending->layout ? VolumePicker(m_pending->layout, occupancy, bottom(), top(), m_range) : VolumePicker();
+    m_source = pickable && !m_pending->layout ? m_pending->source : std::string();
+    m_proxy_visibility = BrickVisibility();
+    m_load_timings = m_pending->timings;
+    m_load_timings.emplace_back("upload", m_upload_time + timer.nsecsElapsed() / 1e6);
+    m_pending.reset();
+}
+
+
+/*!
+ * \brief Build the picker of the current volume, if not built yet.
+ * \return Whether the current volume can be picked.
+ *
+ * A volume prepared without `VolumeOptions::bricked_layout` is read again
+ * from its file into a 16 bit layout on the first call, so the host copy of
+ * the voxels is only kept once picking is used. This is attempted once per
+ * volume, and volumes streamed in bricks cannot be picked.
+ */
+bool RayCastVolume::build_picker(void)
+{
+    if (m_picker.empty() && !m_source.empty()) {
+        const std::string source = std::move(m_source);
+        m_source.clear();
+        m_picker = VolumePicker(read_layout(source), m_occupancy, bottom(), top(), m_range);
+    }
+    return !m_picker.empty();
+}
+
+
+/*!
+ * \brief Discard the pending volume, keeping the current one.
+ */
+void RayCastVolume::cancel_upload(void)
+{
+    release_texture(m_pending_texture);
+    release_texture(m_pending_gradient_texture);
+    m_pending.reset();
+}
+
+
+/*!
+ * \brief Free the gradient texture, falling back to on-the-fly gradients.
+ */
+void RayCastVolume::release_gradients(void)
+{
+    release_texture(m_gradient_texture);
 }
 
 
 /*!
  * \brief Create a noise texture with the size of the viewport.
+ *
+ * The noise is regenerated only when the size of the viewport changes, into
+ * a buffer kept across resizes, and the texture is reallocated in place.
  */
 void RayCastVolume::create_noise(void)
 {
@@ -132,35 +981,453 @@ void RayCastVolume::create_noise(void)
     glGetIntegerv(GL_VIEWPORT, viewport);
     const int width = viewport[2];
     const int height = viewport[3];
+    if (m_noise_texture && width == m_noise_width && height == m_noise_height) {
+        return;
+    }
 
     std::srand(std::time(NULL));
-    unsigned char noise[width * height];
-
-    for (unsigned char *p = noise; p <= noise + width * height; ++p) {
-        *p = std::rand() % 256;
+    m_noise.resize(static_cast<size_t>(width) * height);
+    for (unsigned char& p : m_noise) {
+        p = std::rand() % 256;
     }
 
-    glDeleteTextures(1, &m_noise_texture);
-    glGenTextures(1, &m_noise_texture);
+    if (!m_noise_texture) {
+        glGenTextures(1, &m_noise_texture);
+        glBindTexture(GL_TEXTURE_2D, m_noise_texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
     glBindTexture(GL_TEXTURE_2D, m_noise_texture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, noise);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // The rows on the host are not padded
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, m_noise.data());
     glBindTexture(GL_TEXTURE_2D, 0);
+    m_noise_width = width;
+    m_noise_height = height;
+}
+
+
+/*!
+ * \brief Bricks visible where their maximum exceeds an isosurface threshold.
+ * \param threshold Normalised intensity of the isosurface.
+ */
+BrickVisibility BrickVisibility::above(const float threshold)
+{
+    BrickVisibility visibility;
+    visibility.low.resize(256);
+    visibility.high.resize(256);
+    visibility.visible_before.assign(257, 0);
+    for (int v = 0; v < 256; ++v) {
+        visibility.low[v] = v;
+        visibility.high[v] = v;
+        visibility.visible_before[v + 1] = visibility.visible_before[v] + (v / 255.0f > threshold ? 1 : 0);
+    }
+    return visibility;
+}
+
+
+/*!
+ * \brief Bricks visible where the transfer function reaches an opacity of 1/255.
+ * \param table Colour and opacity table of the transfer function (see `TransferFunction::table`).
+ * \param window Normalised intensity window of the transfer function.
+ *
+ * The intensity range of a brick is windowed and rounded outwards to the
+ * table entries, as `opacity_bounds` in the shaders.
+ */
+BrickVisibility BrickVisibility::opaque(const std::vector<float>& table, const QVector2D& window)
+{
+    const size_t size = table.size() / 4;
+    const float width = std::max(window.y() - window.x(), 1e-6f);
+
+    BrickVisibility visibility;
+    visibility.low.resize(256);
+    visibility.high.resize(256);
+    for (int v = 0; v < 256; ++v) {
+        const float intensity = std::clamp((v / 255.0f - window.x()) / width, 0.0f, 1.0f);
+        visibility.low[v] = static_cast<uint16_t>(std::floor(intensity * (size - 1)));
+        visibility.high[v] = static_cast<uint16_t>(std::ceil(intensity * (size - 1)));
+    }
+    visibility.visible_before.assign(size + 1, 0);
+    for (size_t i = 0; i < size; ++i) {
+        visibility.visible_before[i + 1] = visibility.visible_before[i] + (table[4 * i + 3] >= 1.0f / 255.0f ? 1 : 0);
+    }
+    return visibility;
+}
+
+
+/*!
+ * \brief Fit the proxy geometry to the bricks that can affect the rendering.
+ * \param visibility Bricks that can affect the rendering.
+ *
+ * The proxy is the bounding box of the visible bricks. It is rebuilt only
+ * when the visibility changes, and the mesh is recreated only when its
+ * bounds actually change.
+ */
+void RayCastVolume::update_proxy(const BrickVisibility& visibility)
+{
+    if (visibility == m_proxy_visibility) {
+        return;
+    }
+    m_proxy_visibility = visibility;
+
+    size_t lo[3] = {m_occupancy.width(), m_occupancy.height(), m_occupancy.depth()};
+    size_t hi[3] = {0, 0, 0};
+    for (size_t k = 0; k < m_occupancy.depth(); ++k) {
+        for (size_t j = 0; j < m_occupancy.height(); ++j) {
+            for (size_t i = 0; i < m_occupancy.width(); ++i) {
+                if (visibility.visible(m_occupancy.minimum(i, j, k), m_occupancy.maximum(i, j, k))) {
+                    lo[0] = std::min(lo[0], i); hi[0] = std::max(hi[0], i + 1);
+                    lo[1] = std::min(lo[1], j); hi[1] = std::max(hi[1], j + 1);
+                    lo[2] = std::min(lo[2], k); hi[2] = std::max(hi[2], k + 1);
+                }
+            }
+        }
+    }
+
+    if (hi[0] <= lo[0]) {
+        m_proxy_empty = true;
+        return;
+    }
+    m_proxy_empty = false;
+
+    // Bounds in texture coordinates, the grid covering the box held
+    const float brick = m_occupancy.brick_size();
+    const QVector3D bottom = (m_box_offset + QVector3D(lo[0], lo[1], lo[2]) * brick) / m_size;
+    const QVector3D top = (m_box_offset + QVector3D(std::min(hi[0] * brick, m_box_size.x()),
+                                                    std::min(hi[1] * brick, m_box_size.y()),
+                                                    std::min(hi[2] * brick, m_box_size.z()))) / m_size;
+
+    if (m_proxy && bottom == m_proxy_bottom && top == m_proxy_top) {
+        return;
+    }
+    m_proxy_bottom = bottom;
+    m_proxy_top = top;
+    m_proxy = std::make_unique<Mesh>(box_vertices(2.0f * bottom - QVector3D(1, 1, 1), 2.0f * top - QVector3D(1, 1, 1)), box_indices);
+}
+
+
+/*!
+ * \brief Allocate the brick atlas and the page table for a bricked volume.
+ * \param bricks Source of the bricks.
+ *
+ * The atlas is a 3D texture of page slots, as large as the brick cache size
+ * allows (without exceeding the number of bricks, or the maximum 3D texture
+ * size). The page table holds, for each brick, the coordinates of its slot
+ * in the RGB channels, and whether the brick is resident in the alpha channel.
+ */
+void RayCastVolume::create_brick_cache(std::shared_ptr<const BrickedVolume> bricks)
+{
+    GLint max_texture_size;
+    glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_texture_size);
+
+    const size_t max_side = std::min<size_t>(max_texture_size / bricks->page_size(), 255);
+    const size_t slots = std::min(std::max<size_t>(m_brick_cache_size / bricks->page_bytes(), 1), bricks->brick_count());
+    const size_t width = std::min(max_side, static_cast<size_t>(std::ceil(std::cbrt(static_cast<double>(slots)))));
+    const size_t height = std::min(width, (slots + width - 1) / width);
+    const size_t depth = std::min(max_side, std::max<size_t>(slots / (width * height), 1));
+    const size_t slot_count = width * height * depth;
+
+    m_bricks = std::move(bricks);
+    m_atlas_slots = QVector3D(width, height, depth);
+    m_volume_texture = create_texture(GL_R8, GL_RED, GL_LINEAR, atlas_size(), nullptr);
+
+    const OccupancyGrid& grid = m_bricks->occupancy();
+    m_page_table.assign(4 * m_bricks->brick_count(), 0);
+    m_page_table_texture = create_texture(GL_RGBA8UI, GL_RGBA_INTEGER, GL_NEAREST,
+                                          QVector3D(grid.width(), grid.height(), grid.depth()),
+                                          m_page_table.data());
+
+    m_brick_slot.assign(m_bricks->brick_count(), -1);
+    m_slot_brick.assign(slot_count, -1);
+    m_slot_frame.assign(slot_count, 0);
+    m_slot_lru.resize(slot_count);
+    m_lru.clear();
+    for (size_t slot = 0; slot < slot_count; ++slot) {
+        m_slot_lru[slot] = m_lru.insert(m_lru.end(), slot);
+    }
+    m_wanted_bricks.clear();
+    m_wanted_visibility = BrickVisibility();
+    m_brick_frame = 0;
+}
+
+
+/*!
+ * \brief Release the brick atlas and the page table.
+ *
+ * The atlas is the volume texture, and it is released by the caller.
+ */
+void RayCastVolume::release_brick_cache(void)
+{
+    release_texture(m_page_table_texture);
+    m_bricks.reset();
+    m_atlas_slots = QVector3D();
+    m_page_table.clear();
+    m_brick_slot.clear();
+    m_slot_brick.clear();
+    m_slot_frame.clear();
+    m_slot_lru.clear();
+    m_lru.clear();
+    m_wanted_bricks.clear();
+}
+
+
+/*!
+ * \brief Select the bricks needed at full resolution for the current view.
+ *
+ * A brick is needed when it can affect the rendering (it is visible from
+ * its intensity range), it intersects the view frustum, and its projection
+ * covers more pixels than the coarse level has voxels across a brick, so the
+ * coarse level would be visibly blurred over it. The bricks are sorted from
+ * the nearest to the camera, and only as many as the atlas can hold are kept.
+ */
+void RayCastVolume::select_bricks(void)
+{
+    m_wanted_bricks.clear();
+
+    const OccupancyGrid& grid = m_bricks->occupancy();
+    const float brick = m_bricks->brick_size();
+    const float coarse_voxels = brick * std::get<0>(m_bricks->coarse_size()) / m_size.x();
+    if (coarse_voxels >= brick) {
+        return; // The coarse level is already at full resolution
+    }
+
+    std::vector<std::pair<float, size_t>>& candidates = m_brick_candidates;
+    candidates.clear();
+    for (size_t k = 0; k < grid.depth(); ++k) {
+        for (size_t j = 0; j < grid.height(); ++j) {
+            for (size_t i = 0; i < grid.width(); ++i) {
+                if (!m_wanted_visibility.visible(grid.minimum(i, j, k), grid.maximum(i, j, k))) {
+                    continue;
+                }
+
+                // Corners of the brick, in the coordinates of the two-unit cube
+                const QVector3D bottom = 2.0f * QVector3D(i, j, k) * brick / m_size - QVector3D(1, 1, 1);
+                const QVector3D top = 2.0f * QVector3D(std::min((i + 1) * brick, m_size.x()),
+                                                       std::min((j + 1) * brick, m_size.y()),
+                                                       std::min((k + 1) * brick, m_size.z())) / m_size - QVector3D(1, 1, 1);
+
+                int outside[6] = {0, 0, 0, 0, 0, 0};
+                bool behind = false;
+                float depth = std::numeric_limits<float>::max();
+                QVector2D lo {std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+                QVector2D hi {std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest()};
+                for (int c = 0; c < 8; ++c) {
+                    const QVector4D p = m_wanted_view * QVector4D(c & 1 ? top.x() : bottom.x(),
+                                                                  c & 2 ? top.y() : bottom.y(),
+                                                                  c & 4 ? top.z() : bottom.z(), 1.0f);
+                    outside[0] += p.x() < -p.w();
+                    outside[1] += p.x() > p.w();
+                    outside[2] += p.y() < -p.w();
+                    outside[3] += p.y() > p.w();
+                    outside[4] += p.z() < -p.w();
+                    outside[5] += p.z() > p.w();
+
+                    if (p.w() <= 0.0f) {
+                        behind = true;
+                        continue;
+                    }
+                    const QVector2D ndc = p.toVector2D() / p.w();
+                    lo = QVector2D(std::min(lo.x(), ndc.x()), std::min(lo.y(), ndc.y()));
+                    hi = QVector2D(std::max(hi.x(), ndc.x()), std::max(hi.y(), ndc.y()));
+                    depth = std::min(depth, p.w());
+                }
+
+                // Frustum culling
+                if (std::find(std::begin(outside), std::end(outside), 8) != std::end(outside)) {
+                    continue;
+                }
+
+                // Level of detail, bricks crossing the camera plane always need full resolution
+                if (behind) {
+                    depth = 0.0f;
+                }
+                else {
+                    const QVector2D pixels = 0.5f * (hi - lo) * m_wanted_viewport;
+                    if (std::max(pixels.x(), pixels.y()) <= coarse_voxels) {
+                        continue;
+                    }
+                }
+
+                candidates.push_back({depth, (k * grid.height() + j) * grid.width() + i});
+            }
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end());
+    candidates.resize(std::min(candidates.size(), m_slot_brick.size()));
+    for (const auto& candidate : candidates) {
+        m_wanted_bricks.push_back(candidate.second);
+    }
+}
+
+
+/*!
+ * \brief Stream the bricks needed for a view into the atlas.
+ * \param mvp Model-view-projection matrix of the two-unit cube.
+ * \param viewport Size of the viewport, in pixels.
+ * \param visibility Bricks that can affect the rendering.
+ * \param budget Maximum number of bytes to read and upload (at least one brick is uploaded).
+ * \return `true` if the atlas changed, or more bricks are needed.
+ *
+ * The bricks already resident are marked as used first, then the missing
+ * ones replace the least recently used slots that the view does not need.
+ * The missing bricks are read in parallel, straight into a pixel buffer
+ * object, and each of them is copied into its slot.
+ */
+bool RayCastVolume::update_bricks(const QMatrix4x4& mvp, const QVector2D& viewport, const BrickVisibility& visibility, const size_t budget)
+{
+    if (!m_bricks) {
+        return false;
+    }
+    ++m_brick_frame;
+
+    if (visibility != m_wanted_visibility || mvp != m_wanted_view || viewport != m_wanted_viewport) {
+        m_wanted_visibility = visibility;
+        m_wanted_view = mvp;
+        m_wanted_viewport = viewport;
+        select_bricks();
+    }
+
+    // Mark the resident bricks as used
+    for (const size_t brick : m_wanted_bricks) {
+        const std::ptrdiff_t slot = m_brick_slot[brick];
+        if (slot >= 0) {
+            m_slot_frame[slot] = m_brick_frame;
+            m_lru.splice(m_lru.begin(), m_lru, m_slot_lru[slot]);
+        }
+    }
+
+    // Assign a slot to the missing bricks, evicting the least recently used ones
+    const size_t page_bytes = m_bricks->page_bytes();
+    const size_t max_loads = std::max<size_t>(budget / page_bytes, 1);
+    std::vector<std::pair<size_t, size_t>>& loads = m_brick_loads;
+    loads.clear();
+    bool pending = false;
+    for (const size_t brick : m_wanted_bricks) {
+        if (m_brick_slot[brick] >= 0) {
+            continue;
+        }
+        if (loads.size() >= max_loads) {
+            pending = true;
+            break;
+        }
+        const size_t slot = m_lru.back();
+        if (m_slot_frame[slot] == m_brick_frame) {
+            break; // Every slot is needed by the view
+        }
+
+        const std::ptrdiff_t evicted = m_slot_brick[slot];
+        if (evicted >= 0) {
+            m_brick_slot[evicted] = -1;
+            m_page_table[4 * evicted + 3] = 0;
+        }
+        m_slot_brick[slot] = brick;
+        m_brick_slot[brick] = slot;
+        m_slot_frame[slot] = m_brick_frame;
+        m_lru.splice(m_lru.begin(), m_lru, m_slot_lru[slot]);
+
+        const size_t width = m_atlas_slots.x();
+        const size_t height = m_atlas_slots.y();
+        m_page_table[4 * brick + 0] = slot % width;
+        m_page_table[4 * brick + 1] = (slot / width) % height;
+        m_page_table[4 * brick + 2] = slot / (width * height);
+        m_page_table[4 * brick + 3] = 1;
+        loads.push_back({brick, slot});
+    }
+
+    if (loads.empty()) {
+        return pending;
+    }
+
+    // Read the bricks into the pixel buffer
+    const size_t size = loads.size() * page_bytes;
+    std::vector<unsigned char> staging;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pixel_buffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    unsigned char *pages = static_cast<unsigned char *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+    if (!pages) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        staging.resize(size);
+        pages = staging.data();
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for (std::ptrdiff_t n = 0; n < static_cast<std::ptrdiff_t>(loads.size()); ++n) {
+        m_bricks->read_page(loads[n].first, pages + n * page_bytes);
+    }
+
+    // Offsets are relative to the pixel buffer, unless it could not be mapped
+    const uintptr_t source = staging.empty() ? 0 : reinterpret_cast<uintptr_t>(staging.data());
+    if (staging.empty()) {
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+
+    // Copy each brick into its slot
+    const size_t page = m_bricks->page_size();
+    const size_t width = m_atlas_slots.x();
+    const size_t height = m_atlas_slots.y();
+    glBindTexture(GL_TEXTURE_3D, m_volume_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // The array on the host has 1 byte alignment
+    for (size_t n = 0; n < loads.size(); ++n) {
+        const size_t slot = loads[n].second;
+        glTexSubImage3D(GL_TEXTURE_3D, 0,
+                        (slot % width) * page, ((slot / width) % height) * page, (slot / (width * height)) * page,
+                        page, page, page, GL_RED, GL_UNSIGNED_BYTE, reinterpret_cast<const void *>(source + n * page_bytes));
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    // The page table is small, and it is uploaded whole
+    const OccupancyGrid& grid = m_bricks->occupancy();
+    glBindTexture(GL_TEXTURE_3D, m_page_table_texture);
+    glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, grid.width(), grid.height(), grid.depth(),
+                    GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, m_page_table.data());
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    return true;
 }
 
 
 /*!
  * \brief Render the bounding box.
+ * \param proxy Render the proxy geometry instead of the whole bounding box.
+ *
+ * Only the back faces are rasterised, so each fragment is shaded once, also
+ * when the camera is inside the box.
  */
-void RayCastVolume::paint(void)
+void RayCastVolume::paint(const bool proxy)
 {
-    glActiveTexture(GL_TEXTURE0); glBindTexture(GL_TEXTURE_3D, m_volume_texture);
-    glActiveTexture(GL_TEXTURE1); glBindTexture(GL_TEXTURE_2D, m_noise_texture);
+    if (proxy && m_proxy_empty) {
+        return;
+    }
 
-    m_cube_vao.paint();
+    bind_textures();
+
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_FRONT);
+    if (proxy && m_proxy) {
+        m_proxy->paint();
+    }
+    else {
+        m_cube_vao.paint();
+    }
+    glDisable(GL_CULL_FACE);
+}
+
+
+/*!
+ * \brief Bind the textures of the volume to the units of the raycasting programs.
+ */
+void RayCastVolume::bind_textures(void)
+{
+    glActiveTexture(GL_TEXTURE0); glBindTexture(GL_TEXTURE_3D, m_volume_layered ? 0 : m_volume_texture);
+    glActiveTexture(GL_TEXTURE1); glBindTexture(GL_TEXTURE_2D, m_noise_texture);
+    glActiveTexture(GL_TEXTURE2); glBindTexture(GL_TEXTURE_3D, m_occupancy_texture);
+    glActiveTexture(GL_TEXTURE3); glBindTexture(GL_TEXTURE_3D, m_gradient_texture);
+    glActiveTexture(GL_TEXTURE4); glBindTexture(GL_TEXTURE_3D, m_page_table_texture);
+    glActiveTexture(GL_TEXTURE5); glBindTexture(GL_TEXTURE_3D, m_coarse_texture);
+    glActiveTexture(GL_TEXTURE6); glBindTexture(GL_TEXTURE_2D_ARRAY, m_volume_layered ? m_volume_texture : 0);
+    glActiveTexture(GL_TEXTURE0);
 }
 
 
@@ -22,11 +22,143 @@
 
 #pragma once
 
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include <QMatrix4x4>
 #include <QOpenGLExtraFunctions>
+#include <QVector2D>
 #include <QVector3D>
 
+#include "brickedvolume.h"
+#include "mappedfile.h"
 #include "mesh.h"
+#include "occupancygrid.h"
+#include "volumepicker.h"
+
+/*!
+ * \brief Precision of the voxels of a volume texture.
+ */
+enum class VoxelFormat
+{
+    Automatic, /*!< Narrowest format preserving the dynamic range of the data. */
+    Uint8,     /*!< 8 bit normalised integers (`GL_R8`). */
+    Uint16,    /*!< 16 bit normalised integers (`GL_R16`). */
+    Float16,   /*!< Half precision floats in [0, 1] (`GL_R16F`). */
+    Float32,   /*!< Single precision floats in [0, 1] (`GL_R32F`). */
+    Rgtc1,     /*!< 8 bit slices in lossy 4x4 blocks (`GL_COMPRESSED_RED_RGTC1`), half a byte per voxel. */
+};
+
+size_t slice_bytes(const VoxelFormat format, const size_t width, const size_t height);
+
+/*!
+ * \brief Volume data read and normalised on the CPU, ready to be uploaded.
+ *
+ * Preparing a volume does not require an OpenGL context, so it can be done
+ * on a worker thread.
+ */
+struct PreparedVolume
+{
+    QVector3D size;                   /*!< Number of voxels held for each axis. */
+    QVector3D box_offset;             /*!< First voxel held, in the whole volume (zero unless only a box was read). */
+    QVector3D whole_size;             /*!< Number of voxels of the whole volume, if only a box was read (zero otherwise). */
+    QVector3D origin;                 /*!< Origin, in voxel coordinates. */
+    QVector3D spacing;                /*!< Spacing between voxels. */
+    std::pair<double, double> range;  /*!< (min, max) of the original intensities. */
+    VoxelFormat format {VoxelFormat::Uint8}; /*!< Format of the voxels. */
+    std::vector<unsigned char> data;  /*!< Normalised voxels, in `format` (the 8 bit coarse level, when bricked). */
+    OccupancyGrid occupancy;          /*!< Intensity range of each brick, for empty space skipping. */
+    std::vector<unsigned char> gradients; /*!< Encoded RGBA gradient of each voxel, if computed. */
+    std::shared_ptr<const BrickedVolume> bricks; /*!< Bricks read on demand, when streaming out of core. */
+    std::shared_ptr<const BrickedLayout<uint16_t>> layout; /*!< 16 bit voxels in Z-ordered bricks, for CPU passes, if requested. */
+    double psnr {0.0};                /*!< Peak signal to noise ratio of the compressed voxels against the 8 bit ones, in dB (0 if not compressed, finite even if lossless). */
+    std::shared_ptr<const MappedFile> cache;         /*!< Mapping of the cache file the volume was loaded from, if any. */
+    const unsigned char *cached_data {nullptr};      /*!< Voxels within the cache mapping, replacing `data`. */
+    const unsigned char *cached_gradients {nullptr}; /*!< Gradients within the cache mapping, replacing `gradients`. */
+    std::vector<std::pair<std::string, double>> timings; /*!< CPU time of each preparation stage, in milliseconds. */
+    std::string source;               /*!< File the volume was read from, to build a layout on demand. */
+
+    /*!
+     * \brief Whether only a box of the volume was read (see `VolumeOptions::node`).
+     */
+    bool partial(void) const {
+        return !whole_size.isNull();
+    }
+
+    /*!
+     * \brief Number of voxels of the whole volume for each axis, giving its geometry.
+     */
+    QVector3D volume_size(void) const {
+        return partial() ? whole_size : size;
+    }
+
+    /*!
+     * \brief Normalised voxels, wherever they are stored.
+     */
+    const unsigned char * voxels(void) const {
+        return cached_data ? cached_data : data.data();
+    }
+
+    /*!
+     * \brief Encoded gradients, wherever they are stored, or null if not computed.
+     */
+    const unsigned char * gradient_data(void) const {
+        return cached_gradients ? cached_gradients : (gradients.empty() ? nullptr : gradients.data());
+    }
+};
+
+/*!
+ * \brief Which bricks can affect the rendering, from their 8 bit intensity range.
+ *
+ * A brick with the range [min, max] is visible if some entry of a table
+ * between `low[min]` and `high[max]` is visible, as the shaders skip empty
+ * space, so the proxy geometry and the streamed bricks agree with them.
+ */
+struct BrickVisibility
+{
+    std::vector<uint16_t> low;     /*!< First table entry spanned by each intensity. */
+    std::vector<uint16_t> high;    /*!< Last table entry spanned by each intensity. */
+    std::vector<uint16_t> visible_before; /*!< Visible table entries before each entry, and in the whole table. */
+
+    static BrickVisibility above(const float threshold);
+    static BrickVisibility opaque(const std::vector<float>& table, const QVector2D& window);
+
+    /*!
+     * \brief Whether a brick with an intensity range can affect the rendering.
+     */
+    bool visible(const unsigned char minimum, const unsigned char maximum) const {
+        return visible_before[high[maximum] + 1] > visible_before[low[minimum]];
+    }
+
+    bool operator==(const BrickVisibility& other) const {
+        return low == other.low && high == other.high && visible_before == other.visible_before;
+    }
+
+    bool operator!=(const BrickVisibility& other) const {
+        return !(*this == other);
+    }
+};
+
+/*!
+ * \brief Options controlling which derived data is prepared with a volume.
+ */
+struct VolumeOptions
+{
+    bool gradients = true; /*!< Precompute a gradient texture, trading memory for shading speed. */
+    bool bricked = false;  /*!< Stream bricks on demand, instead of uploading the whole volume. */
+    VoxelFormat format = VoxelFormat::Automatic;    /*!< Precision of the volume texture (bricks are always 8 bit). */
+    size_t texture_budget = size_t {2} << 30;       /*!< Memory the automatic format can use for the volume and gradient textures, in bytes. */
+    bool cache = false;                             /*!< Reuse and write a binary cache of the prepared volume (never when bricked). */
+    std::string cache_directory;                    /*!< Directory of the cache files (next to the source, if empty). */
+    bool bricked_layout = false;                    /*!< Also keep 16 bit voxels in Z-ordered bricks, for CPU passes and picking. */
+    size_t partitions = 1;                          /*!< Boxes the volume is split in by `VolumePartition`, when reading a single box. */
+    int node = -1;                                  /*!< Only box read, with a margin of `VolumePartition::margin` voxels, or the whole volume if negative. */
+};
 
 /*!
  * \brief Class for a raycasting volume.
@@ -37,11 +169,44 @@ public:
     RayCastVolume(void);
     virtual ~RayCastVolume();
 
-    void load_volume(const QString &filename);
+    static std::shared_ptr<const PreparedVolume> prepare_volume(const QString& filename, const VolumeOptions& options = {});
+    static std::shared_ptr<const BrickedLayout<uint16_t>> bricked_layout(const PreparedVolume& volume);
+    static std::shared_ptr<const BrickedLayout<uint16_t>> bricked_layout(const PreparedVolume& volume, const VoxelRegion& region);
+
+    void load_volume(const QString &filename, const VolumeOptions& options = {});
+    void begin_upload(std::shared_ptr<const PreparedVolume> volume);
+    bool upload_step(const size_t budget, const bool replace = true);
+    void replace_volume(void);
+    void cancel_upload(void);
+    void release_gradients(void);
     void create_noise(void);
-    void paint(void);
+    void update_proxy(const BrickVisibility& visibility);
+    bool update_bricks(const QMatrix4x4& mvp, const QVector2D& viewport, const BrickVisibility& visibility, const size_t budget);
+    void paint(const bool proxy = false);
+    void bind_textures(void);
     std::pair<double, double> range(void);
 
+    /*!
+     * \brief Whether a volume is being uploaded.
+     */
+    bool uploading(void) const {
+        return static_cast<bool>(m_pending);
+    }
+
+    /*!
+     * \brief Whether a pending volume is completely uploaded, and waiting to replace the current one.
+     */
+    bool uploaded(void) const {
+        return m_pending && m_pending_slice >= static_cast<size_t>(m_pending->size.z());
+    }
+
+    /*!
+     * \brief Fraction of the pending volume already uploaded, in [0, 1].
+     */
+    float upload_progress(void) const {
+        return m_pending ? static_cast<float>(m_pending_slice) / m_pending->size.z() : 1.0f;
+    }
+
 
     /*!
      * \brief Get the extent of the volume.
@@ -55,6 +220,174 @@ public:
         return e / std::max({e.x(), e.y(), e.z()});
     }
 
+    /*!
+     * \brief Intersect a ray with the isosurface, on the CPU.
+     * \param origin Origin of the ray, in world coordinates.
+     * \param direction Direction of the ray, in world coordinates.
+     * \param threshold Normalised intensity of the isosurface.
+     * \return The first intersection in front of the origin, if any.
+     *
+     * Only volumes prepared with `VolumeOptions::bricked_layout`, or whose
+     * picker was built with `build_picker`, can be picked, others miss every
+     * ray.
+     */
+    std::optional<VolumePicker::Hit> pick(const QVector3D& origin, const QVector3D& direction, const float threshold) const {
+        return m_picker.intersect(origin, direction, threshold);
+    }
+
+    bool build_picker(void);
+
+    /*!
+     * \brief Whether the current volume can be picked.
+     */
+    bool pickable(void) const {
+        return !m_picker.empty();
+    }
+
+    /*!
+     * \brief Whether a precomputed gradient texture is available.
+     */
+    bool has_gradients(void) const {
+        return m_gradient_texture != 0;
+    }
+
+    /*!
+     * \brief Coarsest level of detail of the volume texture.
+     *
+     * Bricked volumes have a single level, as their level of detail is
+     * selected when streaming.
+     */
+    float max_lod(void) const {
+        return m_volume_levels - 1;
+    }
+
+    /*!
+     * \brief Whether the volume is stored as a compressed layered texture.
+     */
+    bool layered(void) const {
+        return m_volume_layered;
+    }
+
+    /*!
+     * \brief Peak signal to noise ratio of the compressed volume, in dB (0 if not compressed).
+     */
+    double psnr(void) const {
+        return m_psnr;
+    }
+
+    /*!
+     * \brief CPU time of each stage of loading the current volume, in milliseconds.
+     *
+     * The preparation stages are followed by the upload, summed over the
+     * frames it was spread across.
+     */
+    const std::vector<std::pair<std::string, double>>& load_timings(void) const {
+        return m_load_timings;
+    }
+
+    /*!
+     * \brief Whether the volume is streamed in bricks.
+     */
+    bool bricked(void) const {
+        return static_cast<bool>(m_bricks);
+    }
+
+    /*!
+     * \brief Set the GPU memory reserved to bricks, from the next volume loaded.
+     * \param bytes Size of the brick cache, in bytes.
+     */
+    void set_brick_cache_size(const size_t bytes) {
+        m_brick_cache_size = bytes;
+    }
+
+    /*!
+     * \brief Set the GPU memory the released textures can keep for reuse.
+     * \param bytes Size of the texture pool, in bytes.
+     */
+    void set_texture_pool_budget(const size_t bytes) {
+        m_texture_pool_budget = bytes;
+    }
+
+    /*!
+     * \brief Number of voxels of the whole volume for each axis.
+     */
+    QVector3D size(void) const {
+        return m_size;
+    }
+
+    /*!
+     * \brief Spacing between voxels.
+     */
+    QVector3D spacing(void) const {
+        return m_spacing;
+    }
+
+    /*!
+     * \brief Bottom corner of the box held by the textures, in texture coordinates of the whole volume.
+     *
+     * Only a box of the volume is held if it was prepared with
+     * `VolumeOptions::node`, the whole volume otherwise.
+     */
+    QVector3D box_bottom(void) const {
+        return m_box_offset / m_size;
+    }
+
+    /*!
+     * \brief Top corner of the box held by the textures, in texture coordinates of the whole volume.
+     */
+    QVector3D box_top(void) const {
+        return (m_box_offset + m_box_size) / m_size;
+    }
+
+    /*!
+     * \brief Side of an occupancy brick (a streamed brick, when bricked), in voxels.
+     */
+    float brick_size(void) const {
+        return m_occupancy.brick_size();
+    }
+
+    /*!
+     * \brief Number of voxels of the brick atlas for each axis.
+     */
+    QVector3D atlas_size(void) const {
+        return m_atlas_slots * (m_bricks ? m_bricks->page_size() : 0.0f);
+    }
+
+    /*!
+     * \brief Extent of an occupancy brick, in texture coordinates.
+     */
+    QVector3D brick_extent(void) {
+        const float brick = m_occupancy.brick_size();
+        return QVector3D(brick, brick, brick) / m_size;
+    }
+
+    /*!
+     * \brief Top planes of the proxy geometry.
+     * \return A vector holding the intercept of the top plane for each axis.
+     *
+     * \sa RayCastVolume::update_proxy
+     */
+    QVector3D proxy_top(void) {
+        return bottom() + (top() - bottom()) * m_proxy_top;
+    }
+
+    /*!
+     * \brief Whether the proxy geometry is empty, as all the bricks are.
+     */
+    bool proxy_empty(void) const {
+        return m_proxy_empty;
+    }
+
+    /*!
+     * \brief Bottom planes of the proxy geometry.
+     * \return A vector holding the intercept of the bottom plane for each axis.
+     *
+     * \sa RayCastVolume::update_proxy
+     */
+    QVector3D proxy_bottom(void) {
+        return bottom() + (top() - bottom()) * m_proxy_bottom;
+    }
+
     /*!
      * \brief Return the model matrix for the volume.
      * \param shift Shift the volume by its origin.
@@ -100,12 +433,86 @@ public:
 
 private:
     GLuint m_volume_texture;
+    int m_volume_levels {1};                 /*!< Number of mipmap levels of the volume texture. */
+    bool m_volume_layered {false};           /*!< Whether the volume texture is a compressed 2D array. */
+    double m_psnr {0.0};                     /*!< Quality of the compressed volume, in dB. */
     GLuint m_noise_texture;
+    std::vector<unsigned char> m_noise;      /*!< Host copy of the noise, kept across resizes. */
+    int m_noise_width {0};                   /*!< Width of the noise texture, in pixels. */
+    int m_noise_height {0};                  /*!< Height of the noise texture, in pixels. */
+    GLuint m_occupancy_texture {0};
+    GLuint m_gradient_texture {0};
     Mesh m_cube_vao;
+    OccupancyGrid m_occupancy;
+    VolumePicker m_picker;                   /*!< CPU ray queries against the isosurface. */
+    std::string m_source;                    /*!< File of the current volume, until its picker is built. */
+    std::unique_ptr<Mesh> m_proxy;           /*!< Bounding box of the non-empty bricks. */
+    QVector3D m_proxy_bottom {0.0, 0.0, 0.0}; /*!< Bottom of the proxy, in texture coordinates. */
+    QVector3D m_proxy_top {1.0, 1.0, 1.0};    /*!< Top of the proxy, in texture coordinates. */
+    BrickVisibility m_proxy_visibility;      /*!< Visibility the proxy was built for, empty if none. */
+    bool m_proxy_empty {false};              /*!< Whether all the bricks are empty. */
     std::pair<double, double> m_range;
     QVector3D m_origin;
     QVector3D m_spacing;
     QVector3D m_size;
+    QVector3D m_box_offset;  /*!< First voxel held by the textures, in the whole volume. */
+    QVector3D m_box_size;    /*!< Number of voxels held by the textures. */
+
+    static constexpr size_t occupancy_brick_size = 8;  /*!< Side of the bricks used for empty space skipping. */
+    static constexpr size_t streaming_brick_size = 32; /*!< Side of the bricks streamed out of core. */
+    static constexpr size_t coarse_size_limit = 256;   /*!< Maximum side of the coarse level of a bricked volume. */
+
+    std::shared_ptr<const BrickedVolume> m_bricks;   /*!< Source of the bricks, when streaming out of core. */
+    size_t m_brick_cache_size {size_t {512} << 20};  /*!< GPU memory reserved to bricks, in bytes. */
+    GLuint m_coarse_texture {0};                     /*!< Coarse level, sampled where no brick is resident. */
+    GLuint m_page_table_texture {0};                 /*!< Atlas slot of each brick. */
+    QVector3D m_atlas_slots;                         /*!< Number of slots of the atlas for each axis. */
+    std::vector<unsigned char> m_page_table;        /*!< RGBA entry of each brick: slot coordinates, and residency. */
+    std::vector<std::ptrdiff_t> m_brick_slot;        /*!< Slot holding each brick, or -1. */
+    std::vector<std::ptrdiff_t> m_slot_brick;        /*!< Brick held by each slot, or -1. */
+    std::vector<uint64_t> m_slot_frame;              /*!< Last frame each slot was needed. */
+    std::list<size_t> m_lru;                         /*!< Slots, from the most to the least recently used. */
+    std::vector<std::list<size_t>::iterator> m_slot_lru; /*!< Position of each slot in the LRU list. */
+    std::vector<size_t> m_wanted_bricks;             /*!< Bricks needed at full resolution for the view, nearest first. */
+    QMatrix4x4 m_wanted_view;                        /*!< View the wanted bricks were selected for. */
+    QVector2D m_wanted_viewport;                     /*!< Viewport the wanted bricks were selected for. */
+    BrickVisibility m_wanted_visibility;             /*!< Visibility the wanted bricks were selected for, empty if none. */
+    uint64_t m_brick_frame {0};                      /*!< Frame counter, for the LRU policy. */
+    std::vector<std::pair<float, size_t>> m_brick_candidates; /*!< Bricks considered by `select_bricks`, kept across views. */
+    std::vector<std::pair<size_t, size_t>> m_brick_loads;     /*!< (brick, slot) loaded by `update_bricks`, kept across frames. */
+
+    std::shared_ptr<const PreparedVolume> m_pending; /*!< Volume being uploaded, if any. */
+    GLuint m_pending_texture {0};                    /*!< Texture receiving the pending volume. */
+    GLuint m_pending_gradient_texture {0};           /*!< Texture receiving the pending gradients. */
+    GLuint m_pixel_buffer {0};                       /*!< Pixel buffer object used to stream the uploads. */
+    size_t m_pending_slice {0};                      /*!< Next slice of the pending volume to be uploaded. */
+    double m_upload_time {0.0};                      /*!< CPU time spent uploading the pending volume, in milliseconds. */
+    std::vector<std::pair<std::string, double>> m_load_timings; /*!< Load timings of the current volume. */
+
+    /*!
+     * \brief Storage of a texture created by `create_texture` or `create_layered_texture`.
+     */
+    struct TextureStorage {
+        GLuint name {0};           /*!< Texture name. */
+        GLenum target {0};         /*!< Target the texture was created for. */
+        GLint internal_format {0}; /*!< Internal format of the storage. */
+        QVector3D size;            /*!< Size of the base level, for each axis. */
+    };
+
+    size_t m_texture_pool_budget {VolumeOptions().texture_budget}; /*!< Memory the released textures can keep, in bytes. */
+    std::vector<TextureStorage> m_textures;          /*!< Textures in use. */
+    std::vector<TextureStorage> m_texture_pool;      /*!< Released textures, the least recently released first. */
 
     float scale_factor(void);
+    GLuint create_texture(const GLint internal_format, const GLenum format, const GLint filter, const QVector3D& size, const void *data, const GLenum type = GL_UNSIGNED_BYTE);
+    GLuint acquire_texture(const GLenum target, const GLint internal_format, const QVector3D& size, bool& reused);
+    void release_texture(GLuint& texture);
+    void recycle_texture(GLuint& texture, const GLuint successor);
+    void create_brick_cache(std::shared_ptr<const BrickedVolume> bricks);
+    void release_brick_cache(void);
+    void select_bricks(void);
+    GLuint create_layered_texture(const VoxelFormat format, const QVector3D& size);
+    const void * stage_pixels(const unsigned char *data, const size_t size);
+    void upload_compressed_slab(const GLuint texture, const VoxelFormat format, const unsigned char *data, const size_t first_slice, const size_t slices);
+    void upload_slab(const GLuint texture, const GLenum format, const unsigned char *data, const size_t voxel_size, const size_t first_slice, const size_t slices, const GLenum type = GL_UNSIGNED_BYTE);
 };
@@ -0,0 +1,130 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdexcept>
+#include <utility>
+
+#include <QDebug>
+#include <QFile>
+
+#include "shadercache.h"
+
+
+/*!
+ * \brief Create an empty cache, without OpenGL resources.
+ * \param stages Source file of each stage of the programs.
+ * \param common Sources inserted into each stage after the definitions, in order.
+ * \param setup Function called with each variant, bound, after it is linked, or null.
+ */
+ShaderCache::ShaderCache(std::vector<Stage> stages, const QStringList& common, Setup setup)
+    : m_stages {std::move(stages)}
+    , m_commonFiles {common}
+    , m_setup {std::move(setup)}
+{
+}
+
+
+/*!
+ * \brief Program compiled with a set of definitions.
+ * \param defines Preprocessor symbols defined for the variant, in any order.
+ * \return The program, compiled and linked on first use.
+ *
+ * A program that fails to link is logged once, and returned anyway.
+ */
+QOpenGLShaderProgram * ShaderCache::program(const QStringList& defines)
+{
+    QStringList sorted = defines;
+    sorted.sort();
+    std::unique_ptr<QOpenGLShaderProgram>& program = m_programs[sorted.join(' ')];
+
+    if (!program) {
+        if (m_sources.empty()) {
+            for (const auto& stage : m_stages) {
+                m_sources.push_back(read_source(stage.file));
+            }
+
+            // Each common source is numbered in the `#line` directives, so
+            // compiler errors can be traced back to it
+            for (int i = 0; i < m_commonFiles.size(); ++i) {
+                m_commonSource += "#line 1 " + QByteArray::number(i + 1) + "\n" + read_source(m_commonFiles[i]);
+                if (!m_commonSource.endsWith('\n')) {
+                    m_commonSource += "\n";
+                }
+            }
+        }
+
+        program = std::make_unique<QOpenGLShaderProgram>();
+        for (size_t i = 0; i < m_stages.size(); ++i) {
+            program->addCacheableShaderFromSourceCode(m_stages[i].type, specialise(m_sources[i], sorted));
+        }
+        if (!program->link()) {
+            qWarning() << "Cannot link shader variant" << sorted.join(' ') << ":" << program->log();
+        }
+        else if (m_setup) {
+            program->bind();
+            m_setup(program.get());
+            program->release();
+        }
+    }
+    return program.get();
+}
+
+
+/*!
+ * \brief Read a shader source file.
+ *
+ * Throws `std::runtime_error` if the file cannot be read.
+ */
+QByteArray ShaderCache::read_source(const QString& filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        throw std::runtime_error("Cannot read shader " + filename.toStdString() + ".");
+    }
+    return file.readAll();
+}
+
+
+/*!
+ * \brief Insert definitions into a shader source.
+ * \param source GLSL source.
+ * \param defines Preprocessor symbols to be defined.
+ * \return The source, with the definitions and the common sources after the `#version` directive.
+ *
+ * A `#line` directive follows the insertions, so the compiler reports
+ * errors at the lines of the original source.
+ */
+QByteArray ShaderCache::specialise(const QByteArray& source, const QStringList& defines) const
+{
+    const int version = source.indexOf("#version");
+    const int line_end = version < 0 ? 0 : source.indexOf('\n', version) + 1;
+    const QByteArray head = line_end > 0 ? source.left(line_end) : QByteArray();
+
+    QByteArray definitions;
+    for (const auto& define : defines) {
+        definitions += "#define " + define.toUtf8() + "\n";
+    }
+    definitions += m_commonSource;
+    definitions += "#line " + QByteArray::number(head.count('\n') + 1) + " 0\n";
+
+    return head + definitions + source.mid(head.size());
+}
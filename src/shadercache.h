@@ -0,0 +1,85 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <QByteArray>
+#include <QOpenGLShaderProgram>
+#include <QString>
+#include <QStringList>
+
+/*!
+ * \brief Shader programs specialised from shared sources by preprocessor definitions.
+ *
+ * Each variant is compiled the first time it is requested, in the current
+ * context, and kept until the cache is cleared. The shaders are added as
+ * cacheable, so Qt stores the linked program binary (`glGetProgramBinary`)
+ * in its shader disk cache, and later runs load it instead of compiling, as
+ * long as the sources and the driver do not change.
+ *
+ * Optional common sources, such as the declaration of a uniform block
+ * shared by the stages, or functions shared by programs with different
+ * stages, are inserted into every stage, in order.
+ */
+class ShaderCache
+{
+public:
+    /*!
+     * \brief Function initialising a program after it is linked.
+     */
+    using Setup = std::function<void(QOpenGLShaderProgram *program)>;
+
+    /*!
+     * \brief Source file of a stage.
+     */
+    struct Stage {
+        QOpenGLShader::ShaderTypeBit type; /*!< Type of the stage. */
+        QString file;                      /*!< Source file. */
+    };
+
+    ShaderCache(std::vector<Stage> stages, const QStringList& common = QStringList(), Setup setup = nullptr);
+
+    QOpenGLShaderProgram * program(const QStringList& defines);
+
+    /*!
+     * \brief Release all the programs, in the current context.
+     */
+    void clear(void) {
+        m_programs.clear();
+    }
+
+private:
+    std::vector<Stage> m_stages;          /*!< Stages of each program. */
+    QStringList m_commonFiles;            /*!< Sources inserted into each stage. */
+    Setup m_setup;                        /*!< Called after linking each variant, if set. */
+    std::vector<QByteArray> m_sources;    /*!< Of each stage, read on first use. */
+    QByteArray m_commonSource;            /*!< Read on first use. */
+    std::map<QString, std::unique_ptr<QOpenGLShaderProgram>> m_programs; /*!< Compiled variants, by definitions. */
+
+    static QByteArray read_source(const QString& filename);
+    QByteArray specialise(const QByteArray& source, const QStringList& defines) const;
+};
@@ -0,0 +1,139 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "sortlastrenderer.h"
+
+
+/*!
+ * \brief Constructor, without a volume.
+ * \param nodes Number of render nodes, at least one.
+ */
+SortLastRenderer::SortLastRenderer(const size_t nodes)
+    : m_casters(std::max<size_t>(nodes, 1))
+    , m_loaded(m_casters.size(), false)
+{
+}
+
+
+/*!
+ * \brief Split a prepared volume and load the boxes of the nodes.
+ * \param volume Volume prepared whole, in any format but `VoxelFormat::Rgtc1`,
+ *               or only the box of the node (see `VolumeOptions::node`).
+ * \param node Only node to be loaded, or all the nodes if negative.
+ *
+ * Throws `std::runtime_error` if the volume cannot be split or loaded.
+ */
+void SortLastRenderer::load(std::shared_ptr<const PreparedVolume> volume, const int node)
+{
+    if (node >= static_cast<int>(m_casters.size())) {
+        throw std::runtime_error("No render node " + std::to_string(node) + ".");
+    }
+
+    if (node < 0 && volume->partial()) {
+        throw std::runtime_error("Loading all the nodes needs the whole volume.");
+    }
+
+    const QVector3D volume_size = volume->volume_size();
+    const std::array<size_t, 3> size {static_cast<size_t>(volume_size.x()),
+                                      static_cast<size_t>(volume_size.y()),
+                                      static_cast<size_t>(volume_size.z())};
+    m_partition = std::make_unique<VolumePartition>(size, m_casters.size());
+    for (size_t i = 0; i < m_casters.size(); ++i) {
+        m_loaded[i] = node < 0 || static_cast<size_t>(node) == i;
+        if (m_loaded[i]) {
+            m_casters[i].load(volume, m_partition->region(i));
+        }
+    }
+}
+
+
+/*!
+ * \brief Render the partial images of the loaded nodes.
+ * \param parameters Parameters of the frame, for a single jitter offset.
+ * \param size Size of the images, in pixels.
+ * \return The partials, each ranked by the position of its box in the
+ *         visibility order from the camera.
+ *
+ * The nodes loaded in this process are rendered one after the other, each
+ * on all threads. Throws `std::runtime_error` if no volume is loaded.
+ */
+std::vector<PartialImage> SortLastRenderer::render_partials(const RenderParameters& parameters, const QSize& size)
+{
+    const auto first = std::find(m_loaded.begin(), m_loaded.end(), true);
+    if (!m_partition || m_loaded.end() == first) {
+        throw std::runtime_error("No volume loaded.");
+    }
+
+    // All the nodes share the geometry of the whole volume
+    const QVector3D eye = m_casters[first - m_loaded.begin()].camera_voxel(parameters.view);
+    const std::vector<size_t> order = m_partition->visibility_order({eye.x(), eye.y(), eye.z()});
+
+    std::vector<PartialImage> partials;
+    for (size_t rank = 0; rank < order.size(); ++rank) {
+        if (m_loaded[order[rank]]) {
+            partials.push_back(m_casters[order[rank]].render_partial(parameters, size));
+            partials.back().rank = static_cast<int>(rank);
+        }
+    }
+    return partials;
+}
+
+
+/*!
+ * \brief Render an image with all the nodes.
+ * \param parameters Parameters of the frame, as for `CpuRayCaster::render`.
+ * \param size Size of the image, in pixels.
+ * \param samples Jittered frames averaged.
+ * \return The image, with the origin at the top left.
+ *
+ * Throws `std::runtime_error` if some node is not loaded.
+ */
+QImage SortLastRenderer::render(const RenderParameters& parameters, const QSize& size, const int samples)
+{
+    if (std::find(m_loaded.begin(), m_loaded.end(), false) != m_loaded.end()) {
+        throw std::runtime_error("Rendering a whole image needs all the nodes.");
+    }
+
+    std::vector<float> sum;
+    RenderParameters sample_parameters = parameters;
+    for (int sample = 0; sample < std::max(samples, 1); ++sample) {
+        sample_parameters.jitter_offset = CpuRayCaster::jitter_offset(parameters, sample);
+        CpuRayCaster::accumulate(composite(render_partials(sample_parameters, size), parameters.opacity_cutoff), parameters.background, sum);
+    }
+    return CpuRayCaster::resolve(sum, size, std::max(samples, 1));
+}
+
+
+/*!
+ * \brief Set the transfer function of all the nodes.
+ * \param transfer_function New transfer function.
+ */
+void SortLastRenderer::set_transfer_function(const TransferFunction& transfer_function)
+{
+    for (CpuRayCaster& caster : m_casters) {
+        caster.set_transfer_function(transfer_function);
+    }
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <QImage>
+#include <QSize>
+
+#include "compositor.h"
+#include "cpuraycaster.h"
+#include "volumepartition.h"
+
+/*!
+ * \brief Sort-last renderer, splitting a volume across render nodes.
+ *
+ * The volume is split in boxes (see `VolumePartition`), each box is
+ * rendered by its own `CpuRayCaster` into a partial image ranked in
+ * visibility order, and the partials are composited into the frame.
+ *
+ * All the nodes can run in this process, or each node in its own process
+ * or machine, keeping only its box and exchanging its partials as files
+ * (see `write_partial`).
+ */
+class SortLastRenderer
+{
+public:
+    SortLastRenderer(const size_t nodes);
+
+    void load(std::shared_ptr<const PreparedVolume> volume, const int node = -1);
+    std::vector<PartialImage> render_partials(const RenderParameters& parameters, const QSize& size);
+    QImage render(const RenderParameters& parameters, const QSize& size, const int samples = 1);
+    void set_transfer_function(const TransferFunction& transfer_function);
+
+    /*!
+     * \brief Number of nodes.
+     */
+    size_t nodes(void) const {
+        return m_casters.size();
+    }
+
+private:
+    std::unique_ptr<VolumePartition> m_partition; /*!< Boxes of the loaded volume. */
+    std::vector<CpuRayCaster> m_casters;          /*!< Raycaster of each node. */
+    std::vector<bool> m_loaded;                   /*!< Whether each node holds its box. */
+};
@@ -0,0 +1,271 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <cmath>
+#include <set>
+
+#include <QtConcurrent>
+
+#include "timeseriesplayer.h"
+
+
+/*!
+ * \brief Constructor.
+ * \param parent Parent object.
+ */
+TimeSeriesPlayer::TimeSeriesPlayer(QObject *parent)
+    : QObject {parent}
+{
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &TimeSeriesPlayer::check_stall);
+}
+
+
+/*!
+ * \brief Open a sequence of volumes, paused on its first frame.
+ * \param files Volume files, in playback order.
+ * \param options Preparation of each frame.
+ */
+void TimeSeriesPlayer::open(const QStringList& files, const VolumeOptions& options)
+{
+    close();
+    m_files = files;
+    m_options = options;
+    m_sinceOpen.start();
+    if (active()) {
+        prefetch(0);
+    }
+}
+
+
+/*!
+ * \brief Close the sequence, discarding the decoded frames.
+ */
+void TimeSeriesPlayer::close(void)
+{
+    pause();
+    m_ring.clear();
+    m_files.clear();
+    m_shown = -1;
+    m_lastDue = -1;
+    m_statistics = {};
+    m_presentTimes.clear();
+}
+
+
+/*!
+ * \brief Start the clock from the frame after the one shown.
+ */
+void TimeSeriesPlayer::play(void)
+{
+    if (m_playing || !active()) {
+        return;
+    }
+    m_playing = true;
+    m_clockStart = m_shown + 1;
+    m_lastDue = -1;
+    m_clock.start();
+    m_timer.start(static_cast<int>(std::round(1000.0 / m_frameRate)));
+    emit tick();
+}
+
+
+/*!
+ * \brief Stop the clock, holding the frame shown.
+ */
+void TimeSeriesPlayer::pause(void)
+{
+    m_playing = false;
+    m_timer.stop();
+}
+
+
+/*!
+ * \brief Set the target frame rate.
+ * \param fps Frames per second.
+ *
+ * The clock restarts from the frame currently due, so the change does not
+ * skip or repeat frames.
+ */
+void TimeSeriesPlayer::set_frame_rate(const double fps)
+{
+    if (fps <= 0.0) {
+        return;
+    }
+    const long due = due_frame();
+    m_frameRate = fps;
+    if (m_playing) {
+        m_clockStart = due;
+        m_clock.restart();
+        m_timer.start(static_cast<int>(std::round(1000.0 / m_frameRate)));
+    }
+}
+
+
+/*!
+ * \brief Frame that should be on screen now.
+ *
+ * While paused, this is the frame shown (or the first one, before any).
+ */
+long TimeSeriesPlayer::due_frame(void) const
+{
+    if (!m_playing) {
+        return std::max(m_shown, 0L);
+    }
+    return m_clockStart + static_cast<long>(std::floor(m_clock.elapsed() * m_frameRate / 1000.0));
+}
+
+
+/*!
+ * \brief Get a decoded frame, prefetching the following ones.
+ * \param frame Frame to be shown.
+ * \return The prepared volume, or `nullptr` if it is not decoded yet.
+ */
+std::shared_ptr<const PreparedVolume> TimeSeriesPlayer::decoded(const long frame)
+{
+    if (!active()) {
+        return nullptr;
+    }
+    prefetch(frame);
+
+    auto slot = m_ring.find(static_cast<int>(frame % m_files.size()));
+    if (slot == m_ring.end() || !slot->second->isFinished()) {
+        return nullptr;
+    }
+    return slot->second->result().volume;
+}
+
+
+/*!
+ * \brief Record that a frame has been shown.
+ * \param frame Frame shown.
+ *
+ * The frames between the previous one shown and this one are dropped.
+ */
+void TimeSeriesPlayer::presented(const long frame)
+{
+    if (m_shown >= 0 && frame > m_shown + 1) {
+        m_statistics.dropped += frame - m_shown - 1;
+    }
+    m_shown = frame;
+    ++m_statistics.presented;
+
+    // Measure the frame rate over about the last second
+    m_presentTimes.push_back(m_sinceOpen.elapsed());
+    while (m_presentTimes.size() > 2 && m_presentTimes.back() - m_presentTimes.front() > 1000) {
+        m_presentTimes.pop_front();
+    }
+}
+
+
+/*!
+ * \brief Playback statistics since the sequence was opened.
+ */
+TimeSeriesPlayer::Statistics TimeSeriesPlayer::statistics(void) const
+{
+    Statistics statistics = m_statistics;
+
+    if (m_presentTimes.size() > 1) {
+        const qint64 span = m_presentTimes.back() - m_presentTimes.front();
+        statistics.frame_rate = span > 0 ? 1000.0 * (m_presentTimes.size() - 1) / span : 0.0;
+    }
+
+    if (active()) {
+        const long ahead = std::min<long>(m_prefetch, m_files.size());
+        for (long i = 1; i <= ahead; ++i) {
+            auto slot = m_ring.find(static_cast<int>((m_shown + i) % m_files.size()));
+            if (slot == m_ring.end() || !slot->second->isFinished()) {
+                break;
+            }
+            ++statistics.buffered;
+        }
+    }
+
+    return statistics;
+}
+
+
+/*!
+ * \brief Keep decoding the frames from `first` onwards.
+ * \param first First frame to be kept in the ring.
+ *
+ * The ring holds the files of the next `m_prefetch` frames, wrapping around
+ * the sequence: frames no longer ahead are discarded, and missing ones are
+ * decoded on the global thread pool. A sequence shorter than the ring stays
+ * decoded entirely, so it loops without reading the files again.
+ */
+void TimeSeriesPlayer::prefetch(const long first)
+{
+    const int count = m_files.size();
+    const int ahead = std::min(m_prefetch, count);
+
+    std::set<int> wanted;
+    for (int i = 0; i < ahead; ++i) {
+        wanted.insert(static_cast<int>((first + i) % count));
+    }
+
+    // Superseded decodes are left to finish on their own, and their result is dropped
+    for (auto slot = m_ring.begin(); slot != m_ring.end();) {
+        slot = wanted.count(slot->first) ? std::next(slot) : m_ring.erase(slot);
+    }
+
+    for (int i = 0; i < ahead; ++i) {
+        const int index = static_cast<int>((first + i) % count);
+        if (m_ring.count(index)) {
+            continue;
+        }
+
+        auto watcher = std::make_unique<QFutureWatcher<Result>>();
+        connect(watcher.get(), &QFutureWatcher<Result>::finished, this, [this, watcher = watcher.get(), index]() {
+            const Result& result = watcher->future().result();
+            if (result.volume) {
+                emit frameDecoded();
+            }
+            else {
+                emit frameFailed(m_files[index], result.error);
+            }
+        });
+
+        watcher->setFuture(QtConcurrent::run([path = m_files[index], options = m_options]() {
+            try {
+                return Result {RayCastVolume::prepare_volume(path, options), {}};
+            }
+            catch (std::exception& e) {
+                return Result {nullptr, e.what()};
+            }
+        }));
+        m_ring.emplace(index, std::move(watcher));
+    }
+}
+
+
+/*!
+ * \brief Count a stall if the frame due at the previous tick was never shown.
+ */
+void TimeSeriesPlayer::check_stall(void)
+{
+    if (m_lastDue >= 0 && m_shown < m_lastDue) {
+        ++m_statistics.stalls;
+    }
+    m_lastDue = due_frame();
+    emit tick();
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
+
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QObject>
+#include <QStringList>
+#include <QTimer>
+
+#include "raycastvolume.h"
+
+/*!
+ * \brief Plays back a sequence of volumes at a target frame rate.
+ *
+ * The frames are decoded on worker threads into a bounded ring of prepared
+ * volumes, a few frames ahead of the one being shown, so reading and
+ * normalising a file overlaps with the upload and display of the previous
+ * ones. The player only keeps the clock and the decoded frames: the canvas
+ * asks which frame is due, uploads it ahead of time, and reports when it is
+ * shown. A frame not ready when due is a stall, and the frames skipped to
+ * catch up with the clock are dropped.
+ */
+class TimeSeriesPlayer : public QObject
+{
+    Q_OBJECT
+public:
+    /*!
+     * \brief Playback statistics.
+     */
+    struct Statistics
+    {
+        long presented = 0;      /*!< Frames shown. */
+        long dropped = 0;        /*!< Frames skipped to keep up with the clock. */
+        long stalls = 0;         /*!< Frame intervals in which the due frame was not ready. */
+        double frame_rate = 0.0; /*!< Recent rate of the frames shown, in frames per second. */
+        int buffered = 0;        /*!< Decoded frames ahead of the one shown. */
+    };
+
+    explicit TimeSeriesPlayer(QObject *parent = nullptr);
+
+    void open(const QStringList& files, const VolumeOptions& options);
+    void close(void);
+
+    void play(void);
+    void pause(void);
+    void set_frame_rate(const double fps);
+
+    long due_frame(void) const;
+    std::shared_ptr<const PreparedVolume> decoded(const long frame);
+    void presented(const long frame);
+    Statistics statistics(void) const;
+
+    /*!
+     * \brief Whether a sequence is open.
+     */
+    bool active(void) const {
+        return !m_files.isEmpty();
+    }
+
+    /*!
+     * \brief Whether the clock is running.
+     */
+    bool playing(void) const {
+        return m_playing;
+    }
+
+    /*!
+     * \brief Number of files in the sequence.
+     */
+    int frame_count(void) const {
+        return m_files.size();
+    }
+
+    /*!
+     * \brief Last frame shown, or -1 if none yet.
+     *
+     * Frames are counted from the start of the playback, and they wrap
+     * around the sequence.
+     */
+    long shown(void) const {
+        return m_shown;
+    }
+
+    /*!
+     * \brief File of a frame.
+     */
+    const QString& file(const long frame) const {
+        return m_files[static_cast<int>(frame % m_files.size())];
+    }
+
+    /*!
+     * \brief Number of frames decoded ahead of the one shown.
+     */
+    void set_prefetch(const int frames) {
+        m_prefetch = std::max(frames, 1);
+    }
+
+signals:
+    void tick(void);                                            /*!< Emitted at each frame interval while playing. */
+    void frameDecoded(void);                                    /*!< Emitted when a frame in the ring is ready. */
+    void frameFailed(const QString& path, const QString& message); /*!< Emitted when a frame cannot be read. */
+
+private:
+    /*!
+     * \brief Outcome of decoding a frame.
+     */
+    struct Result {
+        std::shared_ptr<const PreparedVolume> volume;
+        QString error;
+    };
+
+    QStringList m_files;                /*!< Files of the sequence. */
+    VolumeOptions m_options;            /*!< Preparation of each frame. */
+    int m_prefetch = 8;                 /*!< Capacity of the ring of decoded frames. */
+    std::map<int, std::unique_ptr<QFutureWatcher<Result>>> m_ring; /*!< Decoding or decoded frames, by file index. */
+
+    double m_frameRate = 25.0;          /*!< Target frames per second. */
+    bool m_playing = false;             /*!< Whether the clock is running. */
+    QTimer m_timer;                     /*!< Ticks at the frame interval. */
+    QElapsedTimer m_clock;              /*!< Since the playback started. */
+    long m_clockStart = 0;              /*!< Frame due when the clock started. */
+    long m_shown = -1;                  /*!< Last frame shown. */
+    long m_lastDue = -1;                /*!< Frame due at the previous tick. */
+
+    Statistics m_statistics;            /*!< Accumulated since the sequence was opened. */
+    std::deque<qint64> m_presentTimes;  /*!< Times of the recent frames shown, in milliseconds. */
+    QElapsedTimer m_sinceOpen;          /*!< Since the sequence was opened. */
+
+    void prefetch(const long first);
+    void check_stall(void);
+};
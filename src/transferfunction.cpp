@@ -0,0 +1,211 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+#include "transferfunction.h"
+
+
+/*!
+ * \brief Create the default function, a grey ramp with exponential opacity.
+ */
+TransferFunction::TransferFunction(void)
+{
+    const int points = 9;
+    for (int i = 0; i < points; ++i) {
+        const float x = i / (points - 1.0f);
+        const float alpha = std::expm1(x) / std::expm1(1.0f);
+        m_points.push_back({x, x, x, x, alpha});
+    }
+}
+
+
+/*!
+ * \brief Create a function from its control points.
+ */
+TransferFunction::TransferFunction(std::vector<TransferPoint> points)
+    : m_points {std::move(points)}
+{
+    if (m_points.empty()) {
+        throw std::invalid_argument("A transfer function needs at least one point.");
+    }
+    for (auto& point : m_points) {
+        for (float *value : {&point.intensity, &point.red, &point.green, &point.blue, &point.alpha}) {
+            *value = std::clamp(*value, 0.0f, 1.0f);
+        }
+    }
+    std::stable_sort(m_points.begin(), m_points.end(), [](const TransferPoint& a, const TransferPoint& b) {
+        return a.intensity < b.intensity;
+    });
+}
+
+
+/*!
+ * \brief Read a function from a text file.
+ */
+TransferFunction TransferFunction::read(const std::string& filename)
+{
+    std::ifstream file(filename);
+    if (!file) {
+        throw std::runtime_error("Cannot read transfer function " + filename + ".");
+    }
+
+    std::vector<TransferPoint> points;
+    std::string line;
+    while (std::getline(file, line)) {
+        const size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        TransferPoint point;
+        if (!(fields >> point.intensity >> point.red >> point.green >> point.blue >> point.alpha)) {
+            throw std::runtime_error("Invalid transfer function point \"" + line + "\" in " + filename + ".");
+        }
+        points.push_back(point);
+    }
+
+    if (points.empty()) {
+        throw std::runtime_error("No transfer function points in " + filename + ".");
+    }
+    return TransferFunction(std::move(points));
+}
+
+
+/*!
+ * \brief Colour and opacity (RGBA) at a normalised intensity.
+ */
+std::array<float, 4> TransferFunction::evaluate(const float intensity) const
+{
+    const auto upper = std::upper_bound(m_points.begin(), m_points.end(), intensity, [](const float x, const TransferPoint& p) {
+        return x < p.intensity;
+    });
+
+    const TransferPoint& b = upper == m_points.end() ? m_points.back() : *upper;
+    const TransferPoint& a = upper == m_points.begin() ? m_points.front() : *(upper - 1);
+    const float width = b.intensity - a.intensity;
+    const float t = width > 0.0f ? std::clamp((intensity - a.intensity) / width, 0.0f, 1.0f) : 0.0f;
+
+    return {
+        a.red + t * (b.red - a.red),
+        a.green + t * (b.green - a.green),
+        a.blue + t * (b.blue - a.blue),
+        a.alpha + t * (b.alpha - a.alpha),
+    };
+}
+
+
+/*!
+ * \brief Sample the function at evenly spaced intensities.
+ */
+std::vector<float> TransferFunction::table(const size_t size) const
+{
+    std::vector<float> table(4 * size);
+    for (size_t i = 0; i < size; ++i) {
+        const std::array<float, 4> value = evaluate(i / (size - 1.0f));
+        std::copy(value.begin(), value.end(), table.begin() + 4 * i);
+    }
+    return table;
+}
+
+
+/*!
+ * \brief Minimum and maximum opacity over each interval of a table.
+ */
+std::vector<float> TransferFunction::opacity_range(const std::vector<float>& table)
+{
+    const size_t size = table.size() / 4;
+    std::vector<float> range(2 * size * size);
+
+    // Running extremes from each entry, mirrored below the diagonal
+    for (size_t i = 0; i < size; ++i) {
+        float minimum = table[4 * i + 3];
+        float maximum = minimum;
+        for (size_t j = i; j < size; ++j) {
+            minimum = std::min(minimum, table[4 * j + 3]);
+            maximum = std::max(maximum, table[4 * j + 3]);
+            for (const size_t index : {j * size + i, i * size + j}) {
+                range[2 * index] = minimum;
+                range[2 * index + 1] = maximum;
+            }
+        }
+    }
+    return range;
+}
+
+
+/*!
+ * \brief Pre-integrate the function over ray segments.
+ *
+ * The extinction implied by the opacity of each entry, and the colour
+ * weighted by it, are integrated along the intensity axis once, so each
+ * segment is the difference of two integrals (Engel et al., 2001). The
+ * attenuation within the segment itself is neglected.
+ */
+std::vector<float> TransferFunction::preintegrated(const size_t size) const
+{
+    const std::vector<float> lookup = table(size);
+
+    // Extinction over a reference step, bounded for opaque entries
+    std::vector<double> extinction(size);
+    for (size_t i = 0; i < size; ++i) {
+        extinction[i] = -std::log(std::max(1.0f - lookup[4 * i + 3], 1e-4f));
+    }
+
+    // Trapezoidal integrals of the extinction, and of the weighted colour
+    std::vector<double> integral(size, 0.0);
+    std::vector<double> colour_integral(3 * size, 0.0);
+    for (size_t i = 1; i < size; ++i) {
+        integral[i] = integral[i - 1] + 0.5 * (extinction[i - 1] + extinction[i]);
+        for (size_t c = 0; c < 3; ++c) {
+            colour_integral[3 * i + c] = colour_integral[3 * (i - 1) + c]
+                    + 0.5 * (extinction[i - 1] * lookup[4 * (i - 1) + c] + extinction[i] * lookup[4 * i + c]);
+        }
+    }
+
+    std::vector<float> result(4 * size * size);
+    for (size_t back = 0; back < size; ++back) {
+        for (size_t front = 0; front < size; ++front) {
+            float *entry = &result[4 * (back * size + front)];
+            if (front == back) {
+                std::copy(&lookup[4 * front], &lookup[4 * front + 4], entry);
+                continue;
+            }
+
+            const size_t low = std::min(front, back);
+            const size_t high = std::max(front, back);
+            const double optical_depth = integral[high] - integral[low];
+            entry[3] = static_cast<float>(-std::expm1(-optical_depth / (high - low)));
+            for (size_t c = 0; c < 3; ++c) {
+                entry[c] = optical_depth > 1e-9
+                        ? static_cast<float>((colour_integral[3 * high + c] - colour_integral[3 * low + c]) / optical_depth)
+                        : 0.5f * (lookup[4 * low + c] + lookup[4 * high + c]);
+            }
+        }
+    }
+    return result;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+/*!
+ * \brief Control point of a transfer function.
+ */
+struct TransferPoint
+{
+    float intensity; /*!< Normalised intensity, in [0, 1]. */
+    float red;       /*!< Colour, in [0, 1]. */
+    float green;     /*!< Colour, in [0, 1]. */
+    float blue;      /*!< Colour, in [0, 1]. */
+    float alpha;     /*!< Opacity over a reference step, in [0, 1]. */
+
+    bool operator==(const TransferPoint& other) const {
+        return intensity == other.intensity && red == other.red && green == other.green
+                && blue == other.blue && alpha == other.alpha;
+    }
+};
+
+
+/*!
+ * \brief Piecewise linear colour and opacity transfer function.
+ *
+ * The function interpolates linearly between control points sorted by
+ * intensity, and it is constant beyond the first and the last point. It is
+ * sampled into lookup tables for the shaders: a table of colour and
+ * opacity, a table of the opacity range over each intensity interval, for
+ * empty space skipping, and a pre-integrated table of the colour and
+ * opacity of each ray segment, indexed by the intensities at its ends.
+ */
+class TransferFunction {
+
+public:
+
+    /*!
+     * \brief Create the default function, a grey ramp with exponential opacity.
+     */
+    TransferFunction(void);
+
+    /*!
+     * \brief Create a function from its control points.
+     * \param points Control points, in any order. At least one is required.
+     *
+     * Values are clamped to [0, 1].
+     */
+    explicit TransferFunction(std::vector<TransferPoint> points);
+
+    /*!
+     * \brief Read a function from a text file.
+     * \param filename File with an `intensity red green blue alpha` line per point.
+     *
+     * Empty lines and lines starting with `#` are ignored. Throws
+     * `std::runtime_error` if the file cannot be read or parsed.
+     */
+    static TransferFunction read(const std::string& filename);
+
+    /*!
+     * \brief Control points, sorted by intensity.
+     */
+    const std::vector<TransferPoint>& points(void) const {
+        return m_points;
+    }
+
+    /*!
+     * \brief Colour and opacity (RGBA) at a normalised intensity.
+     */
+    std::array<float, 4> evaluate(const float intensity) const;
+
+    /*!
+     * \brief Sample the function at evenly spaced intensities.
+     * \param size Number of entries, at least 2, from intensity 0 to 1.
+     * \return Interleaved RGBA entries.
+     */
+    std::vector<float> table(const size_t size) const;
+
+    /*!
+     * \brief Minimum and maximum opacity over each interval of a table.
+     * \param table Interleaved RGBA entries, as returned by `table`.
+     * \return Interleaved (minimum, maximum) pairs for a `size` by `size`
+     *         grid, where entry `(i, j)` covers the entries between `i` and `j`.
+     */
+    static std::vector<float> opacity_range(const std::vector<float>& table);
+
+    /*!
+     * \brief Pre-integrate the function over ray segments.
+     * \param size Number of intensities sampled along each axis, at least 2.
+     * \return Interleaved RGBA entries for a `size` by `size` grid, with x
+     *         varying fastest, where entry `(i, j)` is the colour and opacity
+     *         of a segment of reference length going from intensity `i` to
+     *         intensity `j`, both scaled from [0, size - 1] to [0, 1].
+     *
+     * Colour is not premultiplied by opacity, as in `table`, and a segment
+     * with equal intensities at its ends matches the plain lookup.
+     */
+    std::vector<float> preintegrated(const size_t size) const;
+
+    bool operator==(const TransferFunction& other) const {
+        return m_points == other.m_points;
+    }
+
+    bool operator!=(const TransferFunction& other) const {
+        return !(*this == other);
+    }
+
+private:
+    std::vector<TransferPoint> m_points; /*!< Sorted by intensity. */
+};
@@ -0,0 +1,239 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+
+#include <QColorDialog>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QPainterPath>
+
+#include "transferfunctioneditor.h"
+
+
+/*!
+ * \brief Constructor, with the default transfer function.
+ * \param parent Parent widget.
+ */
+TransferFunctionEditor::TransferFunctionEditor(QWidget *parent)
+    : QWidget {parent}
+{
+    setMinimumHeight(80);
+    setToolTip(tr("Click to add or select a point, drag to move it, double click to change its colour, right click to remove it"));
+}
+
+
+/*!
+ * \brief Replace the edited function, without emitting a change.
+ */
+void TransferFunctionEditor::setTransferFunction(const TransferFunction& transfer_function)
+{
+    m_transferFunction = transfer_function;
+    m_selected = -1;
+    update();
+}
+
+
+/*!
+ * \brief Area of the opacity plot, above the colour strip.
+ */
+QRectF TransferFunctionEditor::plot_area(void) const
+{
+    return QRectF(m_margin, m_margin, width() - 2 * m_margin, height() - 3 * m_margin - m_strip);
+}
+
+
+/*!
+ * \brief Position of a control point in the widget.
+ */
+QPointF TransferFunctionEditor::point_position(const TransferPoint& point) const
+{
+    const QRectF area = plot_area();
+    return QPointF(area.left() + point.intensity * area.width(), area.bottom() - point.alpha * area.height());
+}
+
+
+/*!
+ * \brief Index of the control point under a position, or -1.
+ */
+int TransferFunctionEditor::point_at(const QPointF& position) const
+{
+    const auto& points = m_transferFunction.points();
+    for (int i = 0; i < static_cast<int>(points.size()); ++i) {
+        const QPointF distance = point_position(points[i]) - position;
+        if (QPointF::dotProduct(distance, distance) <= 4 * m_pointRadius * m_pointRadius) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/*!
+ * \brief Replace the control points, and notify the change.
+ */
+void TransferFunctionEditor::set_points(std::vector<TransferPoint> points)
+{
+    const TransferFunction transfer_function(std::move(points));
+    if (transfer_function != m_transferFunction) {
+        m_transferFunction = transfer_function;
+        update();
+        emit transferFunctionChanged(m_transferFunction);
+    }
+}
+
+
+/*!
+ * \brief Draw the colour strip, the opacity curve and the control points.
+ */
+void TransferFunctionEditor::paintEvent(QPaintEvent *event)
+{
+    (void) event;
+
+    QPainter painter(this);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.fillRect(rect(), palette().base());
+
+    const QRectF area = plot_area();
+    const auto& points = m_transferFunction.points();
+
+    // Colour strip, with the opacity of each point
+    const QRectF strip(area.left(), area.bottom() + m_margin, area.width(), m_strip);
+    QLinearGradient gradient(strip.topLeft(), strip.topRight());
+    for (const auto& point : points) {
+        gradient.setColorAt(point.intensity, QColor::fromRgbF(point.red, point.green, point.blue));
+    }
+    painter.fillRect(strip, gradient);
+    painter.setPen(palette().mid().color());
+    painter.drawRect(strip);
+    painter.drawRect(area);
+
+    // Opacity curve, constant beyond the first and the last point
+    QPainterPath curve(QPointF(area.left(), point_position(points.front()).y()));
+    for (const auto& point : points) {
+        curve.lineTo(point_position(point));
+    }
+    curve.lineTo(QPointF(area.right(), point_position(points.back()).y()));
+    painter.setPen(QPen(palette().text().color(), 1.5));
+    painter.drawPath(curve);
+
+    for (int i = 0; i < static_cast<int>(points.size()); ++i) {
+        const auto& point = points[i];
+        painter.setPen(QPen(i == m_selected ? palette().highlight().color() : palette().text().color(), 1.5));
+        painter.setBrush(QColor::fromRgbF(point.red, point.green, point.blue));
+        painter.drawEllipse(point_position(point), m_pointRadius, m_pointRadius);
+    }
+}
+
+
+/*!
+ * \brief Select the point under the cursor, add a point, or remove one.
+ */
+void TransferFunctionEditor::mousePressEvent(QMouseEvent *event)
+{
+    std::vector<TransferPoint> points = m_transferFunction.points();
+    const int index = point_at(event->pos());
+
+    if (event->button() == Qt::RightButton) {
+        if (index >= 0 && points.size() > 1) {
+            points.erase(points.begin() + index);
+            m_selected = -1;
+            set_points(std::move(points));
+        }
+        return;
+    }
+    if (event->button() != Qt::LeftButton) {
+        return;
+    }
+
+    if (index >= 0) {
+        m_selected = index;
+        update();
+        return;
+    }
+
+    // New point on the curve where clicked, with the opacity of the cursor
+    const QRectF area = plot_area();
+    const float intensity = std::clamp(static_cast<float>((event->pos().x() - area.left()) / area.width()), 0.0f, 1.0f);
+    const float alpha = std::clamp(static_cast<float>((area.bottom() - event->pos().y()) / area.height()), 0.0f, 1.0f);
+    const auto colour = m_transferFunction.evaluate(intensity);
+
+    const auto position = std::upper_bound(points.begin(), points.end(), intensity, [](const float x, const TransferPoint& p) {
+        return x < p.intensity;
+    });
+    m_selected = static_cast<int>(position - points.begin());
+    points.insert(position, {intensity, colour[0], colour[1], colour[2], alpha});
+    set_points(std::move(points));
+}
+
+
+/*!
+ * \brief Drag the selected point, between its neighbours.
+ */
+void TransferFunctionEditor::mouseMoveEvent(QMouseEvent *event)
+{
+    if (m_selected < 0 || !(event->buttons() & Qt::LeftButton)) {
+        return;
+    }
+
+    std::vector<TransferPoint> points = m_transferFunction.points();
+    const QRectF area = plot_area();
+    const float low = m_selected > 0 ? points[m_selected - 1].intensity : 0.0f;
+    const float high = m_selected + 1 < static_cast<int>(points.size()) ? points[m_selected + 1].intensity : 1.0f;
+
+    TransferPoint& point = points[m_selected];
+    point.intensity = std::clamp(static_cast<float>((event->pos().x() - area.left()) / area.width()), low, high);
+    point.alpha = std::clamp(static_cast<float>((area.bottom() - event->pos().y()) / area.height()), 0.0f, 1.0f);
+    set_points(std::move(points));
+}
+
+
+/*!
+ * \brief Stop dragging.
+ */
+void TransferFunctionEditor::mouseReleaseEvent(QMouseEvent *event)
+{
+    (void) event;
+    update();
+}
+
+
+/*!
+ * \brief Pick the colour of the point under the cursor.
+ */
+void TransferFunctionEditor::mouseDoubleClickEvent(QMouseEvent *event)
+{
+    const int index = point_at(event->pos());
+    if (index < 0 || event->button() != Qt::LeftButton) {
+        return;
+    }
+
+    std::vector<TransferPoint> points = m_transferFunction.points();
+    TransferPoint& point = points[index];
+    const QColor colour = QColorDialog::getColor(QColor::fromRgbF(point.red, point.green, point.blue), this, tr("Point colour"));
+    if (colour.isValid()) {
+        point.red = colour.redF();
+        point.green = colour.greenF();
+        point.blue = colour.blueF();
+        set_points(std::move(points));
+    }
+}
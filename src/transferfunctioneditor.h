@@ -0,0 +1,75 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <QWidget>
+
+#include "transferfunction.h"
+
+/*!
+ * \brief Widget editing the control points of a transfer function.
+ *
+ * The opacity is drawn as a curve over the intensity axis, above a strip
+ * with the colour. Clicking adds a point or selects the one under the
+ * cursor, dragging moves it, double clicking picks its colour, and right
+ * clicking removes it.
+ */
+class TransferFunctionEditor : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit TransferFunctionEditor(QWidget *parent = nullptr);
+
+    void setTransferFunction(const TransferFunction& transfer_function);
+
+    TransferFunction getTransferFunction(void) const {
+        return m_transferFunction;
+    }
+
+    QSize sizeHint(void) const override {
+        return QSize(200, 100);
+    }
+
+signals:
+    void transferFunctionChanged(const TransferFunction& transfer_function);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mouseReleaseEvent(QMouseEvent *event) override;
+    void mouseDoubleClickEvent(QMouseEvent *event) override;
+
+private:
+    TransferFunction m_transferFunction;
+    int m_selected = -1;   /*!< Index of the point being dragged, or -1. */
+
+    const int m_margin = 6;      /*!< Around the plot, in pixels. */
+    const int m_strip = 12;      /*!< Height of the colour strip, in pixels. */
+    const int m_pointRadius = 5; /*!< Radius of the control points, in pixels. */
+
+    QRectF plot_area(void) const;
+    QPointF point_position(const TransferPoint& point) const;
+    int point_at(const QPointF& position) const;
+    void set_points(std::vector<TransferPoint> points);
+};
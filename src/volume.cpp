@@ -0,0 +1,646 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <map>
+
+#include <zlib.h>
+
+#include "metaimagevolume.h"
+#include "nrrdvolume.h"
+#include "rawvolume.h"
+#include "voxelkernels.h"
+#include "volume.h"
+#include "vtkvolume.h"
+
+
+/*!
+ * \brief Size of the pieces a compressed payload is inflated in, in bytes.
+ *
+ * zlib counts the input and output buffers with 32 bit integers, so large
+ * payloads are fed to it in pieces.
+ */
+static constexpr size_t zlib_chunk_size = size_t {1} << 30;
+
+
+/*!
+ * \brief Size of the slabs a compressed payload is inflated in by each pass, in bytes.
+ *
+ * A slab holds whole slices, at least one, so the kernels run on it as on a
+ * smaller volume.
+ */
+static constexpr size_t inflate_slab_size = size_t {64} << 20;
+
+
+/*!
+ * \brief Create an empty volume.
+ */
+Volume::Volume(void)
+{
+}
+
+
+/*!
+ * \brief Destructor.
+ */
+Volume::~Volume()
+{
+}
+
+
+/*!
+ * \brief Check whether the architecture is little endian.
+ * \return `true` if little endian, `false` if big endian.
+ */
+static bool is_little_endian()
+{
+    union {
+        unsigned long l;
+        unsigned char c[sizeof(unsigned long)];
+    } x;
+    x.l = 1;
+    return x.c[0] == 1;
+}
+
+
+/*!
+ * \brief Size of the chunks of text parsed by each task, in bytes.
+ */
+static constexpr size_t ascii_chunk_size = size_t {1} << 20;
+
+
+/*!
+ * \brief Check whether a character separates the values of an ASCII payload.
+ */
+static bool is_separator(const char c)
+{
+    return ' ' == c || '\n' == c || '\r' == c || '\t' == c || '\v' == c || '\f' == c;
+}
+
+
+/*!
+ * \brief Read VTK ASCII data.
+ * \param text Pointer to the first character of the payload.
+ * \param length Length of the payload, in characters.
+ * \param element_count Number of elements to read.
+ * \param image_data Array of `unsigned char` to store the resulting data of type `T`.
+ * \param range Output range of the read data.
+ *
+ * The text is split in chunks at whitespace, and the chunks are parsed in
+ * parallel. A first pass counts the values in each chunk, so each chunk of
+ * the second pass knows where to write its values in the output.
+ */
+template<typename T>
+static void read_ascii_data(const char *text, const size_t length, const size_t element_count, std::vector<unsigned char>& image_data, std::pair<double, double>& range) {
+
+    // Move the start of each chunk forward, past the value it falls into
+    const size_t chunk_count = std::max<size_t>((length + ascii_chunk_size - 1) / ascii_chunk_size, 1);
+    std::vector<size_t> bounds(chunk_count + 1, length);
+    bounds[0] = 0;
+    for (size_t c = 1; c < chunk_count; ++c) {
+        size_t p = std::max(c * ascii_chunk_size, bounds[c - 1]);
+        while (p < length && !is_separator(text[p])) {
+            ++p;
+        }
+        bounds[c] = p;
+    }
+
+    // Count the values starting in each chunk, and turn the counts into offsets
+    std::vector<size_t> offsets(chunk_count + 1, 0);
+    #pragma omp parallel for schedule(dynamic)
+    for (std::ptrdiff_t c = 0; c < static_cast<std::ptrdiff_t>(chunk_count); ++c) {
+        size_t count = 0;
+        bool separator = true;
+        for (size_t p = bounds[c]; p < bounds[c + 1]; ++p) {
+            const bool s = is_separator(text[p]);
+            count += separator && !s;
+            separator = s;
+        }
+        offsets[c + 1] = count;
+    }
+    for (size_t c = 0; c < chunk_count; ++c) {
+        offsets[c + 1] += offsets[c];
+    }
+    if (offsets[chunk_count] < element_count) {
+        throw VolumeReadError("Truncated volume data.");
+    }
+
+    // Parse straight into the output buffer, ignoring any trailing value
+    image_data.clear();
+    image_data.resize(element_count * sizeof (T));
+    T *data = reinterpret_cast<T *>(image_data.data());
+    bool failed = false;
+
+    #pragma omp parallel for schedule(dynamic) reduction(||:failed)
+    for (std::ptrdiff_t c = 0; c < static_cast<std::ptrdiff_t>(chunk_count); ++c) {
+        const char *p = text + bounds[c];
+        const char *end = text + bounds[c + 1];
+        for (size_t i = offsets[c]; i < std::min(offsets[c + 1], element_count) && !failed; ++i) {
+            while (is_separator(*p)) {
+                ++p;
+            }
+            if ('+' == *p) {
+                ++p; // Not accepted by from_chars
+            }
+            const auto [next, error] = std::from_chars(p, end, data[i]);
+            failed = std::errc() != error || (next != end && !is_separator(*next));
+            p = next;
+        }
+    }
+    if (failed) {
+        throw VolumeReadError("Cannot parse ASCII volume data.");
+    }
+
+    range = range_kernel<T, false>(image_data.data(), element_count, 1);
+}
+
+
+/*!
+ * \brief Call a generic function with a value of the C++ type matching a data type.
+ * \param datatype Data type of the volume.
+ * \param f Callable, invoked with a default-constructed value of the matching type.
+ */
+template<typename F>
+void Volume::dispatch(const DataType datatype, F&& f)
+{
+    switch (datatype) {
+    case Volume::DataType::Int8:
+        f(int8_t {});
+        break;
+    case Volume::DataType::Uint8:
+        f(uint8_t {});
+        break;
+    case Volume::DataType::Int16:
+        f(int16_t {});
+        break;
+    case Volume::DataType::Uint16:
+        f(uint16_t {});
+        break;
+    case Volume::DataType::Int32:
+        f(int32_t {});
+        break;
+    case Volume::DataType::Uint32:
+        f(uint32_t {});
+        break;
+    case Volume::DataType::Int64:
+        f(int64_t {});
+        break;
+    case Volume::DataType::Uint64:
+        f(uint64_t {});
+        break;
+    case Volume::DataType::Float:
+        f(float {});
+        break;
+    case Volume::DataType::Double:
+        f(double {});
+        break;
+    }
+}
+
+
+/*!
+ * \brief Load the payload of the volume, after its size and data type are known.
+ * \param filename File holding the payload.
+ * \param offset Offset of the payload within the file, in bytes, or
+ *        `payload_at_end` for a raw payload stored at the end of the file.
+ * \param encoding Encoding of the payload.
+ * \param big_endian Whether binary voxels are stored in big endian order.
+ *
+ * Raw payloads are mapped and read in place. Compressed payloads are kept in
+ * the mapping, and inflated a slab at a time to find their range, which also
+ * checks that they are complete. ASCII payloads are parsed into the data
+ * buffer, releasing the mapping afterwards.
+ */
+void Volume::load_payload(const std::string& filename, const size_t offset, const Encoding encoding, const bool big_endian)
+{
+    const size_t slab_size = std::get<0>(m_size) * std::get<1>(m_size);
+    const size_t slab_count = std::get<2>(m_size);
+    const size_t element_count = slab_size * slab_count;
+    m_data.clear();
+    m_mapping.reset();
+    m_payload = nullptr;
+    m_compressed = nullptr;
+    m_compressed_size = 0;
+    m_swap = big_endian == is_little_endian();
+    m_normalised = false;
+
+    auto mapping = std::make_unique<MappedFile>(filename);
+    m_sources.push_back(filename);
+    if (payload_at_end == offset ? Encoding::Raw != encoding : offset > mapping->size()) {
+        throw VolumeReadError("Truncated volume data.");
+    }
+    const unsigned char *start = mapping->data() + (payload_at_end == offset ? 0 : offset);
+    const size_t available = mapping->size() - (payload_at_end == offset ? 0 : offset);
+
+    dispatch(m_datatype, [&](auto t) {
+        using T = decltype(t);
+        const size_t payload_size = element_count * sizeof (T);
+
+        switch (encoding) {
+        case Encoding::Raw:
+            if (available < payload_size) {
+                throw VolumeReadError("Truncated volume data.");
+            }
+            m_payload = payload_at_end == offset ? start + available - payload_size : start;
+            m_range = m_swap ? range_kernel<T, true>(m_payload, slab_size, slab_count)
+                             : range_kernel<T, false>(m_payload, slab_size, slab_count);
+            m_mapping = std::move(mapping);
+            break;
+
+        case Encoding::Ascii:
+            read_ascii_data<T>(reinterpret_cast<const char *>(start), available, element_count, m_data, m_range);
+            m_swap = false;
+            break;
+
+        case Encoding::Zlib:
+            m_compressed = start;
+            m_compressed_size = available;
+            m_range = {std::numeric_limits<double>::max(), std::numeric_limits<double>::lowest()};
+            inflate_slabs(slab_size * sizeof (T), [&](const unsigned char *slab, const size_t, const size_t slices) {
+                const auto range = m_swap ? range_kernel<T, true>(slab, slab_size, slices)
+                                          : range_kernel<T, false>(slab, slab_size, slices);
+                m_range = {std::min(m_range.first, range.first), std::max(m_range.second, range.second)};
+            });
+            m_mapping = std::move(mapping);
+            break;
+        }
+    });
+}
+
+
+/*!
+ * \brief Inflate the compressed payload, a slab of whole slices at a time.
+ * \param slice_bytes Size of a slice, in bytes.
+ * \param f Function taking `(slab, first_slice, slices)`, called on each slab in order.
+ * \param end_slice First slice not needed, the stream is not inflated past it.
+ *
+ * The stream is decoded as it is read from the mapping, so the compressed
+ * payload is never copied, and only one slab of voxels is held at a time.
+ * The slabs are in the byte order of the payload.
+ */
+template<typename F>
+void Volume::inflate_slabs(const size_t slice_bytes, F&& f, const size_t end_slice) const
+{
+    z_stream stream {};
+    if (Z_OK != inflateInit2(&stream, 15 + 32)) { // Detect zlib or gzip headers
+        throw VolumeReadError("Cannot initialise zlib.");
+    }
+    const std::unique_ptr<z_stream, decltype(&inflateEnd)> guard(&stream, inflateEnd);
+
+    const size_t depth = std::min(std::get<2>(m_size), end_slice);
+    const size_t slab_slices = std::max<size_t>(inflate_slab_size / std::max<size_t>(slice_bytes, 1), 1);
+    std::vector<unsigned char> slab(std::min(slab_slices, depth) * slice_bytes);
+
+    size_t consumed = 0;
+    for (size_t first_slice = 0; first_slice < depth; first_slice += slab_slices) {
+        const size_t slices = std::min(slab_slices, depth - first_slice);
+        const size_t total = slices * slice_bytes;
+        size_t produced = 0;
+        int status = Z_OK;
+        while (produced < total) {
+            if (0 == stream.avail_in) {
+                const size_t chunk = std::min(m_compressed_size - consumed, zlib_chunk_size);
+                stream.next_in = const_cast<Bytef *>(m_compressed + consumed);
+                stream.avail_in = static_cast<uInt>(chunk);
+                consumed += chunk;
+            }
+            const size_t chunk = std::min(total - produced, zlib_chunk_size);
+            stream.next_out = slab.data() + produced;
+            stream.avail_out = static_cast<uInt>(chunk);
+
+            status = inflate(&stream, Z_NO_FLUSH);
+            produced += chunk - stream.avail_out;
+
+            // A buffer error only means that more input is needed
+            const bool more_input = Z_BUF_ERROR == status && consumed < m_compressed_size;
+            if (Z_OK != status && !more_input) {
+                break;
+            }
+        }
+        if (produced < total) {
+            throw VolumeReadError(Z_DATA_ERROR == status ? "Corrupted compressed volume data." : "Truncated volume data.");
+        }
+        f(slab.data(), first_slice, slices);
+    }
+}
+
+
+/*!
+ * \brief Copy a mapped or compressed payload into the data buffer, in native byte order.
+ *
+ * This is only needed when the raw data is accessed before normalisation.
+ */
+void Volume::materialise(void)
+{
+    if (!m_payload && !m_compressed) {
+        return;
+    }
+
+    const size_t slab_size = std::get<0>(m_size) * std::get<1>(m_size);
+    const size_t slab_count = std::get<2>(m_size);
+    dispatch(m_datatype, [&](auto t) {
+        using T = decltype(t);
+        std::vector<unsigned char> data(slab_size * slab_count * sizeof (T));
+        const auto copy = [&](const unsigned char *src, const size_t first_slice, const size_t slices) {
+            unsigned char *dst = data.data() + first_slice * slab_size * sizeof (T);
+            if (m_swap) {
+                copy_kernel<T, true>(src, dst, slab_size, slices);
+            }
+            else {
+                copy_kernel<T, false>(src, dst, slab_size, slices);
+            }
+        };
+        if (m_compressed) {
+            inflate_slabs(slab_size * sizeof (T), copy);
+        }
+        else {
+            copy(m_payload, 0, slab_count);
+        }
+        m_data = std::move(data);
+    });
+
+    m_payload = nullptr;
+    m_compressed = nullptr;
+    m_compressed_size = 0;
+    m_swap = false;
+    m_mapping.reset();
+}
+
+
+/*!
+ * \brief Inflate a compressed payload into memory, so its voxels can be read in any order.
+ */
+void Volume::inflate_payload(void)
+{
+    if (m_compressed) {
+        materialise();
+    }
+}
+
+
+/*!
+ * \brief Cast the data to `unsigned char` and normalise it to [0, 255].
+ */
+void Volume::uint8_normalised(void) {
+    std::vector<unsigned char> normal_data(std::get<0>(m_size) * std::get<1>(m_size) * std::get<2>(m_size));
+    read_normalised(normal_data.data());
+
+    m_data = std::move(normal_data);
+    m_datatype = DataType::Uint8;
+    m_normalised = true;
+    m_payload = nullptr;
+    m_compressed = nullptr;
+    m_compressed_size = 0;
+    m_swap = false;
+    m_mapping.reset();
+}
+
+
+/*!
+ * \brief Write the whole volume, normalised, into a buffer.
+ * \param dst Output buffer, holding one element per voxel.
+ *
+ * The payload is read only once, and written straight into the output buffer.
+ * A compressed payload is inflated one slab at a time, each slab normalised
+ * into its slices of the output.
+ */
+template<typename U>
+void Volume::read_normalised(U *dst) const
+{
+    const size_t slab_size = std::get<0>(m_size) * std::get<1>(m_size);
+    const size_t slab_count = std::get<2>(m_size);
+    const std::pair<double, double> range = m_normalised ? std::pair<double, double>{0.0, 255.0} : m_range;
+
+    dispatch(m_datatype, [&](auto t) {
+        using T = decltype(t);
+        if (m_compressed) {
+            inflate_slabs(slab_size * sizeof (T), [&](const unsigned char *slab, const size_t first_slice, const size_t slices) {
+                if (m_swap) {
+                    normalise_kernel<T, true, U>(slab, range, dst + first_slice * slab_size, slab_size, slices);
+                }
+                else {
+                    normalise_kernel<T, false, U>(slab, range, dst + first_slice * slab_size, slab_size, slices);
+                }
+            });
+        }
+        else if (m_payload && m_swap) {
+            normalise_kernel<T, true, U>(m_payload, range, dst, slab_size, slab_count);
+        }
+        else {
+            normalise_kernel<T, false, U>(m_payload ? m_payload : m_data.data(), range, dst, slab_size, slab_count);
+        }
+    });
+}
+
+template void Volume::read_normalised<uint8_t>(uint8_t *dst) const;
+template void Volume::read_normalised<uint16_t>(uint16_t *dst) const;
+template void Volume::read_normalised<half_t>(half_t *dst) const;
+template void Volume::read_normalised<float>(float *dst) const;
+
+
+/*!
+ * \brief Write a box of the volume, normalised, into a buffer.
+ */
+template<typename U>
+void Volume::read_normalised(U *dst, const VoxelRegion& region) const
+{
+    const size_t width = std::get<0>(m_size);
+    const size_t height = std::get<1>(m_size);
+    const std::pair<double, double> range = m_normalised ? std::pair<double, double>{0.0, 255.0} : m_range;
+
+    dispatch(m_datatype, [&](auto t) {
+        using T = decltype(t);
+        if (m_compressed) {
+            const auto normalise = [&](const unsigned char *slab, const size_t first_slice, const size_t slices) {
+                if (m_swap) {
+                    region_normalise_kernel<T, true, U>(slab, range, dst, width, height, region, first_slice, slices);
+                }
+                else {
+                    region_normalise_kernel<T, false, U>(slab, range, dst, width, height, region, first_slice, slices);
+                }
+            };
+            inflate_slabs(width * height * sizeof (T), normalise, region.offset[2] + region.size[2]);
+        }
+        else if (m_payload && m_swap) {
+            region_normalise_kernel<T, true, U>(m_payload, range, dst, width, height, region);
+        }
+        else {
+            region_normalise_kernel<T, false, U>(m_payload ? m_payload : m_data.data(), range, dst, width, height, region);
+        }
+    });
+}
+
+template void Volume::read_normalised<uint8_t>(uint8_t *dst, const VoxelRegion& region) const;
+template void Volume::read_normalised<uint16_t>(uint16_t *dst, const VoxelRegion& region) const;
+template void Volume::read_normalised<half_t>(half_t *dst, const VoxelRegion& region) const;
+template void Volume::read_normalised<float>(float *dst, const VoxelRegion& region) const;
+
+
+/*!
+ * \brief Read the whole volume, normalised, in Z-ordered bricks.
+ */
+template<typename U>
+BrickedLayout<U> Volume::read_bricked(void) const
+{
+    BrickedLayout<U> layout(std::get<0>(m_size), std::get<1>(m_size), std::get<2>(m_size));
+    const std::pair<double, double> range = m_normalised ? std::pair<double, double>{0.0, 255.0} : m_range;
+
+    dispatch(m_datatype, [&](auto t) {
+        using T = decltype(t);
+        if (m_compressed) {
+            const size_t slice_bytes = std::get<0>(m_size) * std::get<1>(m_size) * sizeof (T);
+            inflate_slabs(slice_bytes, [&](const unsigned char *slab, const size_t first_slice, const size_t slices) {
+                if (m_swap) {
+                    bricked_normalise_kernel<T, true, U>(slab, range, layout, first_slice, slices);
+                }
+                else {
+                    bricked_normalise_kernel<T, false, U>(slab, range, layout, first_slice, slices);
+                }
+            });
+        }
+        else if (m_payload && m_swap) {
+            bricked_normalise_kernel<T, true, U>(m_payload, range, layout);
+        }
+        else {
+            bricked_normalise_kernel<T, false, U>(m_payload ? m_payload : m_data.data(), range, layout);
+        }
+    });
+    return layout;
+}
+
+template BrickedLayout<uint8_t> Volume::read_bricked<uint8_t>(void) const;
+template BrickedLayout<uint16_t> Volume::read_bricked<uint16_t>(void) const;
+template BrickedLayout<float> Volume::read_bricked<float>(void) const;
+
+
+/*!
+ * \brief Read a cubic region of the volume, normalised to [0, 255].
+ * \param x0 First voxel of the region along x.
+ * \param y0 First voxel of the region along y.
+ * \param z0 First voxel of the region along z.
+ * \param side Number of voxels for each side of the region.
+ * \param dst Output buffer, holding `side * side * side` elements.
+ */
+void Volume::read_brick(const std::ptrdiff_t x0, const std::ptrdiff_t y0, const std::ptrdiff_t z0, const size_t side, unsigned char *dst) const
+{
+    if (m_compressed) {
+        throw std::logic_error("Compressed volumes must be inflated before reading bricks.");
+    }
+
+    const size_t width = std::get<0>(m_size);
+    const size_t height = std::get<1>(m_size);
+    const size_t depth = std::get<2>(m_size);
+    const std::pair<double, double> range = m_normalised ? std::pair<double, double>{0.0, 255.0} : m_range;
+
+    dispatch(m_datatype, [&](auto t) {
+        using T = decltype(t);
+        if (m_payload && m_swap) {
+            brick_kernel<T, true>(m_payload, range, dst, width, height, depth, x0, y0, z0, side);
+        }
+        else {
+            brick_kernel<T, false>(m_payload ? m_payload : m_data.data(), range, dst, width, height, depth, x0, y0, z0, side);
+        }
+    });
+}
+
+
+/*!
+ * \brief Create a volume of type `T` from file.
+ */
+template<typename T>
+static std::unique_ptr<Volume> read_volume(const std::string& filename)
+{
+    return std::make_unique<T>(filename);
+}
+
+
+/*!
+ * \brief Readers for each file extension, in lower case.
+ */
+static std::map<std::string, VolumeReader>& volume_readers(void)
+{
+    static std::map<std::string, VolumeReader> readers {
+        {"vtk", read_volume<VTKVolume>},
+        {"nrrd", read_volume<NrrdVolume>},
+        {"nhdr", read_volume<NrrdVolume>},
+        {"mha", read_volume<MetaImageVolume>},
+        {"mhd", read_volume<MetaImageVolume>},
+        {"raw", read_volume<RawVolume>},
+    };
+    return readers;
+}
+
+
+/*!
+ * \brief Register a reader for a file extension, replacing any existing one.
+ * \param extension File extension, without the leading dot.
+ * \param reader Function creating a volume from file.
+ *
+ * Readers should be registered before any volume is opened, since the
+ * registry is not synchronised.
+ */
+void register_volume_reader(const std::string& extension, VolumeReader reader)
+{
+    std::string key = extension;
+    std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return std::tolower(c); });
+    volume_readers()[key] = std::move(reader);
+}
+
+
+/*!
+ * \brief Open a volume, with the reader registered for its extension.
+ * \param filename File to be loaded.
+ * \return The volume.
+ */
+std::unique_ptr<Volume> open_volume(const std::string& filename)
+{
+    std::string extension = std::filesystem::path(filename).extension().string();
+    if (extension.size() < 2) {
+        throw VolumeReadError("Cannot determine file extension.");
+    }
+    extension = extension.substr(1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+
+    const auto reader = volume_readers().find(extension);
+    if (volume_readers().end() == reader) {
+        throw VolumeReadError("Unrecognised extension '" + extension + "'.");
+    }
+    return reader->second(filename);
+}
+
+
+/*!
+ * \brief Extensions with a registered reader, in lower case.
+ */
+std::vector<std::string> volume_extensions(void)
+{
+    std::vector<std::string> extensions;
+    for (const auto& [extension, reader] : volume_readers()) {
+        extensions.push_back(extension);
+    }
+    return extensions;
+}
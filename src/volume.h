@@ -0,0 +1,240 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "mappedfile.h"
+#include "voxellayout.h"
+
+
+class VolumeReadError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+
+/*!
+ * \brief Scalar volume read from file.
+ *
+ * This class holds the voxels and metadata shared by all the file formats,
+ * and each reader derives from it to parse its own header. Uncompressed
+ * binary payloads are mapped from their file, and they are read in place
+ * (in whichever byte order they are stored) by the parallel kernels.
+ * Compressed payloads stay compressed in the mapping, and each pass over
+ * the voxels inflates them again, a slab at a time, so the uncompressed
+ * voxels are never held at once unless they are accessed in any order.
+ */
+class Volume {
+
+public:
+
+    /*!
+     * \brief Create an empty volume.
+     */
+    Volume(void);
+
+    /*!
+     * \brief Destructor.
+     */
+    virtual ~Volume();
+
+    /*!
+     * \brief Cast the data to `unsigned char` and normalise it to [0, 255];
+     */
+    void uint8_normalised(void);
+
+    /*!
+     * \brief Write the whole volume, normalised, into a buffer.
+     * \param dst Output buffer, holding one element per voxel.
+     *
+     * Integer types `U` are normalised to their whole range, floating point
+     * types to [0, 1]. The data is converted straight from the file mapping,
+     * without intermediate buffers.
+     */
+    template<typename U>
+    void read_normalised(U *dst) const;
+
+    /*!
+     * \brief Write a box of the volume, normalised, into a buffer.
+     * \param dst Output buffer, holding one element per voxel of the box.
+     * \param region Box to be read, inside the volume.
+     *
+     * The voxels are normalised as in `read_normalised`, with the range of
+     * the whole volume, and only the rows of the box are read from the file
+     * mapping. A compressed payload is inflated up to the last slice of the
+     * box, a slab at a time.
+     */
+    template<typename U>
+    void read_normalised(U *dst, const VoxelRegion& region) const;
+
+    /*!
+     * \brief Read the whole volume, normalised, in Z-ordered bricks.
+     *
+     * The voxels are normalised as in `read_normalised`, and stored in the
+     * layout meant for CPU passes, where neighbours along y and z are close
+     * in memory. `BrickedLayout::to_linear` gives back the linear order.
+     */
+    template<typename U>
+    BrickedLayout<U> read_bricked(void) const;
+
+    /*!
+     * \brief Whether the voxels have an integer type.
+     */
+    bool integral(void) const {
+        return m_datatype != DataType::Float && m_datatype != DataType::Double;
+    }
+
+    /*!
+     * \brief Read a cubic region of the volume, normalised to [0, 255].
+     * \param x0 First voxel of the region along x.
+     * \param y0 First voxel of the region along y.
+     * \param z0 First voxel of the region along z.
+     * \param side Number of voxels for each side of the region.
+     * \param dst Output buffer, holding `side * side * side` elements.
+     *
+     * Voxels outside the volume replicate its border. The data is read in
+     * place, without materialising the whole volume, and this function can
+     * be called concurrently from multiple threads.
+     */
+    void read_brick(const std::ptrdiff_t x0, const std::ptrdiff_t y0, const std::ptrdiff_t z0, const size_t side, unsigned char *dst) const;
+
+    /*!
+     * \brief Inflate a compressed payload into memory, so its voxels can be read in any order.
+     *
+     * This is needed before `read_brick`, and does nothing for payloads that
+     * are not compressed.
+     */
+    void inflate_payload(void);
+
+    /*!
+     * \brief Pointer to the data.
+     */
+    unsigned char * data_ptr(void) {
+        materialise();
+        return m_data.data();
+    }
+
+    /*!
+     * \brief Voxels in native byte order, without copying them.
+     *
+     * The reference is valid until the volume is normalised or destroyed.
+     */
+    const std::vector<unsigned char>& data(void) {
+        materialise();
+        return m_data;
+    }
+
+    /*!
+     * \brief Range of the image, in intensity value.
+     * \return A pair, holding <minimum, maximum>.
+     */
+    const std::pair<double, double> range(void) const {
+        return m_range;
+    }
+
+    /*!
+     * \brief Number of voxels for each axis.
+     */
+    const std::tuple<size_t, size_t, size_t> size(void) const {
+        return m_size;
+    }
+
+    /*!
+     * \brief Origin of the volume.
+     */
+    const std::tuple<float, float, float> origin(void) const {
+        return m_origin;
+    }
+
+    /*!
+     * \brief Spacing between voxels.
+     */
+    const std::tuple<float, float, float> spacing(void) const {
+        return m_spacing;
+    }
+
+    /*!
+     * \brief Files the volume was read from, besides the file it was opened with.
+     *
+     * Detached payloads and sidecar headers are listed here, so a cache of
+     * the volume can tell when any of them changes.
+     */
+    const std::vector<std::string>& sources(void) const {
+        return m_sources;
+    }
+
+protected:
+    enum class DataType {Int8, Uint8, Int16, Uint16, Int32, Uint32, Int64, Uint64, Float, Double};
+
+    /*!
+     * \brief Encoding of a payload.
+     */
+    enum class Encoding {
+        Raw,   /*!< Binary voxels. */
+        Ascii, /*!< Values separated by whitespace. */
+        Zlib,  /*!< Binary voxels, in a zlib or gzip stream. */
+    };
+
+    static constexpr size_t payload_at_end = static_cast<size_t>(-1); /*!< Offset of a raw payload stored at the end of its file. */
+
+    std::tuple<size_t, size_t, size_t> m_size;    /*!< Number of voxels for each axis. */
+    std::tuple<float, float, float> m_origin;  /*!< Origin, in voxel coordinates. */
+    std::tuple<float, float, float> m_spacing; /*!< Spacing between voxels. */
+    DataType m_datatype;                          /*!< Data type. */
+    std::pair<double, double> m_range;            /*!< (min, max) of the original intensities, before normalisation. */
+    std::vector<unsigned char> m_data;            /*!< Volume data in native byte order, or normalised to [0, 255]. */
+    std::unique_ptr<MappedFile> m_mapping;        /*!< Mapping of a binary file, until its payload is consumed. */
+    const unsigned char *m_payload {nullptr};     /*!< Start of the payload within the mapping. */
+    const unsigned char *m_compressed {nullptr};  /*!< Start of a compressed payload within the mapping, until it is inflated. */
+    size_t m_compressed_size {0};                 /*!< Size of the compressed payload, in bytes. */
+    bool m_swap {false};                          /*!< Whether the byte order of the payload differs from the native one. */
+    bool m_normalised {false};                    /*!< Whether the data has already been normalised to [0, 255]. */
+    std::vector<std::string> m_sources;           /*!< Files read, besides the one the volume was opened with. */
+
+    template<typename F>
+    static void dispatch(const DataType datatype, F&& f);
+
+    void load_payload(const std::string& filename, const size_t offset, const Encoding encoding, const bool big_endian);
+    void materialise(void);
+
+private:
+    template<typename F>
+    void inflate_slabs(const size_t slice_bytes, F&& f, const size_t end_slice = std::numeric_limits<size_t>::max()) const;
+};
+
+
+/*!
+ * \brief Function creating a volume from file.
+ */
+using VolumeReader = std::function<std::unique_ptr<Volume>(const std::string& filename)>;
+
+void register_volume_reader(const std::string& extension, VolumeReader reader);
+std::unique_ptr<Volume> open_volume(const std::string& filename);
+std::vector<std::string> volume_extensions(void);
@@ -0,0 +1,360 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "mappedfile.h"
+#include "volumecache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <type_traits>
+
+namespace fs = std::filesystem;
+
+
+/*!
+ * \brief Alignment of the sections of a cache file, in bytes.
+ */
+static constexpr uint64_t section_alignment = 4096;
+
+/*!
+ * \brief Version of the cache layout, bumped on any change to it.
+ */
+static constexpr uint32_t cache_version = 2;
+
+/*!
+ * \brief Byte order tag, reading differently on a machine with another endianness.
+ */
+static constexpr uint32_t byte_order_tag = 0x01020304;
+
+/*!
+ * \brief Position of a section within a cache file.
+ */
+struct Section {
+    uint64_t offset {0}; /*!< Offset from the start of the file, in bytes. */
+    uint64_t size {0};   /*!< Size of the section, in bytes. */
+};
+
+/*!
+ * \brief Header at the start of a cache file.
+ */
+struct Header {
+    char magic[8];                  /*!< Always "RCVCACHE". */
+    uint32_t version;               /*!< Layout version. */
+    uint32_t byte_order;            /*!< `byte_order_tag`, in the byte order of the writer. */
+    VolumeCache::Key key;           /*!< Source and options of the cache. */
+    uint64_t size[3];               /*!< Number of voxels for each axis. */
+    float origin[3];                /*!< Origin, in voxel coordinates. */
+    float spacing[3];               /*!< Spacing between voxels. */
+    double range[2];                /*!< (min, max) of the original intensities. */
+    double psnr;                    /*!< Quality of compressed voxels, in dB. */
+    uint32_t format;                /*!< `VoxelFormat` of the voxels. */
+    uint32_t reserved;              /*!< Padding, always zero. */
+    uint64_t occupancy_size[3];     /*!< Number of bricks of the occupancy grid for each axis. */
+    uint64_t occupancy_brick_size;  /*!< Side of each brick of the occupancy grid, in voxels. */
+    Section data;                   /*!< Normalised voxels. */
+    Section occupancy;              /*!< Occupancy grid ranges. */
+    Section gradients;              /*!< Encoded gradients, empty if not computed. */
+    Section sources;                /*!< `SourceRecord`s of the other files read by the reader. */
+};
+
+/*!
+ * \brief Record of a file read along with the source, followed by its path.
+ */
+struct SourceRecord {
+    uint64_t size;        /*!< Size of the file, in bytes. */
+    int64_t time;         /*!< Modification time of the file, in file clock ticks. */
+    uint64_t path_size;   /*!< Length of the absolute path following the record. */
+};
+
+static_assert(std::is_trivially_copyable<Header>::value, "The cache header is written as raw bytes");
+static_assert(std::is_trivially_copyable<SourceRecord>::value, "The source records are written as raw bytes");
+
+static const char cache_magic[8] = {'R', 'C', 'V', 'C', 'A', 'C', 'H', 'E'};
+
+
+/*!
+ * \brief Round an offset up to the section alignment.
+ */
+static uint64_t align(const uint64_t offset)
+{
+    return (offset + section_alignment - 1) / section_alignment * section_alignment;
+}
+
+
+/*!
+ * \brief Size and modification time of a file.
+ * \return Whether the file could be queried.
+ */
+static bool stat_file(const fs::path& path, uint64_t& size, int64_t& time)
+{
+    std::error_code error;
+    size = fs::file_size(path, error);
+    if (error) {
+        return false;
+    }
+    time = fs::last_write_time(path, error).time_since_epoch().count();
+    return !error;
+}
+
+
+/*!
+ * \brief Whether the files recorded in a sources section are unchanged.
+ */
+static bool sources_unchanged(const unsigned char *data, const uint64_t size)
+{
+    uint64_t position = 0;
+    while (position < size) {
+        SourceRecord record;
+        if (size - position < sizeof(record)) {
+            return false;
+        }
+        std::memcpy(&record, data + position, sizeof(record));
+        position += sizeof(record);
+        if (size - position < record.path_size) {
+            return false;
+        }
+        const std::string path(reinterpret_cast<const char *>(data + position), record.path_size);
+        position += record.path_size;
+
+        uint64_t file_size;
+        int64_t file_time;
+        if (!stat_file(path, file_size, file_time) || file_size != record.size || file_time != record.time) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/*!
+ * \brief Compare two keys field by field, ignoring padding.
+ */
+static bool operator==(const VolumeCache::Key& a, const VolumeCache::Key& b)
+{
+    return a.source_size == b.source_size && a.source_time == b.source_time && a.format == b.format
+            && a.gradients == b.gradients && a.texture_budget == b.texture_budget;
+}
+
+
+/*!
+ * \brief Locate the cache of a volume.
+ * \param source Source volume file.
+ * \param options Options the volume is prepared with.
+ */
+VolumeCache::VolumeCache(const std::string& source, const VolumeOptions& options)
+{
+    std::error_code error;
+    const fs::path source_path = fs::absolute(source, error);
+    if (error || !stat_file(source_path, m_key.source_size, m_key.source_time)) {
+        return;
+    }
+
+    m_key.format = static_cast<uint32_t>(options.format);
+    m_key.gradients = options.gradients;
+    m_key.texture_budget = options.texture_budget;
+
+    if (options.cache_directory.empty()) {
+        m_path = source_path.string() + ".cache";
+    }
+    else {
+        // Sources with the same name in different directories must not clash
+        std::ostringstream name;
+        name << source_path.filename().string() << "." << std::hex
+             << std::hash<std::string>{}(source_path.string()) << ".cache";
+        m_path = (fs::path(options.cache_directory) / name.str()).string();
+    }
+    m_valid = true;
+}
+
+
+/*!
+ * \brief Load the cached volume.
+ * \return The cached volume, or a null pointer if there is no up to date cache.
+ */
+std::shared_ptr<PreparedVolume> VolumeCache::load(void) const
+{
+    if (!m_valid || !fs::exists(m_path)) {
+        return nullptr;
+    }
+
+    std::shared_ptr<const MappedFile> mapping;
+    try {
+        mapping = std::make_shared<const MappedFile>(m_path);
+    }
+    catch (const std::runtime_error&) {
+        return nullptr;
+    }
+
+    Header header;
+    if (mapping->size() < sizeof(header)) {
+        return nullptr;
+    }
+    std::memcpy(&header, mapping->data(), sizeof(header));
+
+    if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0
+            || cache_version != header.version
+            || byte_order_tag != header.byte_order
+            || !(m_key == header.key)) {
+        return nullptr;
+    }
+
+    // A section out of the file means a truncated or corrupted cache (empty
+    // sections are aligned past the end of the file, and never read)
+    const auto inside = [&](const Section& s) {
+        return 0 == s.size || (s.offset <= mapping->size() && s.size <= mapping->size() - s.offset);
+    };
+    if (header.format < static_cast<uint32_t>(VoxelFormat::Uint8) || header.format > static_cast<uint32_t>(VoxelFormat::Rgtc1)) {
+        return nullptr;
+    }
+    const VoxelFormat format = static_cast<VoxelFormat>(header.format);
+    const uint64_t bricks = header.occupancy_size[0] * header.occupancy_size[1] * header.occupancy_size[2];
+    if (header.data.size != header.size[2] * slice_bytes(format, header.size[0], header.size[1])
+            || !inside(header.data) || !inside(header.occupancy) || !inside(header.gradients) || !inside(header.sources)
+            || header.occupancy.size != 2 * bricks
+            || (header.gradients.size != 0
+                && header.gradients.size != 4 * header.size[0] * header.size[1] * header.size[2])) {
+        return nullptr;
+    }
+
+    // A detached payload or a sidecar may have changed without touching the source
+    if (!sources_unchanged(mapping->data() + header.sources.offset, header.sources.size)) {
+        return nullptr;
+    }
+
+    auto volume = std::make_shared<PreparedVolume>();
+    volume->size = QVector3D(header.size[0], header.size[1], header.size[2]);
+    volume->origin = QVector3D(header.origin[0], header.origin[1], header.origin[2]);
+    volume->spacing = QVector3D(header.spacing[0], header.spacing[1], header.spacing[2]);
+    volume->range = {header.range[0], header.range[1]};
+    volume->format = format;
+    volume->psnr = header.psnr;
+
+    // The occupancy grid is small, and it is kept after the upload
+    const unsigned char *occupancy = mapping->data() + header.occupancy.offset;
+    volume->occupancy = OccupancyGrid(std::vector<unsigned char>(occupancy, occupancy + header.occupancy.size),
+                                      header.occupancy_size[0], header.occupancy_size[1], header.occupancy_size[2],
+                                      header.occupancy_brick_size);
+
+    volume->cached_data = mapping->data() + header.data.offset;
+    if (header.gradients.size) {
+        volume->cached_gradients = mapping->data() + header.gradients.offset;
+    }
+    volume->cache = std::move(mapping);
+
+    return volume;
+}
+
+
+/*!
+ * \brief Write a prepared volume to the cache.
+ * \param volume Volume prepared from the source, with the options of the cache.
+ * \param sources Other files read along with the source.
+ */
+void VolumeCache::store(const PreparedVolume& volume, const std::vector<std::string>& sources) const
+{
+    if (!m_valid) {
+        throw std::runtime_error("Cannot cache a volume without a source file.");
+    }
+
+    std::vector<unsigned char> records;
+    for (const auto& source : sources) {
+        std::error_code error;
+        const std::string path = fs::absolute(source, error).string();
+        SourceRecord record {0, 0, path.size()};
+        if (error || !stat_file(path, record.size, record.time)) {
+            throw std::runtime_error("Cannot query source file '" + source + "'.");
+        }
+        const auto *bytes = reinterpret_cast<const unsigned char *>(&record);
+        records.insert(records.end(), bytes, bytes + sizeof(record));
+        records.insert(records.end(), path.begin(), path.end());
+    }
+
+    Header header {};
+    std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = cache_version;
+    header.byte_order = byte_order_tag;
+    header.key = m_key;
+    header.size[0] = volume.size.x();
+    header.size[1] = volume.size.y();
+    header.size[2] = volume.size.z();
+    header.origin[0] = volume.origin.x();
+    header.origin[1] = volume.origin.y();
+    header.origin[2] = volume.origin.z();
+    header.spacing[0] = volume.spacing.x();
+    header.spacing[1] = volume.spacing.y();
+    header.spacing[2] = volume.spacing.z();
+    header.range[0] = volume.range.first;
+    header.range[1] = volume.range.second;
+    header.psnr = volume.psnr;
+    header.format = static_cast<uint32_t>(volume.format);
+    header.occupancy_size[0] = volume.occupancy.width();
+    header.occupancy_size[1] = volume.occupancy.height();
+    header.occupancy_size[2] = volume.occupancy.depth();
+    header.occupancy_brick_size = volume.occupancy.brick_size();
+
+    header.data = {align(sizeof(header)), volume.data.size()};
+    header.occupancy = {align(header.data.offset + header.data.size), volume.occupancy.data().size()};
+    header.gradients = {align(header.occupancy.offset + header.occupancy.size), volume.gradients.size()};
+    header.sources = {align(header.gradients.offset + header.gradients.size), records.size()};
+
+    std::error_code error;
+    fs::create_directories(fs::path(m_path).parent_path(), error);
+
+    // Processes or threads writing the same cache each have their own temporary file
+    std::ostringstream temporary_name;
+    temporary_name << m_path << "." << std::hex << std::hash<std::thread::id>{}(std::this_thread::get_id())
+                   << std::random_device{}() << ".tmp";
+    const std::string temporary = temporary_name.str();
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            throw std::runtime_error("Cannot create cache file.");
+        }
+
+        const auto write_section = [&](const Section& s, const unsigned char *data) {
+            file.seekp(s.offset);
+            file.write(reinterpret_cast<const char *>(data), s.size);
+        };
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        write_section(header.data, volume.data.data());
+        write_section(header.occupancy, volume.occupancy.data().data());
+        write_section(header.gradients, volume.gradients.data());
+        write_section(header.sources, records.data());
+
+        if (!file.flush()) {
+            file.close();
+            fs::remove(temporary);
+            throw std::runtime_error("Cannot write cache file.");
+        }
+    }
+
+    fs::rename(temporary, m_path, error);
+    if (error) {
+        fs::remove(temporary, error);
+        throw std::runtime_error("Cannot replace cache file.");
+    }
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "raycastvolume.h"
+
+
+/*!
+ * \brief Binary cache of a prepared volume, stored in a file.
+ *
+ * The cache holds the normalised voxels, the intensity range and the derived
+ * acceleration structures of a volume, in native byte order. Each section is
+ * aligned to a page boundary, so a cached volume is loaded by mapping the file
+ * and uploading the sections straight from the mapping.
+ *
+ * A cache is valid only for the source file and the options it was built
+ * from, and it is discarded when the size or the modification time of the
+ * source, or of any other file read along with it, change.
+ */
+class VolumeCache {
+
+public:
+
+    /*!
+     * \brief Key identifying the source of a cache.
+     */
+    struct Key {
+        uint64_t source_size {0};     /*!< Size of the source file, in bytes. */
+        int64_t source_time {0};      /*!< Modification time of the source file, in file clock ticks. */
+        uint32_t format {0};          /*!< Requested `VoxelFormat`. */
+        uint32_t gradients {0};       /*!< Whether gradients were requested. */
+        uint64_t texture_budget {0};  /*!< Budget of the automatic format, in bytes. */
+    };
+
+    /*!
+     * \brief Locate the cache of a volume.
+     * \param source Source volume file.
+     * \param options Options the volume is prepared with.
+     *
+     * The cache is stored next to the source, unless a cache directory is
+     * given in the options.
+     */
+    VolumeCache(const std::string& source, const VolumeOptions& options);
+
+    /*!
+     * \brief Path of the cache file.
+     */
+    const std::string& path(void) const {
+        return m_path;
+    }
+
+    /*!
+     * \brief Whether the source file exists, so the cache can be used.
+     */
+    bool valid(void) const {
+        return m_valid;
+    }
+
+    /*!
+     * \brief Load the cached volume.
+     * \return The cached volume, or a null pointer if there is no up to date cache.
+     *
+     * The voxels and gradients of the volume point into the mapping of the
+     * cache file, which is released with the volume.
+     */
+    std::shared_ptr<PreparedVolume> load(void) const;
+
+    /*!
+     * \brief Write a prepared volume to the cache.
+     * \param volume Volume prepared from the source, with the options of the cache.
+     * \param sources Other files read along with the source, such as detached payloads.
+     *
+     * The cache is written to a temporary file and then renamed, so a partial
+     * cache is never read. Throws `std::runtime_error` on failure.
+     */
+    void store(const PreparedVolume& volume, const std::vector<std::string>& sources) const;
+
+private:
+    std::string m_path;   /*!< Path of the cache file. */
+    Key m_key;            /*!< Key of the source file and options. */
+    bool m_valid {false}; /*!< Whether the source file exists. */
+};
@@ -0,0 +1,111 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "volumepartition.h"
+
+
+/*!
+ * \brief Split a volume.
+ * \param size Number of voxels along each axis.
+ * \param count Number of boxes, at least one.
+ *
+ * Throws `std::runtime_error` if the volume is too small for the boxes.
+ */
+VolumePartition::VolumePartition(const std::array<size_t, 3>& size, const size_t count)
+{
+    if (count < 1) {
+        throw std::runtime_error("A partition needs at least one box.");
+    }
+    split(VoxelRegion {{0, 0, 0}, size}, count);
+}
+
+
+/*!
+ * \brief Boxes sorted front to back.
+ * \param eye Position of the camera, in voxels (the texture coordinates
+ *            scaled by the size of the volume).
+ * \return Indices of the boxes, the closest to the camera first.
+ */
+std::vector<size_t> VolumePartition::visibility_order(const std::array<float, 3>& eye) const
+{
+    std::vector<size_t> order;
+    std::vector<int> stack {0};
+    while (!stack.empty()) {
+        const Node& node = m_nodes[stack.back()];
+        stack.pop_back();
+        if (node.children[0] < 0) {
+            order.push_back(node.region);
+            continue;
+        }
+
+        // The side of the camera is pushed last, to be visited first
+        const bool below = eye[node.axis] < static_cast<float>(node.plane);
+        stack.push_back(node.children[below ? 1 : 0]);
+        stack.push_back(node.children[below ? 0 : 1]);
+    }
+    return order;
+}
+
+
+/*!
+ * \brief Split a box recursively.
+ * \param region Box to be split.
+ * \param count Number of boxes it is split in.
+ * \return Index of the node of the box.
+ */
+int VolumePartition::split(const VoxelRegion& region, const size_t count)
+{
+    const int index = static_cast<int>(m_nodes.size());
+    m_nodes.emplace_back();
+
+    if (1 == count) {
+        m_nodes[index].region = m_regions.size();
+        m_regions.push_back(region);
+        return index;
+    }
+
+    const size_t axis = std::max_element(region.size.begin(), region.size.end()) - region.size.begin();
+    if (region.size[axis] < 2) {
+        throw std::runtime_error("The volume is too small to be split in so many boxes.");
+    }
+
+    // Cut in proportion to the boxes on each side
+    const size_t below = count / 2;
+    const size_t cut = std::clamp<size_t>((region.size[axis] * below + count / 2) / count, 1, region.size[axis] - 1);
+
+    VoxelRegion lower = region;
+    VoxelRegion upper = region;
+    lower.size[axis] = cut;
+    upper.offset[axis] += cut;
+    upper.size[axis] -= cut;
+
+    const int first = split(lower, below);
+    const int second = split(upper, count - below);
+    m_nodes[index].axis = axis;
+    m_nodes[index].plane = upper.offset[axis];
+    m_nodes[index].children[0] = first;
+    m_nodes[index].children[1] = second;
+    return index;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+#include "voxellayout.h"
+
+
+/*!
+ * \brief Split of a volume in boxes, one for each render node.
+ *
+ * The volume is cut recursively along its longest axis, in proportion to
+ * the nodes on each side, so the boxes have nearly the same number of voxels
+ * for any number of nodes. The cuts form a k-d tree, and its traversal on
+ * the side of the camera first gives the boxes in visibility order, valid
+ * for all the rays from the camera.
+ */
+class VolumePartition
+{
+public:
+    static constexpr size_t margin = 4; /*!< Voxels read around a box, for the samples on its faces. */
+
+    VolumePartition(const std::array<size_t, 3>& size, const size_t count);
+
+    /*!
+     * \brief Number of boxes.
+     */
+    size_t count(void) const {
+        return m_regions.size();
+    }
+
+    /*!
+     * \brief Box of a node.
+     */
+    const VoxelRegion& region(const size_t index) const {
+        return m_regions[index];
+    }
+
+    std::vector<size_t> visibility_order(const std::array<float, 3>& eye) const;
+
+private:
+    /*!
+     * \brief Node of the k-d tree.
+     */
+    struct Node {
+        size_t axis {0};          /*!< Axis orthogonal to the cut. */
+        size_t plane {0};         /*!< First voxel after the cut, along the axis. */
+        int children[2] {-1, -1}; /*!< Nodes below and above the cut, negative for a leaf. */
+        size_t region {0};        /*!< Box of a leaf. */
+    };
+
+    std::vector<Node> m_nodes;          /*!< Root first. */
+    std::vector<VoxelRegion> m_regions; /*!< Boxes, in the order of the leaves. */
+
+    int split(const VoxelRegion& region, const size_t count);
+};
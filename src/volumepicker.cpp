@@ -0,0 +1,221 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "volumepicker.h"
+
+
+/*!
+ * \brief Reciprocal of a float, finite for any input.
+ *
+ * Release builds assume finite math, so rays parallel to an axis get a
+ * large value instead of an infinity.
+ */
+static inline float safe_reciprocal(const float x)
+{
+    constexpr float tiny = 1e-20f;
+    return 1.0f / (std::abs(x) > tiny ? x : std::copysign(tiny, x));
+}
+
+
+/*!
+ * \brief Merge each 2x2x2 cells of a min/max grid.
+ * \param grid Grid to be coarsened.
+ * \return A grid with cells of twice the side, holding the range of their children.
+ */
+static OccupancyGrid coarsened(const OccupancyGrid& grid)
+{
+    const size_t width = (grid.width() + 1) / 2;
+    const size_t height = (grid.height() + 1) / 2;
+    const size_t depth = (grid.depth() + 1) / 2;
+    std::vector<unsigned char> ranges(2 * width * height * depth);
+
+    for (size_t k = 0; k < depth; ++k) {
+        for (size_t j = 0; j < height; ++j) {
+            for (size_t i = 0; i < width; ++i) {
+                unsigned char minimum = 255;
+                unsigned char maximum = 0;
+                for (size_t z = 2 * k; z < std::min(2 * k + 2, grid.depth()); ++z) {
+                    for (size_t y = 2 * j; y < std::min(2 * j + 2, grid.height()); ++y) {
+                        for (size_t x = 2 * i; x < std::min(2 * i + 2, grid.width()); ++x) {
+                            minimum = std::min(minimum, grid.minimum(x, y, z));
+                            maximum = std::max(maximum, grid.maximum(x, y, z));
+                        }
+                    }
+                }
+                const size_t cell = (k * height + j) * width + i;
+                ranges[2 * cell] = minimum;
+                ranges[2 * cell + 1] = maximum;
+            }
+        }
+    }
+
+    return OccupancyGrid(std::move(ranges), width, height, depth, 2 * grid.brick_size());
+}
+
+
+/*!
+ * \brief Create a picker without a volume, missing every ray.
+ */
+VolumePicker::VolumePicker(void)
+{
+}
+
+
+/*!
+ * \brief Create a picker, and build its min/max pyramid.
+ * \param voxels Normalised intensities, shared with the other CPU passes.
+ * \param occupancy Occupancy grid of the volume, the finest level of the pyramid.
+ * \param bottom Bottom corner of the volume box, in world coordinates.
+ * \param top Top corner of the volume box, in world coordinates.
+ * \param range Original intensity range of the volume.
+ */
+VolumePicker::VolumePicker(std::shared_ptr<const BrickedLayout<uint16_t>> voxels, const OccupancyGrid& occupancy,
+                           const QVector3D& bottom, const QVector3D& top, const std::pair<double, double>& range)
+    : m_voxels {std::move(voxels)}
+    , m_bottom {bottom}
+    , m_top {top}
+    , m_size(m_voxels->width(), m_voxels->height(), m_voxels->depth())
+    , m_range {range}
+{
+    m_levels.push_back(occupancy);
+    while (m_levels.back().width() > 1 || m_levels.back().height() > 1 || m_levels.back().depth() > 1) {
+        m_levels.push_back(coarsened(m_levels.back()));
+    }
+}
+
+
+/*!
+ * \brief Intersect a ray with the isosurface.
+ * \param origin Origin of the ray, in world coordinates.
+ * \param direction Direction of the ray, in world coordinates.
+ * \param threshold Normalised intensity of the isosurface.
+ * \return The first intersection in front of the origin, if any.
+ *
+ * The crossing is refined by bisection within the step where the ray
+ * enters the surface, so the hit is far more accurate than the step.
+ */
+std::optional<VolumePicker::Hit> VolumePicker::intersect(const QVector3D& origin, const QVector3D& direction, const float threshold) const
+{
+    if (!m_voxels || m_levels.front().width() == 0) {
+        return std::nullopt;
+    }
+
+    // Slab method for ray-box intersection
+    const QVector3D inverse(safe_reciprocal(direction.x()), safe_reciprocal(direction.y()), safe_reciprocal(direction.z()));
+    const QVector3D t_top = inverse * (m_top - origin);
+    const QVector3D t_bottom = inverse * (m_bottom - origin);
+    const float t_0 = std::max({0.0f, std::min(t_top.x(), t_bottom.x()), std::min(t_top.y(), t_bottom.y()), std::min(t_top.z(), t_bottom.z())});
+    const float t_1 = std::min({std::max(t_top.x(), t_bottom.x()), std::max(t_top.y(), t_bottom.y()), std::max(t_top.z(), t_bottom.z())});
+    if (t_0 >= t_1) {
+        return std::nullopt;
+    }
+
+    // March in grid coordinates, where a voxel has unit side
+    const QVector3D scale = m_size / (m_top - m_bottom);
+    const QVector3D grid_origin = (origin - m_bottom) * scale;
+    const QVector3D grid_direction = direction * scale;
+    const QVector3D grid_inverse(safe_reciprocal(grid_direction.x()), safe_reciprocal(grid_direction.y()), safe_reciprocal(grid_direction.z()));
+    const float speed = grid_direction.length();
+    const float step = ray_step / speed;
+    const float epsilon = 1e-3f / speed;
+
+    float t = t_0;
+    float below = -1.0f; // Last position known to be below the threshold
+    while (t <= t_1) {
+        const QVector3D grid = grid_origin + grid_direction * t;
+
+        const float exit = skip(grid, grid_inverse, threshold);
+        if (exit > 0.0f) {
+            // The exit point is still bounded by the range of the cell
+            below = t + exit;
+            t = below + epsilon;
+            continue;
+        }
+
+        if (sample(grid) > threshold) {
+            float above = t;
+            if (below >= 0.0f) {
+                for (int i = 0; i < refinement_steps; ++i) {
+                    const float middle = 0.5f * (below + above);
+                    (sample(grid_origin + grid_direction * middle) > threshold ? above : below) = middle;
+                }
+            }
+
+            Hit hit;
+            hit.position = origin + direction * above;
+            hit.voxel = grid_origin + grid_direction * above - QVector3D(0.5f, 0.5f, 0.5f);
+            hit.distance = above;
+            hit.intensity = sample(hit.voxel + QVector3D(0.5f, 0.5f, 0.5f));
+            hit.value = m_range.first + hit.intensity * (m_range.second - m_range.first);
+            return hit;
+        }
+
+        below = t;
+        t += step;
+    }
+
+    return std::nullopt;
+}
+
+
+/*!
+ * \brief Normalised intensity at a position, in grid coordinates.
+ */
+float VolumePicker::sample(const QVector3D& grid) const
+{
+    return m_voxels->interpolate(grid.x() - 0.5f, grid.y() - 0.5f, grid.z() - 0.5f) * (1.0f / 65535.0f);
+}
+
+
+/*!
+ * \brief Distance to skip from a position, to leave the coarsest empty cell around it.
+ * \param grid Position, in grid coordinates.
+ * \param inverse Reciprocal of the direction of the ray, in grid coordinates.
+ * \param threshold Normalised intensity of the isosurface.
+ * \return Distance along the ray to the exit of the cell, or 0 if even the
+ *         finest cell may hold the surface.
+ */
+float VolumePicker::skip(const QVector3D& grid, const QVector3D& inverse, const float threshold) const
+{
+    for (auto level = m_levels.rbegin(); level != m_levels.rend(); ++level) {
+        const float side = level->brick_size();
+        const auto cell = [side](const float position, const size_t count) {
+            return std::clamp(std::floor(position / side), 0.0f, count - 1.0f);
+        };
+        const float i = cell(grid.x(), level->width());
+        const float j = cell(grid.y(), level->height());
+        const float k = cell(grid.z(), level->depth());
+        if (level->maximum(i, j, k) > threshold * 255.0f) {
+            continue;
+        }
+
+        const auto exit = [side](const float position, const float index, const float inverse) {
+            const float bound = (inverse > 0.0f ? index + 1.0f : index) * side;
+            return (bound - position) * inverse;
+        };
+        return std::max(std::min({exit(grid.x(), i, inverse.x()), exit(grid.y(), j, inverse.y()), exit(grid.z(), k, inverse.z())}), 0.0f);
+    }
+    return 0.0f;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <QVector3D>
+
+#include "occupancygrid.h"
+#include "voxellayout.h"
+
+/*!
+ * \brief CPU ray queries against the isosurface of a volume.
+ *
+ * Rays are marched over the voxels kept on the host, so picking a point
+ * does not read back the framebuffer nor wait for the GPU. Empty space is
+ * skipped with a pyramid of min/max grids: the first level is the
+ * occupancy grid of the volume, and each further level merges 2x2x2 cells
+ * of the previous one, up to a single cell. A ray leaves at once the
+ * coarsest cell entirely below the threshold, so a query only samples the
+ * neighbourhood of the surface.
+ *
+ * The surface is the one of the isosurface shader: the first position
+ * where the trilinear intensity exceeds the threshold.
+ */
+class VolumePicker
+{
+public:
+    /*!
+     * \brief Intersection of a ray with the isosurface.
+     */
+    struct Hit {
+        QVector3D position;  /*!< In world coordinates, as the volume box. */
+        QVector3D voxel;     /*!< In voxel coordinates, with the first voxel centre at 0. */
+        float distance;      /*!< Along the ray, in multiples of its direction. */
+        float intensity;     /*!< Normalised intensity at the hit, in [0, 1]. */
+        double value;        /*!< Intensity at the hit, in the range of the original volume. */
+    };
+
+    VolumePicker(void);
+    VolumePicker(std::shared_ptr<const BrickedLayout<uint16_t>> voxels, const OccupancyGrid& occupancy,
+                 const QVector3D& bottom, const QVector3D& top, const std::pair<double, double>& range);
+
+    std::optional<Hit> intersect(const QVector3D& origin, const QVector3D& direction, const float threshold) const;
+
+    /*!
+     * \brief Whether a volume is available for queries.
+     */
+    bool empty(void) const {
+        return !m_voxels;
+    }
+
+private:
+    static constexpr float ray_step = 0.5f;  /*!< Step within occupied cells, in voxels. */
+    static constexpr int refinement_steps = 8; /*!< Bisections of the step crossing the surface. */
+
+    std::shared_ptr<const BrickedLayout<uint16_t>> m_voxels; /*!< Normalised intensities. */
+    std::vector<OccupancyGrid> m_levels;   /*!< Min/max grids, from the finest. */
+    QVector3D m_bottom;                    /*!< Bottom corner of the volume box. */
+    QVector3D m_top;                       /*!< Top corner of the volume box. */
+    QVector3D m_size;                      /*!< Number of voxels for each axis. */
+    std::pair<double, double> m_range;     /*!< Original intensity range. */
+
+    float sample(const QVector3D& grid) const;
+    float skip(const QVector3D& grid, const QVector3D& inverse, const float threshold) const;
+};
@@ -0,0 +1,551 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+#include "voxellayout.h"
+
+#ifdef _MSC_VER
+#include <stdlib.h>
+#endif
+
+/*
+ * Fused per-voxel kernels used when loading volumes.
+ *
+ * Each kernel visits the volume once, in parallel over z-slabs, and the inner
+ * loop over a slab is written to be vectorised by the compiler: byte swaps
+ * compile to SIMD byte shuffles and the normalisation to packed float math.
+ */
+
+
+/*!
+ * \brief Unsigned integer type with the same size as `T`.
+ */
+template<typename T>
+using same_size_uint_t =
+    std::conditional_t<sizeof (T) == 1, uint8_t,
+    std::conditional_t<sizeof (T) == 2, uint16_t,
+    std::conditional_t<sizeof (T) == 4, uint32_t, uint64_t>>>;
+
+
+/*!
+ * \brief Invert the byte order of an unsigned integer.
+ */
+static inline uint8_t byte_swap(uint8_t x) { return x; }
+#ifdef _MSC_VER
+static inline uint16_t byte_swap(uint16_t x) { return _byteswap_ushort(x); }
+static inline uint32_t byte_swap(uint32_t x) { return _byteswap_ulong(x); }
+static inline uint64_t byte_swap(uint64_t x) { return _byteswap_uint64(x); }
+#else
+static inline uint16_t byte_swap(uint16_t x) { return __builtin_bswap16(x); }
+static inline uint32_t byte_swap(uint32_t x) { return __builtin_bswap32(x); }
+static inline uint64_t byte_swap(uint64_t x) { return __builtin_bswap64(x); }
+#endif
+
+
+/*!
+ * \brief Half precision float, stored as its bit pattern.
+ */
+struct half_t
+{
+    uint16_t bits;
+};
+
+
+/*!
+ * \brief Convert a float to half precision, rounding to nearest even.
+ *
+ * Values too small for a normal half are flushed to zero, and values too
+ * large are converted to infinity.
+ */
+static inline half_t float_to_half(const float value)
+{
+    uint32_t x;
+    std::memcpy(&x, &value, sizeof (x));
+
+    const uint16_t sign = (x >> 16) & 0x8000;
+    const int32_t exponent = static_cast<int32_t>((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = x & 0x7fffff;
+
+    if (exponent <= 0) {
+        return {sign};
+    }
+    if (exponent >= 31) {
+        return {static_cast<uint16_t>(sign | 0x7c00)};
+    }
+
+    // Round to nearest even, the carry propagates into the exponent
+    mantissa += 0xfff + ((mantissa >> 13) & 1);
+    return {static_cast<uint16_t>(sign | ((static_cast<uint32_t>(exponent) << 10) + (mantissa >> 13)))};
+}
+
+
+/*!
+ * \brief Convert a half precision float to float.
+ *
+ * Subnormal halves are flushed to zero.
+ */
+static inline float half_to_float(const half_t value)
+{
+    const uint32_t sign = static_cast<uint32_t>(value.bits & 0x8000) << 16;
+    const uint32_t exponent = (value.bits >> 10) & 0x1f;
+    const uint32_t mantissa = value.bits & 0x3ff;
+
+    uint32_t x = sign;
+    if (exponent == 31) {
+        x |= 0x7f800000 | (mantissa << 13);
+    }
+    else if (exponent > 0) {
+        x |= ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+
+    float result;
+    std::memcpy(&result, &x, sizeof (result));
+    return result;
+}
+
+
+/*!
+ * \brief Largest value of a normalised voxel of type `U`, representing 1.
+ */
+template<typename U>
+constexpr float unit_scale(void)
+{
+    if constexpr (std::is_integral_v<U>) {
+        return static_cast<float>(std::numeric_limits<U>::max());
+    }
+    else {
+        return 1.0f;
+    }
+}
+
+
+/*!
+ * \brief Store a normalised value in a voxel of type `U`.
+ * \param value Value, in [0, unit_scale<U>()].
+ */
+template<typename U>
+static inline U store_unit(const float value)
+{
+    if constexpr (std::is_same_v<U, half_t>) {
+        return float_to_half(value);
+    }
+    else {
+        return static_cast<U>(value);
+    }
+}
+
+
+/*!
+ * \brief Value of a normalised voxel, in [0, 1].
+ */
+static inline float to_unit(const uint8_t v) { return v * (1.0f / 255.0f); }
+static inline float to_unit(const uint16_t v) { return v * (1.0f / 65535.0f); }
+static inline float to_unit(const float v) { return v; }
+static inline float to_unit(const half_t v) { return half_to_float(v); }
+
+
+/*!
+ * \brief Load a voxel of type `T` from an unaligned address.
+ * \param p Pointer to the first byte of the voxel.
+ * \return The voxel value, with its byte order inverted if `Swap` is set.
+ */
+template<typename T, bool Swap>
+static inline T load_voxel(const unsigned char *p)
+{
+    if constexpr (Swap && sizeof (T) > 1) {
+        same_size_uint_t<T> bits;
+        std::memcpy(&bits, p, sizeof (T));
+        bits = byte_swap(bits);
+        T value;
+        std::memcpy(&value, &bits, sizeof (T));
+        return value;
+    }
+    else {
+        T value;
+        std::memcpy(&value, p, sizeof (T));
+        return value;
+    }
+}
+
+
+/*!
+ * \brief Find the range of a volume.
+ * \param src Pointer to the first byte of the volume data, of type `T`.
+ * \param slab_size Number of voxels in each slab.
+ * \param slab_count Number of slabs.
+ * \return A pair, holding <minimum, maximum>.
+ *
+ * Each thread reduces the range over its slabs, and the partial results are
+ * merged at the end.
+ */
+template<typename T, bool Swap>
+std::pair<double, double> range_kernel(const unsigned char *src, const size_t slab_size, const size_t slab_count)
+{
+    T minimum = std::numeric_limits<T>::max();
+    T maximum = std::numeric_limits<T>::lowest();
+
+    #pragma omp parallel
+    {
+        T local_minimum = std::numeric_limits<T>::max();
+        T local_maximum = std::numeric_limits<T>::lowest();
+
+        #pragma omp for schedule(static)
+        for (std::ptrdiff_t z = 0; z < static_cast<std::ptrdiff_t>(slab_count); ++z) {
+            const unsigned char *slab = src + static_cast<size_t>(z) * slab_size * sizeof (T);
+            T slab_minimum = local_minimum;
+            T slab_maximum = local_maximum;
+
+            #pragma omp simd reduction(min:slab_minimum) reduction(max:slab_maximum)
+            for (size_t i = 0; i < slab_size; ++i) {
+                const T voxel = load_voxel<T, Swap>(slab + i * sizeof (T));
+                slab_minimum = std::min(slab_minimum, voxel);
+                slab_maximum = std::max(slab_maximum, voxel);
+            }
+
+            local_minimum = slab_minimum;
+            local_maximum = slab_maximum;
+        }
+
+        #pragma omp critical
+        {
+            minimum = std::min(minimum, local_minimum);
+            maximum = std::max(maximum, local_maximum);
+        }
+    }
+
+    return {static_cast<double>(minimum), static_cast<double>(maximum)};
+}
+
+
+/*!
+ * \brief Cast a volume to `U`, normalising its range to [0, unit_scale<U>()].
+ * \param src Pointer to the first byte of the volume data, of type `T`.
+ * \param range Range of the input data.
+ * \param dst Output buffer, holding `slab_size * slab_count` elements.
+ * \param slab_size Number of voxels in each slab.
+ * \param slab_count Number of slabs.
+ *
+ * Integer outputs span their whole range (e.g. [0, 255] for `uint8_t`), while
+ * floating point outputs are normalised to [0, 1].
+ */
+template<typename T, bool Swap, typename U = uint8_t>
+void normalise_kernel(const unsigned char *src, const std::pair<double, double>& range, U *dst, const size_t slab_size, const size_t slab_count)
+{
+    const double width = range.second - range.first;
+    const float scale = width > 0.0 ? static_cast<float>(unit_scale<U>() / width) : 0.0f;
+    const float offset = static_cast<float>(range.first);
+
+    #pragma omp parallel for schedule(static)
+    for (std::ptrdiff_t z = 0; z < static_cast<std::ptrdiff_t>(slab_count); ++z) {
+        const unsigned char *slab = src + static_cast<size_t>(z) * slab_size * sizeof (T);
+        U *out = dst + static_cast<size_t>(z) * slab_size;
+
+        #pragma omp simd
+        for (size_t i = 0; i < slab_size; ++i) {
+            const float voxel = static_cast<float>(load_voxel<T, Swap>(slab + i * sizeof (T)));
+            out[i] = store_unit<U>(std::min(std::max((voxel - offset) * scale, 0.0f), unit_scale<U>()));
+        }
+    }
+}
+
+
+/*!
+ * \brief Normalise a volume like `normalise_kernel`, into Z-ordered bricks.
+ * \param src Pointer to the first byte of the volume data, of type `T`.
+ * \param range Range of the input data.
+ * \param dst Output layout, already allocated to the size of the volume.
+ * \param first_slice First slice held by `src`, the other slices of `dst` are left untouched.
+ * \param slices Number of slices held by `src`.
+ *
+ * Each source row is read once, and scattered within the bricks it crosses.
+ */
+template<typename T, bool Swap, typename U>
+void bricked_normalise_kernel(const unsigned char *src, const std::pair<double, double>& range, BrickedLayout<U>& dst,
+                              const size_t first_slice = 0, const size_t slices = std::numeric_limits<size_t>::max())
+{
+    const double width = range.second - range.first;
+    const float scale = width > 0.0 ? static_cast<float>(unit_scale<U>() / width) : 0.0f;
+    const float offset = static_cast<float>(range.first);
+    const size_t row_size = dst.width();
+    const size_t height = dst.height();
+
+    dst.for_each_row(first_slice, std::min(slices, dst.depth() - first_slice), [&](const size_t y, const size_t z, U *row) {
+        const unsigned char *in = src + ((z - first_slice) * height + y) * row_size * sizeof (T);
+        for (size_t x = 0; x < row_size; ++x) {
+            const float voxel = static_cast<float>(load_voxel<T, Swap>(in + x * sizeof (T)));
+            row[dst.offset_x(x)] = store_unit<U>(std::min(std::max((voxel - offset) * scale, 0.0f), unit_scale<U>()));
+        }
+    });
+}
+
+
+/*!
+ * \brief Normalise a box of a volume like `normalise_kernel`, into a linear buffer.
+ * \param src Pointer to the first byte of the slices held, of type `T`.
+ * \param range Range of the input data.
+ * \param dst Output buffer, holding one element per voxel of the box.
+ * \param width Number of voxels of the volume along x.
+ * \param height Number of voxels of the volume along y.
+ * \param region Box to be normalised, inside the volume.
+ * \param first_slice First slice held by `src`, the other slices of the box are left untouched.
+ * \param slices Number of slices held by `src`.
+ *
+ * Only the rows of the box are read from the source.
+ */
+template<typename T, bool Swap, typename U>
+void region_normalise_kernel(const unsigned char *src, const std::pair<double, double>& range, U *dst,
+                             const size_t width, const size_t height, const VoxelRegion& region,
+                             const size_t first_slice = 0, const size_t slices = std::numeric_limits<size_t>::max())
+{
+    const double range_width = range.second - range.first;
+    const float scale = range_width > 0.0 ? static_cast<float>(unit_scale<U>() / range_width) : 0.0f;
+    const float offset = static_cast<float>(range.first);
+
+    // Slices of the box held by the source
+    const size_t region_end = region.offset[2] + region.size[2];
+    const size_t z_begin = std::max(region.offset[2], first_slice);
+    const size_t z_end = slices < region_end - std::min(first_slice, region_end) ? first_slice + slices : region_end;
+    if (z_begin >= z_end) {
+        return;
+    }
+
+    const size_t rows = (z_end - z_begin) * region.size[1];
+    #pragma omp parallel for schedule(static)
+    for (std::ptrdiff_t r = 0; r < static_cast<std::ptrdiff_t>(rows); ++r) {
+        const size_t z = z_begin + static_cast<size_t>(r) / region.size[1];
+        const size_t y = region.offset[1] + static_cast<size_t>(r) % region.size[1];
+        const unsigned char *in = src + (((z - first_slice) * height + y) * width + region.offset[0]) * sizeof (T);
+        U *out = dst + ((z - region.offset[2]) * region.size[1] + (y - region.offset[1])) * region.size[0];
+
+        #pragma omp simd
+        for (size_t x = 0; x < region.size[0]; ++x) {
+            const float voxel = static_cast<float>(load_voxel<T, Swap>(in + x * sizeof (T)));
+            out[x] = store_unit<U>(std::min(std::max((voxel - offset) * scale, 0.0f), unit_scale<U>()));
+        }
+    }
+}
+
+
+/*!
+ * \brief Cast a cubic region of a volume to `unsigned char`, normalising its range to [0,255].
+ * \param src Pointer to the first byte of the volume data, of type `T`.
+ * \param range Range of the input data.
+ * \param dst Output buffer, holding `side * side * side` elements.
+ * \param width Number of voxels of the volume along x.
+ * \param height Number of voxels of the volume along y.
+ * \param depth Number of voxels of the volume along z.
+ * \param x0 First voxel of the region along x.
+ * \param y0 First voxel of the region along y.
+ * \param z0 First voxel of the region along z.
+ * \param side Number of voxels for each side of the region.
+ *
+ * The region may extend beyond the volume, in which case the values at the
+ * border are replicated. This kernel is meant to be called concurrently for
+ * different regions, so it is not parallel itself.
+ */
+template<typename T, bool Swap>
+void brick_kernel(const unsigned char *src, const std::pair<double, double>& range, unsigned char *dst,
+                  const size_t width, const size_t height, const size_t depth,
+                  const std::ptrdiff_t x0, const std::ptrdiff_t y0, const std::ptrdiff_t z0, const size_t side)
+{
+    const double extent = range.second - range.first;
+    const float scale = extent > 0.0 ? static_cast<float>(255.0 / extent) : 0.0f;
+    const float offset = static_cast<float>(range.first);
+
+    const auto clamp = [](const std::ptrdiff_t i, const size_t n) {
+        return static_cast<size_t>(std::min<std::ptrdiff_t>(std::max<std::ptrdiff_t>(i, 0), n - 1));
+    };
+
+    for (size_t z = 0; z < side; ++z) {
+        for (size_t y = 0; y < side; ++y) {
+            const size_t row = clamp(z0 + z, depth) * height + clamp(y0 + y, height);
+            const unsigned char *in = src + row * width * sizeof (T);
+            unsigned char *out = dst + (z * side + y) * side;
+
+            for (size_t x = 0; x < side; ++x) {
+                const float voxel = static_cast<float>(load_voxel<T, Swap>(in + clamp(x0 + x, width) * sizeof (T)));
+                out[x] = static_cast<unsigned char>(std::min(std::max((voxel - offset) * scale, 0.0f), 255.0f));
+            }
+        }
+    }
+}
+
+
+/*!
+ * \brief Copy a volume, inverting the byte order of each voxel if `Swap` is set.
+ * \param src Pointer to the first byte of the volume data, of type `T`.
+ * \param dst Output buffer, holding `slab_size * slab_count * sizeof (T)` bytes.
+ * \param slab_size Number of voxels in each slab.
+ * \param slab_count Number of slabs.
+ */
+template<typename T, bool Swap>
+void copy_kernel(const unsigned char *src, unsigned char *dst, const size_t slab_size, const size_t slab_count)
+{
+    #pragma omp parallel for schedule(static)
+    for (std::ptrdiff_t z = 0; z < static_cast<std::ptrdiff_t>(slab_count); ++z) {
+        const size_t offset = static_cast<size_t>(z) * slab_size * sizeof (T);
+
+        #pragma omp simd
+        for (size_t i = 0; i < slab_size; ++i) {
+            const T voxel = load_voxel<T, Swap>(src + offset + i * sizeof (T));
+            std::memcpy(dst + offset + i * sizeof (T), &voxel, sizeof (T));
+        }
+    }
+}
+
+
+/*!
+ * \brief Compute the gradient of a volume with central differences.
+ * \param src Voxels of the volume, normalised.
+ * \param dst Output buffer, holding four bytes for each voxel.
+ * \param width Number of voxels along x.
+ * \param height Number of voxels along y.
+ * \param depth Number of voxels along z.
+ *
+ * The gradient is taken with respect to texture coordinates, and its
+ * direction is encoded in the RGB channels as `0.5 + 0.5 * n`, where `n` is
+ * the unit gradient. The alpha channel holds the gradient magnitude, in
+ * voxel units, relative to the largest magnitude of a normalised volume.
+ * One-sided differences are used at the borders.
+ */
+template<typename T>
+void gradient_kernel(const T *src, unsigned char *dst, const size_t width, const size_t height, const size_t depth)
+{
+    const float max_magnitude = 0.5f * std::sqrt(3.0f);
+
+    #pragma omp parallel for schedule(static)
+    for (std::ptrdiff_t z = 0; z < static_cast<std::ptrdiff_t>(depth); ++z) {
+        const size_t z0 = z > 0 ? z - 1 : 0;
+        const size_t z1 = std::min<size_t>(z + 1, depth - 1);
+
+        for (size_t y = 0; y < height; ++y) {
+            const size_t y0 = y > 0 ? y - 1 : 0;
+            const size_t y1 = std::min(y + 1, height - 1);
+
+            const T *row = src + (z * height + y) * width;
+            const T *row_y0 = src + (z * height + y0) * width;
+            const T *row_y1 = src + (z * height + y1) * width;
+            const T *row_z0 = src + (z0 * height + y) * width;
+            const T *row_z1 = src + (z1 * height + y) * width;
+            unsigned char *out = dst + 4 * (z * height + y) * width;
+
+            for (size_t x = 0; x < width; ++x) {
+                const size_t x0 = x > 0 ? x - 1 : 0;
+                const size_t x1 = std::min(x + 1, width - 1);
+
+                // Differences in voxel units
+                const float gx = (to_unit(row[x1]) - to_unit(row[x0])) / std::max<size_t>(x1 - x0, 1);
+                const float gy = (to_unit(row_y1[x]) - to_unit(row_y0[x])) / std::max<size_t>(y1 - y0, 1);
+                const float gz = (to_unit(row_z1[x]) - to_unit(row_z0[x])) / std::max<size_t>(z1 - z0, 1);
+                const float magnitude = std::sqrt(gx * gx + gy * gy + gz * gz);
+
+                // Direction in texture coordinates
+                const float tx = gx * width;
+                const float ty = gy * height;
+                const float tz = gz * depth;
+                const float norm = std::sqrt(tx * tx + ty * ty + tz * tz);
+                const float inv = norm > 0.0f ? 0.5f / norm : 0.0f;
+
+                out[4 * x + 0] = static_cast<unsigned char>(255.0f * (0.5f + tx * inv) + 0.5f);
+                out[4 * x + 1] = static_cast<unsigned char>(255.0f * (0.5f + ty * inv) + 0.5f);
+                out[4 * x + 2] = static_cast<unsigned char>(255.0f * (0.5f + tz * inv) + 0.5f);
+                out[4 * x + 3] = static_cast<unsigned char>(std::min(255.0f * magnitude / max_magnitude, 255.0f));
+            }
+        }
+    }
+}
+
+
+/*!
+ * \brief Compress the slices of a volume in RGTC1 (BC4) blocks.
+ * \param src Voxels of the volume.
+ * \param dst Output buffer, holding `8 * ceil(width / 4) * ceil(height / 4)` bytes per slice.
+ * \param width Number of voxels along x.
+ * \param height Number of voxels along y.
+ * \param depth Number of voxels along z.
+ * \return Sum of the squared errors of the compressed voxels.
+ *
+ * Each block of 4x4 voxels of a slice is encoded with its minimum and
+ * maximum as end points, and six intermediate levels between them. Blocks
+ * crossing the border of a slice replicate its last row and column.
+ */
+static inline double rgtc1_kernel(const unsigned char *src, unsigned char *dst, const size_t width, const size_t height, const size_t depth)
+{
+    const size_t blocks_x = (width + 3) / 4;
+    const size_t blocks_y = (height + 3) / 4;
+    double error = 0.0;
+
+    #pragma omp parallel for schedule(static) reduction(+:error)
+    for (std::ptrdiff_t z = 0; z < static_cast<std::ptrdiff_t>(depth); ++z) {
+        const unsigned char *slice = src + z * width * height;
+        unsigned char *out = dst + 8 * z * blocks_x * blocks_y;
+
+        for (size_t by = 0; by < blocks_y; ++by) {
+            for (size_t bx = 0; bx < blocks_x; ++bx, out += 8) {
+                unsigned char block[16];
+                for (size_t i = 0; i < 16; ++i) {
+                    const size_t x = std::min(4 * bx + i % 4, width - 1);
+                    const size_t y = std::min(4 * by + i / 4, height - 1);
+                    block[i] = slice[y * width + x];
+                }
+                const auto [lo, hi] = std::minmax_element(block, block + 16);
+
+                // With red_0 > red_1 the palette is red_0, red_1, and six
+                // levels from red_0 to red_1; equal end points use index 0 only
+                const int red_0 = *hi;
+                const int red_1 = *lo;
+                uint64_t indices = 0;
+                for (size_t i = 0; i < 16; ++i) {
+                    int level = 0;  // Steps from red_1 towards red_0, in sevenths
+                    if (red_0 > red_1) {
+                        level = (14 * (block[i] - red_1) + (red_0 - red_1)) / (2 * (red_0 - red_1));
+                    }
+                    const uint64_t index = 7 == level ? 0 : 0 == level ? 1 : 8 - level;
+                    indices |= index << (3 * i);
+
+                    const int decoded = red_0 > red_1 ? (level * red_0 + (7 - level) * red_1) / 7 : red_0;
+                    if (4 * bx + i % 4 < width && 4 * by + i / 4 < height) {
+                        error += (decoded - block[i]) * (decoded - block[i]);
+                    }
+                }
+
+                out[0] = static_cast<unsigned char>(red_0);
+                out[1] = static_cast<unsigned char>(red_1);
+                for (size_t b = 0; b < 6; ++b) {
+                    out[2 + b] = static_cast<unsigned char>(indices >> (8 * b));
+                }
+            }
+        }
+    }
+
+    return error;
+}
@@ -0,0 +1,334 @@
+/*
+ * Copyright © 2018 Martino Pilia <martino.pilia@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+/*!
+ * \brief Box of voxels within a volume.
+ */
+struct VoxelRegion {
+    std::array<size_t, 3> offset {}; /*!< First voxel along each axis. */
+    std::array<size_t, 3> size {};   /*!< Number of voxels along each axis. */
+
+    /*!
+     * \brief The region grown by a margin on each side, within the bounds of a volume.
+     * \param margin Voxels added on each side.
+     * \param bounds Number of voxels of the volume along each axis.
+     */
+    VoxelRegion grown(const size_t margin, const std::array<size_t, 3>& bounds) const {
+        VoxelRegion region;
+        for (size_t axis = 0; axis < 3; ++axis) {
+            const size_t first = offset[axis] > margin ? offset[axis] - margin : 0;
+            const size_t last = std::min(offset[axis] + size[axis] + margin, bounds[axis]);
+            region.offset[axis] = first;
+            region.size[axis] = last - first;
+        }
+        return region;
+    }
+};
+
+
+/*!
+ * \brief Voxels stored in cubic bricks, each brick in Z order (Morton order).
+ *
+ * Voxels close in space along any axis are close in memory, so trilinear
+ * samples and neighbourhood passes touch a few cache lines instead of a few
+ * slices. The offset of a voxel is separable: it is the sum of a term for
+ * each coordinate, looked up in a table per axis, so an access costs three
+ * loads and two additions.
+ *
+ * Bricks are ordered with x varying fastest. Bricks at the border are
+ * padded to the whole brick side, and the padding is never accessed.
+ */
+template<typename T>
+class BrickedLayout {
+
+public:
+
+    static constexpr size_t brick_bits = 3;                 /*!< Log2 of the side of each brick. */
+    static constexpr size_t brick_side = 1 << brick_bits;   /*!< Side of each brick, in voxels. */
+    static constexpr size_t brick_voxels = brick_side * brick_side * brick_side; /*!< Voxels in each brick. */
+
+    /*!
+     * \brief Create an empty layout.
+     */
+    BrickedLayout(void) = default;
+
+    /*!
+     * \brief Allocate a layout, filled with zeros.
+     * \param width Number of voxels along x.
+     * \param height Number of voxels along y.
+     * \param depth Number of voxels along z.
+     */
+    BrickedLayout(const size_t width, const size_t height, const size_t depth)
+        : m_width {width}
+        , m_height {height}
+        , m_depth {depth}
+    {
+        const size_t bricks_x = (width + brick_side - 1) / brick_side;
+        const size_t bricks_y = (height + brick_side - 1) / brick_side;
+        const size_t bricks_z = (depth + brick_side - 1) / brick_side;
+        m_data.resize(bricks_x * bricks_y * bricks_z * brick_voxels);
+
+        // Bits of the coordinate within the brick are interleaved with the other axes
+        const auto axis_offsets = [](const size_t count, const size_t brick_stride, const size_t shift) {
+            std::vector<size_t> offsets(count);
+            for (size_t i = 0; i < count; ++i) {
+                size_t spread = 0;
+                for (size_t bit = 0; bit < brick_bits; ++bit) {
+                    spread |= ((i >> bit) & 1) << (3 * bit + shift);
+                }
+                offsets[i] = (i >> brick_bits) * brick_stride * brick_voxels + spread;
+            }
+            return offsets;
+        };
+        m_offset_x = axis_offsets(width, 1, 0);
+        m_offset_y = axis_offsets(height, bricks_x, 1);
+        m_offset_z = axis_offsets(depth, bricks_x * bricks_y, 2);
+    }
+
+    /*!
+     * \brief Copy a volume stored in the linear order.
+     * \param linear Voxels, with x varying fastest, then y, then z.
+     * \param width Number of voxels along x.
+     * \param height Number of voxels along y.
+     * \param depth Number of voxels along z.
+     * \param convert Function converting a voxel of the source to `T`.
+     */
+    template<typename U, typename F>
+    BrickedLayout(const U *linear, const size_t width, const size_t height, const size_t depth, F&& convert)
+        : BrickedLayout(linear, width, height, VoxelRegion {{0, 0, 0}, {width, height, depth}}, convert)
+    {
+    }
+
+    /*!
+     * \brief Copy a region of a volume stored in the linear order.
+     * \param linear Voxels, with x varying fastest, then y, then z.
+     * \param width Number of voxels of the volume along x.
+     * \param height Number of voxels of the volume along y.
+     * \param region Region to be copied, inside the volume.
+     * \param convert Function converting a voxel of the source to `T`.
+     *
+     * Only the rows of the region are read, so a mapped volume is paged in
+     * only where the region lies.
+     */
+    template<typename U, typename F>
+    BrickedLayout(const U *linear, const size_t width, const size_t height, const VoxelRegion& region, F&& convert)
+        : BrickedLayout(region.size[0], region.size[1], region.size[2])
+    {
+        const auto [x0, y0, z0] = region.offset;
+        for_each_row([&](const size_t y, const size_t z, T *row) {
+            const U *src = linear + ((z + z0) * height + y + y0) * width + x0;
+            for (size_t x = 0; x < m_width; ++x) {
+                row[m_offset_x[x]] = convert(src[x]);
+            }
+        });
+    }
+
+    /*!
+     * \brief Write the volume in the linear order.
+     * \param linear Output buffer, holding `width * height * depth` voxels.
+     *
+     * Rows are visited one row of bricks at a time, so the bricks being read
+     * stay in cache while each of their rows is written.
+     */
+    void to_linear(T *linear) const
+    {
+        for_each_row([&](const size_t y, const size_t z, const T *row) {
+            T *dst = linear + (z * m_height + y) * m_width;
+            for (size_t x = 0; x < m_width; ++x) {
+                dst[x] = row[m_offset_x[x]];
+            }
+        });
+    }
+
+    /*!
+     * \brief Call a function on each row of voxels, in parallel.
+     * \param f Function taking `(y, z, row)`, where `row[offset_x(x)]` is
+     *          the voxel at `(x, y, z)`.
+     *
+     * The rows of each row of bricks are visited together, by the same
+     * thread, so each brick is loaded in cache once.
+     */
+    template<typename F>
+    void for_each_row(F&& f) {
+        visit_rows(m_data.data(), f, 0, m_depth);
+    }
+
+    /*!
+     * \brief Call a function on each row of voxels of some slices, in parallel.
+     * \param first_slice First slice visited.
+     * \param slices Number of slices visited.
+     * \param f Function taking `(y, z, row)`, as for `for_each_row`.
+     *
+     * Only the rows of bricks crossing the slices are visited, so a volume
+     * can be filled one slab at a time.
+     */
+    template<typename F>
+    void for_each_row(const size_t first_slice, const size_t slices, F&& f) {
+        const size_t begin = std::min(first_slice, m_depth);
+        visit_rows(m_data.data(), f, begin, begin + std::min(slices, m_depth - begin));
+    }
+
+    /*!
+     * \brief Call a function on each row of voxels, in parallel, read only.
+     */
+    template<typename F>
+    void for_each_row(F&& f) const {
+        visit_rows(m_data.data(), f, 0, m_depth);
+    }
+
+    /*!
+     * \brief Offset of a voxel within the storage.
+     */
+    size_t index(const size_t x, const size_t y, const size_t z) const {
+        return m_offset_x[x] + m_offset_y[y] + m_offset_z[z];
+    }
+
+    /*!
+     * \brief First voxel of the storage, see `index`.
+     */
+    const T * data(void) const {
+        return m_data.data();
+    }
+
+    /*!
+     * \brief Offset term of an x coordinate, within a row.
+     */
+    size_t offset_x(const size_t x) const {
+        return m_offset_x[x];
+    }
+
+    /*!
+     * \brief Voxel at integer coordinates, inside the volume.
+     */
+    T operator()(const size_t x, const size_t y, const size_t z) const {
+        return m_data[index(x, y, z)];
+    }
+
+    /*!
+     * \brief Trilinear interpolation of the voxels, clamped to the volume.
+     * \param x Position along x, in voxels (the first voxel is at 0).
+     * \param y Position along y, in voxels.
+     * \param z Position along z, in voxels.
+     *
+     * Positions outside the volume take the value at its border, as a
+     * texture with clamped edges.
+     */
+    float interpolate(float x, float y, float z) const
+    {
+        x = std::clamp(x, 0.0f, m_width - 1.0f);
+        y = std::clamp(y, 0.0f, m_height - 1.0f);
+        z = std::clamp(z, 0.0f, m_depth - 1.0f);
+        const size_t x0 = static_cast<size_t>(x);
+        const size_t y0 = static_cast<size_t>(y);
+        const size_t z0 = static_cast<size_t>(z);
+        const size_t x1 = std::min(x0 + 1, m_width - 1);
+        const size_t y1 = std::min(y0 + 1, m_height - 1);
+        const size_t z1 = std::min(z0 + 1, m_depth - 1);
+        const float fx = x - x0;
+        const float fy = y - y0;
+        const float fz = z - z0;
+
+        const auto lerp = [](const float a, const float b, const float t) { return a + t * (b - a); };
+        const T *slice0 = m_data.data() + m_offset_z[z0];
+        const T *slice1 = m_data.data() + m_offset_z[z1];
+        const float c00 = lerp(slice0[m_offset_y[y0] + m_offset_x[x0]], slice0[m_offset_y[y0] + m_offset_x[x1]], fx);
+        const float c10 = lerp(slice0[m_offset_y[y1] + m_offset_x[x0]], slice0[m_offset_y[y1] + m_offset_x[x1]], fx);
+        const float c01 = lerp(slice1[m_offset_y[y0] + m_offset_x[x0]], slice1[m_offset_y[y0] + m_offset_x[x1]], fx);
+        const float c11 = lerp(slice1[m_offset_y[y1] + m_offset_x[x0]], slice1[m_offset_y[y1] + m_offset_x[x1]], fx);
+        return lerp(lerp(c00, c10, fy), lerp(c01, c11, fy), fz);
+    }
+
+    /*!
+     * \brief Mutable voxel at integer coordinates, inside the volume.
+     */
+    T& at(const size_t x, const size_t y, const size_t z) {
+        return m_data[index(x, y, z)];
+    }
+
+    /*!
+     * \brief Number of voxels along x.
+     */
+    size_t width(void) const {
+        return m_width;
+    }
+
+    /*!
+     * \brief Number of voxels along y.
+     */
+    size_t height(void) const {
+        return m_height;
+    }
+
+    /*!
+     * \brief Number of voxels along z.
+     */
+    size_t depth(void) const {
+        return m_depth;
+    }
+
+    /*!
+     * \brief Whether the layout holds no voxels.
+     */
+    bool empty(void) const {
+        return m_data.empty();
+    }
+
+private:
+    /*!
+     * \brief Visit the rows of the slices in [z_begin, z_end), see `for_each_row`.
+     */
+    template<typename P, typename F>
+    void visit_rows(P *data, F& f, const size_t z_begin, const size_t z_end) const
+    {
+        const size_t bricks_y = (m_height + brick_side - 1) / brick_side;
+        const size_t first_brick_z = z_begin / brick_side;
+        const size_t bricks_z = z_end > z_begin ? (z_end + brick_side - 1) / brick_side - first_brick_z : 0;
+
+        #pragma omp parallel for schedule(static)
+        for (std::ptrdiff_t b = 0; b < static_cast<std::ptrdiff_t>(bricks_y * bricks_z); ++b) {
+            const size_t y0 = b % bricks_y * brick_side;
+            const size_t z0 = (first_brick_z + b / bricks_y) * brick_side;
+            for (size_t z = std::max(z0, z_begin); z < std::min(z0 + brick_side, z_end); ++z) {
+                for (size_t y = y0; y < std::min(y0 + brick_side, m_height); ++y) {
+                    f(y, z, data + m_offset_z[z] + m_offset_y[y]);
+                }
+            }
+        }
+    }
+
+    size_t m_width {0};               /*!< Number of voxels along x. */
+    size_t m_height {0};              /*!< Number of voxels along y. */
+    size_t m_depth {0};               /*!< Number of voxels along z. */
+    std::vector<T> m_data;            /*!< Bricks, padded to the whole brick side. */
+    std::vector<size_t> m_offset_x;   /*!< Offset term of each x coordinate. */
+    std::vector<size_t> m_offset_y;   /*!< Offset term of each y coordinate. */
+    std::vector<size_t> m_offset_z;   /*!< Offset term of each z coordinate. */
+};
@@ -23,10 +23,8 @@
 #include <iostream>
 #include <fstream>
 #include <cstdio>
-#include <cstring>
 #include <vector>
 #include <string>
-#include <limits.h>
 
 #include "vtkvolume.h"
 
@@ -57,37 +55,6 @@ VTKVolume::~VTKVolume()
 }
 
 
-/*!
- * \brief Check whether the architecture is little endian.
- * \return `true` if little endian, `false` if big endian.
- */
-static bool is_little_endian()
-{
-    union {
-        unsigned long l;
-        unsigned char c[sizeof(unsigned long)];
-    } x;
-    x.l = 1;
-    return x.c[0] == 1;
-}
-
-
-/*!
- * \brief Invert the endianness of the input value.
- * \param p Pointer to the first byte of an input value of size `N`.
- */
-template<size_t N>
-void swap_byte_order(unsigned char* p)
-{
-    unsigned char tmp;
-    for (size_t i = 0; i < N / 2; ++i) {
-        tmp = p[i];
-        p[i] = p[N-i-1];
-        p[N-i-1] = tmp;
-    }
-}
-
-
 /*!
  * \brief Check if a VTK file is binary.
  * \param header Header lines of the file.
@@ -107,74 +74,6 @@ static bool is_binary(const std::vector<std::string> &header)
 }
 
 
-/*!
- * \brief Read VTK data from file.
- * \param file Stream from the open file.
- * \param image_data Array of `unisgned char` to store the resulting data of type `T`.
- * \param binary Whether the VTK file is binary.
- * \param element_count Number of elements to read.
- * \return The range of the read data.
- */
-template<typename T>
-static void read_data(std::ifstream& file, const bool binary, const size_t element_count, std::vector<unsigned char>& image_data, std::pair<double, double>& range) {
-
-    std::vector<T> data;
-    data.resize(element_count);
-
-    if (binary) {
-        file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(sizeof (T) * element_count));
-        if (is_little_endian() && sizeof (T) > 1) {
-            for (size_t i = 0; i < element_count; ++i) {
-                swap_byte_order<sizeof (T)>(reinterpret_cast<unsigned char*>(data.data() + i));
-            }
-        }
-    }
-    else {
-        T voxel;
-        for (size_t i = 0; i < element_count; ++i) {
-            file >> voxel;
-            data.push_back(voxel);
-        }
-    }
-
-    // Find range
-    range = {std::numeric_limits<double>::max(), std::numeric_limits<double>::min()};
-    for (size_t i = 0; i < element_count; ++i) {
-        if (data[i] > range.second) {
-            range.second = data[i];
-        }
-        if (data[i] < range.first) {
-            range.first = data[i];
-        }
-    }
-
-    size_t size = data.size() * sizeof (data[0]);
-    image_data.clear();
-    image_data.resize(size);
-    std::memcpy(image_data.data(), reinterpret_cast<char*>(data.data()), size);
-}
-
-
-/*!
- * \brief Cast the data to `unsigned char`, and normalise its range to [0,255].
- * \param data Input data of type `T`.
- * \param range Range of the input data.
- * \param normal_data Array to store the resulting normalised data.
- * \param element_count Number of input elements.
- */
-template<typename T>
-void cast_and_normalise(std::vector<unsigned char>& data, const std::pair<double, double>& range, std::vector<unsigned char>& normal_data, const size_t element_count) {
-    auto *p = reinterpret_cast<T*>(data.data());
-
-    // Normalise and cast
-    normal_data.clear();
-    normal_data.resize(element_count);
-    for (size_t i = 0; i < element_count; ++i) {
-        normal_data[i] = static_cast<unsigned char>(255 * (static_cast<double>(p[i]) - range.first) / (range.second - range.first));
-    }
-}
-
-
 /*!
  * \brief Read the dimensions from a VTK header.
  * \param header Lines of the VTK header.
@@ -334,87 +233,8 @@ void VTKVolume::load_volume(const std::string& filename)
     read_origin(header);
     read_spacing(header);
 
-    // Read data
-    size_t element_count = std::get<0>(m_size) * std::get<1>(m_size) * std::get<2>(m_size);
-    const bool binary = is_binary(header);
-    switch (m_datatype) {
-    case VTKVolume::DataType::Int8:
-        read_data<char>(file, binary, element_count, m_data, m_range);
-        break;
-    case VTKVolume::DataType::Uint8:
-        read_data<unsigned char>(file, binary, element_count, m_data, m_range);
-        break;
-    case VTKVolume::DataType::Int16:
-        read_data<unsigned short>(file, binary, element_count, m_data, m_range);
-        break;
-    case VTKVolume::DataType::Uint16:
-        read_data<short>(file, binary, element_count, m_data, m_range);
-        break;
-    case VTKVolume::DataType::Int32:
-        read_data<unsigned int>(file, binary, element_count, m_data, m_range);
-        break;
-    case VTKVolume::DataType::Uint32:
-        read_data<int>(file, binary, element_count, m_data, m_range);
-        break;
-    case VTKVolume::DataType::Int64:
-        read_data<unsigned long>(file, binary, element_count, m_data, m_range);
-        break;
-    case VTKVolume::DataType::Uint64:
-        read_data<long>(file, binary, element_count, m_data, m_range);
-        break;
-    case VTKVolume::DataType::Float:
-        read_data<float>(file, binary, element_count, m_data, m_range);
-        break;
-    case VTKVolume::DataType::Double:
-        read_data<double>(file, binary, element_count, m_data, m_range);
-        break;
-    }
-
+    // Map the payload behind the header, or parse it in place if ASCII
+    const auto header_size = static_cast<size_t>(file.tellg());
     file.close();
-}
-
-
-/*!
- * \brief Cast the data to `unsigned char` and normalise it to [0, 255].
- */
-void VTKVolume::uint8_normalised(void) {
-    size_t element_count = std::get<0>(m_size) * std::get<1>(m_size) * std::get<2>(m_size);
-    std::vector<unsigned char> normal_data;
-    normal_data.resize(element_count);
-
-    switch (m_datatype) {
-    case VTKVolume::DataType::Int8:
-        cast_and_normalise<char>(m_data, m_range, normal_data, element_count);
-        break;
-    case VTKVolume::DataType::Uint8:
-        cast_and_normalise<unsigned char>(m_data, m_range, normal_data, element_count);
-        break;
-    case VTKVolume::DataType::Int16:
-        cast_and_normalise<short>(m_data, m_range, normal_data, element_count);
-        break;
-    case VTKVolume::DataType::Uint16:
-        cast_and_normalise<unsigned short>(m_data, m_range, normal_data, element_count);
-        break;
-    case VTKVolume::DataType::Int32:
-        cast_and_normalise<int>(m_data, m_range, normal_data, element_count);
-        break;
-    case VTKVolume::DataType::Uint32:
-        cast_and_normalise<unsigned int>(m_data, m_range, normal_data, element_count);
-        break;
-    case VTKVolume::DataType::Int64:
-        cast_and_normalise<long>(m_data, m_range, normal_data, element_count);
-        break;
-    case VTKVolume::DataType::Uint64:
-        cast_and_normalise<unsigned long>(m_data, m_range, normal_data, element_count);
-        break;
-    case VTKVolume::DataType::Float:
-        cast_and_normalise<float>(m_data, m_range, normal_data, element_count);
-        break;
-    case VTKVolume::DataType::Double:
-        cast_and_normalise<double>(m_data, m_range, normal_data, element_count);
-        break;
-    }
-
-    m_data = std::move(normal_data);
-    m_datatype = DataType::Uint8;
+    load_payload(filename, header_size, is_binary(header) ? Encoding::Raw : Encoding::Ascii, true);
 }